@@ -36,6 +36,33 @@
 
 void gnb_ctl_dump_status(gnb_ctl_block_t *ctl_block,int reachabl_opt);
 void gnb_ctl_dump_address_list(gnb_ctl_block_t *ctl_block,int reachabl_opt);
+void gnb_ctl_dump_metrics(gnb_ctl_block_t *ctl_block);
+void gnb_ctl_dump_latency(gnb_ctl_block_t *ctl_block);
+void gnb_ctl_set_latency(gnb_ctl_block_t *ctl_block, int enable);
+int  gnb_ctl_top(gnb_ctl_block_t *ctl_block, int interval_sec, int count, int limit, const char *sort_name, int json_opt, int reachabl_opt);
+uint32_t gnb_ctl_trace_parse_mask(const char *names);
+void gnb_ctl_set_trace(gnb_ctl_block_t *ctl_block, uint32_t mask);
+int  gnb_ctl_trace(gnb_ctl_block_t *ctl_block, uint32_t mask, int count, int json_opt);
+int  gnb_ctl_pcap(gnb_ctl_block_t *ctl_block, int count);
+int  gnb_ctl_speedtest(gnb_ctl_block_t *ctl_block, uint32_t dst_uuid32, int duration_sec, int rate_pps, int frame_size, int sink_opt, int batch, int json_opt);
+
+#define GNB_CTL_OPT_INIT       0x2FF
+#define GNB_CTL_OPT_INTERVAL   (GNB_CTL_OPT_INIT + 1)
+#define GNB_CTL_OPT_SORT       (GNB_CTL_OPT_INIT + 2)
+#define GNB_CTL_OPT_COUNT      (GNB_CTL_OPT_INIT + 3)
+#define GNB_CTL_OPT_LIMIT      (GNB_CTL_OPT_INIT + 4)
+#define GNB_CTL_OPT_JSON       (GNB_CTL_OPT_INIT + 5)
+#define GNB_CTL_OPT_LATENCY_ON (GNB_CTL_OPT_INIT + 6)
+#define GNB_CTL_OPT_LATENCY_OFF (GNB_CTL_OPT_INIT + 7)
+#define GNB_CTL_OPT_TRACE      (GNB_CTL_OPT_INIT + 8)
+#define GNB_CTL_OPT_TRACE_OFF  (GNB_CTL_OPT_INIT + 9)
+#define GNB_CTL_OPT_PCAP       (GNB_CTL_OPT_INIT + 10)
+#define GNB_CTL_OPT_SPEEDTEST  (GNB_CTL_OPT_INIT + 11)
+#define GNB_CTL_OPT_DURATION   (GNB_CTL_OPT_INIT + 12)
+#define GNB_CTL_OPT_RATE       (GNB_CTL_OPT_INIT + 13)
+#define GNB_CTL_OPT_SIZE       (GNB_CTL_OPT_INIT + 14)
+#define GNB_CTL_OPT_SINK       (GNB_CTL_OPT_INIT + 15)
+#define GNB_CTL_OPT_BATCH      (GNB_CTL_OPT_INIT + 16)
 
 static void show_useage(int argc,char *argv[]){
 
@@ -54,11 +81,79 @@ static void show_useage(int argc,char *argv[]){
     printf("  -c, --core                operate core zone\n");
     printf("  -r, --reachabl            only output reachabl node\n");
     printf("  -s, --show                show\n");
+    printf("  -R, --reload              reload route.conf and address.conf\n");
+    printf("  -m, --metrics             packet and drop counters\n");
+    printf("  -l, --latency             pf stage latency p50 p99 p999\n");
+    printf("      --latency-on          clear and start recording pf stage latency\n");
+    printf("      --latency-off         stop recording pf stage latency\n");
+    printf("  -t, --top                 sample nodes on an interval, show pps bps rtt path and drop rate\n");
+    printf("      --interval            top sample interval in seconds, default 1\n");
+    printf("      --sort                top sort column: uuid path tx_pps tx_bps rx_pps rx_bps rtt loss\n");
+    printf("      --count               top sample count, 0 run until interrupted\n");
+    printf("      --limit               top max rows, 0 all nodes\n");
+    printf("      --json                top and trace output line-delimited json\n");
+    printf("      --trace               enable tracepoints and stream events: pf_tun pf_inet route4 relay queue_push queue_pop all\n");
+    printf("                            --count stops after that many events\n");
+    printf("      --trace-off           disable all tracepoints\n");
+    printf("      --pcap                write packets captured by gnb --pcap-file to stdout as pcapng\n");
+    printf("                            --count stops after that many packets\n");
+    printf("      --speedtest           measure pps goodput rtt and loss to a node on every direct and relay path\n");
+    printf("      --duration            speedtest seconds per path, default 3\n");
+    printf("      --rate                speedtest packets per second, default 0 unlimited\n");
+    printf("      --size                speedtest ip packet size, default 1400\n");
+    printf("      --sink                speedtest peer replies with headers only instead of echoing\n");
+    printf("      --batch               speedtest packets handed to pf per call 1~64, default 1, all runs 1 2 4 8 16 32 64\n");
 
     printf("      --help\n");
 
     printf("example:\n");
     printf("%s --ctl_block=./gnb.map\n",argv[0]);
+    printf("%s --ctl_block=./gnb.map --top --sort=rtt\n",argv[0]);
+    printf("%s --ctl_block=./gnb.map --trace=pf_tun,route4\n",argv[0]);
+    printf("%s --ctl_block=./gnb.map --pcap | tcpdump -n -r -\n",argv[0]);
+    printf("%s --ctl_block=./gnb.map speedtest 1002 --rate=10000\n",argv[0]);
+    printf("%s --ctl_block=./gnb.map speedtest 1002 --batch=all\n",argv[0]);
+
+}
+
+
+//请求 gnb 热加载 route.conf 和 address.conf 并等待生效
+static int reload_conf(gnb_ctl_block_t *ctl_block){
+
+    uint32_t node_table_epoch = ctl_block->status_zone->node_table_epoch;
+
+    int i;
+
+    ctl_block->status_zone->reload_request = 1;
+
+    //上一次热加载的 grace period 内 gnb 会推迟处理
+    for ( i=0; i<150; i++ ) {
+
+        //gnb 在新的 node 表换入后才会清除 reload_request
+        if ( node_table_epoch != ctl_block->status_zone->node_table_epoch ) {
+            printf("reload finish epoch[%u] node num[%d]\n", ctl_block->status_zone->node_table_epoch, ctl_block->node_zone->node_num);
+            return 0;
+        }
+
+        if ( 0 == ctl_block->status_zone->reload_request ) {
+            break;
+        }
+
+        #ifdef _WIN32
+        Sleep(100);
+        #else
+        usleep(100*1000);
+        #endif
+
+    }
+
+    if ( 0 == ctl_block->status_zone->reload_request ) {
+        printf("reload error, see gnb log\n");
+    } else {
+        printf("reload timeout\n");
+    }
+
+    return -1;
 
 }
 
@@ -73,6 +168,31 @@ int main (int argc,char *argv[]){
     int core_opt     = 0;
     int show_opt     = 0;
     int reachabl_opt = 0;
+    int reload_opt   = 0;
+    int metrics_opt  = 0;
+    int top_opt      = 0;
+    int latency_opt  = 0;
+    int latency_set  = -1;
+
+    int   top_interval = 1;
+    int   top_count    = 0;
+    int   top_limit    = -1;
+    int   top_json     = 0;
+    char *top_sort     = NULL;
+
+    char *trace_names  = NULL;
+    int   trace_off    = 0;
+    int   pcap_opt     = 0;
+    uint32_t trace_mask;
+
+    char *speedtest_uuid     = NULL;
+    int   speedtest_duration = 3;
+    int   speedtest_rate     = 0;
+    int   speedtest_size     = 1400;
+    int   speedtest_sink     = 0;
+    //0 依次测试 1 ~ 64
+    int   speedtest_batch    = 1;
+    int   batch;
 
     static struct option long_options[] = {
 
@@ -81,6 +201,26 @@ int main (int argc,char *argv[]){
       { "core",                 no_argument, 0, 'c' },
       { "show",                 no_argument, 0, 's' },
       { "reachabl",             no_argument, 0, 'r' },
+      { "reload",               no_argument, 0, 'R' },
+      { "metrics",              no_argument, 0, 'm' },
+      { "latency",              no_argument, 0, 'l' },
+      { "latency-on",           no_argument, 0, GNB_CTL_OPT_LATENCY_ON },
+      { "latency-off",          no_argument, 0, GNB_CTL_OPT_LATENCY_OFF },
+      { "top",                  no_argument, 0, 't' },
+      { "interval",             required_argument, 0, GNB_CTL_OPT_INTERVAL },
+      { "sort",                 required_argument, 0, GNB_CTL_OPT_SORT },
+      { "count",                required_argument, 0, GNB_CTL_OPT_COUNT },
+      { "limit",                required_argument, 0, GNB_CTL_OPT_LIMIT },
+      { "json",                 no_argument, 0, GNB_CTL_OPT_JSON },
+      { "trace",                required_argument, 0, GNB_CTL_OPT_TRACE },
+      { "trace-off",            no_argument, 0, GNB_CTL_OPT_TRACE_OFF },
+      { "pcap",                 no_argument, 0, GNB_CTL_OPT_PCAP },
+      { "speedtest",            required_argument, 0, GNB_CTL_OPT_SPEEDTEST },
+      { "duration",             required_argument, 0, GNB_CTL_OPT_DURATION },
+      { "rate",                 required_argument, 0, GNB_CTL_OPT_RATE },
+      { "size",                 required_argument, 0, GNB_CTL_OPT_SIZE },
+      { "sink",                 no_argument, 0, GNB_CTL_OPT_SINK },
+      { "batch",                required_argument, 0, GNB_CTL_OPT_BATCH },
       { "help",                 no_argument, 0, 'h' },
 
       { 0, 0, 0, 0 }
@@ -94,7 +234,7 @@ int main (int argc,char *argv[]){
 
         int option_index = 0;
 
-        opt = getopt_long (argc, argv, "b:acrsh",long_options, &option_index);
+        opt = getopt_long (argc, argv, "b:acrRmltsh",long_options, &option_index);
 
         if (opt == -1) {
             break;
@@ -122,6 +262,93 @@ int main (int argc,char *argv[]){
             show_opt = 1;
             break;
 
+        case 'R':
+            reload_opt = 1;
+            break;
+
+        case 'm':
+            metrics_opt = 1;
+            break;
+
+        case 'l':
+            latency_opt = 1;
+            break;
+
+        case GNB_CTL_OPT_LATENCY_ON:
+            latency_set = 1;
+            break;
+
+        case GNB_CTL_OPT_LATENCY_OFF:
+            latency_set = 0;
+            break;
+
+        case 't':
+            top_opt = 1;
+            break;
+
+        case GNB_CTL_OPT_INTERVAL:
+            top_interval = atoi(optarg);
+            break;
+
+        case GNB_CTL_OPT_SORT:
+            top_sort = optarg;
+            break;
+
+        case GNB_CTL_OPT_COUNT:
+            top_count = atoi(optarg);
+            break;
+
+        case GNB_CTL_OPT_LIMIT:
+            top_limit = atoi(optarg);
+            break;
+
+        case GNB_CTL_OPT_JSON:
+            top_json = 1;
+            break;
+
+        case GNB_CTL_OPT_TRACE:
+            trace_names = optarg;
+            break;
+
+        case GNB_CTL_OPT_TRACE_OFF:
+            trace_off = 1;
+            break;
+
+        case GNB_CTL_OPT_PCAP:
+            pcap_opt = 1;
+            break;
+
+        case GNB_CTL_OPT_SPEEDTEST:
+            speedtest_uuid = optarg;
+            break;
+
+        case GNB_CTL_OPT_DURATION:
+            speedtest_duration = atoi(optarg);
+            break;
+
+        case GNB_CTL_OPT_RATE:
+            speedtest_rate = atoi(optarg);
+            break;
+
+        case GNB_CTL_OPT_SIZE:
+            speedtest_size = atoi(optarg);
+            break;
+
+        case GNB_CTL_OPT_SINK:
+            speedtest_sink = 1;
+            break;
+
+        case GNB_CTL_OPT_BATCH:
+
+            if ( 0 == strcmp(optarg, "all") ) {
+                speedtest_batch = 0;
+            } else {
+                speedtest_batch = atoi(optarg);
+                speedtest_batch = speedtest_batch < 1 ? 1 : speedtest_batch;
+            }
+
+            break;
+
         case 'h':
             show_useage(argc,argv);
             exit(0);
@@ -133,6 +360,16 @@ int main (int argc,char *argv[]){
     }
 
 
+    //gnb_ctl -b gnb.map top
+    if ( optind < argc && 0 == strcmp(argv[optind], "top") ) {
+        top_opt = 1;
+    }
+
+    //gnb_ctl -b gnb.map speedtest 1002
+    if ( optind + 1 < argc && 0 == strcmp(argv[optind], "speedtest") ) {
+        speedtest_uuid = argv[optind+1];
+    }
+
     if ( NULL == ctl_block_file ){
         show_useage(argc,argv);
         exit(0);
@@ -153,6 +390,11 @@ int main (int argc,char *argv[]){
 #endif
 
 
+    if (reload_opt){
+        reload_conf(ctl_block);
+    }
+
+
     if (core_opt){
         gnb_ctl_dump_status(ctl_block,reachabl_opt);
     }
@@ -163,6 +405,73 @@ int main (int argc,char *argv[]){
     }
 
 
+    if (metrics_opt){
+        gnb_ctl_dump_metrics(ctl_block);
+    }
+
+
+    if ( -1 != latency_set ){
+        gnb_ctl_set_latency(ctl_block, latency_set);
+    }
+
+
+    if (latency_opt){
+        gnb_ctl_dump_latency(ctl_block);
+    }
+
+
+    if (top_opt){
+
+        //json 输出给采集程序用，默认输出全部节点
+        if ( -1 == top_limit ) {
+            top_limit = top_json ? 0 : 40;
+        }
+
+        gnb_ctl_top(ctl_block, top_interval, top_count, top_limit, top_sort, top_json, reachabl_opt);
+
+    }
+
+
+    if (trace_off){
+        gnb_ctl_set_trace(ctl_block, 0);
+    }
+
+
+    if ( NULL != trace_names ){
+
+        trace_mask = gnb_ctl_trace_parse_mask(trace_names);
+
+        if ( 0 != trace_mask ) {
+            gnb_ctl_trace(ctl_block, trace_mask, top_count, top_json);
+        }
+
+    }
+
+
+    if (pcap_opt){
+        gnb_ctl_pcap(ctl_block, top_count);
+    }
+
+
+    if ( NULL != speedtest_uuid && speedtest_batch > 0 ){
+        gnb_ctl_speedtest(ctl_block, (uint32_t)strtoul(speedtest_uuid, NULL, 10), speedtest_duration, speedtest_rate, speedtest_size, speedtest_sink, speedtest_batch, top_json);
+    }
+
+
+    //比较 pf 在不同 batch 下的 pps，出错或被中断时停止
+    if ( NULL != speedtest_uuid && 0 == speedtest_batch ){
+
+        for ( batch=1; batch<=64; batch*=2 ) {
+
+            if ( 0 != gnb_ctl_speedtest(ctl_block, (uint32_t)strtoul(speedtest_uuid, NULL, 10), speedtest_duration, speedtest_rate, speedtest_size, speedtest_sink, batch, top_json) ) {
+                break;
+            }
+
+        }
+
+    }
+
+
 #ifdef _WIN32
     WSACleanup();
 #endif
@@ -57,6 +57,7 @@ gnb_es_ctx* gnb_es_ctx_init(int is_service, char *ctl_block_file,gnb_log_ctx_t *
 #define LOG_UDP6                 (GNB_ES_OPT_INIT + 9)
 #define LOG_UDP4                 (GNB_ES_OPT_INIT + 10)
 #define LOG_UDP_TYPE             (GNB_ES_OPT_INIT + 11)
+#define OPT_EXIT_WITH_GNB        (GNB_ES_OPT_INIT + 12)
 
 
 void gnb_start_environment_service(gnb_es_ctx *es_ctx);
@@ -78,6 +79,7 @@ static void show_useage(int argc,char *argv[]){
     printf("  -b, --ctl-block           ctl block mapper file\n");
     printf("  -s, --service             service mode\n");
     printf("  -d, --daemon              daemon\n");
+    printf("      --exit-with-gnb       exit service mode when gnb stops updating the ctl block\n");
     printf("      --upnp                upnp\n");
     printf("      --resolv              resolv\n");
     printf("      --dump-address        dump address\n");
@@ -165,6 +167,8 @@ int main (int argc,char *argv[]){
 
     int service_opt = 0;
 
+    int exit_with_gnb_opt = 0;
+
     gnb_ctl_block_t *ctl_block;
 
     uint8_t log_udp_type;
@@ -191,6 +195,8 @@ int main (int argc,char *argv[]){
 
       { "daemon",        no_argument, 0, 'd' },
 
+      { "exit-with-gnb", no_argument, 0, OPT_EXIT_WITH_GNB },
+
       { "pid-file",      required_argument,  0, PID_FILE },
 
       { "wan-address6-file", required_argument,  0, WAN_ADDRESS6_FILE },
@@ -242,6 +248,10 @@ int main (int argc,char *argv[]){
             dump_address_opt = 1;
             break;
 
+        case OPT_EXIT_WITH_GNB:
+            exit_with_gnb_opt = 1;
+            break;
+
         case PID_FILE:
             pid_file = optarg;
             break;
@@ -417,6 +427,7 @@ int main (int argc,char *argv[]){
     es_ctx->if_up_opt   = if_up_opt;
     es_ctx->if_down_opt = if_down_opt;
     es_ctx->daemon = daemon;
+    es_ctx->exit_with_gnb_opt = exit_with_gnb_opt;
 
 
 #ifdef _WIN32
@@ -16,6 +16,8 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <stddef.h>
 #include <inttypes.h>
@@ -37,6 +39,45 @@
 #endif
 
 
+//从 ctl block 中取得一致的节点快照，用完后 free
+static gnb_node_t* snapshot_nodes(gnb_ctl_block_t *ctl_block, int *node_num_ptr){
+
+    gnb_node_t *nodes;
+
+    int max_num;
+
+    max_num = ctl_block->node_zone->node_capacity;
+
+    if ( max_num < ctl_block->node_zone->node_num ) {
+        max_num = ctl_block->node_zone->node_num;
+    }
+
+    if ( max_num <= 0 ) {
+        *node_num_ptr = 0;
+        return NULL;
+    }
+
+    nodes = (gnb_node_t *)malloc(sizeof(gnb_node_t) * max_num);
+
+    if ( NULL == nodes ) {
+        *node_num_ptr = 0;
+        return NULL;
+    }
+
+    *node_num_ptr = gnb_ctl_block_snapshot_nodes(ctl_block, nodes, max_num);
+
+    if ( *node_num_ptr < 0 ) {
+        printf("node zone is being reloaded, try again\n");
+        *node_num_ptr = 0;
+        free(nodes);
+        return NULL;
+    }
+
+    return nodes;
+
+}
+
+
 void gnb_ctl_dump_status(gnb_ctl_block_t *ctl_block, int reachabl_opt){
 
     gnb_conf_t *conf = NULL;
@@ -56,11 +97,13 @@ void gnb_ctl_dump_status(gnb_ctl_block_t *ctl_block, int reachabl_opt){
     gnb_address_list_t *resolv_address_list;
     gnb_address_list_t *push_address_list;
 
+    gnb_node_t *nodes;
+
     gnb_node_t *node;
 
     int node_num;
 
-    node_num = ctl_block->node_zone->node_num;
+    nodes = snapshot_nodes(ctl_block, &node_num);
 
     printf("node_num[%d]\n",node_num);
 
@@ -70,7 +113,18 @@ void gnb_ctl_dump_status(gnb_ctl_block_t *ctl_block, int reachabl_opt){
 
     for( i=0; i<node_num; i++ ){
 
-        node = &ctl_block->node_zone->node[i];
+        node = &nodes[i];
+
+        //已经通过热加载删除的节点
+        if ( node->type & GNB_NODE_TYPE_RETIRED ) {
+            continue;
+        }
+
+        if ( GNB_CTL_NODE_SNAPSHOT_TORN(node) ) {
+            printf("\n====================\n");
+            printf("node %u inconsistent, being updated\n",node->uuid32);
+            continue;
+        }
 
         if ( 0 != reachabl_opt && !((GNB_NODE_STATUS_IPV6_PONG | GNB_NODE_STATUS_IPV4_PONG) & node->udp_addr_status) && node->uuid32 != ctl_block->core_zone->local_uuid ){
             continue;
@@ -128,6 +182,38 @@ void gnb_ctl_dump_status(gnb_ctl_block_t *ctl_block, int reachabl_opt){
         printf("addr6_ping_latency_usec:%"PRIu64"\n", node->addr6_ping_latency_usec);
         printf("addr4_ping_latency_usec:%"PRIu64"\n", node->addr4_ping_latency_usec);
 
+        printf("addr6_path srtt_usec:%"PRId64" rttvar_usec:%"PRId64" loss:%u.%u%% ping:%u pong:%u\n",
+                node->addr6_path_metric.srtt_usec, node->addr6_path_metric.rttvar_usec,
+                node->addr6_path_metric.loss_permille/10, node->addr6_path_metric.loss_permille%10,
+                node->addr6_path_metric.ping_seq, node->addr6_path_metric.pong_seq);
+
+        printf("addr4_path srtt_usec:%"PRId64" rttvar_usec:%"PRId64" loss:%u.%u%% ping:%u pong:%u\n",
+                node->addr4_path_metric.srtt_usec, node->addr4_path_metric.rttvar_usec,
+                node->addr4_path_metric.loss_permille/10, node->addr4_path_metric.loss_permille%10,
+                node->addr4_path_metric.ping_seq, node->addr4_path_metric.pong_seq);
+
+        if ( GNB_NODE_PATH_IPV6 == node->selected_path ) {
+            printf("selected_path ipv6\n");
+        } else if ( GNB_NODE_PATH_IPV4 == node->selected_path ) {
+            printf("selected_path ipv4\n");
+        } else {
+            printf("selected_path none\n");
+        }
+
+        if ( GNB_NODE_RELAY_DYNAMIC & node->node_relay_mode ) {
+            printf("relay_route auto\n");
+        }
+
+        for ( j=0; j<GNB_MAX_NODE_ROUTE; j++ ) {
+
+            if ( 0 == node->route_node[j][0] ) {
+                break;
+            }
+
+            printf("relay_route[%d] first_relay[%u] ttl:%u flows:%u bytes:%"PRIu64"\n", j, node->route_node[j][0], node->route_node_ttls[j], node->route_node_flows[j], node->route_node_bytes[j]);
+
+        }
+
         printf("detect_count %d\n", node->detect_count);
 
         printf("wan_ipv4 %s\n", GNB_SOCKADDR4STR1(&node->udp_sockaddr4));
@@ -180,6 +266,7 @@ void gnb_ctl_dump_status(gnb_ctl_block_t *ctl_block, int reachabl_opt){
 
     }
 
+    free(nodes);
 
 }
 
@@ -193,18 +280,25 @@ void gnb_ctl_dump_address_list(gnb_ctl_block_t *ctl_block,int reachabl_opt){
     gnb_address_list_t *resolv_address_list;
     gnb_address_list_t *push_address_list;
 
+    gnb_node_t *nodes;
+
     gnb_node_t *node;
 
     int node_num;
 
-    node_num = ctl_block->node_zone->node_num;
+    nodes = snapshot_nodes(ctl_block, &node_num);
 
     int i,j;
 
 
     for( i=0; i<node_num; i++ ){
 
-        node = &ctl_block->node_zone->node[i];
+        node = &nodes[i];
+
+        //重试后仍不一致的节点不输出地址
+        if ( (node->type & GNB_NODE_TYPE_RETIRED) || GNB_CTL_NODE_SNAPSHOT_TORN(node) ) {
+            continue;
+        }
 
         if (node->uuid32 == ctl_block->core_zone->local_uuid){
             printf( "l|%u|%s\n", node->uuid32, GNB_SOCKADDR6STR1(&node->udp_sockaddr6) );
@@ -307,5 +401,249 @@ void gnb_ctl_dump_address_list(gnb_ctl_block_t *ctl_block,int reachabl_opt){
 
     }
 
+    free(nodes);
+
+}
+
+
+static const char *metric_names[GNB_METRIC_NUM] = {
+    [GNB_METRIC_RX_PKT]                        = "rx_pkt",
+    [GNB_METRIC_RX_BYTES]                      = "rx_bytes",
+    [GNB_METRIC_TX_PKT]                        = "tx_pkt",
+    [GNB_METRIC_TX_BYTES]                      = "tx_bytes",
+    [GNB_METRIC_PF_FRAME_PKT]                  = "pf_frame_pkt",
+    [GNB_METRIC_PF_ROUTE_PKT]                  = "pf_route_pkt",
+    [GNB_METRIC_PF_FWD_PKT]                    = "pf_fwd_pkt",
+    [GNB_METRIC_DROP_PF_FRAME]                 = "drop_pf_frame",
+    [GNB_METRIC_DROP_PF_ROUTE]                 = "drop_pf_route",
+    [GNB_METRIC_DROP_PF_FWD]                   = "drop_pf_fwd",
+    [GNB_METRIC_DROP_ROUTE_MISS]               = "drop_route_miss",
+    [GNB_METRIC_DROP_UNREACHABLE]              = "drop_unreachable",
+    [GNB_METRIC_DROP_CRYPTO]                   = "drop_crypto",
+    [GNB_METRIC_DROP_TTL]                      = "drop_ttl",
+    [GNB_METRIC_DROP_BAD_PAYLOAD]              = "drop_bad_payload",
+    [GNB_METRIC_DROP_NODE_QUEUE_FULL]          = "drop_node_queue_full",
+    [GNB_METRIC_DROP_INDEX_QUEUE_FULL]         = "drop_index_queue_full",
+    [GNB_METRIC_DROP_INDEX_SERVICE_QUEUE_FULL] = "drop_index_service_queue_full",
+    [GNB_METRIC_SEND_ERROR]                    = "send_error",
+    [GNB_METRIC_FWDU_PKT]                      = "fwdu_pkt",
+    [GNB_METRIC_WORKER_IN_PKT]                 = "worker_in_pkt",
+    [GNB_METRIC_DROP_POOL_EMPTY]               = "drop_pool_empty",
+};
+
+
+static const char *metrics_slot_names[GNB_METRICS_SLOT_NUM] = {
+    [GNB_METRICS_SLOT_TUN]                  = "tun",
+    [GNB_METRICS_SLOT_INET]                 = "inet",
+    [GNB_METRICS_SLOT_NODE_WORKER]          = "node_worker",
+    [GNB_METRICS_SLOT_INDEX_WORKER]         = "index_worker",
+    [GNB_METRICS_SLOT_INDEX_SERVICE_WORKER] = "index_service_worker",
+};
+
+
+void gnb_ctl_dump_metrics(gnb_ctl_block_t *ctl_block){
+
+    gnb_ctl_metrics_zone_t *metrics_zone = ctl_block->metrics_zone;
+
+    uint64_t counter[GNB_METRIC_NUM];
+
+    uint64_t value;
+
+    int i,j;
+
+    if ( NULL == metrics_zone ) {
+        printf("metrics zone is miss in ctl block\n");
+        return;
+    }
+
+    gnb_ctl_block_sum_metrics(ctl_block, counter);
+
+    printf("metrics total:\n");
+
+    for ( j=0; j<GNB_METRIC_NUM; j++ ) {
+
+        if ( NULL == metric_names[j] ) {
+            continue;
+        }
+
+        printf("%s %"PRIu64"\n", metric_names[j], counter[j]);
+
+    }
+
+    for ( i=0; i<GNB_METRICS_SLOT_NUM; i++ ) {
+
+        if ( NULL == metrics_slot_names[i] ) {
+            continue;
+        }
+
+        printf("\nmetrics slot %s:\n", metrics_slot_names[i]);
+
+        for ( j=0; j<GNB_METRIC_NUM; j++ ) {
+
+            value = metrics_zone->slot[i].counter[j];
+
+            if ( NULL == metric_names[j] || 0 == value ) {
+                continue;
+            }
+
+            printf("%s %"PRIu64"\n", metric_names[j], value);
+
+        }
+
+    }
+
 }
 
+
+static const char *latency_path_names[GNB_LATENCY_PATH_NUM] = {
+    [GNB_LATENCY_PATH_TUN]  = "tun",
+    [GNB_LATENCY_PATH_INET] = "inet",
+};
+
+
+static const char *latency_stage_names[GNB_LATENCY_STAGE_NUM] = {
+    [GNB_LATENCY_STAGE_FRAME]  = "frame",
+    [GNB_LATENCY_STAGE_ROUTE]  = "route",
+    [GNB_LATENCY_STAGE_FWD]    = "fwd",
+    [GNB_LATENCY_STAGE_OUTPUT] = "output",
+    [GNB_LATENCY_STAGE_TOTAL]  = "total",
+};
+
+
+//取桶的中点，gnb 同时在写入, 用各个桶相加得到的数量而不用 histogram->count
+uint64_t gnb_ctl_latency_percentile(uint64_t *bucket, uint64_t total, int permyriad){
+
+    uint64_t rank;
+    uint64_t sum = 0;
+
+    int i;
+
+    rank = (total * permyriad + 9999) / 10000;
+
+    if ( 0 == rank ) {
+        rank = 1;
+    }
+
+    for ( i=0; i<GNB_LATENCY_BUCKET_NUM; i++ ) {
+
+        sum += bucket[i];
+
+        if ( sum < rank ) {
+            continue;
+        }
+
+        if ( i == GNB_LATENCY_BUCKET_NUM - 1 ) {
+            return gnb_latency_bucket_nsec(i);
+        }
+
+        return ( gnb_latency_bucket_nsec(i) + gnb_latency_bucket_nsec(i+1) ) / 2;
+
+    }
+
+    return 0;
+
+}
+
+
+static void dump_latency_histogram(const char *path_name, const char *stage_name, const char *pf_name, gnb_latency_histogram_t *histogram){
+
+    uint64_t bucket[GNB_LATENCY_BUCKET_NUM];
+    uint64_t total = 0;
+    uint64_t max_nsec;
+    uint64_t p50_nsec;
+    uint64_t p99_nsec;
+    uint64_t p999_nsec;
+
+    int i;
+
+    for ( i=0; i<GNB_LATENCY_BUCKET_NUM; i++ ) {
+        bucket[i] = *(volatile uint64_t *)&histogram->bucket[i];
+        total += bucket[i];
+    }
+
+    if ( 0 == total ) {
+        return;
+    }
+
+    max_nsec = histogram->max_nsec;
+
+    p50_nsec  = gnb_ctl_latency_percentile(bucket, total, 5000);
+    p99_nsec  = gnb_ctl_latency_percentile(bucket, total, 9900);
+    p999_nsec = gnb_ctl_latency_percentile(bucket, total, 9990);
+
+    //桶的中点可能超过实际的最大值
+    if ( max_nsec > 0 ) {
+        p50_nsec  = p50_nsec  > max_nsec ? max_nsec : p50_nsec;
+        p99_nsec  = p99_nsec  > max_nsec ? max_nsec : p99_nsec;
+        p999_nsec = p999_nsec > max_nsec ? max_nsec : p999_nsec;
+    }
+
+    printf("%-5s %-7s %-20s %12"PRIu64" %10.3f %10.3f %10.3f %10.3f\n",
+           path_name, stage_name, pf_name, total,
+           p50_nsec / 1000.0, p99_nsec / 1000.0, p999_nsec / 1000.0, max_nsec / 1000.0);
+
+}
+
+
+void gnb_ctl_dump_latency(gnb_ctl_block_t *ctl_block){
+
+    gnb_ctl_latency_zone_t *latency_zone = ctl_block->latency_zone;
+
+    char pf_name[32];
+
+    int path_idx;
+    int stage_idx;
+    int pf_idx;
+
+    if ( NULL == latency_zone ) {
+        printf("latency zone is miss in ctl block\n");
+        return;
+    }
+
+    printf("pf latency enable[%u], time in usec\n", latency_zone->enable);
+
+    printf("%-5s %-7s %-20s %12s %10s %10s %10s %10s\n", "PATH", "STAGE", "PF", "COUNT", "P50", "P99", "P999", "MAX");
+
+    for ( path_idx=0; path_idx<GNB_LATENCY_PATH_NUM; path_idx++ ) {
+
+        for ( stage_idx=0; stage_idx<GNB_LATENCY_STAGE_NUM; stage_idx++ ) {
+
+            dump_latency_histogram(latency_path_names[path_idx], latency_stage_names[stage_idx], "-", &latency_zone->histogram[path_idx][stage_idx][0]);
+
+            for ( pf_idx=0; pf_idx<latency_zone->pf_num && pf_idx<GNB_LATENCY_PF_MAX; pf_idx++ ) {
+                snprintf(pf_name, 32, "%s", latency_zone->pf_name[pf_idx]);
+                dump_latency_histogram(latency_path_names[path_idx], latency_stage_names[stage_idx], pf_name, &latency_zone->histogram[path_idx][stage_idx][pf_idx+1]);
+            }
+
+        }
+
+    }
+
+}
+
+
+//打开时清空之前的记录
+void gnb_ctl_set_latency(gnb_ctl_block_t *ctl_block, int enable){
+
+    gnb_ctl_latency_zone_t *latency_zone = ctl_block->latency_zone;
+
+    if ( NULL == latency_zone ) {
+        printf("latency zone is miss in ctl block\n");
+        return;
+    }
+
+    if ( 0 == enable ) {
+        latency_zone->enable = 0;
+        printf("pf latency disabled\n");
+        return;
+    }
+
+    latency_zone->enable = 0;
+
+    memset(latency_zone->histogram, 0, sizeof(latency_zone->histogram));
+
+    latency_zone->enable = 1;
+
+    printf("pf latency enabled\n");
+
+}
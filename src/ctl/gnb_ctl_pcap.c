@@ -0,0 +1,256 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "gnb_time.h"
+#include "gnb_mmap.h"
+#include "gnb_ctl_block.h"
+#include "gnb_pcap_type.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+
+//一个记录等待写者写完的最大轮数，超过后认为写者已经退出，跳到 ring 的最新位置
+#define GNB_CTL_PCAP_WAIT_ROUND  3
+
+//最大的记录: 记录头 + epb 的固定部分 + 最大的 snaplen + comment
+#define GNB_CTL_PCAP_RECORD_MAX  ( GNB_PCAP_MAX_SNAPLEN + 1024 )
+
+
+static volatile int pcap_running = 1;
+
+
+static void pcap_signal_handler(int signum){
+    pcap_running = 0;
+}
+
+
+static void write_pcapng_head(uint32_t snaplen){
+
+    unsigned char block[64];
+    uint32_t *p = (uint32_t *)block;
+
+    //Section Header Block, section length 未知
+    p[0] = PCAPNG_BLOCK_TYPE_SHB;
+    p[1] = 28;
+    p[2] = PCAPNG_BYTE_ORDER_MAGIC;
+    p[3] = 1;                  //major 1 minor 0
+    p[4] = 0xFFFFFFFF;
+    p[5] = 0xFFFFFFFF;
+    p[6] = 28;
+
+    fwrite(block, 28, 1, stdout);
+
+    //Interface Description Block, if_name 为 gnb
+    p[0] = PCAPNG_BLOCK_TYPE_IDB;
+    p[1] = 32;
+    p[2] = PCAPNG_LINKTYPE_RAW;
+    p[3] = snaplen;
+    p[4] = PCAPNG_OPT_IF_NAME | (3 << 16);
+    memcpy(&p[5], "gnb\0", 4);
+    p[6] = PCAPNG_OPT_ENDOFOPT;
+    p[7] = 32;
+
+    fwrite(block, 32, 1, stdout);
+
+}
+
+
+/*
+从 ring 当前的位置开始把抓到的分组以 pcapng 格式写到 stdout
+count 为 0 时一直输出到被中断
+*/
+int gnb_ctl_pcap(gnb_ctl_block_t *ctl_block, int count){
+
+    char *pcap_file = ctl_block->conf_zone->conf_st.pcap_file;
+
+    gnb_mmap_block_t *mmap_block;
+
+    gnb_pcap_ring_head_t *ring_head;
+    unsigned char *ring_data;
+
+    gnb_pcap_record_head_t *record;
+
+    unsigned char *buffer;
+
+    ssize_t file_size;
+
+    uint32_t data_size;
+    uint32_t cursor;
+    uint32_t head;
+
+    uint64_t lost = 0;
+
+    uint32_t size;
+    uint32_t epb_size;
+
+    int wait_round = 0;
+    int num = 0;
+
+    if ( '\0' == pcap_file[0] ) {
+        fprintf(stderr, "gnb is not started with --pcap-file\n");
+        return -1;
+    }
+
+    if ( isatty(STDOUT_FILENO) ) {
+        fprintf(stderr, "pcapng is binary, redirect stdout to a file or pipe it to 'tcpdump -r -'\n");
+        return -1;
+    }
+
+    file_size = gnb_ctl_file_size(pcap_file);
+
+    if ( file_size <= GNB_PCAP_RING_HEAD_SIZE ) {
+        fprintf(stderr, "open pcap file error [%s]\n", pcap_file);
+        return -1;
+    }
+
+    //只读打开，读者不会影响数据通路
+    mmap_block = gnb_mmap_create(pcap_file, file_size, GNB_MMAP_TYPE_READONLY);
+
+    if ( NULL == mmap_block ) {
+        fprintf(stderr, "mmap pcap file error [%s]\n", pcap_file);
+        return -1;
+    }
+
+    ring_head = (gnb_pcap_ring_head_t *)gnb_mmap_get_block(mmap_block);
+    ring_data = (unsigned char *)ring_head + GNB_PCAP_RING_HEAD_SIZE;
+
+    data_size = ring_head->data_size;
+
+    if ( 0 != memcmp(ring_head->magic, GNB_PCAP_RING_MAGIC, sizeof(GNB_PCAP_RING_MAGIC)) || GNB_PCAP_RING_VERSION != ring_head->version
+         || 0 == data_size || 0 != (data_size & (data_size - 1)) || data_size > GNB_PCAP_MAX_DATA_SIZE
+         || (uint64_t)data_size + GNB_PCAP_RING_HEAD_SIZE > (uint64_t)file_size ) {
+        fprintf(stderr, "invalid pcap file [%s]\n", pcap_file);
+        gnb_mmap_release(mmap_block);
+        return -1;
+    }
+
+    buffer = (unsigned char *)malloc(GNB_CTL_PCAP_RECORD_MAX);
+
+    #ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+    #endif
+
+    signal(SIGINT,  pcap_signal_handler);
+    signal(SIGTERM, pcap_signal_handler);
+
+    write_pcapng_head(ring_head->snaplen);
+
+    fprintf(stderr, "capture from [%s] node[%u] snaplen[%u]\n", pcap_file, ring_head->local_uuid, ring_head->snaplen);
+
+    cursor = ring_head->head;
+
+    while ( pcap_running ) {
+
+        head = ring_head->head;
+
+        //读得太慢被写者追上，记录的边界已经丢失，只能从最新的位置重新开始
+        if ( head - cursor > data_size ) {
+            lost++;
+            cursor = head;
+        }
+
+        while ( (int32_t)(head - cursor) > 0 && pcap_running ) {
+
+            record = (gnb_pcap_record_head_t *)(ring_data + (cursor & (data_size - 1)));
+
+            if ( record->commit != cursor + 1 ) {
+
+                if ( wait_round < GNB_CTL_PCAP_WAIT_ROUND ) {
+                    wait_round++;
+                    break;
+                }
+
+                lost++;
+                cursor = head;
+                wait_round = 0;
+                break;
+
+            }
+
+            __sync_synchronize();
+
+            size = record->size;
+
+            if ( size < sizeof(gnb_pcap_record_head_t) || size > GNB_CTL_PCAP_RECORD_MAX || 0 != size % GNB_PCAP_RECORD_ALIGN || (cursor & (data_size - 1)) + size > data_size ) {
+                lost++;
+                cursor = head;
+                break;
+            }
+
+            memcpy(buffer, (void *)record, size);
+
+            __sync_synchronize();
+
+            //复制的过程中被覆盖
+            if ( record->commit != cursor + 1 || ring_head->head - cursor > data_size ) {
+                lost++;
+                cursor = ring_head->head;
+                break;
+            }
+
+            wait_round = 0;
+            cursor += size;
+
+            if ( GNB_PCAP_RECORD_TYPE_EPB != ((gnb_pcap_record_head_t *)buffer)->type ) {
+                continue;
+            }
+
+            memcpy(&epb_size, buffer + sizeof(gnb_pcap_record_head_t) + sizeof(uint32_t), sizeof(uint32_t));
+
+            if ( epb_size > size - sizeof(gnb_pcap_record_head_t) ) {
+                continue;
+            }
+
+            fwrite(buffer + sizeof(gnb_pcap_record_head_t), epb_size, 1, stdout);
+
+            num++;
+
+            if ( count > 0 && num >= count ) {
+                pcap_running = 0;
+            }
+
+        }
+
+        fflush(stdout);
+
+        if ( pcap_running ) {
+            GNB_SLEEP_MILLISECOND(10);
+        }
+
+    }
+
+    fflush(stdout);
+
+    fprintf(stderr, "pcap records[%d] lost[%"PRIu64"]\n", num, lost);
+
+    free(buffer);
+
+    gnb_mmap_release(mmap_block);
+
+    return 0;
+
+}
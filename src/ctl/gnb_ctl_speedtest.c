@@ -0,0 +1,335 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "gnb_alloc.h"
+#include "gnb_time.h"
+#include "gnb_pf.h"
+#include "gnb_ctl_block.h"
+
+
+uint64_t gnb_ctl_latency_percentile(uint64_t *bucket, uint64_t total, int permyriad);
+
+
+//gnb 在 main worker 的循环中开始测试，最长 1 秒
+#define GNB_CTL_SPEEDTEST_START_TIMEOUT_MSEC  3000
+
+#define GNB_CTL_SPEEDTEST_POLL_MSEC           100
+
+
+static volatile int speedtest_running = 1;
+
+
+static void speedtest_signal_handler(int signum){
+    speedtest_running = 0;
+}
+
+
+static void path_label(gnb_speedtest_path_t *path, char *label, size_t label_size){
+
+    int len;
+    int i;
+
+    switch ( path->path ) {
+
+    case GNB_PF_PATH_DIRECT4:
+        snprintf(label, label_size, "direct4");
+        break;
+
+    case GNB_PF_PATH_DIRECT6:
+        snprintf(label, label_size, "direct6");
+        break;
+
+    default:
+
+        len = snprintf(label, label_size, "relay");
+
+        for ( i=0; i<path->relay_num && len < (int)label_size; i++ ) {
+            len += snprintf(label + len, label_size - len, "%s%u", 0==i?" ":">", path->relay[i]);
+        }
+
+        break;
+
+    }
+
+}
+
+
+static void print_path(gnb_speedtest_t *test, gnb_speedtest_path_t *path, int json_opt){
+
+    char label[80];
+
+    uint64_t bucket[GNB_LATENCY_BUCKET_NUM];
+    uint64_t total = 0;
+
+    uint64_t send_nsec;
+    uint64_t pps = 0;
+    uint64_t goodput_bps = 0;
+    uint64_t p50_nsec = 0;
+    uint64_t p99_nsec = 0;
+
+    //对端收到的比例和收到回应的比例，千分之一
+    uint32_t loss_permille = 0;
+    uint32_t rtt_loss_permille = 0;
+
+    int i;
+
+    path_label(path, label, sizeof(label));
+
+    memcpy(bucket, path->rtt.bucket, sizeof(bucket));
+
+    for ( i=0; i<GNB_LATENCY_BUCKET_NUM; i++ ) {
+        total += bucket[i];
+    }
+
+    if ( total > 0 ) {
+        p50_nsec = gnb_ctl_latency_percentile(bucket, total, 5000);
+        p99_nsec = gnb_ctl_latency_percentile(bucket, total, 9900);
+    }
+
+    send_nsec = path->end_nsec > path->begin_nsec ? path->end_nsec - path->begin_nsec : 0;
+
+    if ( send_nsec > 0 ) {
+        pps         = path->peer_recv_packets * 1000000000 / send_nsec;
+        goodput_bps = (uint64_t)((double)path->peer_recv_bytes * 8 * 1000000000 / send_nsec);
+    }
+
+    if ( path->send_packets > 0 ) {
+
+        if ( path->send_packets > path->peer_recv_packets ) {
+            loss_permille = (uint32_t)((path->send_packets - path->peer_recv_packets) * 1000 / path->send_packets);
+        }
+
+        if ( path->send_packets > path->recv_packets ) {
+            rtt_loss_permille = (uint32_t)((path->send_packets - path->recv_packets) * 1000 / path->send_packets);
+        }
+
+    }
+
+    if ( json_opt ) {
+
+        printf("{\"type\":\"speedtest\",\"dst\":%u,\"batch\":%u,\"path\":\"%s\",\"relay\":[", test->dst_uuid32, test->batch,
+               GNB_PF_PATH_DIRECT4 == path->path ? "direct4" : GNB_PF_PATH_DIRECT6 == path->path ? "direct6" : "relay");
+
+        for ( i=0; i<path->relay_num; i++ ) {
+            printf("%s%u", 0==i?"":",", path->relay[i]);
+        }
+
+        printf("],\"send_nsec\":%"PRIu64",\"sent\":%"PRIu64",\"replies\":%"PRIu64",\"peer_recv\":%"PRIu64",\"peer_recv_bytes\":%"PRIu64","
+               "\"pps\":%"PRIu64",\"goodput_bps\":%"PRIu64",\"loss_permille\":%u,\"rtt_loss_permille\":%u,"
+               "\"rtt_p50_usec\":%"PRIu64",\"rtt_p99_usec\":%"PRIu64",\"rtt_max_usec\":%"PRIu64"}\n",
+               send_nsec, path->send_packets, path->recv_packets, path->peer_recv_packets, path->peer_recv_bytes,
+               pps, goodput_bps, loss_permille, rtt_loss_permille,
+               p50_nsec/1000, p99_nsec/1000, path->rtt.max_nsec/1000);
+
+        return;
+
+    }
+
+    printf("%-24s %9"PRIu64" %9"PRIu64" %9"PRIu64" %9"PRIu64".%02"PRIu64" %4u.%u %4u.%u %9"PRIu64" %9"PRIu64" %9"PRIu64"\n",
+           label, path->send_packets, path->recv_packets, pps,
+           goodput_bps/1000000, goodput_bps/10000%100,
+           loss_permille/10, loss_permille%10, rtt_loss_permille/10, rtt_loss_permille%10,
+           p50_nsec/1000, p99_nsec/1000, path->rtt.max_nsec/1000);
+
+}
+
+
+static void print_result(gnb_speedtest_t *test, int json_opt){
+
+    uint32_t path_num = test->path_num;
+    uint32_t i;
+
+    if ( path_num > GNB_SPEEDTEST_PATH_MAX ) {
+        path_num = GNB_SPEEDTEST_PATH_MAX;
+    }
+
+    if ( !json_opt ) {
+
+        printf("speedtest node[%u] duration[%u]ms frame_size[%u] rate[%u]pps mode[%s] batch[%u]\n",
+               test->dst_uuid32, test->duration_msec, test->frame_size, test->rate_pps,
+               GNB_SPEEDTEST_MODE_SINK == test->mode ? "sink" : "echo", test->batch);
+
+        printf("%-24s %9s %9s %9s %12s %6s %6s %9s %9s %9s\n",
+               "PATH", "SENT", "REPLIES", "PPS", "MBPS", "LOSS%", "RLOSS%", "RTT_P50", "RTT_P99", "RTT_MAX");
+
+    }
+
+    for ( i=0; i<path_num; i++ ) {
+
+        //中止时还没有开始的路径
+        if ( 0 == test->path[i].send_packets ) {
+            continue;
+        }
+
+        print_path(test, &test->path[i], json_opt);
+
+    }
+
+    if ( !json_opt ) {
+        printf("pps and mbps are counted by the peer, loss is one way, rloss is round trip, rtt in usec\n");
+    }
+
+    fflush(stdout);
+
+}
+
+
+/*
+把测试的参数写入 speedtest zone, 由 gnb 依次测试到 dst_uuid32 的每条路径
+rate_pps 为 0 时不限制发送的速率
+batch 是 gnb 每次交给 pf 的测试分组数
+*/
+int gnb_ctl_speedtest(gnb_ctl_block_t *ctl_block, uint32_t dst_uuid32, int duration_sec, int rate_pps, int frame_size, int sink_opt, int batch, int json_opt){
+
+    gnb_speedtest_t *test;
+
+    uint32_t state;
+    uint32_t current_path = 0;
+
+    int wait_msec = 0;
+    int timeout_msec;
+
+    if ( NULL == ctl_block->speedtest_zone ) {
+        printf("ctl block has no speedtest zone, gnb version too old\n");
+        return -1;
+    }
+
+    test = &ctl_block->speedtest_zone->test;
+
+    state = test->state;
+
+    if ( GNB_SPEEDTEST_STATE_REQUEST == state || GNB_SPEEDTEST_STATE_RUNNING == state ) {
+        printf("another speedtest is running\n");
+        return -1;
+    }
+
+    if ( duration_sec <= 0 ) {
+        duration_sec = 3;
+    }
+
+    if ( rate_pps < 0 ) {
+        rate_pps = 0;
+    }
+
+    if ( frame_size < GNB_SPEEDTEST_MIN_FRAME_SIZE ) {
+        frame_size = GNB_SPEEDTEST_MIN_FRAME_SIZE;
+    }
+
+    if ( frame_size > GNB_SPEEDTEST_MAX_FRAME_SIZE ) {
+        frame_size = GNB_SPEEDTEST_MAX_FRAME_SIZE;
+    }
+
+    if ( batch < 1 ) {
+        batch = 1;
+    }
+
+    if ( batch > GNB_SPEEDTEST_MAX_BATCH ) {
+        batch = GNB_SPEEDTEST_MAX_BATCH;
+    }
+
+    test->test_id       = (uint32_t)(gnb_timestamp_usec() ^ ((uint64_t)getpid() << 16));
+    test->dst_uuid32    = dst_uuid32;
+    test->duration_msec = (uint32_t)duration_sec * 1000;
+    test->rate_pps      = (uint32_t)rate_pps;
+    test->frame_size    = (uint32_t)frame_size;
+    test->mode          = sink_opt ? GNB_SPEEDTEST_MODE_SINK : GNB_SPEEDTEST_MODE_ECHO;
+    test->batch         = (uint32_t)batch;
+    test->path_num      = 0;
+    test->current_path  = 0;
+    test->error[0]      = '\0';
+
+    __sync_synchronize();
+
+    if ( !__sync_bool_compare_and_swap(&test->state, state, GNB_SPEEDTEST_STATE_REQUEST) ) {
+        printf("another speedtest is running\n");
+        return -1;
+    }
+
+    signal(SIGINT,  speedtest_signal_handler);
+    signal(SIGTERM, speedtest_signal_handler);
+
+    while ( speedtest_running ) {
+
+        GNB_SLEEP_MILLISECOND(GNB_CTL_SPEEDTEST_POLL_MSEC);
+
+        wait_msec += GNB_CTL_SPEEDTEST_POLL_MSEC;
+
+        state = test->state;
+
+        if ( GNB_SPEEDTEST_STATE_REQUEST == state ) {
+
+            if ( wait_msec < GNB_CTL_SPEEDTEST_START_TIMEOUT_MSEC ) {
+                continue;
+            }
+
+            if ( __sync_bool_compare_and_swap(&test->state, GNB_SPEEDTEST_STATE_REQUEST, GNB_SPEEDTEST_STATE_IDLE) ) {
+                printf("gnb did not start the speedtest\n");
+                return -1;
+            }
+
+            continue;
+
+        }
+
+        if ( GNB_SPEEDTEST_STATE_ERROR == state ) {
+            printf("speedtest error: %s\n", test->error);
+            return -1;
+        }
+
+        if ( GNB_SPEEDTEST_STATE_DONE == state ) {
+            print_result(test, json_opt);
+            return 0;
+        }
+
+        if ( GNB_SPEEDTEST_STATE_RUNNING != state ) {
+            printf("speedtest aborted\n");
+            return -1;
+        }
+
+        if ( !json_opt && test->current_path != current_path ) {
+            current_path = test->current_path;
+            fprintf(stderr, "path %u/%u\n", current_path + 1, test->path_num);
+        }
+
+        //每条路径多等 1 秒，gnb 退出时不会一直等下去
+        timeout_msec = GNB_CTL_SPEEDTEST_START_TIMEOUT_MSEC + test->path_num * (test->duration_msec + 1000);
+
+        if ( wait_msec > timeout_msec ) {
+            __sync_bool_compare_and_swap(&test->state, GNB_SPEEDTEST_STATE_RUNNING, GNB_SPEEDTEST_STATE_IDLE);
+            printf("speedtest timeout\n");
+            return -1;
+        }
+
+    }
+
+    //被中断时让 gnb 停止发送，输出已经完成的部分
+    __sync_bool_compare_and_swap(&test->state, GNB_SPEEDTEST_STATE_REQUEST, GNB_SPEEDTEST_STATE_IDLE);
+
+    if ( __sync_bool_compare_and_swap(&test->state, GNB_SPEEDTEST_STATE_RUNNING, GNB_SPEEDTEST_STATE_IDLE) ) {
+        print_result(test, json_opt);
+    }
+
+    return -1;
+
+}
@@ -0,0 +1,605 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "gnb_conf_type.h"
+#include "gnb_node_type.h"
+#include "gnb_time.h"
+#include "gnb_ctl_block.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#endif
+
+
+#define GNB_CTL_TOP_SORT_UUID     0
+#define GNB_CTL_TOP_SORT_PATH     1
+#define GNB_CTL_TOP_SORT_TX_PPS   2
+#define GNB_CTL_TOP_SORT_TX_BPS   3
+#define GNB_CTL_TOP_SORT_RX_PPS   4
+#define GNB_CTL_TOP_SORT_RX_BPS   5
+#define GNB_CTL_TOP_SORT_RTT      6
+#define GNB_CTL_TOP_SORT_LOSS     7
+
+
+static const char *sort_column_names[] = {
+    "uuid", "path", "tx_pps", "tx_bps", "rx_pps", "rx_bps", "rtt", "loss", NULL
+};
+
+
+typedef struct _top_row_t {
+
+    uint32_t uuid32;
+
+    const char *path;
+
+    //经过 relay 时的第一跳
+    uint32_t relay_uuid32;
+
+    //从本节点的角度, tx 是发往这个节点的数据, 对应 gnb_node_t 的 in_bytes in_packets
+    uint64_t tx_pps;
+    uint64_t tx_bps;
+    uint64_t rx_pps;
+    uint64_t rx_bps;
+
+    int64_t  rtt_usec;
+
+    uint16_t loss_permille;
+
+}top_row_t;
+
+
+//上一次采样时的计数器，按 node_zone 中的下标保存
+typedef struct _top_sample_t {
+
+    uint32_t uuid32;
+
+    uint64_t in_bytes;
+    uint64_t out_bytes;
+    uint64_t in_packets;
+    uint64_t out_packets;
+
+}top_sample_t;
+
+
+static int sort_column = GNB_CTL_TOP_SORT_TX_BPS;
+
+
+static int sort_column_from_name(const char *name){
+
+    int i;
+
+    for ( i=0; NULL!=sort_column_names[i]; i++ ) {
+
+        if ( 0 == strcmp(name, sort_column_names[i]) ) {
+            return i;
+        }
+
+    }
+
+    return -1;
+
+}
+
+
+#define CMP_DESC(a,b) ( (a) > (b) ? -1 : ( (a) < (b) ? 1 : 0 ) )
+
+static int row_cmp(const void *a, const void *b){
+
+    const top_row_t *ra = (const top_row_t *)a;
+    const top_row_t *rb = (const top_row_t *)b;
+
+    int ret;
+
+    switch ( sort_column ) {
+
+    case GNB_CTL_TOP_SORT_PATH:
+        ret = strcmp(ra->path, rb->path);
+        break;
+    case GNB_CTL_TOP_SORT_TX_PPS:
+        ret = CMP_DESC(ra->tx_pps, rb->tx_pps);
+        break;
+    case GNB_CTL_TOP_SORT_TX_BPS:
+        ret = CMP_DESC(ra->tx_bps, rb->tx_bps);
+        break;
+    case GNB_CTL_TOP_SORT_RX_PPS:
+        ret = CMP_DESC(ra->rx_pps, rb->rx_pps);
+        break;
+    case GNB_CTL_TOP_SORT_RX_BPS:
+        ret = CMP_DESC(ra->rx_bps, rb->rx_bps);
+        break;
+    case GNB_CTL_TOP_SORT_RTT:
+        ret = CMP_DESC(ra->rtt_usec, rb->rtt_usec);
+        break;
+    case GNB_CTL_TOP_SORT_LOSS:
+        ret = CMP_DESC(ra->loss_permille, rb->loss_permille);
+        break;
+    default:
+        ret = 0;
+        break;
+
+    }
+
+    if ( 0 != ret ) {
+        return ret;
+    }
+
+    return ra->uuid32 < rb->uuid32 ? -1 : ( ra->uuid32 > rb->uuid32 ? 1 : 0 );
+
+}
+
+
+//和 gnb_pf_route 选择下一跳的顺序一致
+static const char* node_path(gnb_node_t *node, uint32_t local_uuid32, uint32_t *relay_uuid32_ptr){
+
+    uint8_t route_idx;
+    uint8_t ttl;
+
+    int reachabl;
+    int relay_route = 0;
+
+    *relay_uuid32_ptr = 0;
+
+    if ( node->uuid32 == local_uuid32 ) {
+        return "local";
+    }
+
+    reachabl = (GNB_NODE_STATUS_IPV6_PONG | GNB_NODE_STATUS_IPV4_PONG) & node->udp_addr_status;
+
+    route_idx = node->selected_route_node < GNB_MAX_NODE_ROUTE ? node->selected_route_node : 0;
+    ttl = node->route_node_ttls[route_idx];
+
+    if ( ((GNB_NODE_RELAY_FORCE|GNB_NODE_RELAY_AUTO) & node->node_relay_mode) && ttl > 0 && ttl <= GNB_MAX_NODE_RELAY ) {
+        relay_route = 1;
+        *relay_uuid32_ptr = node->route_node[route_idx][ttl-1];
+    }
+
+    if ( relay_route && (GNB_NODE_RELAY_FORCE & node->node_relay_mode) ) {
+        return "relay";
+    }
+
+    if ( reachabl ) {
+
+        *relay_uuid32_ptr = 0;
+
+        if ( GNB_NODE_PATH_IPV6 == node->selected_path ) {
+            return "direct6";
+        }
+
+        if ( GNB_NODE_PATH_IPV4 == node->selected_path ) {
+            return "direct4";
+        }
+
+        return (GNB_NODE_STATUS_IPV6_PONG & node->udp_addr_status) ? "direct6" : "direct4";
+
+    }
+
+    if ( relay_route ) {
+        return "relay";
+    }
+
+    return "unreach";
+
+}
+
+
+static void node_rtt_loss(gnb_node_t *node, int64_t *rtt_usec_ptr, uint16_t *loss_permille_ptr){
+
+    gnb_node_path_metric_t *path_metric;
+
+    if ( GNB_NODE_PATH_IPV6 == node->selected_path ) {
+        path_metric = &node->addr6_path_metric;
+    } else if ( GNB_NODE_PATH_IPV4 == node->selected_path ) {
+        path_metric = &node->addr4_path_metric;
+    } else {
+        path_metric = NULL;
+    }
+
+    if ( NULL != path_metric && path_metric->srtt_usec > 0 ) {
+        *rtt_usec_ptr = path_metric->srtt_usec;
+        *loss_permille_ptr = path_metric->loss_permille;
+        return;
+    }
+
+    if ( (GNB_NODE_STATUS_IPV6_PONG & node->udp_addr_status) && node->addr6_ping_latency_usec > 0 ) {
+        *rtt_usec_ptr = node->addr6_ping_latency_usec;
+    } else if ( (GNB_NODE_STATUS_IPV4_PONG & node->udp_addr_status) && node->addr4_ping_latency_usec > 0 ) {
+        *rtt_usec_ptr = node->addr4_ping_latency_usec;
+    } else {
+        *rtt_usec_ptr = 0;
+    }
+
+    *loss_permille_ptr = NULL != path_metric ? path_metric->loss_permille : 0;
+
+}
+
+
+static uint64_t rate_per_sec(uint64_t cur, uint64_t prev, uint64_t elapsed_usec){
+
+    if ( cur < prev || 0 == elapsed_usec ) {
+        return 0;
+    }
+
+    return (cur - prev) * 1000000 / elapsed_usec;
+
+}
+
+
+static char* human_number(uint64_t n, char *buffer, size_t buffer_size){
+
+    if ( n >= (uint64_t)1000000000 ) {
+        snprintf(buffer, buffer_size, "%"PRIu64".%02"PRIu64"G", n/(uint64_t)1000000000, (n%(uint64_t)1000000000)/(uint64_t)10000000);
+    } else if ( n >= (uint64_t)1000000 ) {
+        snprintf(buffer, buffer_size, "%"PRIu64".%02"PRIu64"M", n/(uint64_t)1000000, (n%(uint64_t)1000000)/(uint64_t)10000);
+    } else if ( n >= (uint64_t)1000 ) {
+        snprintf(buffer, buffer_size, "%"PRIu64".%02"PRIu64"K", n/(uint64_t)1000, (n%(uint64_t)1000)/(uint64_t)10);
+    } else {
+        snprintf(buffer, buffer_size, "%"PRIu64, n);
+    }
+
+    return buffer;
+
+}
+
+
+static void top_sleep(int interval_sec){
+
+    #ifdef _WIN32
+    Sleep(interval_sec*1000);
+    #else
+    sleep(interval_sec);
+    #endif
+
+}
+
+
+#define TOP_DROP_REASON_NUM 6
+
+static const int drop_reason_ids[TOP_DROP_REASON_NUM] = {
+    GNB_METRIC_DROP_ROUTE_MISS,
+    GNB_METRIC_DROP_UNREACHABLE,
+    GNB_METRIC_DROP_CRYPTO,
+    GNB_METRIC_DROP_TTL,
+    GNB_METRIC_DROP_BAD_PAYLOAD,
+    GNB_METRIC_SEND_ERROR,
+};
+
+static const char *drop_reason_names[TOP_DROP_REASON_NUM] = {
+    "route_miss", "unreachable", "crypto", "ttl", "bad_payload", "send_error"
+};
+
+
+static void print_text(gnb_ctl_block_t *ctl_block, top_row_t *rows, int row_num, int reachabl_num, int limit, uint64_t *metrics_rate, int interval_sec){
+
+    char time_string[32];
+    char tx_pps_string[16];
+    char tx_bps_string[16];
+    char rx_pps_string[16];
+    char rx_bps_string[16];
+    char relay_string[16];
+
+    uint64_t queue_full_rate;
+
+    top_row_t *row;
+
+    int i;
+
+    if ( isatty(STDOUT_FILENO) ) {
+        printf("\033[H\033[2J");
+    }
+
+    gnb_now_timef("%H:%M:%S", time_string, 32);
+
+    printf("gnb top %s  local[%u] nodes[%d] reachabl[%d] interval[%ds] sort[%s]\n",
+           time_string, ctl_block->core_zone->local_uuid, row_num, reachabl_num, interval_sec, sort_column_names[sort_column]);
+
+    printf("tun rx %s pps %s bps   inet rx %s pps %s bps\n",
+           human_number(metrics_rate[GNB_METRIC_NUM*2 + GNB_METRIC_RX_PKT],              tx_pps_string, 16),
+           human_number(metrics_rate[GNB_METRIC_NUM*2 + GNB_METRIC_RX_BYTES]*8,          tx_bps_string, 16),
+           human_number(metrics_rate[GNB_METRIC_NUM + GNB_METRIC_RX_PKT],                rx_pps_string, 16),
+           human_number(metrics_rate[GNB_METRIC_NUM + GNB_METRIC_RX_BYTES]*8,            rx_bps_string, 16));
+
+    queue_full_rate = metrics_rate[GNB_METRIC_DROP_NODE_QUEUE_FULL] + metrics_rate[GNB_METRIC_DROP_INDEX_QUEUE_FULL] + metrics_rate[GNB_METRIC_DROP_INDEX_SERVICE_QUEUE_FULL];
+
+    printf("drop/s");
+
+    for ( i=0; i<TOP_DROP_REASON_NUM; i++ ) {
+        printf(" %s[%"PRIu64"]", drop_reason_names[i], metrics_rate[drop_reason_ids[i]]);
+    }
+
+    printf(" queue_full[%"PRIu64"]\n\n", queue_full_rate);
+
+    printf("%-10s %-8s %-10s %9s %9s %9s %9s %10s %6s\n", "UUID", "PATH", "RELAY", "TX_PPS", "TX_BPS", "RX_PPS", "RX_BPS", "RTT_MS", "LOSS%");
+
+    for ( i=0; i<row_num; i++ ) {
+
+        if ( limit > 0 && i >= limit ) {
+            break;
+        }
+
+        row = &rows[i];
+
+        if ( 0 != row->relay_uuid32 ) {
+            snprintf(relay_string, 16, "%u", row->relay_uuid32);
+        } else {
+            snprintf(relay_string, 16, "-");
+        }
+
+        printf("%-10u %-8s %-10s %9s %9s %9s %9s %6"PRId64".%03"PRId64" %4u.%u\n",
+               row->uuid32, row->path, relay_string,
+               human_number(row->tx_pps, tx_pps_string, 16), human_number(row->tx_bps, tx_bps_string, 16),
+               human_number(row->rx_pps, rx_pps_string, 16), human_number(row->rx_bps, rx_bps_string, 16),
+               row->rtt_usec/1000, row->rtt_usec%1000,
+               row->loss_permille/10, row->loss_permille%10);
+
+    }
+
+    fflush(stdout);
+
+}
+
+
+static void print_json(gnb_ctl_block_t *ctl_block, top_row_t *rows, int row_num, int reachabl_num, int limit, uint64_t *metrics_rate, uint64_t now_sec){
+
+    top_row_t *row;
+
+    int i;
+
+    printf("{\"type\":\"summary\",\"ts\":%"PRIu64",\"local\":%u,\"nodes\":%d,\"reachabl\":%d",
+           now_sec, ctl_block->core_zone->local_uuid, row_num, reachabl_num);
+
+    printf(",\"tun_rx_pps\":%"PRIu64",\"tun_rx_bps\":%"PRIu64",\"inet_rx_pps\":%"PRIu64",\"inet_rx_bps\":%"PRIu64,
+           metrics_rate[GNB_METRIC_NUM*2 + GNB_METRIC_RX_PKT], metrics_rate[GNB_METRIC_NUM*2 + GNB_METRIC_RX_BYTES]*8,
+           metrics_rate[GNB_METRIC_NUM + GNB_METRIC_RX_PKT], metrics_rate[GNB_METRIC_NUM + GNB_METRIC_RX_BYTES]*8);
+
+    printf(",\"drop_rate\":{");
+
+    for ( i=0; i<TOP_DROP_REASON_NUM; i++ ) {
+        printf("%s\"%s\":%"PRIu64, 0==i?"":",", drop_reason_names[i], metrics_rate[drop_reason_ids[i]]);
+    }
+
+    printf(",\"queue_full\":%"PRIu64"}}\n",
+           metrics_rate[GNB_METRIC_DROP_NODE_QUEUE_FULL] + metrics_rate[GNB_METRIC_DROP_INDEX_QUEUE_FULL] + metrics_rate[GNB_METRIC_DROP_INDEX_SERVICE_QUEUE_FULL]);
+
+    for ( i=0; i<row_num; i++ ) {
+
+        if ( limit > 0 && i >= limit ) {
+            break;
+        }
+
+        row = &rows[i];
+
+        printf("{\"type\":\"node\",\"ts\":%"PRIu64",\"uuid\":%u,\"path\":\"%s\",\"relay\":%u,"
+               "\"tx_pps\":%"PRIu64",\"tx_bps\":%"PRIu64",\"rx_pps\":%"PRIu64",\"rx_bps\":%"PRIu64","
+               "\"rtt_usec\":%"PRId64",\"loss_permille\":%u}\n",
+               now_sec, row->uuid32, row->path, row->relay_uuid32,
+               row->tx_pps, row->tx_bps, row->rx_pps, row->rx_bps,
+               row->rtt_usec, row->loss_permille);
+
+    }
+
+    fflush(stdout);
+
+}
+
+
+/*
+每隔 interval_sec 秒对 ctl block 做一次快照，和上一次的快照相减得到速率
+count 为 0 时一直运行
+metrics_rate 的前 GNB_METRIC_NUM 个是所有 slot 的合计, 后面依次是 inet 和 tun slot
+*/
+int gnb_ctl_top(gnb_ctl_block_t *ctl_block, int interval_sec, int count, int limit, const char *sort_name, int json_opt, int reachabl_opt){
+
+    gnb_node_t *nodes;
+    top_sample_t *samples;
+    top_row_t *rows;
+
+    gnb_node_t *node;
+    top_sample_t *sample;
+    top_row_t *row;
+
+    uint64_t metrics[GNB_METRIC_NUM];
+    uint64_t pre_metrics[GNB_METRIC_NUM*3];
+    uint64_t cur_metrics[GNB_METRIC_NUM*3];
+    uint64_t metrics_rate[GNB_METRIC_NUM*3];
+
+    uint64_t pre_usec;
+    uint64_t now_usec;
+    uint64_t elapsed_usec;
+
+    int max_num;
+    int node_num;
+    int row_num;
+    int reachabl_num;
+
+    int loop;
+    int i,j;
+
+    if ( NULL != sort_name ) {
+
+        sort_column = sort_column_from_name(sort_name);
+
+        if ( -1 == sort_column ) {
+            printf("unknown sort column '%s', use one of uuid path tx_pps tx_bps rx_pps rx_bps rtt loss\n", sort_name);
+            return -1;
+        }
+
+    }
+
+    if ( interval_sec <= 0 ) {
+        interval_sec = 1;
+    }
+
+    max_num = ctl_block->node_zone->node_capacity;
+
+    if ( max_num < ctl_block->node_zone->node_num ) {
+        max_num = ctl_block->node_zone->node_num;
+    }
+
+    if ( max_num <= 0 ) {
+        return -1;
+    }
+
+    nodes   = (gnb_node_t *)malloc(sizeof(gnb_node_t) * max_num);
+    samples = (top_sample_t *)malloc(sizeof(top_sample_t) * max_num);
+    rows    = (top_row_t *)malloc(sizeof(top_row_t) * max_num);
+
+    if ( NULL == nodes || NULL == samples || NULL == rows ) {
+        free(nodes);
+        free(samples);
+        free(rows);
+        return -1;
+    }
+
+    memset(samples, 0, sizeof(top_sample_t) * max_num);
+    memset(pre_metrics, 0, sizeof(pre_metrics));
+    memset(cur_metrics, 0, sizeof(cur_metrics));
+
+    pre_usec = 0;
+
+    for ( loop=0; 0==count || loop<=count; loop++ ) {
+
+        now_usec = gnb_timestamp_usec();
+
+        node_num = gnb_ctl_block_snapshot_nodes(ctl_block, nodes, max_num);
+
+        //node_zone 正在热加载，这一次不采样
+        if ( node_num < 0 ) {
+            top_sleep(interval_sec);
+            continue;
+        }
+
+        gnb_ctl_block_sum_metrics(ctl_block, metrics);
+
+        memcpy(cur_metrics, metrics, sizeof(metrics));
+
+        if ( NULL != ctl_block->metrics_zone ) {
+
+            for ( j=0; j<GNB_METRIC_NUM; j++ ) {
+                cur_metrics[GNB_METRIC_NUM   + j] = ctl_block->metrics_zone->slot[GNB_METRICS_SLOT_INET].counter[j];
+                cur_metrics[GNB_METRIC_NUM*2 + j] = ctl_block->metrics_zone->slot[GNB_METRICS_SLOT_TUN].counter[j];
+            }
+
+        }
+
+        elapsed_usec = now_usec - pre_usec;
+
+        row_num = 0;
+        reachabl_num = 0;
+
+        for ( i=0; i<node_num; i++ ) {
+
+            node   = &nodes[i];
+            sample = &samples[i];
+
+            //热加载后这个下标上换了节点, 重新开始计算
+            if ( sample->uuid32 != node->uuid32 ) {
+                sample->uuid32      = node->uuid32;
+                sample->in_bytes    = node->in_bytes;
+                sample->out_bytes   = node->out_bytes;
+                sample->in_packets  = node->in_packets;
+                sample->out_packets = node->out_packets;
+            }
+
+            if ( node->type & GNB_NODE_TYPE_RETIRED ) {
+                continue;
+            }
+
+            //重试后仍不一致的节点也显示出来, 计数器是单独读出的，只有路径、rtt 和状态不可信
+            if ( !GNB_CTL_NODE_SNAPSHOT_TORN(node) ) {
+
+                if ( (GNB_NODE_STATUS_IPV6_PONG | GNB_NODE_STATUS_IPV4_PONG) & node->udp_addr_status ) {
+                    reachabl_num++;
+                } else if ( 0 != reachabl_opt && node->uuid32 != ctl_block->core_zone->local_uuid ) {
+                    goto next;
+                }
+
+            }
+
+            row = &rows[row_num];
+            row_num++;
+
+            row->uuid32 = node->uuid32;
+
+            row->tx_pps = rate_per_sec(node->in_packets,  sample->in_packets,  elapsed_usec);
+            row->tx_bps = rate_per_sec(node->in_bytes,    sample->in_bytes,    elapsed_usec) * 8;
+            row->rx_pps = rate_per_sec(node->out_packets, sample->out_packets, elapsed_usec);
+            row->rx_bps = rate_per_sec(node->out_bytes,   sample->out_bytes,   elapsed_usec) * 8;
+
+            if ( GNB_CTL_NODE_SNAPSHOT_TORN(node) ) {
+                row->path          = "torn";
+                row->relay_uuid32  = 0;
+                row->rtt_usec      = 0;
+                row->loss_permille = 0;
+            } else {
+                row->path = node_path(node, ctl_block->core_zone->local_uuid, &row->relay_uuid32);
+                node_rtt_loss(node, &row->rtt_usec, &row->loss_permille);
+            }
+
+        next:
+
+            sample->in_bytes    = node->in_bytes;
+            sample->out_bytes   = node->out_bytes;
+            sample->in_packets  = node->in_packets;
+            sample->out_packets = node->out_packets;
+
+        }
+
+        for ( j=0; j<GNB_METRIC_NUM*3; j++ ) {
+            metrics_rate[j] = rate_per_sec(cur_metrics[j], pre_metrics[j], elapsed_usec);
+        }
+
+        memcpy(pre_metrics, cur_metrics, sizeof(cur_metrics));
+
+        pre_usec = now_usec;
+
+        //第一次采样只记录计数器
+        if ( loop > 0 ) {
+
+            qsort(rows, row_num, sizeof(top_row_t), row_cmp);
+
+            if ( json_opt ) {
+                print_json(ctl_block, rows, row_num, reachabl_num, limit, metrics_rate, now_usec/1000000);
+            } else {
+                print_text(ctl_block, rows, row_num, reachabl_num, limit, metrics_rate, interval_sec);
+            }
+
+        }
+
+        if ( 0 != count && loop == count ) {
+            break;
+        }
+
+        top_sleep(interval_sec);
+
+    }
+
+    free(nodes);
+    free(samples);
+    free(rows);
+
+    return 0;
+
+}
+
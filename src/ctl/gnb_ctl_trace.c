@@ -0,0 +1,341 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <inttypes.h>
+
+#include "gnb_time.h"
+#include "gnb_ctl_block.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#else
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+
+//一个事件等待写者写完的最大轮数，超过后认为写者已经退出，跳过这个事件
+#define GNB_CTL_TRACE_WAIT_ROUND  3
+
+
+static const char *trace_names[GNB_TRACE_NUM] = {
+    [GNB_TRACE_PF_TUN]     = "pf_tun",
+    [GNB_TRACE_PF_INET]    = "pf_inet",
+    [GNB_TRACE_ROUTE4]     = "route4",
+    [GNB_TRACE_RELAY]      = "relay",
+    [GNB_TRACE_QUEUE_PUSH] = "queue_push",
+    [GNB_TRACE_QUEUE_POP]  = "queue_pop",
+};
+
+
+static const char *trace_result_names[GNB_TRACE_RESULT_NUM] = {
+    [GNB_TRACE_RESULT_OUT]        = "out",
+    [GNB_TRACE_RESULT_TO_TUN]     = "to_tun",
+    [GNB_TRACE_RESULT_DROP_FRAME] = "drop_frame",
+    [GNB_TRACE_RESULT_DROP_ROUTE] = "drop_route",
+    [GNB_TRACE_RESULT_NOROUTE]    = "noroute",
+    [GNB_TRACE_RESULT_DROP_FWD]   = "drop_fwd",
+};
+
+
+static const char *route4_match_names[] = {
+    "host", "subnetc", "subnetb", "subneta", "miss"
+};
+
+
+static const char *queue_names[] = {
+    "node", "index", "index_service"
+};
+
+
+static volatile int trace_running = 1;
+
+
+static void trace_signal_handler(int signum){
+    trace_running = 0;
+}
+
+
+#define TRACE_NAME(names, idx) ( (idx) < sizeof(names)/sizeof(names[0]) ? names[(idx)] : "unknown" )
+
+
+/*
+names 是用逗号分隔的 tracepoint 名字, all 表示全部
+返回对应的 enable_mask, 有不认识的名字时返回 0
+*/
+uint32_t gnb_ctl_trace_parse_mask(const char *names){
+
+    char buffer[256];
+
+    char *name;
+
+    uint32_t mask = 0;
+
+    int i;
+
+    snprintf(buffer, sizeof(buffer), "%s", names);
+
+    for ( name = strtok(buffer, ","); NULL != name; name = strtok(NULL, ",") ) {
+
+        if ( 0 == strcmp(name, "all") ) {
+            mask |= (1u << GNB_TRACE_NUM) - 1;
+            continue;
+        }
+
+        for ( i=0; i<GNB_TRACE_NUM; i++ ) {
+            if ( 0 == strcmp(name, trace_names[i]) ) {
+                break;
+            }
+        }
+
+        if ( GNB_TRACE_NUM == i ) {
+            printf("unknown tracepoint [%s]\n", name);
+            return 0;
+        }
+
+        mask |= 1u << i;
+
+    }
+
+    return mask;
+
+}
+
+
+static void print_event_text(gnb_trace_event_t *event, uint64_t begin_ts_nsec){
+
+    char ip_string[INET_ADDRSTRLEN];
+
+    uint64_t ts_usec = (event->ts_nsec - begin_ts_nsec) / 1000;
+
+    printf("%8"PRIu64".%06"PRIu64" %-10s ", ts_usec / 1000000, ts_usec % 1000000, TRACE_NAME(trace_names, event->id));
+
+    switch ( event->id ) {
+
+    case GNB_TRACE_PF_TUN:
+    case GNB_TRACE_PF_INET:
+        printf("src[%u] dst[%u] fwd[%u] size[%u] %s\n", event->arg[0], event->arg[1], event->arg[2], event->arg[3], TRACE_NAME(trace_result_names, event->status));
+        break;
+
+    case GNB_TRACE_ROUTE4:
+        inet_ntop(AF_INET, &event->arg[0], ip_string, INET_ADDRSTRLEN);
+        printf("dst[%s] node[%u] %s\n", ip_string, event->arg[1], TRACE_NAME(route4_match_names, event->status));
+        break;
+
+    case GNB_TRACE_RELAY:
+        printf("src[%u] dst[%u] next[%u] size[%u] in_ttl[%u]\n", event->arg[0], event->arg[1], event->arg[2], event->arg[3], event->status);
+        break;
+
+    case GNB_TRACE_QUEUE_PUSH:
+    case GNB_TRACE_QUEUE_POP:
+        printf("queue[%s] type[%u] sub_type[%u] size[%u]%s\n", TRACE_NAME(queue_names, event->status), event->arg[0], event->arg[1], event->arg[2],
+               (GNB_TRACE_QUEUE_PUSH == event->id && event->arg[3]) ? " full" : "");
+        break;
+
+    default:
+        printf("status[%u] arg[%u %u %u %u]\n", event->status, event->arg[0], event->arg[1], event->arg[2], event->arg[3]);
+        break;
+
+    }
+
+}
+
+
+static void print_event_json(gnb_trace_event_t *event){
+
+    char ip_string[INET_ADDRSTRLEN];
+
+    printf("{\"type\":\"trace\",\"ts_nsec\":%"PRIu64",\"event\":\"%s\"", event->ts_nsec, TRACE_NAME(trace_names, event->id));
+
+    switch ( event->id ) {
+
+    case GNB_TRACE_PF_TUN:
+    case GNB_TRACE_PF_INET:
+        printf(",\"src\":%u,\"dst\":%u,\"fwd\":%u,\"size\":%u,\"result\":\"%s\"}\n", event->arg[0], event->arg[1], event->arg[2], event->arg[3], TRACE_NAME(trace_result_names, event->status));
+        break;
+
+    case GNB_TRACE_ROUTE4:
+        inet_ntop(AF_INET, &event->arg[0], ip_string, INET_ADDRSTRLEN);
+        printf(",\"dst\":\"%s\",\"node\":%u,\"match\":\"%s\"}\n", ip_string, event->arg[1], TRACE_NAME(route4_match_names, event->status));
+        break;
+
+    case GNB_TRACE_RELAY:
+        printf(",\"src\":%u,\"dst\":%u,\"next\":%u,\"size\":%u,\"in_ttl\":%u}\n", event->arg[0], event->arg[1], event->arg[2], event->arg[3], event->status);
+        break;
+
+    case GNB_TRACE_QUEUE_PUSH:
+    case GNB_TRACE_QUEUE_POP:
+        printf(",\"queue\":\"%s\",\"type\":%u,\"sub_type\":%u,\"size\":%u,\"full\":%u}\n", TRACE_NAME(queue_names, event->status), event->arg[0], event->arg[1], event->arg[2],
+               GNB_TRACE_QUEUE_PUSH == event->id ? event->arg[3] : 0);
+        break;
+
+    default:
+        printf(",\"status\":%u,\"arg\":[%u,%u,%u,%u]}\n", event->status, event->arg[0], event->arg[1], event->arg[2], event->arg[3]);
+        break;
+
+    }
+
+}
+
+
+void gnb_ctl_set_trace(gnb_ctl_block_t *ctl_block, uint32_t mask){
+
+    if ( NULL == ctl_block->trace_zone ) {
+        printf("ctl block has no trace zone, gnb version too old\n");
+        return;
+    }
+
+    ctl_block->trace_zone->ring.enable_mask = mask;
+
+}
+
+
+/*
+打开 mask 中的 tracepoint, 从 ring 当前的位置开始输出事件
+count 为 0 时一直输出到被中断, 退出时关闭由这次打开的 tracepoint
+*/
+int gnb_ctl_trace(gnb_ctl_block_t *ctl_block, uint32_t mask, int count, int json_opt){
+
+    gnb_trace_ring_t *ring;
+
+    gnb_trace_event_t event_st;
+    gnb_trace_event_t *event;
+
+    uint32_t cursor;
+    uint32_t head;
+    uint64_t lost = 0;
+    uint64_t begin_ts_nsec = 0;
+
+    uint32_t seq;
+    uint32_t old_mask;
+    uint32_t enable_mask;
+
+    int wait_round = 0;
+    int num = 0;
+
+    if ( NULL == ctl_block->trace_zone ) {
+        printf("ctl block has no trace zone, gnb version too old\n");
+        return -1;
+    }
+
+    ring = &ctl_block->trace_zone->ring;
+
+    if ( GNB_TRACE_EVENT_NUM != ring->event_num ) {
+        printf("trace ring size mismatch [%u] [%u]\n", ring->event_num, GNB_TRACE_EVENT_NUM);
+        return -1;
+    }
+
+    signal(SIGINT,  trace_signal_handler);
+    signal(SIGTERM, trace_signal_handler);
+
+    //只关闭这次新打开的 tracepoint, 不影响其他 gnb_ctl 已经打开的
+    old_mask = __sync_fetch_and_or(&ring->enable_mask, mask);
+    enable_mask = mask & ~old_mask;
+
+    cursor = ring->head;
+
+    while ( trace_running ) {
+
+        head = ring->head;
+
+        if ( head - cursor > GNB_TRACE_EVENT_NUM ) {
+            lost  += head - cursor - GNB_TRACE_EVENT_NUM;
+            cursor = head - GNB_TRACE_EVENT_NUM;
+        }
+
+        while ( (int32_t)(head - cursor) > 0 && trace_running ) {
+
+            event = &ring->event[ cursor & (GNB_TRACE_EVENT_NUM - 1) ];
+
+            seq = event->seq;
+            __sync_synchronize();
+            memcpy(&event_st, (void *)event, sizeof(gnb_trace_event_t));
+            __sync_synchronize();
+
+            if ( seq != cursor + 1 || seq != event->seq ) {
+
+                //已经被新的事件覆盖
+                if ( 0 != seq && (int32_t)(seq - (cursor + 1)) > 0 ) {
+                    lost++;
+                    cursor++;
+                    continue;
+                }
+
+                //写者还没有写完, 等下一轮
+                if ( wait_round < GNB_CTL_TRACE_WAIT_ROUND ) {
+                    wait_round++;
+                    break;
+                }
+
+                lost++;
+                cursor++;
+                wait_round = 0;
+                continue;
+
+            }
+
+            wait_round = 0;
+            cursor++;
+
+            //其他 gnb_ctl 打开的 tracepoint 产生的事件
+            if ( event_st.id >= GNB_TRACE_NUM || 0 == ( (mask >> event_st.id) & 0x1 ) ) {
+                continue;
+            }
+
+            if ( 0 == begin_ts_nsec ) {
+                begin_ts_nsec = event_st.ts_nsec;
+            }
+
+            if ( json_opt ) {
+                print_event_json(&event_st);
+            } else {
+                print_event_text(&event_st, begin_ts_nsec);
+            }
+
+            num++;
+
+            if ( count > 0 && num >= count ) {
+                trace_running = 0;
+            }
+
+        }
+
+        fflush(stdout);
+
+        if ( trace_running ) {
+            GNB_SLEEP_MILLISECOND(10);
+        }
+
+    }
+
+    __sync_fetch_and_and(&ring->enable_mask, ~enable_mask);
+
+    if ( json_opt ) {
+        printf("{\"type\":\"trace_summary\",\"events\":%d,\"lost\":%"PRIu64"}\n", num, lost);
+    } else {
+        printf("trace events[%d] lost[%"PRIu64"]\n", num, lost);
+    }
+
+    return 0;
+
+}
@@ -148,16 +148,56 @@ gnb_map_init_success:
         GNB_HASH32_UINT32_SET(es_ctx->uuid_node_map, node->uuid32, node);
     }
 
+    es_ctx->node_table_epoch = es_ctx->ctl_block->status_zone->node_table_epoch;
+
 finish:
 
     return es_ctx;
 }
 
 
-#define GNB_RESOLV_INTERVAL_SEC        900
+//域名按 TTL 缓存，未过期的不会重新查询
+#define GNB_RESOLV_INTERVAL_SEC        60
 #define GNB_UPNP_INTERVAL_SEC          180
 #define GNB_DUMP_ADDRESS_INTERVAL_SEC  15
-#define GNB_BROADCAST_INTERVAL_SEC     300
+//gnb 每秒更新一次 keep_alive_ts_sec
+#define GNB_ES_KEEP_ALIVE_TIMEOUT_SEC  30
+//每轮 gossip 只发送改变了的地址，因此间隔可以比较短
+#define GNB_BROADCAST_INTERVAL_SEC     30
+
+//service 方式运行时把 gnb 热加载新增的节点加入索引
+static void sync_node_map(gnb_es_ctx *es_ctx){
+
+    gnb_node_t *node;
+
+    int node_num;
+
+    int i;
+
+    if ( es_ctx->node_table_epoch == es_ctx->ctl_block->status_zone->node_table_epoch ) {
+        return;
+    }
+
+    es_ctx->node_table_epoch = es_ctx->ctl_block->status_zone->node_table_epoch;
+
+    node_num = es_ctx->ctl_block->node_zone->node_num;
+
+    for( i=0; i<node_num; i++ ){
+
+        node = &es_ctx->ctl_block->node_zone->node[i];
+
+        if ( NULL != GNB_HASH32_UINT32_GET(es_ctx->uuid_node_map, node->uuid32) ) {
+            continue;
+        }
+
+        GNB_HASH32_UINT32_SET(es_ctx->uuid_node_map, node->uuid32, node);
+
+    }
+
+    GNB_LOG1(es_ctx->log, GNB_LOG_ID_ES_CORE, "node table epoch[%u] node num[%d]\n", es_ctx->node_table_epoch, node_num);
+
+}
+
 
 void gnb_start_environment_service(gnb_es_ctx *es_ctx){
 
@@ -186,6 +226,14 @@ void gnb_start_environment_service(gnb_es_ctx *es_ctx){
 
         sync_es_time(es_ctx);
 
+        if ( es_ctx->service_opt && es_ctx->exit_with_gnb_opt &&
+             es_ctx->now_time_sec > es_ctx->ctl_block->status_zone->keep_alive_ts_sec + GNB_ES_KEEP_ALIVE_TIMEOUT_SEC ) {
+            GNB_LOG1(es_ctx->log, GNB_LOG_ID_ES_CORE, "gnb keep alive timeout, exit\n");
+            break;
+        }
+
+        sync_node_map(es_ctx);
+
         if ( es_ctx->resolv_opt && (es_ctx->now_time_sec - last_resolv_address_sec ) > GNB_RESOLV_INTERVAL_SEC ) {
 
             gnb_resolv_address(es_ctx);
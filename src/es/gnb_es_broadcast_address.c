@@ -18,6 +18,8 @@
 #include <stdio.h>
 #include <limits.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "gnb_es_type.h"
 
@@ -35,12 +37,15 @@
 #include "gnb_conf_type.h"
 #include "gnb_node_type.h"
 #include "gnb_ctl_block.h"
+#include "gnb_seqlock.h"
 #include "gnb_payload16.h"
 #include "gnb_address.h"
 #include "gnb_time.h"
 #include "gnb_binary.h"
 #include "gnb_udp.h"
 
+uint32_t murmurhash_hash(unsigned char *data, size_t len);
+
 
 #pragma pack(push, 1)
 
@@ -134,7 +139,7 @@ static void send_address_to_node(gnb_es_ctx *es_ctx, gnb_node_t *src_node, gnb_n
     memcpy(&push_addr_frame->data.addr4_a, &src_node->udp_sockaddr4.sin_addr.s_addr, 4);
     push_addr_frame->data.port4_a = src_node->udp_sockaddr4.sin_port;
 
-    snprintf(push_addr_frame->data.text,32,"%u>%u>%u", ctl_block->core_zone->local_uuid, src_node->uuid32, dst_node->uuid32);
+    snprintf(push_addr_frame->data.text,32,"%u>%u>%u v%u", ctl_block->core_zone->local_uuid, src_node->uuid32, dst_node->uuid32, src_node->addr_version);
 
     struct sockaddr_in udp_sockaddr4;
     memset(&udp_sockaddr4, 0, sizeof(struct sockaddr_in));
@@ -150,52 +155,202 @@ static void send_address_to_node(gnb_es_ctx *es_ctx, gnb_node_t *src_node, gnb_n
 }
 
 
-static void broadcast_address_to_node(gnb_es_ctx *es_ctx, gnb_node_t *src_node){
+//每轮随机选取的 gossip 节点数
+#define GNB_GOSSIP_FANOUT                 3
 
-    gnb_ctl_block_t  *ctl_block;
+//每隔这段时间向一个随机节点发送全部节点的地址，用于修复 gossip 丢失的消息
+#define GNB_GOSSIP_ANTI_ENTROPY_INTERVAL_SEC   300
+
+//每个新连通的节点期望从这么多个节点收到全部节点的地址，节点很多时不是每个节点都向它发送
+#define GNB_GOSSIP_NEW_PEER_FANOUT        6
+
+//每轮最多向多少个新连通的节点发送全部节点的地址，gnb_es 刚启动时所有节点都是新连通的
+#define GNB_GOSSIP_NEW_PEER_MAX           8
+
+
+static uint32_t address_digest(gnb_node_t *node){
+
+    unsigned char buffer[4+2+16+2];
+
+    memcpy(buffer,    &node->udp_sockaddr4.sin_addr.s_addr, 4);
+    memcpy(buffer+4,  &node->udp_sockaddr4.sin_port, 2);
+    memcpy(buffer+6,  &node->udp_sockaddr6.sin6_addr, 16);
+    memcpy(buffer+22, &node->udp_sockaddr6.sin6_port, 2);
+
+    return murmurhash_hash(buffer, sizeof(buffer));
+
+}
+
+
+static int is_gossip_src_node(gnb_es_ctx *es_ctx, gnb_node_t *node){
+
+    if ( node->uuid32 == es_ctx->ctl_block->core_zone->local_uuid ){
+        return 0;
+    }
+
+    if ( node->type & GNB_NODE_TYPE_RETIRED ){
+        return 0;
+    }
+
+    if ( !( (GNB_NODE_STATUS_IPV6_PONG|GNB_NODE_STATUS_IPV4_PONG) & node->udp_addr_status ) ){
+        return 0;
+    }
+
+    if ( (node->type & GNB_NODE_TYPE_IDX) || (node->type & GNB_NODE_TYPE_FWD) ){
+        return 0;
+    }
+
+    return 1;
+
+}
+
+
+static int is_gossip_dst_node(gnb_es_ctx *es_ctx, gnb_node_t *node){
+
+    if ( 0 == is_gossip_src_node(es_ctx, node) ){
+        return 0;
+    }
+
+    if ( 0 == node->tun_sin_port4 ){
+        return 0;
+    }
+
+    return 1;
+
+}
 
-    ctl_block = es_ctx->ctl_block;
+
+/*
+地址发生改变的节点的 addr_gossip_rounds 设为 log2(N)+2,
+每轮只把这些节点的地址发给 GNB_GOSSIP_FANOUT 个随机节点，收到地址的节点连通后在下一轮也会 gossip 这个地址，
+因此地址的改变可以在 O(logN) 轮内传遍所有节点
+*/
+static int update_address_version(gnb_es_ctx *es_ctx){
+
+    gnb_ctl_block_t  *ctl_block = es_ctx->ctl_block;
 
     gnb_log_ctx_t *log = es_ctx->log;
 
-    gnb_node_t *dst_node;
+    gnb_node_t *node;
+
+    uint32_t digest;
+
     int node_num;
+    int rounds;
+    int changed_num = 0;
     int i;
 
     node_num = ctl_block->node_zone->node_num;
 
+    for ( rounds=2, i=node_num; i>1; i>>=1 ){
+        rounds++;
+    }
+
     for( i=0; i<node_num; i++ ){
 
-        dst_node = &ctl_block->node_zone->node[i];
+        node = &ctl_block->node_zone->node[i];
+
+        if ( 0 == is_gossip_src_node(es_ctx, node) ){
+            continue;
+        }
 
-        if ( dst_node->uuid32 == src_node->uuid32 ){
+        digest = address_digest(node);
+
+        if ( digest == node->addr_digest ){
             continue;
         }
 
-        if ( src_node->uuid32 == ctl_block->core_zone->local_uuid ){
+        gnb_seqlock_write_begin(&node->seq);
+        node->addr_digest = digest;
+        node->addr_version++;
+        node->addr_gossip_rounds = rounds;
+        gnb_seqlock_write_end(&node->seq);
+
+        changed_num++;
+
+        GNB_LOG1(log, GNB_LOG_ID_ES_BROADCAST, "node [%u] address version %u\n", node->uuid32, node->addr_version);
+
+    }
+
+    return changed_num;
+
+}
+
+
+static int select_random_dst_node(gnb_es_ctx *es_ctx, int *dst_idx_array, int max_num){
+
+    gnb_ctl_block_t  *ctl_block = es_ctx->ctl_block;
+
+    gnb_node_t *node;
+
+    int node_num;
+    int num = 0;
+    int seen = 0;
+    int r;
+    int i;
+
+    node_num = ctl_block->node_zone->node_num;
+
+    //reservoir sampling, 只需遍历一次
+    for( i=0; i<node_num; i++ ){
+
+        node = &ctl_block->node_zone->node[i];
+
+        if ( 0 == is_gossip_dst_node(es_ctx, node) ){
             continue;
         }
 
-        if ( dst_node->uuid32 == ctl_block->core_zone->local_uuid ){
+        seen++;
+
+        if ( num < max_num ){
+            dst_idx_array[num] = i;
+            num++;
             continue;
         }
 
+        r = rand() % seen;
+
+        if ( r < max_num ){
+            dst_idx_array[r] = i;
+        }
+
+    }
+
+    return num;
+
+}
+
+
+static void gossip_address_to_node(gnb_es_ctx *es_ctx, gnb_node_t *dst_node, int full){
+
+    gnb_ctl_block_t  *ctl_block = es_ctx->ctl_block;
+
+    gnb_log_ctx_t *log = es_ctx->log;
+
+    gnb_node_t *src_node;
+
+    int node_num;
+    int i;
 
-        if ( !( (GNB_NODE_STATUS_IPV6_PONG|GNB_NODE_STATUS_IPV4_PONG) & dst_node->udp_addr_status ) ){
+    node_num = ctl_block->node_zone->node_num;
+
+    for( i=0; i<node_num; i++ ){
+
+        src_node = &ctl_block->node_zone->node[i];
+
+        if ( src_node->uuid32 == dst_node->uuid32 ){
             continue;
         }
 
-        if ( 0 == dst_node->tun_sin_port4 ){
+        if ( 0 == is_gossip_src_node(es_ctx, src_node) ){
             continue;
         }
 
-        #if 1
-        if ( (dst_node->type & GNB_NODE_TYPE_IDX) || (dst_node->type & GNB_NODE_TYPE_FWD) ){
+        if ( 0 == full && 0 == src_node->addr_gossip_rounds ){
             continue;
         }
-        #endif
 
-        GNB_LOG1(log, GNB_LOG_ID_ES_BROADCAST, "broadcast_address_to_node [%u] ==> [%u]\n",src_node->uuid32, dst_node->uuid32);
+        GNB_LOG1(log, GNB_LOG_ID_ES_BROADCAST, "gossip_address_to_node [%u] v%u ==> [%u]\n", src_node->uuid32, src_node->addr_version, dst_node->uuid32);
 
         send_address_to_node(es_ctx, src_node, dst_node);
 
@@ -206,14 +361,17 @@ static void broadcast_address_to_node(gnb_es_ctx *es_ctx, gnb_node_t *src_node){
 
 void gnb_broadcast_address(gnb_es_ctx *es_ctx){
 
-    int socket4;
-    int socket6;
+    static uint64_t last_anti_entropy_sec = 0;
+    static int random_seeded = 0;
 
     gnb_ctl_block_t  *ctl_block;
 
     ctl_block = es_ctx->ctl_block;
 
     gnb_node_t *node;
+    int dst_idx_array[GNB_GOSSIP_FANOUT];
+    int dst_num;
+    int reachable_num;
     int node_num;
     int i;
 
@@ -223,21 +381,93 @@ void gnb_broadcast_address(gnb_es_ctx *es_ctx){
         return;
     }
 
+    if ( 0 == random_seeded ){
+        srand( (unsigned int)(es_ctx->now_time_usec ^ ctl_block->core_zone->local_uuid) );
+        random_seeded = 1;
+    }
+
+    update_address_version(es_ctx);
+
+    //只 gossip 还在传播中的地址
+    for( i=0; i<node_num; i++ ){
+
+        if ( 0 != ctl_block->node_zone->node[i].addr_gossip_rounds ){
+            break;
+        }
+
+    }
+
+    if ( i < node_num ){
+
+        dst_num = select_random_dst_node(es_ctx, dst_idx_array, GNB_GOSSIP_FANOUT);
+
+        for( i=0; i<dst_num; i++ ){
+            gossip_address_to_node(es_ctx, &ctl_block->node_zone->node[dst_idx_array[i]], 0);
+        }
+
+    }
+
     for( i=0; i<node_num; i++ ){
 
         node = &ctl_block->node_zone->node[i];
 
-        if ( !( (GNB_NODE_STATUS_IPV6_PONG|GNB_NODE_STATUS_IPV4_PONG) & node->udp_addr_status ) ){
+        if ( node->addr_gossip_rounds > 0 ){
+            node->addr_gossip_rounds--;
+        }
+
+    }
+
+    /*
+    新连通的节点没有收到过之前已经稳定的地址，不必等待 anti-entropy,
+    每个节点以 GNB_GOSSIP_NEW_PEER_FANOUT/N 的概率向它发送全部节点的地址，它期望收到 GNB_GOSSIP_NEW_PEER_FANOUT 份
+    */
+    reachable_num = 0;
+
+    for( i=0; i<node_num; i++ ){
+
+        node = &ctl_block->node_zone->node[i];
+
+        if ( 0 == is_gossip_dst_node(es_ctx, node) ){
+            node->addr_gossip_synced = 0;
+            continue;
+        }
+
+        reachable_num++;
+
+    }
+
+    dst_num = 0;
+
+    for( i=0; i<node_num && dst_num < GNB_GOSSIP_NEW_PEER_MAX; i++ ){
+
+        node = &ctl_block->node_zone->node[i];
+
+        if ( 0 != node->addr_gossip_synced || 0 == is_gossip_dst_node(es_ctx, node) ){
             continue;
         }
 
-        if ( (node->type & GNB_NODE_TYPE_IDX) || (node->type & GNB_NODE_TYPE_FWD) ){
+        node->addr_gossip_synced = 1;
+
+        if ( reachable_num > GNB_GOSSIP_NEW_PEER_FANOUT && (rand() % reachable_num) >= GNB_GOSSIP_NEW_PEER_FANOUT ){
             continue;
         }
 
-        broadcast_address_to_node(es_ctx, node);
+        gossip_address_to_node(es_ctx, node, 1);
+
+        dst_num++;
 
     }
 
-}
+    if ( (es_ctx->now_time_sec - last_anti_entropy_sec) < GNB_GOSSIP_ANTI_ENTROPY_INTERVAL_SEC ){
+        return;
+    }
+
+    last_anti_entropy_sec = es_ctx->now_time_sec;
 
+    dst_num = select_random_dst_node(es_ctx, dst_idx_array, 1);
+
+    if ( 1 == dst_num ){
+        gossip_address_to_node(es_ctx, &ctl_block->node_zone->node[dst_idx_array[0]], 1);
+    }
+
+}
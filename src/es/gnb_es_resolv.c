@@ -20,12 +20,18 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
 #include <limits.h>
 #include <stddef.h>
 
 #ifdef __UNIX_LIKE_OS__
+#include <unistd.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #endif
@@ -40,6 +46,7 @@
 
 #include "gnb_node_type.h"
 #include "gnb_address.h"
+#include "gnb_seqlock.h"
 #include "gnb_es_type.h"
 
 static char * check_domain_name(char *host_string){
@@ -71,6 +78,8 @@ static char * check_domain_name(char *host_string){
 }
 
 
+#ifdef _WIN32
+
 static void gnb_do_resolv_node_address(gnb_node_t *node, char *host_string, uint16_t port, gnb_log_ctx_t *log){
 
     int ret;
@@ -88,7 +97,7 @@ static void gnb_do_resolv_node_address(gnb_node_t *node, char *host_string, uint
 
     ret = getaddrinfo(host_string, NULL, &hints, &result);
 
-    if ( -1 == ret ){
+    if ( 0 != ret ){
         return;
     }
 
@@ -111,7 +120,9 @@ static void gnb_do_resolv_node_address(gnb_node_t *node, char *host_string, uint
 
                 memcpy(&address_st.m_address6, &(((struct sockaddr_in6 *)(cur->ai_addr))->sin6_addr), 16);
 
+                gnb_seqlock_write_begin(&node->seq);
                 gnb_address_list_update(resolv_address_list, &address_st);
+                gnb_seqlock_write_end(&node->seq);
 
                 break;
 
@@ -121,7 +132,9 @@ static void gnb_do_resolv_node_address(gnb_node_t *node, char *host_string, uint
 
                 memcpy(&address_st.m_address4, &(((struct sockaddr_in *)(cur->ai_addr))->sin_addr), 4);
 
+                gnb_seqlock_write_begin(&node->seq);
                 gnb_address_list_update(resolv_address_list, &address_st);
+                gnb_seqlock_write_end(&node->seq);
 
                 break;
 
@@ -230,6 +243,1242 @@ void gnb_resolv_address(gnb_es_ctx *es_ctx){
 
 }
 
+#endif
+
+
+#ifdef __UNIX_LIKE_OS__
+
+/*
+在 unix-like 系统上直接向 /etc/resolv.conf 中的 nameserver 发出 DNS 查询，
+所有域名的 A 和 AAAA 查询同时发出，用一个非阻塞的 udp socket 收取结果，
+这样可以得到每条记录的 TTL, 一个域名解析超时也不会阻塞其他域名
+
+每个查询使用随机的 id, 应答的来源地址、id 和 question 都一致才接受，被截断的应答改用 tcp 重新查询
+没有得到地址的域名再用 getaddrinfo 解析，这样 /etc/hosts、nsswitch、search 域名和系统自己的 resolver 仍然有效
+*/
+
+#define GNB_RESOLV_MAX_NAMESERVER        3
+#define GNB_RESOLV_TIMEOUT_MSEC          1500
+
+#define GNB_RESOLV_MIN_TTL_SEC           30
+#define GNB_RESOLV_MAX_TTL_SEC           3600
+//解析失败的域名在这段时间内不再查询
+#define GNB_RESOLV_NEGATIVE_TTL_SEC      60
+//getaddrinfo 得不到 TTL
+#define GNB_RESOLV_GETADDRINFO_TTL_SEC   60
+
+#define GNB_RESOLV_CACHE_FILE            "resolv.cache"
+#define GNB_RESOLV_CACHE_MAGIC           "GNBRSV01"
+
+//超过这个数量的 resolv.cache 视为损坏
+#define GNB_RESOLV_CACHE_FILE_MAX_NUM    (1024*1024)
+
+#define DNS_TYPE_A       1
+#define DNS_TYPE_AAAA    28
+#define DNS_CLASS_IN     1
+
+#define DNS_HEAD_SIZE    12
+
+#define DNS_FLAG_QR      0x80
+#define DNS_FLAG_TC      0x02
+
+#define GNB_RESOLV_DONE_A     (0x1)
+#define GNB_RESOLV_DONE_AAAA  (0x1 << 1)
+#define GNB_RESOLV_DONE       (GNB_RESOLV_DONE_A|GNB_RESOLV_DONE_AAAA)
+
+
+typedef struct _gnb_resolv_cache_t {
+
+    char     host_string[NAME_MAX+1];
+
+    uint64_t expire_ts_sec;
+
+    //A 和 AAAA 记录中最小的 TTL
+    uint32_t ttl_sec;
+
+    int      num;
+
+    //port 为 0, 发布到 node 时填上 address.conf 中的端口
+    gnb_address_t address[GNB_NODE_RESOLV_ADDRESS_NUM];
+
+}gnb_resolv_cache_t;
+
+
+typedef struct _gnb_resolv_host_t {
+
+    gnb_resolv_cache_t *cache;
+
+    //A 和 AAAA 查询的随机 id
+    uint16_t query_id[2];
+
+    uint8_t  done_flags;
+
+    //udp 应答被截断，需要用 tcp 重新查询的类型
+    uint8_t  truncated_flags;
+
+    uint8_t  answered;
+
+    uint32_t min_ttl_sec;
+
+    int      num;
+
+    gnb_address_t address[GNB_NODE_RESOLV_ADDRESS_NUM];
+
+}gnb_resolv_host_t;
+
+
+typedef struct _gnb_resolv_line_t {
+
+    gnb_node_t *node;
+
+    //resolv_cache 会扩大，先记录下标
+    int cache_idx;
+
+    uint16_t port;
+
+}gnb_resolv_line_t;
+
+
+typedef struct _gnb_resolv_cache_file_head_t {
+
+    char     magic[8];
+
+    uint32_t entry_size;
+
+    uint32_t num;
+
+}gnb_resolv_cache_file_head_t;
+
+
+//gnb_es 以 service 方式运行时缓存在两次解析之间保留，单次运行时从 conf_dir 下的 resolv.cache 加载
+static gnb_resolv_cache_t *resolv_cache = NULL;
+static int resolv_cache_num      = 0;
+static int resolv_cache_capacity = 0;
+static int resolv_cache_loaded   = 0;
+
+
+static int reserve_resolv_cache(int num){
+
+    gnb_resolv_cache_t *new_cache;
+
+    int capacity;
+
+    if ( num <= resolv_cache_capacity ){
+        return 0;
+    }
+
+    capacity = resolv_cache_capacity > 0 ? resolv_cache_capacity : 64;
+
+    while ( capacity < num ){
+        capacity *= 2;
+    }
+
+    new_cache = (gnb_resolv_cache_t *)realloc(resolv_cache, sizeof(gnb_resolv_cache_t) * capacity);
+
+    if ( NULL == new_cache ){
+        return -1;
+    }
+
+    resolv_cache = new_cache;
+    resolv_cache_capacity = capacity;
+
+    return 0;
+
+}
+
+
+static void load_resolv_cache(char *conf_dir){
+
+    char cache_file[PATH_MAX+NAME_MAX];
+
+    gnb_resolv_cache_file_head_t head;
+
+    FILE *file;
+
+    snprintf(cache_file, PATH_MAX+NAME_MAX, "%s/%s", conf_dir, GNB_RESOLV_CACHE_FILE);
+
+    file = fopen(cache_file, "r");
+
+    if ( NULL == file ){
+        return;
+    }
+
+    if ( 1 != fread(&head, sizeof(gnb_resolv_cache_file_head_t), 1, file) ){
+        goto finish;
+    }
+
+    if ( 0 != memcmp(head.magic, GNB_RESOLV_CACHE_MAGIC, 8) || sizeof(gnb_resolv_cache_t) != head.entry_size || head.num > GNB_RESOLV_CACHE_FILE_MAX_NUM ){
+        goto finish;
+    }
+
+    if ( 0 != reserve_resolv_cache(head.num) ){
+        goto finish;
+    }
+
+    if ( head.num != fread(resolv_cache, sizeof(gnb_resolv_cache_t), head.num, file) ){
+        goto finish;
+    }
+
+    resolv_cache_num = head.num;
+
+finish:
+
+    fclose(file);
+
+}
+
+
+static void save_resolv_cache(char *conf_dir){
+
+    char cache_file[PATH_MAX+NAME_MAX];
+    char cache_tmp_file[PATH_MAX+NAME_MAX];
+
+    gnb_resolv_cache_file_head_t head;
+
+    FILE *file;
+
+    snprintf(cache_file,     PATH_MAX+NAME_MAX, "%s/%s",     conf_dir, GNB_RESOLV_CACHE_FILE);
+    snprintf(cache_tmp_file, PATH_MAX+NAME_MAX, "%s/%s.tmp", conf_dir, GNB_RESOLV_CACHE_FILE);
+
+    file = fopen(cache_tmp_file, "w");
+
+    if ( NULL == file ){
+        return;
+    }
+
+    memset(&head, 0, sizeof(gnb_resolv_cache_file_head_t));
+    memcpy(head.magic, GNB_RESOLV_CACHE_MAGIC, 8);
+    head.entry_size = sizeof(gnb_resolv_cache_t);
+    head.num = resolv_cache_num;
+
+    fwrite(&head, sizeof(gnb_resolv_cache_file_head_t), 1, file);
+    fwrite(resolv_cache, sizeof(gnb_resolv_cache_t), resolv_cache_num, file);
+
+    fclose(file);
+
+    rename(cache_tmp_file, cache_file);
+
+}
+
+
+//返回域名在 resolv_cache 中的下标
+static int get_resolv_cache(char *host_string){
+
+    int i;
+
+    for ( i=0; i<resolv_cache_num; i++ ){
+
+        if ( 0 == strncmp(resolv_cache[i].host_string, host_string, NAME_MAX) ){
+            return i;
+        }
+
+    }
+
+    if ( 0 != reserve_resolv_cache(resolv_cache_num + 1) ){
+        return -1;
+    }
+
+    memset(&resolv_cache[resolv_cache_num], 0, sizeof(gnb_resolv_cache_t));
+    snprintf(resolv_cache[resolv_cache_num].host_string, NAME_MAX+1, "%s", host_string);
+
+    resolv_cache_num++;
+
+    return resolv_cache_num-1;
+
+}
+
+
+//查询 id 必须是不可预测的，否则应答可以被伪造
+static void random_query_id(uint16_t *query_id_array, int num){
+
+    static FILE *urandom_file = NULL;
+
+    struct timeval tv;
+
+    int i;
+
+    if ( NULL == urandom_file ){
+        urandom_file = fopen("/dev/urandom", "r");
+    }
+
+    if ( NULL != urandom_file && num == fread(query_id_array, sizeof(uint16_t), num, urandom_file) ){
+        return;
+    }
+
+    gettimeofday(&tv, NULL);
+
+    srand((unsigned int)(tv.tv_sec ^ tv.tv_usec ^ getpid()));
+
+    for ( i=0; i<num; i++ ){
+        query_id_array[i] = (uint16_t)(rand() ^ (rand() >> 8));
+    }
+
+}
+
+
+static int load_nameserver(struct sockaddr_storage *nameserver_array, int max_num){
+
+    FILE *file;
+
+    char line_buffer[1024];
+    char host_string[INET6_ADDRSTRLEN];
+
+    struct sockaddr_in  *in;
+    struct sockaddr_in6 *in6;
+
+    int num = 0;
+
+    file = fopen("/etc/resolv.conf", "r");
+
+    if ( NULL == file ){
+        return 0;
+    }
+
+    while ( num < max_num && NULL != fgets(line_buffer, sizeof(line_buffer), file) ){
+
+        if ( 1 != sscanf(line_buffer, "nameserver %45s", host_string) ){
+            continue;
+        }
+
+        memset(&nameserver_array[num], 0, sizeof(struct sockaddr_storage));
+
+        in  = (struct sockaddr_in  *)&nameserver_array[num];
+        in6 = (struct sockaddr_in6 *)&nameserver_array[num];
+
+        if ( 1 == inet_pton(AF_INET, host_string, &in->sin_addr) ){
+            in->sin_family = AF_INET;
+            in->sin_port   = htons(53);
+            num++;
+            continue;
+        }
+
+        if ( 1 == inet_pton(AF_INET6, host_string, &in6->sin6_addr) ){
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port   = htons(53);
+            num++;
+            continue;
+        }
+
+    }
+
+    fclose(file);
+
+    return num;
+
+}
+
+
+//应答必须来自发出查询的 nameserver
+static int is_nameserver_address(struct sockaddr_storage *nameserver, struct sockaddr_storage *from){
+
+    struct sockaddr_in  *ns_in,  *from_in;
+    struct sockaddr_in6 *ns_in6, *from_in6;
+
+    if ( nameserver->ss_family != from->ss_family ){
+        return 0;
+    }
+
+    if ( AF_INET == nameserver->ss_family ){
+
+        ns_in   = (struct sockaddr_in *)nameserver;
+        from_in = (struct sockaddr_in *)from;
+
+        return ns_in->sin_port == from_in->sin_port && ns_in->sin_addr.s_addr == from_in->sin_addr.s_addr;
+
+    }
+
+    ns_in6   = (struct sockaddr_in6 *)nameserver;
+    from_in6 = (struct sockaddr_in6 *)from;
+
+    return ns_in6->sin6_port == from_in6->sin6_port && 0 == memcmp(&ns_in6->sin6_addr, &from_in6->sin6_addr, 16);
+
+}
+
+
+static int build_dns_query(unsigned char *buffer, size_t buffer_size, uint16_t query_id, char *host_string, uint16_t qtype){
+
+    unsigned char *p = buffer + DNS_HEAD_SIZE;
+    unsigned char *end = buffer + buffer_size - 4;
+
+    char *label = host_string;
+    char *dot;
+
+    size_t label_len;
+
+    memset(buffer, 0, DNS_HEAD_SIZE);
+
+    buffer[0] = query_id >> 8;
+    buffer[1] = query_id & 0xff;
+    //RD
+    buffer[2] = 0x01;
+    //QDCOUNT
+    buffer[5] = 1;
+
+    while ( '\0' != *label ){
+
+        dot = strchr(label, '.');
+
+        label_len = NULL != dot ? (size_t)(dot - label) : strlen(label);
+
+        if ( 0 == label_len || label_len > 63 || p + label_len + 1 >= end ){
+            return -1;
+        }
+
+        *p++ = (unsigned char)label_len;
+        memcpy(p, label, label_len);
+        p += label_len;
+
+        if ( NULL == dot ){
+            break;
+        }
+
+        label = dot + 1;
+
+    }
+
+    *p++ = 0;
+
+    *p++ = qtype >> 8;
+    *p++ = qtype & 0xff;
+    *p++ = 0;
+    *p++ = DNS_CLASS_IN;
+
+    return (int)(p - buffer);
+
+}
+
+
+static unsigned char* skip_dns_name(unsigned char *p, unsigned char *end){
+
+    while ( p < end ){
+
+        if ( 0 == *p ){
+            return p + 1;
+        }
+
+        //压缩的名字
+        if ( 0xc0 == (*p & 0xc0) ){
+            return p + 2;
+        }
+
+        p += *p + 1;
+
+    }
+
+    return NULL;
+
+}
+
+
+/*
+应答中的 question 必须与查询的域名和类型相同，返回 question 之后的位置
+question 中的名字不会被压缩
+*/
+static unsigned char* match_dns_question(unsigned char *p, unsigned char *end, char *host_string, uint16_t qtype){
+
+    char *name = host_string;
+
+    size_t label_len;
+
+    while ( p < end && 0 != *p ){
+
+        label_len = *p;
+
+        if ( label_len > 63 || p + 1 + label_len > end ){
+            return NULL;
+        }
+
+        if ( 0 != strncasecmp(name, (char *)p + 1, label_len) ){
+            return NULL;
+        }
+
+        name += label_len;
+
+        if ( '.' == *name ){
+            name++;
+        } else if ( '\0' != *name ){
+            return NULL;
+        }
+
+        p += 1 + label_len;
+
+    }
+
+    if ( p + 5 > end || '\0' != *name ){
+        return NULL;
+    }
+
+    p++;
+
+    if ( qtype != ((p[0] << 8) | p[1]) || DNS_CLASS_IN != ((p[2] << 8) | p[3]) ){
+        return NULL;
+    }
+
+    return p + 4;
+
+}
+
+
+static void handle_dns_response(gnb_resolv_host_t *resolv_host_array, int host_num, unsigned char *buffer, ssize_t size, int from_tcp){
+
+    gnb_resolv_host_t *resolv_host = NULL;
+
+    unsigned char *p;
+    unsigned char *end = buffer + size;
+
+    uint16_t response_id;
+    uint16_t qdcount;
+    uint16_t ancount;
+    uint16_t qtype = 0;
+    uint16_t rtype;
+    uint16_t rclass;
+    uint16_t rdlength;
+    uint32_t ttl;
+
+    uint8_t done_flag;
+
+    gnb_address_t *address;
+
+    int i;
+
+    if ( size < DNS_HEAD_SIZE ){
+        return;
+    }
+
+    //不是应答
+    if ( !(buffer[2] & DNS_FLAG_QR) ){
+        return;
+    }
+
+    response_id = (buffer[0] << 8) | buffer[1];
+
+    for ( i=0; i<host_num; i++ ){
+
+        if ( response_id == resolv_host_array[i].query_id[0] ){
+            resolv_host = &resolv_host_array[i];
+            qtype = DNS_TYPE_A;
+            break;
+        }
+
+        if ( response_id == resolv_host_array[i].query_id[1] ){
+            resolv_host = &resolv_host_array[i];
+            qtype = DNS_TYPE_AAAA;
+            break;
+        }
+
+    }
+
+    if ( NULL == resolv_host ){
+        return;
+    }
+
+    done_flag = DNS_TYPE_A == qtype ? GNB_RESOLV_DONE_A : GNB_RESOLV_DONE_AAAA;
+
+    if ( resolv_host->done_flags & done_flag ){
+        return;
+    }
+
+    qdcount = (buffer[4] << 8) | buffer[5];
+    ancount = (buffer[6] << 8) | buffer[7];
+
+    //question 不一致的应答不是对这个查询的回应，继续等待
+    if ( 1 != qdcount ){
+        return;
+    }
+
+    p = match_dns_question(buffer + DNS_HEAD_SIZE, end, resolv_host->cache->host_string, qtype);
+
+    if ( NULL == p ){
+        return;
+    }
+
+    resolv_host->done_flags |= done_flag;
+
+    //被截断的应答中的记录不完整，之后用 tcp 重新查询
+    if ( 0 == from_tcp && (buffer[2] & DNS_FLAG_TC) ){
+        resolv_host->truncated_flags |= done_flag;
+        return;
+    }
+
+    //RCODE 不为 0 或 NXDOMAIN 都视为这个类型的查询已经完成
+    if ( 0 != (buffer[3] & 0x0f) ){
+        return;
+    }
+
+    resolv_host->answered = 1;
+
+    for ( i=0; i<ancount; i++ ){
+
+        p = skip_dns_name(p, end);
+
+        if ( NULL == p || p + 10 > end ){
+            return;
+        }
+
+        rtype    = (p[0] << 8) | p[1];
+        rclass   = (p[2] << 8) | p[3];
+        ttl      = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+        rdlength = (p[8] << 8) | p[9];
+
+        p += 10;
+
+        if ( p + rdlength > end ){
+            return;
+        }
+
+        //CNAME 等记录跳过，递归 DNS 会在后面给出最终的 A 或 AAAA 记录
+        if ( DNS_CLASS_IN != rclass || rtype != qtype || resolv_host->num >= GNB_NODE_RESOLV_ADDRESS_NUM ){
+            p += rdlength;
+            continue;
+        }
+
+        address = &resolv_host->address[resolv_host->num];
+
+        memset(address, 0, sizeof(gnb_address_t));
+
+        if ( DNS_TYPE_A == rtype && 4 == rdlength ){
+            address->type = AF_INET;
+            memcpy(&address->m_address4, p, 4);
+            resolv_host->num++;
+        } else if ( DNS_TYPE_AAAA == rtype && 16 == rdlength ){
+            address->type = AF_INET6;
+            memcpy(&address->m_address6, p, 16);
+            resolv_host->num++;
+        }
+
+        if ( ttl < resolv_host->min_ttl_sec ){
+            resolv_host->min_ttl_sec = ttl;
+        }
+
+        p += rdlength;
+
+    }
+
+}
+
+
+static void send_dns_query(int sockfd, struct sockaddr_storage *nameserver, gnb_resolv_host_t *resolv_host){
+
+    unsigned char buffer[512];
+
+    socklen_t addr_len;
+
+    int len;
+
+    addr_len = AF_INET6 == nameserver->ss_family ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+    if ( !(resolv_host->done_flags & GNB_RESOLV_DONE_A) ){
+
+        len = build_dns_query(buffer, sizeof(buffer), resolv_host->query_id[0], resolv_host->cache->host_string, DNS_TYPE_A);
+
+        if ( len > 0 ){
+            sendto(sockfd, buffer, len, 0, (struct sockaddr *)nameserver, addr_len);
+        }
+
+    }
+
+    if ( !(resolv_host->done_flags & GNB_RESOLV_DONE_AAAA) ){
+
+        len = build_dns_query(buffer, sizeof(buffer), resolv_host->query_id[1], resolv_host->cache->host_string, DNS_TYPE_AAAA);
+
+        if ( len > 0 ){
+            sendto(sockfd, buffer, len, 0, (struct sockaddr *)nameserver, addr_len);
+        }
+
+    }
+
+}
+
+
+static int recv_full(int sockfd, unsigned char *buffer, size_t size){
+
+    ssize_t n;
+
+    size_t offset = 0;
+
+    while ( offset < size ){
+
+        n = recv(sockfd, buffer + offset, size - offset, 0);
+
+        if ( n <= 0 ){
+            return -1;
+        }
+
+        offset += n;
+
+    }
+
+    return 0;
+
+}
+
+
+/*
+udp 应答被截断时用 tcp 向同一个 nameserver 重新查询，
+tcp 的 DNS 消息前面有 2 字节的长度
+*/
+static void tcp_dns_query(struct sockaddr_storage *nameserver, gnb_resolv_host_t *resolv_host_array, int host_num, gnb_resolv_host_t *resolv_host, uint16_t qtype){
+
+    unsigned char query[2+512];
+    unsigned char *response;
+
+    struct timeval timeout;
+
+    socklen_t addr_len;
+
+    uint16_t response_len;
+
+    int sockfd;
+    int len;
+
+    len = build_dns_query(query+2, sizeof(query)-2, DNS_TYPE_A == qtype ? resolv_host->query_id[0] : resolv_host->query_id[1], resolv_host->cache->host_string, qtype);
+
+    if ( len <= 0 ){
+        return;
+    }
+
+    query[0] = len >> 8;
+    query[1] = len & 0xff;
+
+    sockfd = socket(nameserver->ss_family, SOCK_STREAM, 0);
+
+    if ( -1 == sockfd ){
+        return;
+    }
+
+    timeout.tv_sec  = GNB_RESOLV_TIMEOUT_MSEC / 1000;
+    timeout.tv_usec = (GNB_RESOLV_TIMEOUT_MSEC % 1000) * 1000;
+
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    addr_len = AF_INET6 == nameserver->ss_family ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+    if ( 0 != connect(sockfd, (struct sockaddr *)nameserver, addr_len) ){
+        goto finish;
+    }
+
+    if ( len + 2 != send(sockfd, query, len + 2, 0) ){
+        goto finish;
+    }
+
+    if ( 0 != recv_full(sockfd, query, 2) ){
+        goto finish;
+    }
+
+    response_len = (query[0] << 8) | query[1];
+
+    response = (unsigned char *)malloc(response_len);
+
+    if ( NULL == response ){
+        goto finish;
+    }
+
+    if ( 0 == recv_full(sockfd, response, response_len) ){
+        handle_dns_response(resolv_host_array, host_num, response, response_len, 1);
+    }
+
+    free(response);
+
+finish:
+
+    close(sockfd);
+
+}
+
+
+static void do_resolv_host(struct sockaddr_storage *nameserver_array, int nameserver_num, gnb_resolv_host_t *resolv_host_array, int host_num){
+
+    struct sockaddr_storage from_addr;
+    socklen_t from_addr_len;
+
+    unsigned char buffer[1500];
+
+    struct timeval timeout;
+    struct timeval start_tv;
+    struct timeval now_tv;
+
+    fd_set readfds;
+
+    ssize_t n;
+
+    int64_t elapsed_msec;
+
+    uint8_t truncated_flags;
+
+    int sockfd;
+    int attempt;
+    int pending;
+    int ret;
+    int i;
+
+    for ( attempt=0; attempt<nameserver_num; attempt++ ){
+
+        sockfd = socket(nameserver_array[attempt].ss_family, SOCK_DGRAM, 0);
+
+        if ( -1 == sockfd ){
+            continue;
+        }
+
+        //所有域名的查询一次性发出
+        for ( i=0; i<host_num; i++ ){
+
+            if ( GNB_RESOLV_DONE == resolv_host_array[i].done_flags ){
+                continue;
+            }
+
+            send_dns_query(sockfd, &nameserver_array[attempt], &resolv_host_array[i]);
+
+        }
+
+        gettimeofday(&start_tv, NULL);
+
+        do{
+
+            pending = 0;
+
+            for ( i=0; i<host_num; i++ ){
+
+                if ( GNB_RESOLV_DONE != resolv_host_array[i].done_flags ){
+                    pending++;
+                }
+
+            }
+
+            if ( 0 == pending ){
+                break;
+            }
+
+            gettimeofday(&now_tv, NULL);
+
+            elapsed_msec = (int64_t)(now_tv.tv_sec - start_tv.tv_sec)*1000 + (now_tv.tv_usec - start_tv.tv_usec)/1000;
+
+            if ( elapsed_msec >= GNB_RESOLV_TIMEOUT_MSEC ){
+                break;
+            }
+
+            timeout.tv_sec  = (GNB_RESOLV_TIMEOUT_MSEC - elapsed_msec) / 1000;
+            timeout.tv_usec = ((GNB_RESOLV_TIMEOUT_MSEC - elapsed_msec) % 1000) * 1000;
+
+            FD_ZERO(&readfds);
+            FD_SET(sockfd, &readfds);
+
+            ret = select(sockfd + 1, &readfds, NULL, NULL, &timeout);
+
+            if ( ret <= 0 ){
+                continue;
+            }
+
+            from_addr_len = sizeof(struct sockaddr_storage);
+
+            n = recvfrom(sockfd, buffer, sizeof(buffer), 0, (struct sockaddr *)&from_addr, &from_addr_len);
+
+            if ( n > 0 && is_nameserver_address(&nameserver_array[attempt], &from_addr) ){
+                handle_dns_response(resolv_host_array, host_num, buffer, n, 0);
+            }
+
+        }while(1);
+
+        close(sockfd);
+
+        //tcp 查询失败的类型会在下一个 nameserver 重新查询
+        for ( i=0; i<host_num; i++ ){
+
+            truncated_flags = resolv_host_array[i].truncated_flags;
+
+            if ( 0 == truncated_flags ){
+                continue;
+            }
+
+            resolv_host_array[i].truncated_flags = 0;
+            resolv_host_array[i].done_flags &= ~truncated_flags;
+
+            if ( truncated_flags & GNB_RESOLV_DONE_A ){
+                tcp_dns_query(&nameserver_array[attempt], resolv_host_array, host_num, &resolv_host_array[i], DNS_TYPE_A);
+            }
+
+            if ( truncated_flags & GNB_RESOLV_DONE_AAAA ){
+                tcp_dns_query(&nameserver_array[attempt], resolv_host_array, host_num, &resolv_host_array[i], DNS_TYPE_AAAA);
+            }
+
+            if ( GNB_RESOLV_DONE != resolv_host_array[i].done_flags ){
+                pending++;
+            }
+
+        }
+
+        if ( 0 == pending ){
+            break;
+        }
+
+    }
+
+}
+
+
+/*
+DNS 查询没有得到地址时交给系统的 resolver, 
+/etc/hosts 中的名字、search 域名以及 Darwin 和 BSD 上不在 /etc/resolv.conf 中的配置都由它处理
+*/
+static void getaddrinfo_resolv_host(gnb_resolv_host_t *resolv_host){
+
+    struct addrinfo hints;
+
+    struct addrinfo *result;
+    struct addrinfo *cur;
+
+    gnb_address_t address_st;
+
+    int i;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    if ( 0 != getaddrinfo(resolv_host->cache->host_string, NULL, &hints, &result) ){
+        return;
+    }
+
+    for ( cur=result; NULL!=cur && resolv_host->num < GNB_NODE_RESOLV_ADDRESS_NUM; cur=cur->ai_next ) {
+
+        memset(&address_st, 0, sizeof(gnb_address_t));
+
+        if ( AF_INET == cur->ai_addr->sa_family ){
+            address_st.type = AF_INET;
+            memcpy(&address_st.m_address4, &(((struct sockaddr_in *)(cur->ai_addr))->sin_addr), 4);
+        } else if ( AF_INET6 == cur->ai_addr->sa_family ){
+            address_st.type = AF_INET6;
+            memcpy(&address_st.m_address6, &(((struct sockaddr_in6 *)(cur->ai_addr))->sin6_addr), 16);
+        } else {
+            continue;
+        }
+
+        for ( i=0; i<resolv_host->num; i++ ){
+
+            if ( 0 == memcmp(&resolv_host->address[i], &address_st, sizeof(gnb_address_t)) ){
+                break;
+            }
+
+        }
+
+        if ( i < resolv_host->num ){
+            continue;
+        }
+
+        resolv_host->address[resolv_host->num] = address_st;
+        resolv_host->num++;
+
+    }
+
+    freeaddrinfo(result);
+
+    if ( resolv_host->num > 0 ){
+        resolv_host->min_ttl_sec = GNB_RESOLV_GETADDRINFO_TTL_SEC;
+    }
+
+}
+
+
+//把解析的结果写入 cache, 没有得到地址时保留之前的结果
+static void update_resolv_cache(gnb_es_ctx *es_ctx, gnb_resolv_host_t *resolv_host){
+
+    gnb_resolv_cache_t *resolv_cache_entry = resolv_host->cache;
+
+    uint32_t ttl_sec;
+
+    if ( 0 == resolv_host->num ){
+
+        resolv_cache_entry->expire_ts_sec = es_ctx->now_time_sec + GNB_RESOLV_NEGATIVE_TTL_SEC;
+
+        GNB_LOG1(es_ctx->log, GNB_LOG_ID_ES_RESOLV, "resolv [%s] %s\n", resolv_cache_entry->host_string, resolv_host->answered ? "no record" : "timeout");
+
+        return;
+
+    }
+
+    ttl_sec = resolv_host->min_ttl_sec;
+
+    if ( ttl_sec < GNB_RESOLV_MIN_TTL_SEC ){
+        ttl_sec = GNB_RESOLV_MIN_TTL_SEC;
+    }
+
+    resolv_cache_entry->ttl_sec = ttl_sec;
+    resolv_cache_entry->expire_ts_sec = es_ctx->now_time_sec + ttl_sec;
+    resolv_cache_entry->num = resolv_host->num;
+    memcpy(resolv_cache_entry->address, resolv_host->address, sizeof(gnb_address_t)*GNB_NODE_RESOLV_ADDRESS_NUM);
+
+}
+
+
+//只把新的地址更新到 resolv_address_block
+static void publish_resolv_address(gnb_es_ctx *es_ctx, gnb_node_t *node, gnb_resolv_cache_t *resolv_cache_entry, uint16_t port){
+
+    gnb_address_list_t *resolv_address_list;
+
+    gnb_address_t address_st;
+
+    int i;
+
+    resolv_address_list = (gnb_address_list_t *)&node->resolv_address_block;
+
+    for ( i=0; i<resolv_cache_entry->num; i++ ){
+
+        address_st = resolv_cache_entry->address[i];
+        address_st.port = htons(port);
+
+        if ( -1 != gnb_address_list_find(resolv_address_list, &address_st) ){
+            continue;
+        }
+
+        address_st.ts_sec = es_ctx->now_time_sec;
+
+        gnb_seqlock_write_begin(&node->seq);
+        gnb_address_list_update(resolv_address_list, &address_st);
+        gnb_seqlock_write_end(&node->seq);
+
+        GNB_LOG1(es_ctx->log, GNB_LOG_ID_ES_RESOLV, "resolv [%s]>[%s] ttl=%u\n", resolv_cache_entry->host_string, GNB_IP_PORT_STR1(&address_st), resolv_cache_entry->ttl_sec);
+
+    }
+
+}
+
+
+void gnb_resolv_address(gnb_es_ctx *es_ctx){
+
+    char *conf_dir = es_ctx->ctl_block->conf_zone->conf_st.conf_dir;
+
+    char address_file[PATH_MAX+NAME_MAX];
+
+    gnb_resolv_host_t *resolv_host_array = NULL;
+
+    gnb_resolv_line_t *line_array = NULL;
+    gnb_resolv_line_t *new_line_array;
+
+    int line_capacity = 0;
+    int line_num = 0;
+    int host_num = 0;
+
+    gnb_resolv_cache_t *resolv_cache_entry;
+
+    struct sockaddr_storage nameserver_array[GNB_RESOLV_MAX_NAMESERVER];
+
+    uint16_t *query_id_array;
+
+    int nameserver_num;
+    int getaddrinfo_num;
+
+    int cache_idx;
+
+    int i,j;
+
+    snprintf(address_file, PATH_MAX+NAME_MAX, "%s/%s", conf_dir, "address.conf");
+
+    FILE *file;
+
+    file = fopen(address_file,"r");
+
+    if (NULL==file){
+        return;
+    }
+
+    if ( 0 == resolv_cache_loaded ){
+        load_resolv_cache(conf_dir);
+        resolv_cache_loaded = 1;
+    }
+
+    char line_buffer[1024];
+
+    char attrib_string[16];
+
+    uint32_t uuid32;
+
+    char     host_string[NAME_MAX+1];
+
+    uint16_t port = 0;
+
+    gnb_node_t *node;
+
+    int num;
+
+    do{
+
+        num = fscanf(file,"%1024s\n",line_buffer);
+
+        if ( EOF == num ) {
+            break;
+        }
+
+        if ('#' == line_buffer[0]){
+            continue;
+        }
+
+        num = sscanf(line_buffer,"%16[^|]|%u|%255[^|]|%hu\n", attrib_string, &uuid32, host_string, &port);
+
+        if ( 4 != num ) {
+
+            continue;
+        }
+
+        if ( 0 == port ){
+            continue;
+        }
+
+        if ( NULL == check_domain_name(host_string) ){
+            continue;
+        }
+
+        node = (gnb_node_t *)GNB_HASH32_UINT32_GET_PTR(es_ctx->uuid_node_map, uuid32);
+
+        if ( NULL == node ){
+            continue;
+        }
+
+        cache_idx = get_resolv_cache(host_string);
+
+        if ( -1 == cache_idx ){
+            continue;
+        }
+
+        if ( line_num >= line_capacity ){
+
+            line_capacity = line_capacity > 0 ? line_capacity * 2 : 64;
+
+            new_line_array = (gnb_resolv_line_t *)realloc(line_array, sizeof(gnb_resolv_line_t) * line_capacity);
+
+            if ( NULL == new_line_array ){
+                break;
+            }
+
+            line_array = new_line_array;
+
+        }
+
+        line_array[line_num].node      = node;
+        line_array[line_num].cache_idx = cache_idx;
+        line_array[line_num].port      = port;
+        line_num++;
+
+    }while(1);
+
+    fclose(file);
+
+    if ( 0 == line_num ){
+        goto finish;
+    }
+
+    resolv_host_array = (gnb_resolv_host_t *)malloc(sizeof(gnb_resolv_host_t) * line_num);
+    query_id_array    = (uint16_t *)malloc(sizeof(uint16_t) * line_num * 2);
+
+    if ( NULL == resolv_host_array || NULL == query_id_array ){
+        free(query_id_array);
+        goto finish;
+    }
+
+    random_query_id(query_id_array, line_num * 2);
+
+    //TTL 未过期的域名不需要查询，多行使用同一个域名时只查询一次
+    for ( i=0; i<line_num; i++ ){
+
+        resolv_cache_entry = &resolv_cache[ line_array[i].cache_idx ];
+
+        if ( resolv_cache_entry->expire_ts_sec > es_ctx->now_time_sec ){
+            continue;
+        }
+
+        for ( j=0; j<host_num; j++ ){
+
+            if ( resolv_host_array[j].cache == resolv_cache_entry ){
+                break;
+            }
+
+        }
+
+        if ( j < host_num ){
+            continue;
+        }
+
+        memset(&resolv_host_array[host_num], 0, sizeof(gnb_resolv_host_t));
+        resolv_host_array[host_num].cache = resolv_cache_entry;
+        resolv_host_array[host_num].query_id[0] = query_id_array[host_num*2];
+        resolv_host_array[host_num].query_id[1] = query_id_array[host_num*2+1];
+        resolv_host_array[host_num].min_ttl_sec = GNB_RESOLV_MAX_TTL_SEC;
+
+        host_num++;
+
+    }
+
+    free(query_id_array);
+
+    getaddrinfo_num = 0;
+
+    if ( host_num > 0 ){
+
+        nameserver_num = load_nameserver(nameserver_array, GNB_RESOLV_MAX_NAMESERVER);
+
+        if ( 0 == nameserver_num ){
+            GNB_LOG1(es_ctx->log, GNB_LOG_ID_ES_RESOLV, "resolv no nameserver\n");
+        } else {
+            do_resolv_host(nameserver_array, nameserver_num, resolv_host_array, host_num);
+        }
+
+        for ( i=0; i<host_num; i++ ){
+
+            if ( 0 == resolv_host_array[i].num ){
+                getaddrinfo_num++;
+                continue;
+            }
+
+            update_resolv_cache(es_ctx, &resolv_host_array[i]);
+
+        }
+
+    }
+
+    //先发布 DNS 查询得到的和 cache 中的地址，getaddrinfo 较慢的域名不会推迟其他域名
+    for ( i=0; i<line_num; i++ ){
+        publish_resolv_address(es_ctx, line_array[i].node, &resolv_cache[ line_array[i].cache_idx ], line_array[i].port);
+    }
+
+    //每个域名用 getaddrinfo 解析后马上发布这个域名的地址
+    for ( i=0; i<host_num && getaddrinfo_num > 0; i++ ){
+
+        if ( 0 != resolv_host_array[i].num ){
+            continue;
+        }
+
+        getaddrinfo_resolv_host(&resolv_host_array[i]);
+
+        update_resolv_cache(es_ctx, &resolv_host_array[i]);
+
+        if ( 0 == resolv_host_array[i].num ){
+            continue;
+        }
+
+        for ( j=0; j<line_num; j++ ){
+
+            if ( &resolv_cache[ line_array[j].cache_idx ] == resolv_host_array[i].cache ){
+                publish_resolv_address(es_ctx, line_array[j].node, resolv_host_array[i].cache, line_array[j].port);
+            }
+
+        }
+
+    }
+
+    if ( host_num > 0 ){
+        save_resolv_cache(conf_dir);
+    }
+
+finish:
+
+    free(resolv_host_array);
+    free(line_array);
+
+}
+
+#endif
+
+
 /*
 dig -6 TXT +short o-o.myaddr.l.google.com @ns1.google.com | awk -F'"' '{ print $2}'
 */
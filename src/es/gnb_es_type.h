@@ -51,6 +51,9 @@ typedef struct _gnb_es_ctx{
 
 	gnb_hash32_map_t *uuid_node_map;
 
+	//gnb 热加载后 node_zone 中会出现新的节点
+	uint32_t node_table_epoch;
+
 	char *pid_file;
 
 	char *wan_address6_file;
@@ -65,6 +68,9 @@ typedef struct _gnb_es_ctx{
 	int if_up_opt;
 	int if_down_opt;
 
+	//由 gnb 以 service 方式启动时, gnb 退出后 gnb_es 也退出
+	int exit_with_gnb_opt;
+
 	gnb_log_ctx_t    *log;
 
 	int daemon;
@@ -58,6 +58,20 @@
 #include "gnb_log.h"
 
 
+typedef struct _gnb_conf_reload_t gnb_conf_reload_t;
+
+//读 node 表的线程，各自在 gnb_core->node_table_reader_epoch 中占一个位置
+#define GNB_NODE_TABLE_READER_MAIN     0
+//Windows 下单独处理 tun 的线程
+#define GNB_NODE_TABLE_READER_TUN      1
+#define GNB_NODE_TABLE_READER_NODE     2
+#define GNB_NODE_TABLE_READER_INDEX    3
+#define GNB_NODE_TABLE_READER_NUM      4
+
+//线程还没有开始读 node 表
+#define GNB_NODE_TABLE_READER_OFFLINE  0xFFFFFFFF
+typedef struct _gnb_speedtest_ctx_t gnb_speedtest_ctx_t;
+
 typedef struct _gnb_core_t{
 
 	gnb_heap_t *heap;
@@ -154,8 +168,31 @@ typedef struct _gnb_core_t{
 
 	gnb_ctl_block_t  *ctl_block;
 
+	//数据通路写的计数器，指向 ctl block metrics zone 中各自的 slot
+	gnb_metrics_block_t *tun_metrics;
+	gnb_metrics_block_t *inet_metrics;
+
+	//pf 各个阶段耗时的 histogram, enable 为 0 时不记录
+	gnb_ctl_latency_zone_t *latency_zone;
+
+	//数据通路的 tracepoint, 指向 ctl block trace zone 中的 ring
+	gnb_trace_ring_t *trace;
+
+	//gnb_ctl speedtest 的请求和结果, 指向 ctl block speedtest zone
+	gnb_speedtest_t *speedtest;
+	gnb_speedtest_ctx_t *speedtest_ctx;
+
 	gnb_log_ctx_t    *log;
 
+	//热加载准备好的 node 表，由数据通路线程在两次处理之间换入
+	gnb_conf_reload_t * volatile pending_reload;
+
+	//被换下的 node 表，读 node 表的线程都进入了换入后的 epoch 才释放
+	gnb_conf_reload_t *retired_reload;
+
+	//读 node 表的线程在每轮循环开始时写入看到的 status_zone->node_table_epoch, 此时线程没有持有 node 表中的指针
+	volatile uint32_t node_table_reader_epoch[GNB_NODE_TABLE_READER_NUM];
+
 }gnb_core_t;
 
 
@@ -165,6 +202,10 @@ typedef struct _gnb_core_t{
 #define GNB_PAYLOAD_SUB_TYPE_IPFRAME_INIT   (0x0)
 #define GNB_PAYLOAD_SUB_TYPE_IPFRAME_STD    (0x1)
 #define GNB_PAYLOAD_SUB_TYPE_IPFRAME_RELAY  (0x1 << 1)
+//speedtest 的测试分组，对端不写入 tun
+#define GNB_PAYLOAD_SUB_TYPE_IPFRAME_TEST   (0x1 << 2)
+//中继节点不重新加密 ip frame, 见 gnb_route_frame_type.h
+#define GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH (0x1 << 3)
 
 
 #define GNB_PAYLOAD_TYPE_INDEX              0x08
@@ -45,6 +45,7 @@ void gnb_setup_es_argv(char *es_argv_string);
 #define DETECT_PORT_START  1024
 #define DETECT_PORT_END   65535
 #define DETECT_PORT_RANGE    25
+#define DETECT_PORT_RATE   1000
 
 
 #define GNB_OPT_INIT                   0x91
@@ -107,6 +108,28 @@ void gnb_setup_es_argv(char *es_argv_string);
 #define SET_FWDU0                      (GNB_OPT_INIT + 43)
 #define SET_FWDU1                      (GNB_OPT_INIT + 44)
 
+#define SET_INDEX_SERVICE_CACHE_FILE   (GNB_OPT_INIT + 45)
+#define SET_PORT_DETECT_RATE           (GNB_OPT_INIT + 46)
+#define SET_AUTO_RELAY_ROUTE           (GNB_OPT_INIT + 47)
+#define SET_ES_SERVICE                 (GNB_OPT_INIT + 48)
+#define SET_LOG_ASYNC                  (GNB_OPT_INIT + 49)
+
+#define SET_PCAP_FILE                  (GNB_OPT_INIT + 50)
+#define SET_PCAP_SIZE                  (GNB_OPT_INIT + 51)
+#define SET_PCAP_SNAPLEN               (GNB_OPT_INIT + 52)
+#define SET_PCAP_SAMPLE                (GNB_OPT_INIT + 53)
+#define SET_PCAP_FILTER                (GNB_OPT_INIT + 54)
+
+#define SET_FLOW_EXPORT                (GNB_OPT_INIT + 55)
+#define SET_FLOW_TABLE_SIZE            (GNB_OPT_INIT + 56)
+#define SET_FLOW_IDLE_TIMEOUT          (GNB_OPT_INIT + 57)
+#define SET_FLOW_ACTIVE_TIMEOUT        (GNB_OPT_INIT + 58)
+
+#define SET_RELAY_CUT_THROUGH          (GNB_OPT_INIT + 59)
+
+#define SET_PACKET_POOL_HUGEPAGE       (GNB_OPT_INIT + 60)
+#define SET_PACKET_POOL_NUMA           (GNB_OPT_INIT + 61)
+
 gnb_arg_list_t *gnb_es_arg_list;
 int is_self_test = 0;
 
@@ -146,6 +169,15 @@ gnb_conf_t* gnb_argv(int argc,char *argv[]){
 
     conf->fwdu0          = 1;
 
+    conf->auto_relay_route = 0;
+
+    conf->relay_cut_through = 0;
+
+    conf->packet_pool_hugepage = 0;
+    conf->packet_pool_numa = 0;
+
+    conf->es_service = 0;
+
     /*
     IPv4最小MTU=576bytes
     IPv6最小MTU=1280bytes
@@ -169,8 +201,18 @@ gnb_conf_t* gnb_argv(int argc,char *argv[]){
 
     conf->if_dump = 0;
 
+    conf->pcap_size_mb = 16;
+    conf->pcap_snaplen = 256;
+    conf->pcap_sample  = 1;
+
+    conf->flow_table_size     = 4096;
+    conf->flow_idle_timeout   = 15;
+    conf->flow_active_timeout = 60;
+
     conf->log_udp_type = GNB_LOG_UDP_TYPE_BINARY;
 
+    conf->log_async = 0;
+
     conf->console_log_level = GNB_LOG_LEVEL_UNSET;
     conf->file_log_level    = GNB_LOG_LEVEL_UNSET;
     conf->udp_log_level     = GNB_LOG_LEVEL_UNSET;
@@ -197,6 +239,7 @@ gnb_conf_t* gnb_argv(int argc,char *argv[]){
     conf->port_detect_end   = DETECT_PORT_END;
 
     conf->port_detect_range = DETECT_PORT_RANGE;
+    conf->port_detect_rate  = DETECT_PORT_RATE;
 
     conf->daemon = 0;
 
@@ -278,6 +321,17 @@ gnb_conf_t* gnb_argv(int argc,char *argv[]){
 	  { "ctl-block",           required_argument,  0, 'b' },
       { "if-dump",             required_argument,  0, SET_IF_DUMP },
 
+      { "pcap-file",           required_argument,  0, SET_PCAP_FILE },
+      { "pcap-size",           required_argument,  0, SET_PCAP_SIZE },
+      { "pcap-snaplen",        required_argument,  0, SET_PCAP_SNAPLEN },
+      { "pcap-sample",         required_argument,  0, SET_PCAP_SAMPLE },
+      { "pcap-filter",         required_argument,  0, SET_PCAP_FILTER },
+
+      { "flow-export",         required_argument,  0, SET_FLOW_EXPORT },
+      { "flow-table-size",     required_argument,  0, SET_FLOW_TABLE_SIZE },
+      { "flow-idle-timeout",   required_argument,  0, SET_FLOW_IDLE_TIMEOUT },
+      { "flow-active-timeout", required_argument,  0, SET_FLOW_ACTIVE_TIMEOUT },
+
       { "ipv4-only", no_argument,   0, '4'},
       { "ipv6-only", no_argument,   0, '6'},
 
@@ -296,11 +350,17 @@ gnb_conf_t* gnb_argv(int argc,char *argv[]){
       { "port-detect-start",         required_argument,  0, SET_PORT_DETECT_START },
       { "port-detect-end",           required_argument,  0, SET_PORT_DETECT_END },
       { "port-detect-range",         required_argument,  0, SET_PORT_DETECT_RANGE },
+      { "port-detect-rate",          required_argument,  0, SET_PORT_DETECT_RATE },
 
       { "set-tun",                   required_argument,  0, SET_TUN },
       { "index-worker",              required_argument,  0, SET_INDEX_WORKER },
       { "index-service-worker",      required_argument,  0, SET_INDEX_SERVICE_WORKER },
       { "node-detect-worker",        required_argument,  0, SET_DETECT_WORKER },
+      { "auto-relay-route",          required_argument,  0, SET_AUTO_RELAY_ROUTE },
+      { "relay-cut-through",         required_argument,  0, SET_RELAY_CUT_THROUGH },
+      { "packet-pool-hugepage",      required_argument,  0, SET_PACKET_POOL_HUGEPAGE },
+      { "packet-pool-numa",          required_argument,  0, SET_PACKET_POOL_NUMA },
+      { "es-service",                required_argument,  0, SET_ES_SERVICE },
 
       { "multi-socket",              required_argument,  0,  SET_MULTI_SOCKET },
       { "set-fwdu0",                 required_argument,  0, SET_FWDU0 },
@@ -309,12 +369,14 @@ gnb_conf_t* gnb_argv(int argc,char *argv[]){
       { "direct-forwarding",         required_argument,  0, SET_DIRECT_FORWARDING },
       { "pid-file",                  required_argument,  0, SET_PID_FILE },
       { "node-cache-file",           required_argument,  0, SET_NODE_CACHE_FILE },
+      { "index-service-cache-file",  required_argument,  0, SET_INDEX_SERVICE_CACHE_FILE },
 
       { "log-file-path",             required_argument,  0,     SET_LOG_FILE_PATH },
       { "log-udp6",                  optional_argument,  &flag, SET_LOG_UDP6 },
       { "log-udp4",                  optional_argument,  &flag, SET_LOG_UDP4 },
 
       { "log-udp-type",              required_argument,  0,   SET_LOG_UDP_TYPE },
+      { "log-async",                 required_argument,  0,   SET_LOG_ASYNC },
 
       { "console-log-level",         required_argument,  0,   SET_CONSOLE_LOG_LEVEL },
       { "file-log-level",            required_argument,  0,   SET_FILE_LOG_LEVEL },
@@ -450,6 +512,10 @@ gnb_conf_t* gnb_argv(int argc,char *argv[]){
             conf->port_detect_range = (uint16_t)strtoul(optarg, NULL, 10);
             break;
 
+        case SET_PORT_DETECT_RATE:
+            conf->port_detect_rate = (uint16_t)strtoul(optarg, NULL, 10);
+            break;
+
         case SET_MTU:
             conf->mtu = (unsigned int)strtoul(optarg, NULL, 10);
             break;
@@ -468,6 +534,16 @@ gnb_conf_t* gnb_argv(int argc,char *argv[]){
 
             break;
 
+        case SET_LOG_ASYNC:
+
+            if ( !strncmp(optarg, "on", 2) ) {
+                conf->log_async = 1;
+            } else {
+                conf->log_async = 0;
+            }
+
+            break;
+
         case SET_CONSOLE_LOG_LEVEL:
             conf->console_log_level = (uint8_t)strtoul(optarg, NULL, 10);
             break;
@@ -630,6 +706,56 @@ gnb_conf_t* gnb_argv(int argc,char *argv[]){
 
             break;
 
+        case SET_AUTO_RELAY_ROUTE:
+
+            if ( !strncmp(optarg, "on", 2) ) {
+                conf->auto_relay_route = 1;
+            } else {
+                conf->auto_relay_route = 0;
+            }
+
+            break;
+
+        case SET_RELAY_CUT_THROUGH:
+
+            if ( !strncmp(optarg, "on", 2) ) {
+                conf->relay_cut_through = 1;
+            } else {
+                conf->relay_cut_through = 0;
+            }
+
+            break;
+
+        case SET_PACKET_POOL_HUGEPAGE:
+
+            if ( !strncmp(optarg, "on", 2) ) {
+                conf->packet_pool_hugepage = 1;
+            } else {
+                conf->packet_pool_hugepage = 0;
+            }
+
+            break;
+
+        case SET_PACKET_POOL_NUMA:
+
+            if ( !strncmp(optarg, "on", 2) ) {
+                conf->packet_pool_numa = 1;
+            } else {
+                conf->packet_pool_numa = 0;
+            }
+
+            break;
+
+        case SET_ES_SERVICE:
+
+            if ( !strncmp(optarg, "on", 2) ) {
+                conf->es_service = 1;
+            } else {
+                conf->es_service = 0;
+            }
+
+            break;
+
         case SET_FWDU0:
 
             if ( !strncmp(optarg, "on", 2) ) {
@@ -678,6 +804,42 @@ gnb_conf_t* gnb_argv(int argc,char *argv[]){
 
             break;
 
+        case SET_PCAP_FILE:
+            snprintf(conf->pcap_file, PATH_MAX+NAME_MAX, "%s", optarg);
+            break;
+
+        case SET_PCAP_SIZE:
+            conf->pcap_size_mb = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case SET_PCAP_SNAPLEN:
+            conf->pcap_snaplen = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case SET_PCAP_SAMPLE:
+            conf->pcap_sample = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case SET_PCAP_FILTER:
+            snprintf(conf->pcap_filter, 256, "%s", optarg);
+            break;
+
+        case SET_FLOW_EXPORT:
+            snprintf(conf->flow_export, PATH_MAX+NAME_MAX, "%s", optarg);
+            break;
+
+        case SET_FLOW_TABLE_SIZE:
+            conf->flow_table_size = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case SET_FLOW_IDLE_TIMEOUT:
+            conf->flow_idle_timeout = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case SET_FLOW_ACTIVE_TIMEOUT:
+            conf->flow_active_timeout = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
         case SET_SOCKET_IF_NAME:
             snprintf(conf->socket_ifname, 16, "%s", optarg);
             break;
@@ -690,6 +852,10 @@ gnb_conf_t* gnb_argv(int argc,char *argv[]){
             snprintf(conf->node_cache_file, PATH_MAX, "%s", optarg);
             break;
 
+        case SET_INDEX_SERVICE_CACHE_FILE:
+            snprintf(conf->index_service_cache_file, PATH_MAX, "%s", optarg);
+            break;
+
         case 'e':
             gnb_setup_es_argv(optarg);
             break;
@@ -805,6 +971,10 @@ gnb_conf_t* gnb_argv(int argc,char *argv[]){
             snprintf(conf->node_cache_file, PATH_MAX+NAME_MAX,"%s/%s", conf->conf_dir, "node_cache.dump");
         }
 
+        if ( '\0' == conf->index_service_cache_file[0] ) {
+            snprintf(conf->index_service_cache_file, PATH_MAX+NAME_MAX,"%s/%s", conf->conf_dir, "index_service.cache");
+        }
+
     } else {
 
         conf->conf_dir[0] = '\0';
@@ -813,12 +983,20 @@ gnb_conf_t* gnb_argv(int argc,char *argv[]){
         snprintf(conf->pid_file,        PATH_MAX+NAME_MAX, "/tmp/gnb.%d.pid",       conf->udp4_ports[0]);
         snprintf(conf->map_file,        PATH_MAX+NAME_MAX, "/tmp/gnb.%d.map",       conf->udp4_ports[0]);
         snprintf(conf->node_cache_file, PATH_MAX+NAME_MAX, "/tmp/node_cache.%d.dump", conf->udp4_ports[0]);
+
+        if ( '\0' == conf->index_service_cache_file[0] ) {
+            snprintf(conf->index_service_cache_file, PATH_MAX+NAME_MAX, "/tmp/index_service.%d.cache", conf->udp4_ports[0]);
+        }
         #endif
 
         #ifdef _WIN32
         snprintf(conf->map_file,        PATH_MAX+NAME_MAX, "%s/gnb.%d.map",         conf->binary_dir, conf->udp4_ports[0]);
         snprintf(conf->pid_file,        PATH_MAX+NAME_MAX, "%s/gnb.%d.pid",         conf->binary_dir, conf->udp4_ports[0]);
         snprintf(conf->node_cache_file, PATH_MAX+NAME_MAX, "%s/node_cache.%d.dump", conf->binary_dir, conf->udp4_ports[0]);
+
+        if ( '\0' == conf->index_service_cache_file[0] ) {
+            snprintf(conf->index_service_cache_file, PATH_MAX+NAME_MAX, "%s/index_service.%d.cache", conf->binary_dir, conf->udp4_ports[0]);
+        }
         #endif
 
     }
@@ -926,6 +1104,7 @@ static void show_useage(int argc,char *argv[]){
     printf("      --port-detect-start          port detect start\n");
     printf("      --port-detect-end            port detect end\n");
     printf("      --port-detect-range          port detect range\n");
+    printf("      --port-detect-rate           max port detect packets per second default is %d\n", DETECT_PORT_RATE);
 
     printf("      --mtu                        TUN Device MTU ipv4：532～1500, ipv6: 1280～1500\n");
     printf("      --crypto                     ip frame crypto 'xor' or 'arc4' or 'none' default is 'xor'\n");
@@ -939,6 +1118,15 @@ static void show_useage(int argc,char *argv[]){
 
     printf("      --address-secure             hide part of ip address in logs 'on' or 'off' default is 'on'\n");
     printf("      --if-dump                    dump the interface data frame 'on' or 'off' default is 'off'\n");
+    printf("      --pcap-file                  capture ip frames as pcapng records into this mmap ring file\n");
+    printf("      --pcap-size                  pcap ring size in MB, rounded down to a power of 2, default is 16\n");
+    printf("      --pcap-snaplen               max captured bytes of each ip frame default is 256\n");
+    printf("      --pcap-sample                capture 1 of every N matched ip frames default is 1\n");
+    printf("      --pcap-filter                example: 'node 1002 node 1003 udp icmp' 'proto 47'\n");
+    printf("      --flow-export                export IPFIX flow records to 'udp:ip:port' or append them to a file\n");
+    printf("      --flow-table-size            max number of active flows default is 4096\n");
+    printf("      --flow-idle-timeout          export a flow after N seconds without packets default is 15\n");
+    printf("      --flow-active-timeout        export a long lived flow every N seconds default is 60\n");
     printf("      --pf-route                   packet filter route\n");
     printf("      --multi-socket               'on' or 'off' default is 'off'\n");
     printf("      --direct-forwarding          'on' or 'off' default is 'on'\n");
@@ -946,12 +1134,19 @@ static void show_useage(int argc,char *argv[]){
     printf("      --index-worker               'on' or 'off' default is 'on'\n");
     printf("      --index-service-worker       'on' or 'off' default is 'on'\n");
     printf("      --node-detect-worker         'on' or 'off' default is 'on'\n");
+    printf("      --auto-relay-route           'on' or 'off' default is 'off'\n");
+    printf("      --relay-cut-through          'on' or 'off' default is 'off', relay nodes do not re-encrypt the ip frame, all nodes on the relay route must support it\n");
+    printf("      --packet-pool-hugepage       'on' or 'off' default is 'off', back the packet buffers with hugepages\n");
+    printf("      --packet-pool-numa           'on' or 'off' default is 'off', allocate the packet buffers on the NUMA node of the receiving thread\n");
+    printf("      --es-service                 'on' or 'off' default is 'off', keep gnb_es running instead of exec it every 5 minutes\n");
     printf("      --set-fwdu0                  'on' or 'off' default is 'on'\n");
     printf("      --pid-file                   pid file\n");
     printf("      --node-cache-file            node address cache file\n");
+    printf("      --index-service-cache-file   index service address table snapshot file\n");
     printf("      --log-file-path              log file path\n");
     printf("      --log-udp4                   send log to the address ipv4 default is '127.0.0.1:9000'\n");
     printf("      --log-udp-type               log udp type 'binary' or 'text' default is 'binary'\n");
+    printf("      --log-async                  'on' or 'off' default is 'off', output log in a writer thread\n");
     printf("      --console-log-level          log console level 0-3\n");
     printf("      --file-log-level             log file level    0-3\n" );
     printf("      --udp-log-level              log udp level     0-3\n");
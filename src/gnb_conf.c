@@ -87,9 +87,8 @@ int gnb_test_field_separator(char *config_string){
 
 
 
-gnb_node_t * gnb_node_init(gnb_core_t *gnb_core, uint32_t uuid32){
-
-    gnb_node_t *node = &gnb_core->ctl_block->node_zone->node[gnb_core->node_nums];
+//初始化 node 指向的 gnb_node_t, node 可以不在 node_zone 中，热加载时先在别处准备好新节点再复制到 node_zone
+gnb_node_t * gnb_node_setup(gnb_core_t *gnb_core, gnb_node_t *node, uint32_t uuid32){
 
     memset(node,0,sizeof(gnb_node_t));
 
@@ -171,6 +170,15 @@ gnb_node_t * gnb_node_init(gnb_core_t *gnb_core, uint32_t uuid32){
 
 }
 
+
+gnb_node_t * gnb_node_init(gnb_core_t *gnb_core, uint32_t uuid32){
+
+    gnb_node_t *node = &gnb_core->ctl_block->node_zone->node[gnb_core->node_nums];
+
+    return gnb_node_setup(gnb_core, node, uuid32);
+
+}
+
 /*
 return value:
 0    port
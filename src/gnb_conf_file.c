@@ -34,6 +34,9 @@
 #include "gnb_node.h"
 #include "gnb_keys.h"
 #include "gnb_udp.h"
+#include "gnb_route_conf.h"
+#include "gnb_seqlock.h"
+#include "gnb_time.h"
 
 #include "ed25519/ed25519.h"
 #include "ed25519/sha512.h"
@@ -41,6 +44,7 @@
 char * check_domain_name(char *host_string);
 char * check_node_route(char *config_line_string);
 gnb_node_t * gnb_node_init(gnb_core_t *gnb_core, uint32_t uuid32);
+gnb_node_t * gnb_node_setup(gnb_core_t *gnb_core, gnb_node_t *node, uint32_t uuid32);
 int check_listen_string(char *listen_string);
 void gnb_setup_listen_addr_port(char *listen_address6_string, uint16_t *port_ptr, char *sockaddress_string, int addr_type);
 void gnb_setup_es_argv(char *es_argv_string);
@@ -714,6 +718,91 @@ static void local_node_file_config(gnb_core_t *gnb_core){
 
         }
 
+        if ( !strncmp(line_buffer, "es-service", sizeof("es-service")-1) ) {
+
+            num = sscanf(line_buffer,"%32[^ ] %3s", field, value);
+
+            if ( 2 != num ) {
+                printf("config %s error in [%s]\n", "es-service", node_conf_file);
+                exit(1);
+            }
+
+            if ( !strncmp(value, "on", sizeof("on")-1) ) {
+                gnb_core->conf->es_service = 1;
+            } else {
+                gnb_core->conf->es_service = 0;
+            }
+
+        }
+
+        if ( !strncmp(line_buffer, "auto-relay-route", sizeof("auto-relay-route")-1) ) {
+
+            num = sscanf(line_buffer,"%32[^ ] %3s", field, value);
+
+            if ( 2 != num ) {
+                printf("config %s error in [%s]\n", "auto-relay-route", node_conf_file);
+                exit(1);
+            }
+
+            if ( !strncmp(value, "on", sizeof("on")-1) ) {
+                gnb_core->conf->auto_relay_route = 1;
+            } else {
+                gnb_core->conf->auto_relay_route = 0;
+            }
+
+        }
+
+        if ( !strncmp(line_buffer, "relay-cut-through", sizeof("relay-cut-through")-1) ) {
+
+            num = sscanf(line_buffer,"%32[^ ] %3s", field, value);
+
+            if ( 2 != num ) {
+                printf("config %s error in [%s]\n", "relay-cut-through", node_conf_file);
+                exit(1);
+            }
+
+            if ( !strncmp(value, "on", sizeof("on")-1) ) {
+                gnb_core->conf->relay_cut_through = 1;
+            } else {
+                gnb_core->conf->relay_cut_through = 0;
+            }
+
+        }
+
+        if ( !strncmp(line_buffer, "packet-pool-hugepage", sizeof("packet-pool-hugepage")-1) ) {
+
+            num = sscanf(line_buffer,"%32[^ ] %3s", field, value);
+
+            if ( 2 != num ) {
+                printf("config %s error in [%s]\n", "packet-pool-hugepage", node_conf_file);
+                exit(1);
+            }
+
+            if ( !strncmp(value, "on", sizeof("on")-1) ) {
+                gnb_core->conf->packet_pool_hugepage = 1;
+            } else {
+                gnb_core->conf->packet_pool_hugepage = 0;
+            }
+
+        }
+
+        if ( !strncmp(line_buffer, "packet-pool-numa", sizeof("packet-pool-numa")-1) ) {
+
+            num = sscanf(line_buffer,"%32[^ ] %3s", field, value);
+
+            if ( 2 != num ) {
+                printf("config %s error in [%s]\n", "packet-pool-numa", node_conf_file);
+                exit(1);
+            }
+
+            if ( !strncmp(value, "on", sizeof("on")-1) ) {
+                gnb_core->conf->packet_pool_numa = 1;
+            } else {
+                gnb_core->conf->packet_pool_numa = 0;
+            }
+
+        }
+
         if ( !strncmp(line_buffer, "node-detect-worker", sizeof("node-detect-worker")-1) ) {
 
             num = sscanf(line_buffer,"%32[^ ] %2s", field, value);
@@ -768,6 +857,18 @@ static void local_node_file_config(gnb_core_t *gnb_core){
         }
 
 
+        if ( !strncmp(line_buffer, "port-detect-rate", sizeof("port-detect-rate")-1) ) {
+
+            num = sscanf(line_buffer,"%32[^ ] %hu", field, &gnb_core->conf->port_detect_rate);
+
+            if ( 2 != num ) {
+                printf("config %s error in [%s]\n", "port-detect-rate", node_conf_file);
+                exit(1);
+            }
+
+        }
+
+
         if ( !strncmp(line_buffer, "log-file-path", sizeof("log-file-path")-1) ) {
 
             num = sscanf(line_buffer,"%32[^ ] %s", field, gnb_core->conf->log_path);
@@ -814,6 +915,24 @@ static void local_node_file_config(gnb_core_t *gnb_core){
         }
 
 
+        if ( !strncmp(line_buffer, "log-async", sizeof("log-async")-1) ) {
+
+            num = sscanf(line_buffer,"%32[^ ] %3s", field, value);
+
+            if ( 2 != num ) {
+                printf("config %s error in [%s]\n", "log-async", node_conf_file);
+                exit(1);
+            }
+
+            if ( !strncmp(value, "on", sizeof("on")-1) ) {
+                gnb_core->conf->log_async = 1;
+            } else {
+                gnb_core->conf->log_async = 0;
+            }
+
+        }
+
+
         if ( !strncmp(line_buffer, "console-log-level", sizeof("console-log-level")-1) ) {
 
             num = sscanf(line_buffer,"%32[^ ] %u", field, &log_level);
@@ -1013,147 +1132,62 @@ static void local_node_file_config(gnb_core_t *gnb_core){
 }
 
 
-size_t gnb_get_node_num_from_file(gnb_conf_t *conf){
-
-    size_t n = 0;
-
-    FILE *file;
-
-    uint32_t uuid32;
-
-    char tun_ipv4_string[INET_ADDRSTRLEN];
-    char tun_netmask_string[INET_ADDRSTRLEN];
+//gnb_get_node_num_from_file 解析的结果留给 load_route_config 和 load_route_node_config 使用，不再重复读 route.conf
+static gnb_route_conf_t *loaded_route_conf = NULL;
 
-    char route_file[PATH_MAX+NAME_MAX];
-    snprintf(route_file, PATH_MAX+NAME_MAX, "%s/%s", conf->conf_dir, "route.conf");
+size_t gnb_get_node_num_from_file(gnb_conf_t *conf){
 
-    file = fopen(route_file,"r");
+    if ( NULL == loaded_route_conf ) {
+        loaded_route_conf = gnb_route_conf_load(conf->conf_dir);
+    }
 
-    if ( NULL == file ) {
+    if ( NULL == loaded_route_conf ) {
         printf("miss route.conf\n");
         exit(1);
     }
 
-    char line_buffer[1024];
-
-    int num;
-
-    do{
-
-        num = fscanf(file,"%1024s\n",line_buffer);
-
-        if ( EOF == num ) {
-            break;
-        }
-
-        if ('#' == line_buffer[0]) {
-            continue;
-        }
-
-        if ( NULL != check_node_route(line_buffer) ) {
-            continue;
-        }
-
-        num = sscanf(line_buffer,"%u|%16[^|]|%16[^|]",
-                &uuid32,
-                tun_ipv4_string,
-                tun_netmask_string
-        );
+    return loaded_route_conf->node_num;
 
-        if ( 3 != num ) {
-            continue;
-        }
-
-        n++;
-
-    }while(1);
-
-    fclose(file);
-
-    return n;
 }
 
 
+static void load_route_config(gnb_core_t *gnb_core, gnb_route_conf_t *route_conf){
 
-static void load_route_config(gnb_core_t *gnb_core){
+    gnb_route_conf_record_t *record;
 
-    int ret;
-
-    FILE *file;
-
-    char route_file[PATH_MAX+NAME_MAX];
-
-    uint32_t uuid32;
     uint32_t tun_addr4;
     uint32_t tun_subnet_addr4;
     uint32_t tun_netmask_addr4;
 
     char tun_ipv4_string[INET_ADDRSTRLEN];
-    char tun_netmask_string[INET_ADDRSTRLEN];
-
     char tun_ipv6_string[INET6_ADDRSTRLEN];
 
-    int num;
-
     gnb_node_t *node;
 
-    snprintf(route_file, PATH_MAX+NAME_MAX, "%s/%s", gnb_core->conf->conf_dir, "route.conf");
-
-    file = fopen(route_file,"r");
-
-    if ( NULL == file ) {
-        GNB_LOG1(gnb_core->log, GNB_LOG_ID_CORE, "miss route.conf\n");
-        exit(1);
-    }
-
-    char line_buffer[1024];
-
     char netmask_class;
 
-    gnb_core->node_nums = 0;
-
-    do{
-
-        num = fscanf(file,"%1024s\n",line_buffer);
-
-        if ( EOF == num ) {
-            break;
-        }
-
-        if ('#' == line_buffer[0]) {
-            continue;
-        }
-
-        if ( NULL != check_node_route(line_buffer) ) {
-            continue;
-        }
+    size_t i;
 
+    gnb_core->node_nums = 0;
 
-        ret = gnb_test_field_separator(line_buffer);
-
-        if ( GNB_CONF_FIELD_SEPARATOR_TYPE_SLASH == ret ) {
-            num = sscanf(line_buffer,"%u/%16[^/]/%16[^/]", &uuid32, tun_ipv4_string, tun_netmask_string);
-        } else if ( GNB_CONF_FIELD_SEPARATOR_TYPE_VERTICAL == ret ) {
-            num = sscanf(line_buffer,"%u|%16[^|]|%16[^|]", &uuid32, tun_ipv4_string, tun_netmask_string);
-        } else {
-            num = 0;
-        }
+    for ( i=0; i<route_conf->num; i++ ) {
 
+        record = &route_conf->records[i];
 
-        if ( 3 != num ) {
+        if ( GNB_ROUTE_CONF_RECORD_NODE != record->type ) {
             continue;
         }
 
-        node = GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, uuid32);
+        node = GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, record->uuid32);
 
         if ( NULL==node ) {
-            node = gnb_node_init(gnb_core, uuid32);
-            GNB_HASH32_UINT32_SET(gnb_core->uuid_node_map, uuid32, node);
+            node = gnb_node_init(gnb_core, record->uuid32);
+            GNB_HASH32_UINT32_SET(gnb_core->uuid_node_map, record->uuid32, node);
             gnb_core->node_nums++;
         }
 
-        inet_pton(AF_INET, tun_ipv4_string, (struct in_addr *)&tun_addr4);
-        inet_pton(AF_INET, tun_netmask_string, (struct in_addr *)&tun_netmask_addr4);
+        tun_addr4 = record->tun_addr4;
+        tun_netmask_addr4 = record->tun_netmask_addr4;
 
         tun_subnet_addr4 = tun_addr4 & tun_netmask_addr4;
 
@@ -1167,6 +1201,7 @@ static void load_route_config(gnb_core_t *gnb_core){
             node->tun_netmask_addr4.s_addr = tun_netmask_addr4;
             node->tun_subnet_addr4.s_addr = tun_subnet_addr4;
 
+            inet_ntop(AF_INET, &tun_addr4, tun_ipv4_string, INET_ADDRSTRLEN);
             snprintf(tun_ipv6_string, INET6_ADDRSTRLEN, "64:ff9b::%s", tun_ipv4_string);
             inet_pton(AF_INET6, tun_ipv6_string, (struct in6_addr *)&node->tun_ipv6_addr);
 
@@ -1190,22 +1225,16 @@ static void load_route_config(gnb_core_t *gnb_core){
 
         }
 
-    }while(1);
-
-    fclose(file);
+    }
 
 }
 
 
-static void set_node_route(gnb_core_t *gnb_core, uint32_t uuid32, char *relay_nodeids_string){
-
-    char *p;
-
-    char *endptr;
+static void set_node_route(gnb_core_t *gnb_core, gnb_route_conf_record_t *record){
 
     gnb_node_t *node;
 
-    node = GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, uuid32);
+    node = GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, record->uuid32);
 
     if ( NULL==node ) {
         return;
@@ -1222,142 +1251,51 @@ static void set_node_route(gnb_core_t *gnb_core, uint32_t uuid32, char *relay_no
     }
 
     if ( GNB_MAX_NODE_ROUTE == line ) {
-        //printf("#add_node_route uuid32[%u] relay_nodeids_string[%s]\n", uuid32, relay_nodeids_string);
-        //printf("#add_node_route is FULL\n");
         return;
     }
 
-    uint32_t relay_nodeid;
-
-    p = relay_nodeids_string;
-
     int row;
 
-    for ( row = 0; row < GNB_MAX_NODE_RELAY; row++ ) {
-
-        relay_nodeid = strtoul(p, &endptr, 10);
-
-        if ( NULL == endptr ) {
-            break;
-        }
-
-        if (0 == relay_nodeid ) {
-            break;
-        }
-
-        node->route_node[line][row] = relay_nodeid;
+    for ( row = 0; row < record->relay_count; row++ ) {
+        node->route_node[line][row] = record->relay_nodeid[row];
         node->route_node_ttls[line]++;
-
-        if ( '\0' == *endptr ) {
-            break;
-        }
-
-        p = endptr;
-        p++;
-
     }
 
 }
 
 
-static void set_node_route_mode(gnb_core_t *gnb_core, uint32_t uuid32, char *route_mode_string){
+static void set_node_route_mode(gnb_core_t *gnb_core, gnb_route_conf_record_t *record){
 
     gnb_node_t *node;
 
-    node = GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, uuid32);
+    node = GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, record->uuid32);
 
     if ( NULL==node ) {
         return;
     }
 
-    node->node_relay_mode = GNB_NODE_RELAY_DISABLE;
-
-    if ( NULL != strstr(route_mode_string,"force") ) {
-        node->node_relay_mode &= ~GNB_NODE_RELAY_AUTO;
-        node->node_relay_mode |= GNB_NODE_RELAY_FORCE;
-    }
-
-    if( NULL != strstr(route_mode_string,"auto") ) {
-        node->node_relay_mode &= ~GNB_NODE_RELAY_FORCE;
-        node->node_relay_mode |= GNB_NODE_RELAY_AUTO;
-    }
-
-    if( NULL != strstr(route_mode_string,"balance") ) {
-        node->node_relay_mode |= GNB_NODE_RELAY_BALANCE;
-    }
-
-    if( NULL != strstr(route_mode_string,"static") ) {
-        node->node_relay_mode |= GNB_NODE_RELAY_STATIC;
-    }
+    node->node_relay_mode = record->relay_mode;
 
 }
 
 
-static void load_route_node_config(gnb_core_t *gnb_core){
-
-    int ret;
-
-    FILE *file;
-
-    char route_file[PATH_MAX+NAME_MAX];
-
-    uint32_t uuid32;
-    char row2_string[512];
-
-    gnb_conf_t *conf = gnb_core->conf;
-
-    snprintf(route_file, PATH_MAX+NAME_MAX, "%s/%s", conf->conf_dir, "route.conf");
-
-    file = fopen(route_file,"r");
-
-    if ( NULL == file ) {
-        printf("miss route.conf\n");
-        exit(1);
-    }
-
-    char line_buffer[1024];
-
-    int num;
-
-    do{
-
-        num = fscanf(file,"%1024s\n",line_buffer);
-
-        if ( EOF == num ) {
-            break;
-        }
-
-        if ('#' == line_buffer[0]) {
-            continue;
-        }
+static void load_route_node_config(gnb_core_t *gnb_core, gnb_route_conf_t *route_conf){
 
-        if ( NULL == check_node_route(line_buffer) ) {
-            continue;
-        }
+    gnb_route_conf_record_t *record;
 
-        ret = gnb_test_field_separator(line_buffer);
+    size_t i;
 
-        if ( GNB_CONF_FIELD_SEPARATOR_TYPE_SLASH == ret ) {
-            num = sscanf(line_buffer,"%u/%512s]", &uuid32, row2_string);
-        } else if ( GNB_CONF_FIELD_SEPARATOR_TYPE_VERTICAL == ret ) {
-            num = sscanf(line_buffer,"%u|%512s]", &uuid32, row2_string);
-        } else {
-            num = 0;
-        }
+    for ( i=0; i<route_conf->num; i++ ) {
 
-        if ( 2 != num ) {
-            continue;
-        }
+        record = &route_conf->records[i];
 
-        if ( row2_string[0] < '0' || row2_string[0] > '9' ) {
-            set_node_route_mode(gnb_core, uuid32, row2_string);
-        } else {
-            set_node_route(gnb_core, uuid32, row2_string);
+        if ( GNB_ROUTE_CONF_RECORD_MODE == record->type ) {
+            set_node_route_mode(gnb_core, record);
+        } else if ( GNB_ROUTE_CONF_RECORD_RELAY == record->type && record->relay_count > 0 ) {
+            set_node_route(gnb_core, record);
         }
 
-    }while(1);
-
-    fclose(file);
+    }
 
 }
 
@@ -1371,7 +1309,19 @@ void gnb_config_file(gnb_core_t *gnb_core){
     //装载local node的公私钥
     gnb_load_keypair(gnb_core);
 
-    load_route_config(gnb_core);
+    if ( NULL == loaded_route_conf ) {
+        loaded_route_conf = gnb_route_conf_load(gnb_core->conf->conf_dir);
+    }
+
+    if ( NULL == loaded_route_conf ) {
+        GNB_LOG1(gnb_core->log, GNB_LOG_ID_CORE, "miss route.conf\n");
+        exit(1);
+    }
+
+    GNB_LOG1(gnb_core->log, GNB_LOG_ID_CORE, "load route.conf %zu records from %s in %"PRIu64"us\n",
+             loaded_route_conf->num, loaded_route_conf->from_cache ? "cache" : "source", loaded_route_conf->load_usec);
+
+    load_route_config(gnb_core, loaded_route_conf);
 
     gnb_core->ctl_block->node_zone->node_num = gnb_core->node_nums;
 
@@ -1398,7 +1348,10 @@ void gnb_config_file(gnb_core_t *gnb_core){
 #endif
 
 
-    load_route_node_config(gnb_core);
+    load_route_node_config(gnb_core, loaded_route_conf);
+
+    gnb_route_conf_release(loaded_route_conf);
+    loaded_route_conf = NULL;
 
     //加载 address.conf
     address_file_config(gnb_core);
@@ -1409,3 +1362,721 @@ void gnb_config_file(gnb_core_t *gnb_core){
     }
 
 }
+
+
+typedef struct _gnb_conf_reload_node_t {
+
+    //出现在新的 route.conf 中
+    uint8_t present;
+
+    //tun 地址、relay route 或 relay mode 与当前的不同
+    uint8_t changed;
+
+    //新增的节点先在这里初始化，换入时再复制到 node_zone
+    gnb_node_t *new_node;
+
+    struct in_addr  tun_addr4;
+    struct in_addr  tun_netmask_addr4;
+    struct in_addr  tun_subnet_addr4;
+    struct in6_addr tun_ipv6_addr;
+
+    uint32_t route_node[GNB_MAX_NODE_ROUTE][GNB_MAX_NODE_RELAY];
+    uint8_t  route_node_ttls[GNB_MAX_NODE_ROUTE];
+
+    uint8_t  has_relay_mode;
+    uint8_t  node_relay_mode;
+
+}gnb_conf_reload_node_t;
+
+
+struct _gnb_conf_reload_t {
+
+    uint32_t epoch;
+
+    //新的 node 表都在这个 heap 上，换入后这里保存的是被换下的表
+    gnb_heap_t *heap;
+
+    gnb_hash32_map_t *uuid_node_map;
+    gnb_hash32_map_t *ipv4_node_map;
+    gnb_hash32_map_t *subneta_node_map;
+    gnb_hash32_map_t *subnetb_node_map;
+    gnb_hash32_map_t *subnetc_node_map;
+
+    //换入后 node_zone->node_num 和 gnb_core->node_nums 的值
+    size_t   node_num;
+    uint32_t node_nums;
+
+    //按节点在 node_zone 中的下标存放，长度为 node_capacity
+    gnb_conf_reload_node_t *nodes;
+
+    //换入时需要处理的节点在 node_zone 中的下标，换入只处理这些节点
+    size_t *apply_idx;
+    size_t apply_num;
+
+    //准备时以 uuid32 为 key 的已退出的节点，重新加入的节点使用原来的位置
+    gnb_heap_t *retired_heap;
+    gnb_hash32_map_t *retired_node_map;
+
+    //各个 pf 模块的 pf_reload_prepare 的返回值
+    void **pf_reload_ctx;
+
+    //为新增的节点建立 crypto key 时的 time_seed_update_factor
+    int time_seed_update_factor;
+
+    size_t add_num;
+    size_t retire_num;
+    size_t update_num;
+
+    uint64_t prepare_usec;
+
+    uint8_t  applied;
+
+};
+
+
+static void reload_release(gnb_core_t *gnb_core, gnb_conf_reload_t *reload){
+
+    size_t i;
+
+    gnb_pf_reload_release(gnb_core, reload->pf_reload_ctx);
+
+    free(reload->pf_reload_ctx);
+
+    if ( NULL != reload->retired_heap ) {
+        gnb_heap_release(reload->retired_heap);
+    }
+
+    free(reload->apply_idx);
+
+    for ( i=0; i<reload->node_num; i++ ) {
+
+        if ( NULL != reload->nodes[i].new_node ) {
+            free(reload->nodes[i].new_node);
+        }
+
+    }
+
+    free(reload->nodes);
+
+    //启动时创建的 node 表在 gnb_core->heap 上，不单独释放
+    if ( NULL != reload->heap && gnb_core->heap != reload->heap ) {
+        gnb_heap_release(reload->heap);
+    }
+
+    free(reload);
+
+}
+
+
+static gnb_conf_reload_node_t* reload_node_slot(gnb_core_t *gnb_core, gnb_conf_reload_t *reload, uint32_t uuid32, gnb_node_t **node_ptr){
+
+    gnb_ctl_node_zone_t *node_zone = gnb_core->ctl_block->node_zone;
+
+    gnb_conf_reload_node_t *reload_node;
+
+    gnb_node_t *node;
+
+    size_t idx;
+
+    node = GNB_HASH32_UINT32_GET_PTR(reload->uuid_node_map, uuid32);
+
+    if ( NULL != node ) {
+        *node_ptr = node;
+        return &reload->nodes[node - node_zone->node];
+    }
+
+    node = GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, uuid32);
+
+    if ( NULL != node ) {
+        idx = node - node_zone->node;
+        goto finish;
+    }
+
+    //重新加入的节点使用原来的位置
+    node = GNB_HASH32_UINT32_GET_PTR(reload->retired_node_map, uuid32);
+
+    if ( NULL != node ) {
+
+        idx = node - node_zone->node;
+
+    } else {
+
+        if ( reload->node_num >= (size_t)node_zone->node_capacity ) {
+            GNB_LOG1(gnb_core->log, GNB_LOG_ID_CORE, "reload node[%u] node zone is full, restart gnb to add it\n", uuid32);
+            return NULL;
+        }
+
+        idx = reload->node_num;
+        reload->node_num++;
+
+    }
+
+    node = &node_zone->node[idx];
+
+    reload_node = &reload->nodes[idx];
+
+    reload_node->new_node = (gnb_node_t *)malloc(sizeof(gnb_node_t));
+
+    gnb_node_setup(gnb_core, reload_node->new_node, uuid32);
+
+    gnb_build_node_key512(gnb_core, reload_node->new_node);
+
+    if ( gnb_core->conf->local_uuid != uuid32 ) {
+        gnb_build_crypto_key(gnb_core, reload_node->new_node);
+    }
+
+    reload->add_num++;
+
+finish:
+
+    GNB_HASH32_UINT32_SET(reload->uuid_node_map, uuid32, node);
+
+    reload->node_nums++;
+
+    reload->nodes[idx].present = 1;
+
+    *node_ptr = node;
+
+    return &reload->nodes[idx];
+
+}
+
+
+static void reload_route_record(gnb_core_t *gnb_core, gnb_conf_reload_t *reload, gnb_route_conf_record_t *record){
+
+    gnb_conf_reload_node_t *reload_node;
+
+    gnb_node_t *node;
+
+    uint32_t tun_addr4;
+    uint32_t tun_subnet_addr4;
+    uint32_t tun_netmask_addr4;
+
+    char tun_ipv4_string[INET_ADDRSTRLEN];
+    char tun_ipv6_string[INET6_ADDRSTRLEN];
+
+    char netmask_class;
+
+    int line;
+    int row;
+
+    if ( GNB_ROUTE_CONF_RECORD_NODE == record->type ) {
+
+        reload_node = reload_node_slot(gnb_core, reload, record->uuid32, &node);
+
+        if ( NULL == reload_node ) {
+            return;
+        }
+
+        tun_addr4 = record->tun_addr4;
+        tun_netmask_addr4 = record->tun_netmask_addr4;
+        tun_subnet_addr4 = tun_addr4 & tun_netmask_addr4;
+
+        char *p = (char *)&tun_addr4;
+
+        //与 load_route_config 相同
+        if ( 0 != p[3] && 0 == reload_node->tun_addr4.s_addr ) {
+
+            reload_node->tun_addr4.s_addr = tun_addr4;
+            reload_node->tun_netmask_addr4.s_addr = tun_netmask_addr4;
+            reload_node->tun_subnet_addr4.s_addr = tun_subnet_addr4;
+
+            inet_ntop(AF_INET, &tun_addr4, tun_ipv4_string, INET_ADDRSTRLEN);
+            snprintf(tun_ipv6_string, INET6_ADDRSTRLEN, "64:ff9b::%s", tun_ipv4_string);
+            inet_pton(AF_INET6, tun_ipv6_string, (struct in6_addr *)&reload_node->tun_ipv6_addr);
+
+            GNB_HASH32_UINT32_SET(reload->ipv4_node_map, tun_addr4, node);
+
+        } else {
+
+            netmask_class = get_netmask_class(tun_netmask_addr4);
+
+            if ( 'c' == netmask_class ) {
+                GNB_HASH32_UINT32_SET(reload->subnetc_node_map, tun_subnet_addr4, node);
+            }
+
+            if ( 'b' == netmask_class ) {
+                GNB_HASH32_UINT32_SET(reload->subnetb_node_map, tun_subnet_addr4, node);
+            }
+
+            if ( 'a' == netmask_class ) {
+                GNB_HASH32_UINT32_SET(reload->subneta_node_map, tun_subnet_addr4, node);
+            }
+
+        }
+
+        return;
+
+    }
+
+    node = GNB_HASH32_UINT32_GET_PTR(reload->uuid_node_map, record->uuid32);
+
+    if ( NULL == node ) {
+        return;
+    }
+
+    reload_node = &reload->nodes[node - gnb_core->ctl_block->node_zone->node];
+
+    if ( GNB_ROUTE_CONF_RECORD_MODE == record->type ) {
+        reload_node->has_relay_mode  = 1;
+        reload_node->node_relay_mode = record->relay_mode;
+        return;
+    }
+
+    if ( 0 == record->relay_count ) {
+        return;
+    }
+
+    for ( line=0; line<GNB_MAX_NODE_ROUTE; line++ ) {
+
+        if ( 0 == reload_node->route_node_ttls[line] ) {
+            break;
+        }
+
+    }
+
+    if ( GNB_MAX_NODE_ROUTE == line ) {
+        return;
+    }
+
+    for ( row = 0; row < record->relay_count; row++ ) {
+        reload_node->route_node[line][row] = record->relay_nodeid[row];
+    }
+
+    reload_node->route_node_ttls[line] = record->relay_count;
+
+}
+
+
+static void reload_check_changed(gnb_node_t *node, gnb_conf_reload_node_t *reload_node){
+
+    uint8_t relay_mode;
+
+    if ( node->tun_addr4.s_addr != reload_node->tun_addr4.s_addr || node->tun_netmask_addr4.s_addr != reload_node->tun_netmask_addr4.s_addr ) {
+        reload_node->changed = 1;
+        return;
+    }
+
+    //route.conf 中没有 relay route 的节点, route 由 node worker 自动计算, 保持不变
+    if ( 0 == reload_node->route_node_ttls[0] && 0 == reload_node->has_relay_mode && (node->node_relay_mode & GNB_NODE_RELAY_DYNAMIC) ) {
+        return;
+    }
+
+    relay_mode = reload_node->has_relay_mode ? reload_node->node_relay_mode : GNB_NODE_RELAY_DISABLE;
+
+    if ( node->node_relay_mode != relay_mode ) {
+        reload_node->changed = 1;
+        return;
+    }
+
+    if ( 0 != memcmp(node->route_node_ttls, reload_node->route_node_ttls, sizeof(reload_node->route_node_ttls)) ) {
+        reload_node->changed = 1;
+        return;
+    }
+
+    if ( 0 != memcmp(node->route_node, reload_node->route_node, sizeof(reload_node->route_node)) ) {
+        reload_node->changed = 1;
+        return;
+    }
+
+}
+
+
+/*
+在 primary process 中调用，重新解析 route.conf 生成新的 node 表，不影响数据通路
+准备好后交给 gnb_config_file_reload_apply 在数据通路线程中换入
+return value:
+0  准备完成
+1  上一次的热加载还没有完成，稍后再试
+-1 出错
+*/
+int gnb_config_file_reload(gnb_core_t *gnb_core){
+
+    gnb_ctl_node_zone_t *node_zone = gnb_core->ctl_block->node_zone;
+
+    gnb_route_conf_t *route_conf;
+
+    gnb_conf_reload_t *reload;
+
+    gnb_conf_reload_node_t *reload_node;
+
+    gnb_node_t *node;
+
+    gnb_node_t **nodes;
+
+    uint64_t start_usec;
+
+    int time_seed_update_factor;
+
+    size_t node_num;
+
+    size_t i;
+
+    if ( 0 != gnb_core->conf->lite_mode || 0 != gnb_core->conf->public_index_service ) {
+        GNB_LOG1(gnb_core->log, GNB_LOG_ID_CORE, "reload is not supported in this mode\n");
+        return -1;
+    }
+
+    if ( NULL != gnb_core->pending_reload || NULL != gnb_core->retired_reload ) {
+        return 1;
+    }
+
+    start_usec = gnb_timestamp_usec();
+
+    time_seed_update_factor = gnb_core->time_seed_update_factor;
+
+    __sync_synchronize();
+
+    route_conf = gnb_route_conf_load(gnb_core->conf->conf_dir);
+
+    if ( NULL == route_conf ) {
+        GNB_LOG1(gnb_core->log, GNB_LOG_ID_CORE, "reload miss route.conf\n");
+        return -1;
+    }
+
+    reload = (gnb_conf_reload_t *)malloc(sizeof(gnb_conf_reload_t));
+    memset(reload, 0, sizeof(gnb_conf_reload_t));
+
+    //每条记录最多在两张表中各占一个 fragment
+    reload->heap = gnb_heap_create(route_conf->num*2 + 64);
+
+    reload->uuid_node_map    = gnb_hash32_create(reload->heap, 1024,1024);
+    reload->ipv4_node_map    = gnb_hash32_create(reload->heap, 1024,1024);
+    reload->subneta_node_map = gnb_hash32_create(reload->heap, 1024,1024);
+    reload->subnetb_node_map = gnb_hash32_create(reload->heap, 1024,1024);
+    reload->subnetc_node_map = gnb_hash32_create(reload->heap, 1024,1024);
+
+    reload->nodes = (gnb_conf_reload_node_t *)malloc(sizeof(gnb_conf_reload_node_t) * node_zone->node_capacity);
+    memset(reload->nodes, 0, sizeof(gnb_conf_reload_node_t) * node_zone->node_capacity);
+
+    reload->node_num = node_zone->node_num;
+
+    reload->apply_idx = (size_t *)malloc(sizeof(size_t) * node_zone->node_capacity);
+
+    reload->pf_reload_ctx = (void **)malloc(sizeof(void *) * gnb_core->pf_array->num);
+    memset(reload->pf_reload_ctx, 0, sizeof(void *) * gnb_core->pf_array->num);
+
+    reload->time_seed_update_factor = time_seed_update_factor;
+
+    //hash map 占用 3 个 fragment, 每个已退出的节点占 1 个
+    reload->retired_heap = gnb_heap_create(node_zone->node_num + 8);
+    reload->retired_node_map = gnb_hash32_create(reload->retired_heap, 1024,1024);
+
+    for ( i=0; i<node_zone->node_num; i++ ) {
+
+        if ( node_zone->node[i].type & GNB_NODE_TYPE_RETIRED ) {
+            GNB_HASH32_UINT32_SET(reload->retired_node_map, node_zone->node[i].uuid32, &node_zone->node[i]);
+        }
+
+    }
+
+    for ( i=0; i<route_conf->num; i++ ) {
+        reload_route_record(gnb_core, reload, &route_conf->records[i]);
+    }
+
+    gnb_route_conf_release(route_conf);
+
+    gnb_heap_release(reload->retired_heap);
+    reload->retired_heap = NULL;
+    reload->retired_node_map = NULL;
+
+    node = GNB_HASH32_UINT32_GET_PTR(reload->uuid_node_map, gnb_core->conf->local_uuid);
+
+    if ( node != gnb_core->local_node ) {
+        GNB_LOG1(gnb_core->log, GNB_LOG_ID_CORE, "reload local node[%u] is miss in route.conf\n", gnb_core->conf->local_uuid);
+        reload_release(gnb_core, reload);
+        return -1;
+    }
+
+    for ( i=0; i<reload->node_num; i++ ) {
+
+        reload_node = &reload->nodes[i];
+
+        node = &node_zone->node[i];
+
+        if ( NULL != reload_node->new_node ) {
+
+            node = reload_node->new_node;
+
+            node->tun_addr4         = reload_node->tun_addr4;
+            node->tun_netmask_addr4 = reload_node->tun_netmask_addr4;
+            node->tun_subnet_addr4  = reload_node->tun_subnet_addr4;
+            node->tun_ipv6_addr     = reload_node->tun_ipv6_addr;
+
+            memcpy(node->route_node, reload_node->route_node, sizeof(reload_node->route_node));
+            memcpy(node->route_node_ttls, reload_node->route_node_ttls, sizeof(reload_node->route_node_ttls));
+
+            if ( reload_node->has_relay_mode ) {
+                node->node_relay_mode = reload_node->node_relay_mode;
+            }
+
+            reload->apply_idx[reload->apply_num++] = i;
+
+            continue;
+
+        }
+
+        if ( 0 == reload_node->present ) {
+
+            if ( !(node->type & GNB_NODE_TYPE_RETIRED) ) {
+                reload->apply_idx[reload->apply_num++] = i;
+                reload->retire_num++;
+            }
+
+            continue;
+
+        }
+
+        //本节点的 tun 地址已经设到虚拟网卡上，需要重启 gnb 才能更改
+        if ( node == gnb_core->local_node && node->tun_addr4.s_addr != reload_node->tun_addr4.s_addr ) {
+
+            GNB_LOG1(gnb_core->log, GNB_LOG_ID_CORE, "reload local node tun address changed, restart gnb to apply it\n");
+
+            GNB_HASH32_UINT32_DEL(reload->ipv4_node_map, reload_node->tun_addr4.s_addr);
+            GNB_HASH32_UINT32_SET(reload->ipv4_node_map, node->tun_addr4.s_addr, node);
+
+            reload_node->tun_addr4         = node->tun_addr4;
+            reload_node->tun_netmask_addr4 = node->tun_netmask_addr4;
+            reload_node->tun_subnet_addr4  = node->tun_subnet_addr4;
+            reload_node->tun_ipv6_addr     = node->tun_ipv6_addr;
+
+        }
+
+        reload_check_changed(node, reload_node);
+
+        if ( reload_node->changed ) {
+            reload->apply_idx[reload->apply_num++] = i;
+            reload->update_num++;
+        }
+
+    }
+
+    //pf 模块为新的 node 表建立 sbox 等按节点保存的数据，数据通路换入时只交换指针
+    nodes = (gnb_node_t **)malloc(sizeof(gnb_node_t *) * reload->node_num);
+
+    node_num = 0;
+
+    for ( i=0; i<reload->node_num; i++ ) {
+
+        reload_node = &reload->nodes[i];
+
+        if ( 0 == reload_node->present ) {
+            continue;
+        }
+
+        nodes[node_num++] = NULL != reload_node->new_node ? reload_node->new_node : &node_zone->node[i];
+
+    }
+
+    gnb_pf_reload_prepare(gnb_core, reload->pf_reload_ctx, nodes, node_num);
+
+    free(nodes);
+
+    reload->epoch = gnb_core->ctl_block->status_zone->node_table_epoch + 1;
+
+    reload->prepare_usec = gnb_timestamp_usec() - start_usec;
+
+    __sync_synchronize();
+
+    gnb_core->pending_reload = reload;
+
+    return 0;
+
+}
+
+
+/*
+在数据通路线程两次处理之间调用，只处理准备时记录在 apply_idx 中的新增、退出和发生改变的节点，其余是指针交换
+*/
+void gnb_config_file_reload_apply(gnb_core_t *gnb_core){
+
+    gnb_conf_reload_t *reload = gnb_core->pending_reload;
+
+    gnb_ctl_node_zone_t *node_zone = gnb_core->ctl_block->node_zone;
+
+    gnb_conf_reload_node_t *reload_node;
+
+    gnb_hash32_map_t *map;
+
+    gnb_node_t *node;
+
+    uint32_t seq;
+
+    int line;
+
+    size_t i;
+    size_t n;
+
+    if ( NULL == reload ) {
+        return;
+    }
+
+    //gnb_ctl 在 node_zone_generation 为奇数时不会采用读到的 node_zone
+    gnb_seqlock_write_begin(&gnb_core->ctl_block->status_zone->node_zone_generation);
+
+    for ( n=0; n<reload->apply_num; n++ ) {
+
+        i = reload->apply_idx[n];
+
+        reload_node = &reload->nodes[i];
+
+        node = &node_zone->node[i];
+
+        if ( NULL != reload_node->new_node ) {
+
+            gnb_seqlock_write_begin(&node->seq);
+            seq = node->seq;
+            memcpy(node, reload_node->new_node, sizeof(gnb_node_t));
+            node->seq = seq;
+
+            //准备之后 node worker 已经按新的 time seed 更新了其他节点的 crypto key
+            if ( reload->time_seed_update_factor != gnb_core->time_seed_update_factor && gnb_core->local_node != node ) {
+                gnb_build_crypto_key(gnb_core, node);
+            }
+
+            gnb_seqlock_write_end(&node->seq);
+
+            continue;
+
+        }
+
+        if ( 0 == reload_node->present ) {
+            node->type |= GNB_NODE_TYPE_RETIRED;
+            continue;
+        }
+
+        gnb_seqlock_write_begin(&node->seq);
+
+        //先让其他线程看不到旧的 route 再更新
+        for ( line=0; line<GNB_MAX_NODE_ROUTE; line++ ) {
+            node->route_node_ttls[line] = 0;
+        }
+
+        __sync_synchronize();
+
+        node->selected_route_node = 0;
+
+        node->tun_addr4         = reload_node->tun_addr4;
+        node->tun_netmask_addr4 = reload_node->tun_netmask_addr4;
+        node->tun_subnet_addr4  = reload_node->tun_subnet_addr4;
+        node->tun_ipv6_addr     = reload_node->tun_ipv6_addr;
+
+        memcpy(node->route_node, reload_node->route_node, sizeof(reload_node->route_node));
+
+        for ( line=0; line<GNB_MAX_NODE_ROUTE; line++ ) {
+            node->route_node_flows[line] = 0;
+            node->route_node_bytes[line] = 0;
+        }
+
+        node->node_relay_mode = reload_node->has_relay_mode ? reload_node->node_relay_mode : GNB_NODE_RELAY_DISABLE;
+
+        __sync_synchronize();
+
+        memcpy(node->route_node_ttls, reload_node->route_node_ttls, sizeof(reload_node->route_node_ttls));
+
+        gnb_seqlock_write_end(&node->seq);
+
+    }
+
+    __sync_synchronize();
+
+    //先换入 pf 模块为新增的节点准备的数据，再让新增的节点出现在 node 表中
+    gnb_pf_reload_apply(gnb_core, reload->pf_reload_ctx);
+
+    //换入新的 node 表，被换下的表留在 reload 中
+    map = gnb_core->uuid_node_map;    gnb_core->uuid_node_map    = reload->uuid_node_map;    reload->uuid_node_map    = map;
+    map = gnb_core->ipv4_node_map;    gnb_core->ipv4_node_map    = reload->ipv4_node_map;    reload->ipv4_node_map    = map;
+    map = gnb_core->subneta_node_map; gnb_core->subneta_node_map = reload->subneta_node_map; reload->subneta_node_map = map;
+    map = gnb_core->subnetb_node_map; gnb_core->subnetb_node_map = reload->subnetb_node_map; reload->subnetb_node_map = map;
+    map = gnb_core->subnetc_node_map; gnb_core->subnetc_node_map = reload->subnetc_node_map; reload->subnetc_node_map = map;
+
+    reload->heap = map->heap;
+
+    gnb_core->node_nums = reload->node_nums;
+
+    node_zone->node_num = (int)reload->node_num;
+
+    gnb_seqlock_write_end(&gnb_core->ctl_block->status_zone->node_zone_generation);
+
+    __sync_synchronize();
+
+    //读 node 表的线程看到这个 epoch 后读到的都是新的 node 表
+    gnb_core->ctl_block->status_zone->node_table_epoch = reload->epoch;
+
+    __sync_synchronize();
+
+    gnb_core->retired_reload = reload;
+
+    gnb_core->pending_reload = NULL;
+
+}
+
+
+void gnb_config_file_reload_quiescent(gnb_core_t *gnb_core, int reader){
+
+    gnb_core->node_table_reader_epoch[reader] = gnb_core->ctl_block->status_zone->node_table_epoch;
+
+    //此后这个线程读到的 node 表指针不会早于写入的 epoch
+    __sync_synchronize();
+
+}
+
+
+//读 node 表的线程是否都已经进入了 epoch, 没有启动的线程不用等待
+static int reload_readers_quiescent(gnb_core_t *gnb_core, uint32_t epoch){
+
+    uint32_t reader_epoch;
+
+    int i;
+
+    for ( i=0; i<GNB_NODE_TABLE_READER_NUM; i++ ) {
+
+        reader_epoch = gnb_core->node_table_reader_epoch[i];
+
+        if ( GNB_NODE_TABLE_READER_OFFLINE != reader_epoch && reader_epoch < epoch ) {
+            return 0;
+        }
+
+    }
+
+    return 1;
+
+}
+
+
+/*
+在 primary process 中周期调用, 换入后加载 address.conf, 读 node 表的线程都进入了换入后的 epoch 后释放被换下的表
+*/
+void gnb_config_file_reload_finish(gnb_core_t *gnb_core){
+
+    gnb_conf_reload_t *reload = gnb_core->retired_reload;
+
+    if ( NULL == reload ) {
+        return;
+    }
+
+    __sync_synchronize();
+
+    if ( 0 == reload->applied ) {
+
+        reload->applied = 1;
+
+        gnb_core->ctl_block->status_zone->reload_request = 0;
+
+        //address.conf 只做增量的加载，已经删除的地址会随着探测失败而淘汰
+        address_file_config(gnb_core);
+
+        GNB_LOG1(gnb_core->log, GNB_LOG_ID_CORE, "reload epoch[%u] nodes[%u] add[%zu] retire[%zu] update[%zu] prepare in %"PRIu64"us\n",
+                 reload->epoch, reload->node_nums, reload->add_num, reload->retire_num, reload->update_num, reload->prepare_usec);
+
+    }
+
+    if ( !reload_readers_quiescent(gnb_core, reload->epoch) ) {
+        return;
+    }
+
+    gnb_core->retired_reload = NULL;
+
+    reload_release(gnb_core, reload);
+
+}
@@ -24,5 +24,15 @@ void gnb_config_file(gnb_core_t *gnb_core);
 
 size_t gnb_get_node_num_from_file(gnb_conf_t *conf);
 
+//热加载 route.conf 和 address.conf
+int gnb_config_file_reload(gnb_core_t *gnb_core);
+
+void gnb_config_file_reload_apply(gnb_core_t *gnb_core);
+
+//读 node 表的线程在每轮循环开始时调用，reader 为 GNB_NODE_TABLE_READER_*
+void gnb_config_file_reload_quiescent(gnb_core_t *gnb_core, int reader);
+
+void gnb_config_file_reload_finish(gnb_core_t *gnb_core);
+
 #endif
 
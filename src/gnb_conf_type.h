@@ -63,6 +63,8 @@ typedef struct _gnb_conf_t {
 
 	char node_cache_file[PATH_MAX+NAME_MAX];
 
+	char index_service_cache_file[PATH_MAX+NAME_MAX];
+
 	char log_path[PATH_MAX];
 
 	uint8_t console_log_level;
@@ -79,6 +81,9 @@ typedef struct _gnb_conf_t {
 
 	uint8_t log_udp_type;
 
+	//日志先写入各个线程的 ring, 由 writer 线程输出
+	uint8_t log_async;
+
 	char log_udp_sockaddress4_string[16 + 1 + sizeof("65535") + 1];
 
 	char ifname[256];
@@ -97,6 +102,19 @@ typedef struct _gnb_conf_t {
 
 	unsigned char if_dump;
 
+	//pcap_file 不为空时 gnb_pf_dump 把 ip 分组以 pcapng 格式写入这个 mmap ring 文件
+	char pcap_file[PATH_MAX+NAME_MAX];
+	uint32_t pcap_size_mb;
+	uint32_t pcap_snaplen;
+	uint32_t pcap_sample;
+	char pcap_filter[256];
+
+	//flow_export 不为空时 gnb_pf_flow 按 flow 聚合分组，以 IPFIX 格式输出到 udp:ip:port 或者追加到文件
+	char flow_export[PATH_MAX+NAME_MAX];
+	uint32_t flow_table_size;
+	uint32_t flow_idle_timeout;
+	uint32_t flow_active_timeout;
+
 	unsigned char udp_socket_type;
 
 	uint8_t multi_socket;
@@ -141,6 +159,21 @@ typedef struct _gnb_conf_t {
 	uint16_t port_detect_start;
 	uint16_t port_detect_end;
 	uint16_t port_detect_range;
+	//每秒最多发出的端口探测包数量
+	uint16_t port_detect_rate;
+
+	//根据各节点 pong 带来的链路延迟自动计算 relay route
+	uint8_t auto_relay_route;
+
+	//经过中继的 payload 的 ip frame 只用目的节点的密钥加密，中继节点只处理 route frame head 和 relay trailer
+	uint8_t relay_cut_through;
+
+	//main worker 的 packet pool 使用 hugepage, 在收包线程所在的 NUMA node 上分配
+	uint8_t packet_pool_hugepage;
+	uint8_t packet_pool_numa;
+
+	//gnb_es 以 service 方式常驻运行，而不是每隔一段时间执行一次
+	uint8_t es_service;
 
 	uint8_t addr_secure;
 
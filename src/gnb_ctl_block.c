@@ -24,6 +24,7 @@
 #include "gnb_mmap.h"
 #include "gnb_time.h"
 #include "gnb_block.h"
+#include "gnb_seqlock.h"
 
 
 //entry_table256 的类型是 uint32_t,
@@ -35,6 +36,10 @@
 #define GNB_CTL_CORE          4
 #define GNB_CTL_STATUS        5
 #define GNB_CTL_NODE          6
+#define GNB_CTL_METRICS       7
+#define GNB_CTL_LATENCY       8
+#define GNB_CTL_TRACE         9
+#define GNB_CTL_SPEEDTEST     10
 
 
 ssize_t gnb_ctl_file_size(const char *filename) {
@@ -109,6 +114,55 @@ gnb_ctl_block_t *gnb_ctl_block_build(void *memory, size_t node_num){
 
     snprintf((char *)ctl_block->node_zone->name,    8, "%s", "NODE");
     ctl_block->node_zone->node_num = node_num;
+    ctl_block->node_zone->node_capacity = node_num;
+
+
+    //让 metrics zone 的起始地址按 cache line 对齐
+    off_set += sizeof(gnb_block32_t);
+    off_set  = (off_set + GNB_METRICS_CACHE_LINE_SIZE - 1) & ~(GNB_METRICS_CACHE_LINE_SIZE - 1);
+    off_set -= sizeof(gnb_block32_t);
+
+    ctl_block->entry_table256[GNB_CTL_METRICS] = off_set;
+    block = memory + ctl_block->entry_table256[GNB_CTL_METRICS];
+    block->size = sizeof(gnb_ctl_metrics_zone_t);
+    ctl_block->metrics_zone = (gnb_ctl_metrics_zone_t *)block->data;
+    off_set += sizeof(gnb_block32_t) + sizeof(gnb_ctl_metrics_zone_t);
+
+    memset(ctl_block->metrics_zone, 0, sizeof(gnb_ctl_metrics_zone_t));
+    snprintf((char *)ctl_block->metrics_zone->name, 8, "%s", "METRICS");
+    ctl_block->metrics_zone->slot_num   = GNB_METRICS_SLOT_NUM;
+    ctl_block->metrics_zone->metric_num = GNB_METRIC_NUM;
+
+
+    ctl_block->entry_table256[GNB_CTL_LATENCY] = off_set;
+    block = memory + ctl_block->entry_table256[GNB_CTL_LATENCY];
+    block->size = sizeof(gnb_ctl_latency_zone_t);
+    ctl_block->latency_zone = (gnb_ctl_latency_zone_t *)block->data;
+    off_set += sizeof(gnb_block32_t) + sizeof(gnb_ctl_latency_zone_t);
+
+    memset(ctl_block->latency_zone, 0, sizeof(gnb_ctl_latency_zone_t));
+    snprintf((char *)ctl_block->latency_zone->name, 8, "%s", "LATENCY");
+
+
+    ctl_block->entry_table256[GNB_CTL_TRACE] = off_set;
+    block = memory + ctl_block->entry_table256[GNB_CTL_TRACE];
+    block->size = sizeof(gnb_ctl_trace_zone_t);
+    ctl_block->trace_zone = (gnb_ctl_trace_zone_t *)block->data;
+    off_set += sizeof(gnb_block32_t) + sizeof(gnb_ctl_trace_zone_t);
+
+    memset(ctl_block->trace_zone, 0, sizeof(gnb_ctl_trace_zone_t));
+    snprintf((char *)ctl_block->trace_zone->name, 8, "%s", "TRACE");
+    ctl_block->trace_zone->ring.event_num = GNB_TRACE_EVENT_NUM;
+
+
+    ctl_block->entry_table256[GNB_CTL_SPEEDTEST] = off_set;
+    block = memory + ctl_block->entry_table256[GNB_CTL_SPEEDTEST];
+    block->size = sizeof(gnb_ctl_speedtest_zone_t);
+    ctl_block->speedtest_zone = (gnb_ctl_speedtest_zone_t *)block->data;
+    off_set += sizeof(gnb_block32_t) + sizeof(gnb_ctl_speedtest_zone_t);
+
+    memset(ctl_block->speedtest_zone, 0, sizeof(gnb_ctl_speedtest_zone_t));
+    snprintf((char *)ctl_block->speedtest_zone->name, 8, "%s", "SPEED");
 
     return ctl_block;
 
@@ -153,6 +207,34 @@ void gnb_ctl_block_setup(gnb_ctl_block_t *ctl_block, void *memory){
     block = memory + ctl_block->entry_table256[GNB_CTL_NODE];
     ctl_block->node_zone = (gnb_ctl_node_zone_t *)block->data;
 
+    if ( 0 != ctl_block->entry_table256[GNB_CTL_METRICS] ) {
+        block = memory + ctl_block->entry_table256[GNB_CTL_METRICS];
+        ctl_block->metrics_zone = (gnb_ctl_metrics_zone_t *)block->data;
+    } else {
+        ctl_block->metrics_zone = NULL;
+    }
+
+    if ( 0 != ctl_block->entry_table256[GNB_CTL_LATENCY] ) {
+        block = memory + ctl_block->entry_table256[GNB_CTL_LATENCY];
+        ctl_block->latency_zone = (gnb_ctl_latency_zone_t *)block->data;
+    } else {
+        ctl_block->latency_zone = NULL;
+    }
+
+    if ( 0 != ctl_block->entry_table256[GNB_CTL_TRACE] ) {
+        block = memory + ctl_block->entry_table256[GNB_CTL_TRACE];
+        ctl_block->trace_zone = (gnb_ctl_trace_zone_t *)block->data;
+    } else {
+        ctl_block->trace_zone = NULL;
+    }
+
+    if ( 0 != ctl_block->entry_table256[GNB_CTL_SPEEDTEST] ) {
+        block = memory + ctl_block->entry_table256[GNB_CTL_SPEEDTEST];
+        ctl_block->speedtest_zone = (gnb_ctl_speedtest_zone_t *)block->data;
+    } else {
+        ctl_block->speedtest_zone = NULL;
+    }
+
 }
 
 
@@ -220,3 +302,104 @@ finish_error:
 
 }
 
+
+
+static void snapshot_node(gnb_node_t *src_node, gnb_node_t *dst_node){
+
+    uint32_t seq;
+
+    int i;
+
+    for ( i=0; i<GNB_SEQLOCK_READ_RETRY; i++ ) {
+
+        seq = gnb_seqlock_read_begin(&src_node->seq);
+
+        memcpy(dst_node, src_node, sizeof(gnb_node_t));
+
+        if ( 0 == gnb_seqlock_read_retry(&src_node->seq, seq) ) {
+            break;
+        }
+
+    }
+
+    //副本的 seq 为偶数说明副本是一致的，重试用完时置为奇数，见 GNB_CTL_NODE_SNAPSHOT_TORN
+    if ( i < GNB_SEQLOCK_READ_RETRY ) {
+        dst_node->seq = seq;
+    } else {
+        dst_node->seq = seq | 1;
+    }
+
+    //计数器不受 seqlock 保护，按字长单独读一次避免 memcpy 读到写了一半的值
+    dst_node->in_bytes    = *(volatile uint64_t *)&src_node->in_bytes;
+    dst_node->out_bytes   = *(volatile uint64_t *)&src_node->out_bytes;
+    dst_node->in_packets  = *(volatile uint64_t *)&src_node->in_packets;
+    dst_node->out_packets = *(volatile uint64_t *)&src_node->out_packets;
+
+}
+
+
+int gnb_ctl_block_snapshot_nodes(gnb_ctl_block_t *ctl_block, gnb_node_t *nodes, int max_num){
+
+    gnb_ctl_node_zone_t *node_zone = ctl_block->node_zone;
+
+    uint32_t generation;
+
+    int node_num = 0;
+
+    int i,r;
+
+    for ( r=0; r<GNB_SEQLOCK_READ_RETRY; r++ ) {
+
+        generation = gnb_seqlock_read_begin(&ctl_block->status_zone->node_zone_generation);
+
+        node_num = node_zone->node_num;
+
+        if ( node_zone->node_capacity > 0 && node_num > node_zone->node_capacity ) {
+            node_num = node_zone->node_capacity;
+        }
+
+        if ( node_num > max_num ) {
+            node_num = max_num;
+        }
+
+        if ( node_num < 0 ) {
+            node_num = 0;
+        }
+
+        for ( i=0; i<node_num; i++ ) {
+            snapshot_node(&node_zone->node[i], &nodes[i]);
+        }
+
+        if ( 0 == gnb_seqlock_read_retry(&ctl_block->status_zone->node_zone_generation, generation) ) {
+            return node_num;
+        }
+
+    }
+
+    //热加载一直在改变 node_zone, 复制出的节点可能属于不同的 generation
+    return -1;
+
+}
+
+
+void gnb_ctl_block_sum_metrics(gnb_ctl_block_t *ctl_block, uint64_t *counter){
+
+    gnb_ctl_metrics_zone_t *metrics_zone = ctl_block->metrics_zone;
+
+    int i,j;
+
+    memset(counter, 0, sizeof(uint64_t)*GNB_METRIC_NUM);
+
+    if ( NULL == metrics_zone ) {
+        return;
+    }
+
+    for ( i=0; i<GNB_METRICS_SLOT_NUM; i++ ) {
+
+        for ( j=0; j<GNB_METRIC_NUM; j++ ) {
+            counter[j] += *(volatile uint64_t *)&metrics_zone->slot[i].counter[j];
+        }
+
+    }
+
+}
@@ -25,11 +25,21 @@
 #include "gnb_conf_type.h"
 #include "gnb_node_type.h"
 #include "gnb_log_type.h"
+#include "gnb_metrics_type.h"
+#include "gnb_latency_type.h"
+#include "gnb_trace_type.h"
+#include "gnb_speedtest_type.h"
 
 
 #define GNB_TUN_PAYLOAD_BLOCK_SIZE  4096
 #define GNB_INET_PAYLOAD_BLOCK_SIZE 4096
 
+//tun_payload 之前保留的空间，发送 fwdu0 时在 payload 前面填充 fwdu0 的头部，不需要复制 payload
+#define GNB_PAYLOAD_HEADROOM        32
+
+//packet pool 中 payload 之后保留的空间，中继时在 payload 后面追加 relay trailer
+#define GNB_PAYLOAD_TAILROOM        64
+
 #define CTL_BLOCK_ES_MAGIC_IDX 3
 #define CTL_BLOCK_VT_MAGIC_IDX 4
 
@@ -72,7 +82,7 @@ typedef struct _gnb_ctl_core_zone_t {
 
 	unsigned char ufwd_address_block[ sizeof(gnb_address_list_t) + sizeof(gnb_address_t) * 16 ];
 
-	unsigned char  tun_payload_block[sizeof(gnb_payload16_t)+GNB_TUN_PAYLOAD_BLOCK_SIZE];
+	unsigned char  tun_payload_block[GNB_PAYLOAD_HEADROOM+sizeof(gnb_payload16_t)+GNB_TUN_PAYLOAD_BLOCK_SIZE];
 	unsigned char inet_payload_block[sizeof(gnb_payload16_t)+GNB_INET_PAYLOAD_BLOCK_SIZE];
 
 }gnb_ctl_core_zone_t;
@@ -82,6 +92,15 @@ typedef struct _gnb_ctl_status_zone_t {
 
 	uint64_t keep_alive_ts_sec;
 
+	//gnb_ctl 置 1 请求 gnb 重新加载 route.conf 和 address.conf，gnb 处理后清零
+	uint32_t reload_request;
+
+	//每次热加载生效后加 1
+	uint32_t node_table_epoch;
+
+	//node_zone 的 seqlock, 热加载改变 node_num 和节点槽位时为奇数
+	uint32_t node_zone_generation;
+
 }gnb_ctl_status_zone_t;
 
 
@@ -89,11 +108,61 @@ typedef struct _gnb_ctl_node_zone_t {
 
 	unsigned char name[8];
 	int node_num;
+	//node_zone 可以容纳的节点数，多出 node_num 的部分留给热加载时新增的节点
+	int node_capacity;
 	gnb_node_t node[0];
 
 }gnb_ctl_node_zone_t;
 
 
+typedef struct _gnb_ctl_metrics_zone_t {
+
+	unsigned char name[8];
+
+	uint32_t slot_num;
+	uint32_t metric_num;
+
+	//按 cache line 对齐，不同线程写的 slot 不会落在同一个 cache line 上
+	gnb_metrics_block_t slot[GNB_METRICS_SLOT_NUM];
+
+}gnb_ctl_metrics_zone_t;
+
+
+typedef struct _gnb_ctl_latency_zone_t {
+
+	unsigned char name[8];
+
+	//由 gnb_ctl 设置，非 0 时 gnb_pf_tun gnb_pf_inet 记录各个阶段的耗时
+	volatile uint32_t enable;
+
+	uint32_t pf_num;
+
+	unsigned char pf_name[GNB_LATENCY_PF_MAX][32];
+
+	gnb_latency_histogram_t histogram[GNB_LATENCY_PATH_NUM][GNB_LATENCY_STAGE_NUM][GNB_LATENCY_PF_MAX+1];
+
+}gnb_ctl_latency_zone_t;
+
+
+typedef struct _gnb_ctl_trace_zone_t {
+
+	unsigned char name[8];
+
+	gnb_trace_ring_t ring;
+
+}gnb_ctl_trace_zone_t;
+
+
+typedef struct _gnb_ctl_speedtest_zone_t {
+
+	unsigned char name[8];
+
+	//gnb_ctl 写入测试的参数，gnb 写入测试的结果
+	gnb_speedtest_t test;
+
+}gnb_ctl_speedtest_zone_t;
+
+
 typedef struct _gnb_ctl_block_t {
 
 	uint32_t *entry_table256;
@@ -108,6 +177,18 @@ typedef struct _gnb_ctl_block_t {
 
 	gnb_ctl_node_zone_t    *node_zone;
 
+	//旧版本 gnb 创建的 ctl block 没有这个 zone, 为 NULL
+	gnb_ctl_metrics_zone_t *metrics_zone;
+
+	//旧版本 gnb 创建的 ctl block 没有这个 zone, 为 NULL
+	gnb_ctl_latency_zone_t *latency_zone;
+
+	//旧版本 gnb 创建的 ctl block 没有这个 zone, 为 NULL
+	gnb_ctl_trace_zone_t   *trace_zone;
+
+	//旧版本 gnb 创建的 ctl block 没有这个 zone, 为 NULL
+	gnb_ctl_speedtest_zone_t *speedtest_zone;
+
 	gnb_mmap_block_t *mmap_block;
 
 }gnb_ctl_block_t;
@@ -124,9 +205,24 @@ void gnb_ctl_block_setup(gnb_ctl_block_t *ctl_block, void *memory);
 
 gnb_ctl_block_t *gnb_get_ctl_block(const char *ctl_block_file, int flag);
 
+/*
+把 node_zone 中的节点复制到 nodes 中，每个节点和整个 node_zone 都通过 seqlock 保证一致
+返回复制的节点数，重试 GNB_SEQLOCK_READ_RETRY 次 node_zone 仍在改变时返回 -1
+单个节点重试后仍不一致时副本的 seq 为奇数，用 GNB_CTL_NODE_SNAPSHOT_TORN 判断，这样的节点不能当作有效的数据显示
+*/
+int gnb_ctl_block_snapshot_nodes(gnb_ctl_block_t *ctl_block, gnb_node_t *nodes, int max_num);
+
+#define GNB_CTL_NODE_SNAPSHOT_TORN(node) ( 1 & (node)->seq )
+
+//把所有 slot 的计数器加到 counter 中, counter 的长度为 GNB_METRIC_NUM
+void gnb_ctl_block_sum_metrics(gnb_ctl_block_t *ctl_block, uint64_t *counter);
+
 #define MIN_CTL_BLOCK_FILE_SIZE  (sizeof(uint32_t)*256 + sizeof(gnb_ctl_magic_number_t) + sizeof(gnb_ctl_conf_zone_t) + sizeof(gnb_ctl_core_zone_t) + sizeof(gnb_ctl_status_zone_t) + sizeof(gnb_ctl_node_zone_t) + sizeof(gnb_node_t))
 
 #define GNB_CTL_KEEP_ALIVE_TS 15
 
+//node_zone 为热加载新增节点预留的最少数量
+#define GNB_NODE_ZONE_RESERVE_NUM 16
+
 #endif
 
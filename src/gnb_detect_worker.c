@@ -41,10 +41,30 @@
 #include "gnb_binary.h"
 
 #include "ed25519/ed25519.h"
+#include "crypto/random/gnb_random.h"
 
 #include "gnb_index_frame_type.h"
 
 
+typedef struct _detect_node_cache_t{
+
+    uint32_t uuid32;
+
+    //签名后的 detect_addr_frame 在 GNB_DETECT_SIGN_WINDOW_SEC 内重复使用
+    uint64_t sign_ts_sec;
+
+    //用于统计打通端口所用的时间和探测包数量
+    uint64_t start_ts_usec;
+    uint32_t probe_num;
+
+    //当前地址已经探测过的端口数
+    uint32_t address_probe_num;
+
+    detect_addr_frame_t detect_addr_frame;
+
+}detect_node_cache_t;
+
+
 typedef struct _detect_worker_ctx_t{
 
     gnb_core_t *gnb_core;
@@ -57,6 +77,18 @@ typedef struct _detect_worker_ctx_t{
 
     uint8_t  is_send_detect;
 
+    //令牌桶, 每个探测包消耗一个令牌
+    uint32_t tokens;
+    uint64_t last_refill_usec;
+
+    uint32_t random_state;
+
+    //下一轮从这个节点开始探测，令牌不够时排在后面的节点也能轮到
+    size_t next_node_idx;
+
+    size_t node_cache_num;
+    detect_node_cache_t *node_cache;
+
     pthread_t thread_worker;
 
 }detect_worker_ctx_t;
@@ -65,28 +97,68 @@ typedef struct _detect_worker_ctx_t{
 #define GNB_DETECT_PUSH_ADDRESS_INTERVAL_SEC   60*10
 #define GNB_DETECT_INTERVAL_SEC                60*3
 
+#define GNB_DETECT_SIGN_WINDOW_SEC             30
 
-static void detect_node_address(gnb_worker_t *gnb_detect_worker, gnb_node_t *node){
+//每轮对一个节点最多连续发出的探测包数量
+#define GNB_DETECT_BURST_NUM                   64
 
-    detect_worker_ctx_t *detect_worker_ctx = gnb_detect_worker->ctx;
+
+static uint32_t detect_random(detect_worker_ctx_t *detect_worker_ctx){
+
+    //xorshift32
+    uint32_t x = detect_worker_ctx->random_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    detect_worker_ctx->random_state = x;
+
+    return x;
+
+}
+
+
+static void detect_refill_tokens(detect_worker_ctx_t *detect_worker_ctx){
 
     gnb_core_t *gnb_core = detect_worker_ctx->gnb_core;
 
-    gnb_address_t address_st;
+    uint64_t elapsed_usec;
+    uint64_t tokens;
 
-    if( 0 == node->detect_port4 ){
+    elapsed_usec = detect_worker_ctx->now_time_usec - detect_worker_ctx->last_refill_usec;
+
+    tokens = elapsed_usec * gnb_core->conf->port_detect_rate / 1000000;
+
+    if ( 0 == tokens ) {
         return;
     }
 
-    memcpy(&address_st.m_address4, &node->detect_addr4, 4);
-    address_st.port = htons(node->detect_port4);
-    address_st.type = AF_INET;
+    detect_worker_ctx->last_refill_usec = detect_worker_ctx->now_time_usec;
 
-    detect_worker_ctx->index_frame_payload->sub_type = PAYLOAD_SUB_TYPE_DETECT_ADDR;
+    tokens += detect_worker_ctx->tokens;
+
+    //最多积累1秒的令牌
+    if ( tokens > gnb_core->conf->port_detect_rate ) {
+        tokens = gnb_core->conf->port_detect_rate;
+    }
+
+    detect_worker_ctx->tokens = (uint32_t)tokens;
+
+}
 
-    gnb_payload16_set_data_len( detect_worker_ctx->index_frame_payload,  sizeof(detect_addr_frame_t) );
 
-    detect_addr_frame_t *detect_addr_frame = (detect_addr_frame_t *)detect_worker_ctx->index_frame_payload->data;
+static void detect_sign_frame(gnb_worker_t *gnb_detect_worker, gnb_node_t *node, detect_node_cache_t *node_cache){
+
+    detect_worker_ctx_t *detect_worker_ctx = gnb_detect_worker->ctx;
+
+    gnb_core_t *gnb_core = detect_worker_ctx->gnb_core;
+
+    detect_addr_frame_t *detect_addr_frame = &node_cache->detect_addr_frame;
+
+    if ( node_cache->uuid32 == node->uuid32 && (detect_worker_ctx->now_time_sec - node_cache->sign_ts_sec) < GNB_DETECT_SIGN_WINDOW_SEC ) {
+        return;
+    }
 
     memset(detect_addr_frame, 0, sizeof(detect_addr_frame_t));
 
@@ -103,23 +175,89 @@ static void detect_node_address(gnb_worker_t *gnb_detect_worker, gnb_node_t *nod
 
     ed25519_sign(detect_addr_frame->src_sign, (const unsigned char *)&detect_addr_frame->data, sizeof(struct detect_addr_frame_data), gnb_core->ed25519_public_key, gnb_core->ed25519_private_key);
 
-    if ( (GNB_NODE_STATUS_IPV6_PONG | GNB_NODE_STATUS_IPV4_PONG) & node->udp_addr_status ) {
-        //在这里做一个判断，如果节点地址端口已经探测成功，就退出循环
+    node_cache->uuid32 = node->uuid32;
+    node_cache->sign_ts_sec = detect_worker_ctx->now_time_sec;
+
+}
+
+
+/*
+对端节点也在用同样的方式随机探测，双方各自发出 n 个随机端口的探测包后，
+两端 NAT 上打开的映射发生碰撞的概率按生日问题增长，比顺序扫描端口更快打通
+*/
+static void detect_node_address(gnb_worker_t *gnb_detect_worker, gnb_node_t *node, detect_node_cache_t *node_cache){
+
+    detect_worker_ctx_t *detect_worker_ctx = gnb_detect_worker->ctx;
+
+    gnb_core_t *gnb_core = detect_worker_ctx->gnb_core;
+
+    gnb_address_t address_st;
+
+    uint32_t port_range;
+
+    int i;
+
+    if( 0 == node->detect_port4 ){
+        return;
+    }
+
+    if ( gnb_core->conf->port_detect_end <= gnb_core->conf->port_detect_start ) {
         return;
     }
 
-    address_st.port = htons(node->detect_port4);
+    port_range = gnb_core->conf->port_detect_end - gnb_core->conf->port_detect_start;
+
+    memcpy(&address_st.m_address4, &node->detect_addr4, 4);
+    address_st.type = AF_INET;
+
+    detect_sign_frame(gnb_detect_worker, node, node_cache);
+
+    detect_worker_ctx->index_frame_payload->sub_type = PAYLOAD_SUB_TYPE_DETECT_ADDR;
+
+    gnb_payload16_set_data_len( detect_worker_ctx->index_frame_payload,  sizeof(detect_addr_frame_t) );
+
+    memcpy(detect_worker_ctx->index_frame_payload->data, &node_cache->detect_addr_frame, sizeof(detect_addr_frame_t));
+
+    if ( 0 == node_cache->probe_num ) {
+        node_cache->start_ts_usec = detect_worker_ctx->now_time_usec;
+    }
+
+    for ( i=0; i<GNB_DETECT_BURST_NUM; i++ ) {
+
+        if ( 0 == detect_worker_ctx->tokens ) {
+            break;
+        }
+
+        if ( (GNB_NODE_STATUS_IPV6_PONG | GNB_NODE_STATUS_IPV4_PONG) & node->udp_addr_status ) {
+            //在这里做一个判断，如果节点地址端口已经探测成功，就退出循环
+            break;
+        }
+
+        if ( node_cache->address_probe_num >= port_range ) {
+            break;
+        }
+
+        node->detect_port4 = gnb_core->conf->port_detect_start + detect_random(detect_worker_ctx) % port_range;
+
+        address_st.port = htons(node->detect_port4);
 
-    gnb_send_to_address_through_all_sockets(gnb_core, &address_st, detect_worker_ctx->index_frame_payload);
+        gnb_send_to_address_through_all_sockets(gnb_core, &address_st, detect_worker_ctx->index_frame_payload);
 
-    detect_worker_ctx->is_send_detect = 1;
+        detect_worker_ctx->tokens--;
+
+        node_cache->probe_num++;
+        node_cache->address_probe_num++;
+
+        detect_worker_ctx->is_send_detect = 1;
+
+    }
 
     //GNB_LOG3(gnb_core->log, GNB_LOG_ID_DETECT_WORKER, "#detect_node_address [%d]->[%d]%s\n", gnb_core->local_node->uuid32, node->uuid32, GNB_IP_PORT_STR1(&address_st));
 
 }
 
 
-static void detect_node_set_address(gnb_worker_t *gnb_detect_worker, gnb_node_t *node){
+static void detect_node_set_address(gnb_worker_t *gnb_detect_worker, gnb_node_t *node, detect_node_cache_t *node_cache){
 
     detect_worker_ctx_t *detect_worker_ctx = gnb_detect_worker->ctx;
 
@@ -127,47 +265,50 @@ static void detect_node_set_address(gnb_worker_t *gnb_detect_worker, gnb_node_t
 
     gnb_address_list_t *address_list;
 
+    uint32_t port_range;
+
+    port_range = gnb_core->conf->port_detect_end - gnb_core->conf->port_detect_start;
+
     address_list = (gnb_address_list_t *)&node->detect_address4_block;
 
-    memcpy(&node->detect_addr4, &address_list->array[node->detect_address4_idx].m_address4, 4);
+    //当前地址探测的端口数已经达到端口范围，换下一个地址
+    if ( 0 != node->detect_port4 && node_cache->address_probe_num < port_range ) {
+        return;
+    }
 
-    if( 0 == node->detect_addr4.s_addr ){
+    if ( 0 != node->detect_port4 ) {
 
         if( 2==node->detect_address4_idx ){
-
             node->detect_address4_idx = 0;
-            node->last_detect_sec = detect_worker_ctx->now_time_sec;
-
         }else{
             node->detect_address4_idx += 1;
         }
 
-        node->detect_port4 = gnb_core->conf->port_detect_start;
-
-        return;
     }
 
-    if ( node->detect_port4 < gnb_core->conf->port_detect_start ){
-        node->detect_port4 = gnb_core->conf->port_detect_start;
-    }else{
-        node->detect_port4 += 1;
-    }
+    node_cache->address_probe_num = 0;
 
-    if( node->detect_port4 >= gnb_core->conf->port_detect_end ){
+    memcpy(&node->detect_addr4, &address_list->array[node->detect_address4_idx].m_address4, 4);
+
+    if( 0 == node->detect_addr4.s_addr ){
 
         if( 2==node->detect_address4_idx ){
+
             node->detect_address4_idx = 0;
+            node->last_detect_sec = detect_worker_ctx->now_time_sec;
+
         }else{
             node->detect_address4_idx += 1;
         }
 
-        node->detect_port4 = gnb_core->conf->port_detect_start;
+        node->detect_port4 = 0;
 
+        return;
     }
 
-    if( gnb_core->conf->port_detect_start == node->detect_port4 ){
-        GNB_LOG3(gnb_core->log, GNB_LOG_ID_DETECT_WORKER, "#START DECETE node[%d] idx[%d]\n", node->uuid32, node->detect_address4_idx);
-    }
+    node->detect_port4 = gnb_core->conf->port_detect_start;
+
+    GNB_LOG3(gnb_core->log, GNB_LOG_ID_DETECT_WORKER, "#START DECETE node[%d] idx[%d]\n", node->uuid32, node->detect_address4_idx);
 
 }
 
@@ -180,24 +321,37 @@ static void detect_loop(gnb_worker_t *gnb_detect_worker){
 
     gnb_node_t *node;
 
+    detect_node_cache_t *node_cache;
+
     size_t num = gnb_core->ctl_block->node_zone->node_num;
 
     if( 0==num ){
         return;
     }
 
-    int i;
+    if ( num > detect_worker_ctx->node_cache_num ) {
+        num = detect_worker_ctx->node_cache_num;
+    }
+
+    size_t start_idx = detect_worker_ctx->next_node_idx % num;
 
-    for( i=0; i<num; i++ ){
+    size_t n;
+    size_t i;
+
+    for( n=0; n<num; n++ ){
+
+        i = (start_idx + n) % num;
 
         node = &gnb_core->ctl_block->node_zone->node[i];
 
+        node_cache = &detect_worker_ctx->node_cache[i];
+
         if ( gnb_core->local_node->uuid32 == node->uuid32 ){
             continue;
         }
 
 
-        if ( node->type & GNB_NODE_TYPE_SLIENCE ) {
+        if ( node->type & (GNB_NODE_TYPE_SLIENCE|GNB_NODE_TYPE_RETIRED) ) {
             continue;
         }
 
@@ -208,6 +362,15 @@ static void detect_loop(gnb_worker_t *gnb_detect_worker){
 
 
         if ( (GNB_NODE_STATUS_IPV6_PONG|GNB_NODE_STATUS_IPV4_PONG) & node->udp_addr_status ) {
+
+            if ( 0 != node_cache->probe_num ) {
+                GNB_LOG2(gnb_core->log, GNB_LOG_ID_DETECT_WORKER, "#DETECT node[%u] connected after %u probes in %"PRIu64" ms\n",
+                         node->uuid32, node_cache->probe_num, (detect_worker_ctx->now_time_usec - node_cache->start_ts_usec)/1000);
+                node_cache->probe_num = 0;
+                node_cache->address_probe_num = 0;
+                node->detect_port4 = 0;
+            }
+
             continue;
         }
 
@@ -219,8 +382,15 @@ static void detect_loop(gnb_worker_t *gnb_detect_worker){
             continue;
         }
 
-        detect_node_set_address(gnb_detect_worker, node);
-        detect_node_address(gnb_detect_worker, node);
+        if ( 0 == detect_worker_ctx->tokens ) {
+            detect_worker_ctx->next_node_idx = i;
+            break;
+        }
+
+        detect_node_set_address(gnb_detect_worker, node, node_cache);
+        detect_node_address(gnb_detect_worker, node, node_cache);
+
+        detect_worker_ctx->next_node_idx = i + 1;
 
     }
 
@@ -252,6 +422,9 @@ static void* thread_worker_func( void *data ) {
         }
 
         detect_worker_ctx->is_send_detect = 0;
+
+        detect_refill_tokens(detect_worker_ctx);
+
         detect_loop(gnb_detect_worker);
 
         if(detect_worker_ctx->is_send_detect){
@@ -281,6 +454,24 @@ static void init(gnb_worker_t *gnb_worker, void *ctx){
 
     detect_worker_ctx->gnb_core = (gnb_core_t *)ctx;
 
+    //按 node_zone 的容量分配，热加载新增的节点也有 cache
+    detect_worker_ctx->node_cache_num = gnb_core->ctl_block->node_zone->node_capacity;
+
+    if ( 0 != detect_worker_ctx->node_cache_num ) {
+        detect_worker_ctx->node_cache = (detect_node_cache_t *)gnb_heap_alloc(gnb_core->heap, sizeof(detect_node_cache_t) * detect_worker_ctx->node_cache_num);
+        memset(detect_worker_ctx->node_cache, 0, sizeof(detect_node_cache_t) * detect_worker_ctx->node_cache_num);
+    }
+
+    gnb_worker_sync_time(&detect_worker_ctx->now_time_sec, &detect_worker_ctx->now_time_usec);
+
+    detect_worker_ctx->last_refill_usec = detect_worker_ctx->now_time_usec;
+
+    gnb_random_data((unsigned char *)&detect_worker_ctx->random_state, sizeof(uint32_t));
+
+    if ( 0 == detect_worker_ctx->random_state ) {
+        detect_worker_ctx->random_state = 0x9e3779b9;
+    }
+
     gnb_worker->ctx = detect_worker_ctx;
 
     GNB_LOG1(gnb_core->log,GNB_LOG_ID_DETECT_WORKER,"%s init finish\n", gnb_worker->name);
@@ -294,6 +485,10 @@ static void release(gnb_worker_t *gnb_worker){
 
     gnb_core_t *gnb_core = detect_worker_ctx->gnb_core;
 
+    if ( NULL != detect_worker_ctx->node_cache ) {
+        gnb_heap_free(gnb_core->heap, detect_worker_ctx->node_cache);
+    }
+
     gnb_heap_free(gnb_core->heap, detect_worker_ctx);
 
 }
@@ -0,0 +1,39 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GNB_FWDU0_FRAME_TYPE_H
+#define GNB_FWDU0_FRAME_TYPE_H
+
+#include "stdint.h"
+
+#pragma pack(push, 1)
+
+typedef struct _gnb_fwdu0_frame_head_t {
+
+	uint8_t  dst_addr4[4];
+	uint16_t dst_port4;      //网络字节序
+
+	unsigned char passcode[4];
+
+}__attribute__ ((__packed__)) gnb_fwdu0_frame_head_t;
+
+#pragma pack(pop)
+
+//fwdu0 payload 的 payload16 头部和 fwdu0 frame head, 被转发的 payload 紧跟在后面
+#define GNB_FWDU0_HEAD_SIZE  (4 + sizeof(gnb_fwdu0_frame_head_t))
+
+#endif
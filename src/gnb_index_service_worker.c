@@ -32,6 +32,7 @@
 #include <errno.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 
 #include "gnb.h"
@@ -41,10 +42,12 @@
 
 #include "gnb_ring_buffer.h"
 #include "gnb_lru32.h"
+#include "gnb_mmap.h"
 
 #include "gnb_time.h"
 #include "gnb_binary.h"
 
+#include "gnb_packet_pool.h"
 #include "gnb_worker_queue_data.h"
 
 #include "ed25519/ed25519.h"
@@ -70,6 +73,20 @@ typedef struct _index_service_worker_ctx_t {
 
     pthread_t thread_worker;
 
+    /*
+    快照缓冲区由 service 线程在两次处理队列之间填充(只做内存拷贝)，
+    写文件由 snapshot 线程完成，不阻塞 service 线程
+    snapshot_ready 为 1 时缓冲区属于 snapshot 线程
+    修改 snapshot_ready 之前和读到 snapshot_ready 之后都有内存屏障，保证另一个线程看到的是完整的缓冲区
+    */
+    unsigned char *snapshot_block;
+    size_t snapshot_block_size;
+    volatile int snapshot_ready;
+    volatile int thread_snapshot_flag;
+    uint64_t last_snapshot_ts_sec;
+
+    pthread_t thread_snapshot;
+
 }index_service_worker_ctx_t;
 
 
@@ -103,6 +120,31 @@ typedef struct _gnb_key_address_t{
 }gnb_key_address_t;
 
 
+#define GNB_INDEX_SERVICE_SNAPSHOT_MAGIC         "GNBISS01"
+#define GNB_INDEX_SERVICE_SNAPSHOT_INTERVAL_SEC  30
+
+typedef struct _index_service_snapshot_head_t {
+
+    char     magic[8];
+
+    uint32_t entry_size;
+
+    uint32_t num;
+
+    uint64_t ts_sec;
+
+}index_service_snapshot_head_t;
+
+
+typedef struct _index_service_snapshot_entry_t {
+
+    unsigned char key512[64];
+
+    gnb_key_address_t key_address;
+
+}index_service_snapshot_entry_t;
+
+
 static void send_echo_addr_frame(gnb_worker_t *gnb_index_service_worker, unsigned char *key512, uint32_t uuid32, gnb_address_t *address);
 static void send_push_addr_frame(gnb_worker_t *gnb_index_service_worker, unsigned char action, unsigned char attachment, unsigned char *src_key, gnb_key_address_t *src_key_address, unsigned char *dst_key, gnb_key_address_t *dst_key_address);
 static void handle_post_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *index_service_worker_in_data);
@@ -115,7 +157,7 @@ static void handle_post_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *i
 
     gnb_key_address_t *key_address;
 
-    post_addr_frame_t *post_addr_frame = (post_addr_frame_t *)&index_service_worker_in_data->payload_st.data;
+    post_addr_frame_t *post_addr_frame = (post_addr_frame_t *)&index_service_worker_in_data->payload->data;
 #if 0
     if ( 0 == gnb_core->conf->lite_mode && 0 != gnb_node_sign_verify(gnb_core, post_addr_frame->data.src_uuid32, post_addr_frame->src_sign, (void *)&post_addr_frame->data, sizeof(struct post_addr_frame_data)) ){
         return;
@@ -363,7 +405,7 @@ static void handle_request_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t
 
     index_service_worker_ctx_t *index_service_worker_ctx = gnb_core->index_service_worker->ctx;
 
-    request_addr_frame_t *request_addr_frame = (request_addr_frame_t *)&index_service_worker_in_data->payload_st.data;
+    request_addr_frame_t *request_addr_frame = (request_addr_frame_t *)&index_service_worker_in_data->payload->data;
 
 #if 0
     if ( 0 == gnb_core->conf->lite_mode && 0 != gnb_node_sign_verify(gnb_core, request_addr_frame->data.src_uuid32, request_addr_frame->src_sign, (void *)&request_addr_frame->data, sizeof(struct request_addr_frame_data)) ){
@@ -457,7 +499,7 @@ static void handle_request_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t
 
 static void handle_index_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *index_service_worker_in_data){
 
-    gnb_payload16_t *payload = &index_service_worker_in_data->payload_st;
+    gnb_payload16_t *payload = index_service_worker_in_data->payload;
 
     if ( GNB_PAYLOAD_TYPE_INDEX != payload->type ){
         GNB_LOG2(gnb_core->log,GNB_LOG_ID_INDEX_SERVICE_WORKER,"handle_index_frame GNB_PAYLOAD_TYPE_INDEX != payload->type[%x]\n",payload->type);
@@ -505,10 +547,20 @@ static void handle_recv_queue(gnb_core_t *gnb_core){
             break;
         }
 
+        GNB_METRICS_INC(&gnb_core->ctl_block->metrics_zone->slot[GNB_METRICS_SLOT_INDEX_SERVICE_WORKER], GNB_METRIC_WORKER_IN_PKT);
+
         receive_queue_data = (gnb_worker_queue_data_t *)ring_node->data;
 
+        if ( GNB_TRACE_ON(gnb_core->trace, GNB_TRACE_QUEUE_POP) ) {
+            gnb_trace_emit(gnb_core->trace, GNB_TRACE_QUEUE_POP, GNB_TRACE_QUEUE_INDEX_SERVICE, receive_queue_data->data.node_in.payload->type,
+                           receive_queue_data->data.node_in.payload->sub_type, gnb_payload16_size(receive_queue_data->data.node_in.payload), 0);
+        }
+
         handle_index_frame(gnb_core, &receive_queue_data->data.node_in);
 
+
+        gnb_packet_buf_unref(receive_queue_data->data.node_in.packet_buf);
+
         gnb_ring_buffer_pop_submit( gnb_core->index_service_worker->ring_buffer );
 
     }
@@ -516,6 +568,218 @@ static void handle_recv_queue(gnb_core_t *gnb_core){
 }
 
 
+static int check_key_address_alive(gnb_key_address_t *key_address, uint64_t now_time_sec){
+
+    if ( (now_time_sec - key_address->last_post_addr6_sec) < GNB_POST_ADDR_INTERVAL_TIME_SEC*2 || (now_time_sec - key_address->last_post_addr4_sec) < GNB_POST_ADDR_INTERVAL_TIME_SEC*2 ) {
+        return 1;
+    }
+
+    return 0;
+
+}
+
+
+/*
+从链表尾部(最旧)向头部(最新)拷贝，加载时按文件顺序存入 lru 就能恢复原来的顺序
+*/
+static void make_snapshot(gnb_core_t *gnb_core){
+
+    index_service_worker_ctx_t *index_service_worker_ctx = gnb_core->index_service_worker->ctx;
+
+    index_service_snapshot_head_t  *snapshot_head;
+    index_service_snapshot_entry_t *snapshot_entry;
+
+    gnb_doubly_linked_list_node_t *dl_node;
+    gnb_lru32_node_t *lru_node;
+
+    gnb_key_address_t *key_address;
+
+    uint32_t num = 0;
+
+    if ( NULL == index_service_worker_ctx->snapshot_block ) {
+        return;
+    }
+
+    if ( 1 == index_service_worker_ctx->snapshot_ready ) {
+        return;
+    }
+
+    //snapshot 线程写完文件后才会把 snapshot_ready 置 0
+    __sync_synchronize();
+
+    if ( (index_service_worker_ctx->now_time_sec - index_service_worker_ctx->last_snapshot_ts_sec) < GNB_INDEX_SERVICE_SNAPSHOT_INTERVAL_SEC ) {
+        return;
+    }
+
+    index_service_worker_ctx->last_snapshot_ts_sec = index_service_worker_ctx->now_time_sec;
+
+    snapshot_head  = (index_service_snapshot_head_t *)index_service_worker_ctx->snapshot_block;
+    snapshot_entry = (index_service_snapshot_entry_t *)(index_service_worker_ctx->snapshot_block + sizeof(index_service_snapshot_head_t));
+
+    dl_node = index_service_worker_ctx->lru->doubly_linked_list->tail;
+
+    while ( NULL != dl_node && num < index_service_worker_ctx->lru->max_size ) {
+
+        lru_node = (gnb_lru32_node_t *)dl_node->data;
+        key_address = (gnb_key_address_t *)lru_node->udata;
+
+        dl_node = dl_node->pre;
+
+        if ( 64 != lru_node->kv->key->size ) {
+            continue;
+        }
+
+        if ( 0 == check_key_address_alive(key_address, index_service_worker_ctx->now_time_sec) ) {
+            continue;
+        }
+
+        memcpy(snapshot_entry[num].key512, lru_node->kv->key->data, 64);
+        memcpy(&snapshot_entry[num].key_address, key_address, sizeof(gnb_key_address_t));
+
+        num++;
+
+    }
+
+    memcpy(snapshot_head->magic, GNB_INDEX_SERVICE_SNAPSHOT_MAGIC, 8);
+    snapshot_head->entry_size = sizeof(index_service_snapshot_entry_t);
+    snapshot_head->num        = num;
+    snapshot_head->ts_sec     = index_service_worker_ctx->now_time_sec;
+
+    //release: 缓冲区填充完成后再交给 snapshot 线程
+    __sync_synchronize();
+
+    index_service_worker_ctx->snapshot_ready = 1;
+
+}
+
+
+static void write_snapshot_file(index_service_worker_ctx_t *index_service_worker_ctx){
+
+    gnb_core_t *gnb_core = index_service_worker_ctx->gnb_core;
+
+    index_service_snapshot_head_t *snapshot_head = (index_service_snapshot_head_t *)index_service_worker_ctx->snapshot_block;
+
+    char tmp_file[PATH_MAX+NAME_MAX+4];
+
+    FILE *file;
+
+    size_t size;
+
+    size = sizeof(index_service_snapshot_head_t) + sizeof(index_service_snapshot_entry_t) * snapshot_head->num;
+
+    snprintf(tmp_file, PATH_MAX+NAME_MAX+4, "%s.tmp", gnb_core->conf->index_service_cache_file);
+
+    file = fopen(tmp_file, "wb");
+
+    if ( NULL == file ) {
+        GNB_LOG1(gnb_core->log, GNB_LOG_ID_INDEX_SERVICE_WORKER, "snapshot can't open file '%s'\n", tmp_file);
+        return;
+    }
+
+    if ( size != fwrite(index_service_worker_ctx->snapshot_block, 1, size, file) ) {
+        fclose(file);
+        remove(tmp_file);
+        return;
+    }
+
+    fclose(file);
+
+    #ifdef _WIN32
+    remove(gnb_core->conf->index_service_cache_file);
+    #endif
+
+    rename(tmp_file, gnb_core->conf->index_service_cache_file);
+
+    GNB_LOG3(gnb_core->log, GNB_LOG_ID_INDEX_SERVICE_WORKER, "snapshot %u key address to '%s'\n", snapshot_head->num, gnb_core->conf->index_service_cache_file);
+
+}
+
+
+static void* thread_snapshot_func( void *data ) {
+
+    index_service_worker_ctx_t *index_service_worker_ctx = (index_service_worker_ctx_t *)data;
+
+    do{
+
+        if ( 1 == index_service_worker_ctx->snapshot_ready ) {
+            //acquire: 读到 snapshot_ready 之后再读缓冲区
+            __sync_synchronize();
+            write_snapshot_file(index_service_worker_ctx);
+            __sync_synchronize();
+            index_service_worker_ctx->snapshot_ready = 0;
+        }
+
+        GNB_SLEEP_MILLISECOND(1000);
+
+    }while(index_service_worker_ctx->thread_snapshot_flag);
+
+    return NULL;
+
+}
+
+
+static void load_snapshot(gnb_core_t *gnb_core, index_service_worker_ctx_t *index_service_worker_ctx){
+
+    gnb_mmap_block_t *mmap_block;
+
+    struct stat st;
+
+    index_service_snapshot_head_t  *snapshot_head;
+    index_service_snapshot_entry_t *snapshot_entry;
+
+    uint32_t i;
+    uint32_t num = 0;
+
+    if ( 0 != stat(gnb_core->conf->index_service_cache_file, &st) ) {
+        return;
+    }
+
+    if ( st.st_size < sizeof(index_service_snapshot_head_t) ) {
+        return;
+    }
+
+    mmap_block = gnb_mmap_create(gnb_core->conf->index_service_cache_file, st.st_size, GNB_MMAP_TYPE_READONLY);
+
+    if ( NULL == mmap_block ) {
+        return;
+    }
+
+    snapshot_head  = (index_service_snapshot_head_t *)gnb_mmap_get_block(mmap_block);
+    snapshot_entry = (index_service_snapshot_entry_t *)((unsigned char *)snapshot_head + sizeof(index_service_snapshot_head_t));
+
+    if ( 0 != memcmp(snapshot_head->magic, GNB_INDEX_SERVICE_SNAPSHOT_MAGIC, 8) || sizeof(index_service_snapshot_entry_t) != snapshot_head->entry_size ) {
+        goto finish;
+    }
+
+    if ( snapshot_head->num > index_service_worker_ctx->lru->max_size ) {
+        goto finish;
+    }
+
+    if ( st.st_size < sizeof(index_service_snapshot_head_t) + sizeof(index_service_snapshot_entry_t) * snapshot_head->num ) {
+        goto finish;
+    }
+
+    for ( i=0; i<snapshot_head->num; i++ ) {
+
+        if ( 0 == check_key_address_alive(&snapshot_entry[i].key_address, index_service_worker_ctx->now_time_sec) ) {
+            continue;
+        }
+
+        GNB_LRU32_FIXED_STORE(index_service_worker_ctx->lru, snapshot_entry[i].key512, 64, &snapshot_entry[i].key_address);
+
+        num++;
+
+    }
+
+    GNB_LOG1(gnb_core->log, GNB_LOG_ID_INDEX_SERVICE_WORKER, "load %u/%u key address from snapshot '%s'\n", num, snapshot_head->num, gnb_core->conf->index_service_cache_file);
+
+finish:
+
+    gnb_mmap_release(mmap_block);
+
+}
+
+
 static void* thread_worker_func( void *data ) {
 
     int ret;
@@ -535,6 +799,8 @@ static void* thread_worker_func( void *data ) {
 
         handle_recv_queue(gnb_core);
 
+        make_snapshot(gnb_core);
+
         GNB_SLEEP_MILLISECOND(100);
 
     }while(gnb_index_service_worker->thread_worker_flag);
@@ -565,6 +831,19 @@ static void init(gnb_worker_t *gnb_worker, void *ctx){
 
     gnb_worker->ctx = index_service_worker_ctx;
 
+    if ( '\0' != gnb_core->conf->index_service_cache_file[0] ) {
+
+        index_service_worker_ctx->snapshot_block_size = sizeof(index_service_snapshot_head_t) + sizeof(index_service_snapshot_entry_t) * index_service_worker_ctx->lru->max_size;
+        index_service_worker_ctx->snapshot_block = (unsigned char *)gnb_heap_alloc(gnb_core->heap, index_service_worker_ctx->snapshot_block_size);
+
+        gnb_worker_sync_time(&index_service_worker_ctx->now_time_sec, &index_service_worker_ctx->now_time_usec);
+
+        load_snapshot(gnb_core, index_service_worker_ctx);
+
+        index_service_worker_ctx->last_snapshot_ts_sec = index_service_worker_ctx->now_time_sec;
+
+    }
+
     GNB_LOG1(gnb_core->log,GNB_LOG_ID_INDEX_SERVICE_WORKER,"%s init finish\n", gnb_worker->name);
 
 }
@@ -575,6 +854,10 @@ static void release(gnb_worker_t *gnb_worker){
 
     gnb_ring_buffer_release(gnb_worker->ring_buffer);
 
+    if ( NULL != index_service_worker_ctx->snapshot_block ) {
+        gnb_heap_free(index_service_worker_ctx->gnb_core->heap, index_service_worker_ctx->snapshot_block);
+    }
+
     gnb_heap_free(index_service_worker_ctx->gnb_core->heap, index_service_worker_ctx);
 
 }
@@ -587,6 +870,12 @@ static int start(gnb_worker_t *gnb_worker){
 
     pthread_detach(index_service_worker_ctx->thread_worker);
 
+    if ( NULL != index_service_worker_ctx->snapshot_block ) {
+        index_service_worker_ctx->thread_snapshot_flag = 1;
+        pthread_create(&index_service_worker_ctx->thread_snapshot, NULL, thread_snapshot_func, index_service_worker_ctx);
+        pthread_detach(index_service_worker_ctx->thread_snapshot);
+    }
+
     return 0;
 }
 
@@ -600,6 +889,8 @@ static int stop(gnb_worker_t *gnb_worker){
 
     index_service_worker->thread_worker_flag = 0;
 
+    index_service_worker_ctx->thread_snapshot_flag = 0;
+
     return 0;
 }
 
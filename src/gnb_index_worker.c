@@ -36,6 +36,8 @@
 #include "gnb.h"
 
 #include "gnb_node.h"
+#include "gnb_conf_file.h"
+#include "gnb_seqlock.h"
 #include "gnb_worker.h"
 
 #include "gnb_ring_buffer.h"
@@ -43,6 +45,7 @@
 #include "gnb_time.h"
 #include "gnb_binary.h"
 
+#include "gnb_packet_pool.h"
 #include "gnb_worker_queue_data.h"
 
 #include "ed25519/ed25519.h"
@@ -342,7 +345,7 @@ static void handle_push_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *i
 
     index_worker_ctx_t *index_worker_ctx = gnb_core->index_worker->ctx;
 
-    push_addr_frame_t *push_addr_frame = (push_addr_frame_t *)&index_worker_in_data->payload_st.data;
+    push_addr_frame_t *push_addr_frame = (push_addr_frame_t *)&index_worker_in_data->payload->data;
 
 #if 0
     if ( 0 == gnb_core->conf->lite_mode && 0 != gnb_node_sign_verify(gnb_core, push_addr_frame->data.src_uuid32, push_addr_frame->src_sign, (void *)&push_addr_frame->data, sizeof(struct push_addr_frame_data)) ){
@@ -398,6 +401,8 @@ static void handle_push_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *i
     memset(&address_st, 0, sizeof(gnb_address_t));
     address_st.ts_sec = index_worker_ctx->now_time_sec;
 
+    gnb_seqlock_write_begin(&node->seq);
+
     address_st.type = AF_INET6;
     if ( 0 != push_addr_frame->data.port6_a ) {
         address_st.port = push_addr_frame->data.port6_a;
@@ -420,6 +425,8 @@ static void handle_push_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *i
         gnb_address_list_update(push_address_list, &address_st);
     }
 
+    gnb_seqlock_write_end(&node->seq);
+
     //just for log
     for( i=0; i<dst_address6_list->num; i++ ) {
         GNB_LOG2(gnb_core->log,GNB_LOG_ID_INDEX_WORKER,"RECEIVE_PUSH_ADDR node=%d %s text='%.*s' action=%c\n", nodeid, GNB_IP_PORT_STR1(&dst_address6_list->array[i]), 32, push_addr_frame->data.text, push_addr_frame->data.arg0);
@@ -434,6 +441,8 @@ static void handle_push_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *i
     //下面是处理 ipv4
     address_st.type = AF_INET;
 
+    gnb_seqlock_write_begin(&node->seq);
+
     //由于 detect_address_list 是先进先出，push_addr_frame->data.addr4_a 保存的是最新提交的地址，因此倒序列录入数据，使得最新的地址优先探测
     if ( 0 != push_addr_frame->data.port4_c ) {
         address_st.port = push_addr_frame->data.port4_c;
@@ -464,6 +473,8 @@ static void handle_push_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *i
         gnb_address_list3_fifo(detect_address_list, &address_st);
     }
 
+    gnb_seqlock_write_end(&node->seq);
+
     //just for log
     for( i=0; i<dst_address4_list->num; i++ ) {
         GNB_LOG2(gnb_core->log,GNB_LOG_ID_INDEX_WORKER,"RECEIVE_PUSH_ADDR node=%d %s text='%.*s' action=%c\n", nodeid, GNB_IP_PORT_STR1(&dst_address4_list->array[i]), 32, push_addr_frame->data.text, push_addr_frame->data.arg0);
@@ -502,7 +513,7 @@ static void sync_index_node(gnb_worker_t *gnb_index_worker){
             continue;
         }
 
-        if ( node->type & GNB_NODE_TYPE_SLIENCE ) {
+        if ( node->type & (GNB_NODE_TYPE_SLIENCE|GNB_NODE_TYPE_RETIRED) ) {
             continue;
         }
 
@@ -541,7 +552,7 @@ static void handle_echo_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *i
 
     gnb_sockaddress_t *sockaddress = &index_worker_in_data->node_addr_st;
 
-    echo_addr_frame_t *echo_addr_frame = (echo_addr_frame_t *)&index_worker_in_data->payload_st.data;
+    echo_addr_frame_t *echo_addr_frame = (echo_addr_frame_t *)&index_worker_in_data->payload->data;
 
     uint32_t dst_uuid32 = ntohl(echo_addr_frame->data.dst_uuid32);
 
@@ -572,12 +583,16 @@ static void handle_echo_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *i
     gnb_core->index_address_ring.address_list->array[idx].ts_sec = index_worker_ctx->now_time_sec;
 
     if ( '6' == echo_addr_frame->data.addr_type ) {
+        gnb_seqlock_write_begin(&gnb_core->local_node->seq);
         memcpy(&gnb_core->local_node->udp_sockaddr6.sin6_addr, &echo_addr_frame->data.addr, 16);
         gnb_core->local_node->udp_sockaddr6.sin6_port = echo_addr_frame->data.port;
+        gnb_seqlock_write_end(&gnb_core->local_node->seq);
         GNB_LOG3(gnb_core->log,GNB_LOG_ID_INDEX_WORKER,"HANDLE ECHO addr %s\n", GNB_ADDR6STR1(echo_addr_frame->data.addr));
     } else if ( '4' == echo_addr_frame->data.addr_type ) {
+        gnb_seqlock_write_begin(&gnb_core->local_node->seq);
         memcpy(&gnb_core->local_node->udp_sockaddr4.sin_addr, &echo_addr_frame->data.addr, 4);
         gnb_core->local_node->udp_sockaddr4.sin_port = echo_addr_frame->data.port;
+        gnb_seqlock_write_end(&gnb_core->local_node->seq);
         GNB_LOG3(gnb_core->log,GNB_LOG_ID_INDEX_WORKER,"HANDLE ECHO addr %s\n", GNB_ADDR4STR1(echo_addr_frame->data.addr));
     } else {
         GNB_LOG3(gnb_core->log,GNB_LOG_ID_INDEX_WORKER,"HANDLE ECHO addr type error%.*s\n", 80, echo_addr_frame->data.text);
@@ -593,7 +608,7 @@ static void handle_detect_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t
 
     index_worker_ctx_t *index_worker_ctx = gnb_core->index_worker->ctx;
 
-    detect_addr_frame_t *detect_addr_frame = (detect_addr_frame_t *)&index_worker_in_data->payload_st.data;
+    detect_addr_frame_t *detect_addr_frame = (detect_addr_frame_t *)&index_worker_in_data->payload->data;
 
     uint32_t src_uuid32 = ntohl(detect_addr_frame->data.src_uuid32);
     uint32_t dst_uuid32 = ntohl(detect_addr_frame->data.dst_uuid32);
@@ -636,6 +651,8 @@ static void handle_detect_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t
     address->socket_idx = index_worker_in_data->socket_idx;
     address->ts_sec = index_worker_ctx->now_time_usec;
 
+    gnb_seqlock_write_begin(&src_node->seq);
+
     if (AF_INET6 == sockaddress->addr_type){
 
         if ( 'e' == detect_addr_frame->data.arg0 ){
@@ -678,6 +695,8 @@ static void handle_detect_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t
 
     gnb_address_list_update(dynamic_address_list, address);
 
+    gnb_seqlock_write_end(&src_node->seq);
+
     if ( 'e' != detect_addr_frame->data.arg0 ) {
         send_detect_addr_frame_arg(gnb_core->index_worker, address,  src_uuid32, 'e');
     }
@@ -688,7 +707,7 @@ static void handle_detect_addr_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t
 
 static void handle_index_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *index_worker_in_data){
 
-    gnb_payload16_t *payload = &index_worker_in_data->payload_st;
+    gnb_payload16_t *payload = index_worker_in_data->payload;
 
     if ( GNB_PAYLOAD_TYPE_INDEX != payload->type ) {
         GNB_LOG2(gnb_core->log, GNB_LOG_ID_INDEX_WORKER, "handle_index_frame GNB_PAYLOAD_TYPE_INDEX != payload->type[%x]\n", payload->type);
@@ -737,10 +756,20 @@ static void handle_recv_queue(gnb_core_t *gnb_core){
             break;
         }
 
+        GNB_METRICS_INC(&gnb_core->ctl_block->metrics_zone->slot[GNB_METRICS_SLOT_INDEX_WORKER], GNB_METRIC_WORKER_IN_PKT);
+
         receive_queue_data = (gnb_worker_queue_data_t *)ring_node->data;
 
+        if ( GNB_TRACE_ON(gnb_core->trace, GNB_TRACE_QUEUE_POP) ) {
+            gnb_trace_emit(gnb_core->trace, GNB_TRACE_QUEUE_POP, GNB_TRACE_QUEUE_INDEX, receive_queue_data->data.node_in.payload->type,
+                           receive_queue_data->data.node_in.payload->sub_type, gnb_payload16_size(receive_queue_data->data.node_in.payload), 0);
+        }
+
         handle_index_frame(gnb_core, &receive_queue_data->data.node_in);
 
+
+        gnb_packet_buf_unref(receive_queue_data->data.node_in.packet_buf);
+
         gnb_ring_buffer_pop_submit( gnb_core->index_worker->ring_buffer );
 
     }
@@ -763,6 +792,8 @@ static void* thread_worker_func( void *data ) {
 
     do{
 
+        gnb_config_file_reload_quiescent(gnb_core, GNB_NODE_TABLE_READER_INDEX);
+
         gnb_worker_sync_time(&index_worker_ctx->now_time_sec, &index_worker_ctx->now_time_usec);
 
         handle_recv_queue(gnb_core);
@@ -0,0 +1,109 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GNB_LATENCY_TYPE_H
+#define GNB_LATENCY_TYPE_H
+
+#include <stdint.h>
+
+#define GNB_LATENCY_PATH_TUN     0
+#define GNB_LATENCY_PATH_INET    1
+#define GNB_LATENCY_PATH_NUM     2
+
+#define GNB_LATENCY_STAGE_FRAME  0
+#define GNB_LATENCY_STAGE_ROUTE  1
+#define GNB_LATENCY_STAGE_FWD    2
+//tun 方向是 sendto, inet 方向是 write tun 或 sendto
+#define GNB_LATENCY_STAGE_OUTPUT 3
+//整个 gnb_pf_tun gnb_pf_inet 的耗时
+#define GNB_LATENCY_STAGE_TOTAL  4
+#define GNB_LATENCY_STAGE_NUM    5
+
+//每个阶段 0 号是整个阶段的耗时, 1 ~ GNB_LATENCY_PF_MAX 是各个 pf 模块的耗时
+#define GNB_LATENCY_PF_MAX       8
+
+/*
+log-linear 分桶, 单位是纳秒
+小于 8 的值每个值一个桶，之后每个 2 的幂次区间分成 8 个桶，相对误差不超过 12.5%
+最后一个桶的下限约为 2^33 纳秒，超过的值都计入最后一个桶
+*/
+#define GNB_LATENCY_SUB_BITS     3
+#define GNB_LATENCY_SUB_NUM      (1 << GNB_LATENCY_SUB_BITS)
+#define GNB_LATENCY_BUCKET_NUM   256
+
+
+typedef struct _gnb_latency_histogram_t {
+
+	uint64_t count;
+	uint64_t max_nsec;
+	uint64_t bucket[GNB_LATENCY_BUCKET_NUM];
+
+}gnb_latency_histogram_t;
+
+
+static inline int gnb_latency_bucket_idx(uint64_t nsec){
+
+    int e;
+    int idx;
+
+    if ( nsec < GNB_LATENCY_SUB_NUM ) {
+        return (int)nsec;
+    }
+
+    e = 63 - __builtin_clzll(nsec);
+
+    idx = (e - GNB_LATENCY_SUB_BITS + 1) * GNB_LATENCY_SUB_NUM + (int)((nsec >> (e - GNB_LATENCY_SUB_BITS)) & (GNB_LATENCY_SUB_NUM - 1));
+
+    if ( idx >= GNB_LATENCY_BUCKET_NUM ) {
+        idx = GNB_LATENCY_BUCKET_NUM - 1;
+    }
+
+    return idx;
+
+}
+
+
+//桶的下限
+static inline uint64_t gnb_latency_bucket_nsec(int idx){
+
+    int e;
+
+    if ( idx < GNB_LATENCY_SUB_NUM ) {
+        return (uint64_t)idx;
+    }
+
+    e = idx / GNB_LATENCY_SUB_NUM + GNB_LATENCY_SUB_BITS - 1;
+
+    return (uint64_t)(GNB_LATENCY_SUB_NUM + idx % GNB_LATENCY_SUB_NUM) << (e - GNB_LATENCY_SUB_BITS);
+
+}
+
+
+//每个 histogram 只由一个线程写入，不需要原子操作
+static inline void gnb_latency_record(gnb_latency_histogram_t *histogram, uint64_t nsec){
+
+    histogram->bucket[gnb_latency_bucket_idx(nsec)]++;
+    histogram->count++;
+
+    if ( nsec > histogram->max_nsec ) {
+        histogram->max_nsec = nsec;
+    }
+
+}
+
+
+#endif
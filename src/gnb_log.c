@@ -21,6 +21,8 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #if defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__) || defined(__OpenBSD__)
@@ -50,6 +52,115 @@
 
 #define GNB_LOG_LINE_MAX 1024*4
 
+
+/*
+异步输出时每个线程有自己的 ring, 线程把日志的正文写入 ring 后立即返回
+由 writer 线程加上时间和日志名，合并后再写到 console 和 file, 按天切换日志文件也由 writer 线程完成
+ring 满了就丢弃这条日志并计数，不会阻塞写日志的线程
+线程退出后它的 ring 由 writer 线程输出完剩余的日志后交给新的线程使用
+*/
+#define GNB_LOG_RING_NUM       32
+#define GNB_LOG_RING_SIZE      (1024*256)
+#define GNB_LOG_RECORD_ALIGN   16
+#define GNB_LOG_RECORD_PAD     0xFF
+
+#define GNB_LOG_RING_OWNED     0
+//所属的线程已经退出，ring 中可能还有没输出的日志
+#define GNB_LOG_RING_EXITED    1
+#define GNB_LOG_RING_FREE      2
+
+#define GNB_LOG_BATCH_SIZE     (1024*16)
+
+//writer 线程没有日志可写时的休眠时间
+#define GNB_LOG_WRITER_IDLE_MS 10
+
+
+typedef struct _gnb_log_record_t {
+
+    //包括首部并按 GNB_LOG_RECORD_ALIGN 对齐的长度
+    uint32_t size;
+
+    //为 GNB_LOG_RECORD_PAD 时表示 ring 尾部不够放下一条记录，跳到 ring 的开头
+    uint8_t  log_type;
+    uint8_t  log_id;
+
+    uint16_t data_len;
+
+    uint64_t ts_sec;
+
+    char data[0];
+
+}gnb_log_record_t;
+
+
+typedef struct _gnb_log_ring_t {
+
+    //head 只由写日志的线程修改, tail 只由 writer 线程修改，放在不同的 cache line 上
+    volatile uint32_t head;
+    unsigned char pad0[60];
+
+    volatile uint32_t tail;
+    unsigned char pad1[60];
+
+    volatile uint64_t dropped;
+
+    //GNB_LOG_RING_XXX
+    volatile uint32_t state;
+
+    unsigned char buffer[GNB_LOG_RING_SIZE];
+
+}gnb_log_ring_t;
+
+
+typedef struct _gnb_log_batch_t {
+
+    int len;
+
+    char data[GNB_LOG_BATCH_SIZE];
+
+}gnb_log_batch_t;
+
+
+struct _gnb_log_async_t {
+
+    gnb_log_ctx_t *log;
+
+    volatile int running;
+
+    volatile uint32_t ring_num;
+
+    gnb_log_ring_t * volatile ring[GNB_LOG_RING_NUM];
+
+    pthread_t thread_writer;
+
+    //writer 线程和 gnb_log_async_flush 不能同时读 ring
+    pthread_mutex_t drain_lock;
+
+    uint64_t time_string_sec;
+    char time_string[GNB_TIME_STRING_MAX];
+
+    uint64_t reported_dropped;
+
+    uint64_t rotate_ts_sec;
+
+    //前面留出 4 个字节给 udp binary output 的 gnb_payload 首部
+    char line_buffer[4 + GNB_LOG_LINE_MAX + 64];
+
+    gnb_log_batch_t console_batch[3];
+    gnb_log_batch_t file_batch[3];
+
+};
+
+
+static __thread gnb_log_ring_t *local_log_ring = NULL;
+static __thread int local_log_ring_miss = 0;
+
+//用于在线程退出时释放 ring
+static pthread_key_t log_ring_key;
+static pthread_once_t log_ring_key_once = PTHREAD_ONCE_INIT;
+
+static gnb_log_ctx_t *atexit_log = NULL;
+
 static void open_log_file(gnb_log_ctx_t *log){
 
     log->std_fd   = open(log->log_file_name_std,   O_WRONLY|O_CREAT|O_APPEND, S_IRUSR|S_IWUSR);
@@ -209,6 +320,165 @@ static void log_udp_binary_output(gnb_log_ctx_t *log, uint8_t log_type, uint8_t
 }
 
 
+static void log_ring_thread_exit(void *data){
+
+    gnb_log_ring_t *ring = (gnb_log_ring_t *)data;
+
+    __sync_synchronize();
+
+    ring->state = GNB_LOG_RING_EXITED;
+
+}
+
+
+static void log_ring_key_create(void){
+    pthread_key_create(&log_ring_key, log_ring_thread_exit);
+}
+
+
+static gnb_log_ring_t* log_async_get_ring(gnb_log_async_t *async){
+
+    gnb_log_ring_t *ring;
+
+    uint32_t ring_num;
+    uint32_t idx;
+
+    if ( NULL != local_log_ring ) {
+        return local_log_ring;
+    }
+
+    if ( local_log_ring_miss ) {
+        return NULL;
+    }
+
+    //先使用已经退出的线程留下的 ring
+    ring_num = async->ring_num < GNB_LOG_RING_NUM ? async->ring_num : GNB_LOG_RING_NUM;
+
+    for ( idx=0; idx<ring_num; idx++ ) {
+
+        ring = async->ring[idx];
+
+        if ( NULL != ring && __sync_bool_compare_and_swap(&ring->state, GNB_LOG_RING_FREE, GNB_LOG_RING_OWNED) ) {
+            goto finish;
+        }
+
+    }
+
+    if ( async->ring_num >= GNB_LOG_RING_NUM ) {
+        local_log_ring_miss = 1;
+        return NULL;
+    }
+
+    idx = __sync_fetch_and_add(&async->ring_num, 1);
+
+    if ( idx >= GNB_LOG_RING_NUM ) {
+        local_log_ring_miss = 1;
+        return NULL;
+    }
+
+    ring = (gnb_log_ring_t *)malloc(sizeof(gnb_log_ring_t));
+
+    if ( NULL == ring ) {
+        local_log_ring_miss = 1;
+        return NULL;
+    }
+
+    ring->head    = 0;
+    ring->tail    = 0;
+    ring->dropped = 0;
+    ring->state   = GNB_LOG_RING_OWNED;
+
+    __sync_synchronize();
+
+    async->ring[idx] = ring;
+
+finish:
+
+    pthread_setspecific(log_ring_key, ring);
+
+    local_log_ring = ring;
+
+    return ring;
+
+}
+
+
+//返回 -1 表示当前线程没有 ring, 需要同步输出, 这时 ap 还没有被使用
+static int log_async_push(gnb_log_async_t *async, uint8_t log_type, uint8_t log_id, const char *format, va_list ap){
+
+    char data[GNB_LOG_LINE_MAX];
+
+    gnb_log_ring_t *ring;
+
+    gnb_log_record_t *record;
+
+    uint32_t head;
+    uint32_t pos;
+    uint32_t contiguous;
+    uint32_t size;
+    uint32_t need;
+
+    int len;
+
+    ring = log_async_get_ring(async);
+
+    if ( NULL == ring ) {
+        return -1;
+    }
+
+    len = vsnprintf(data, GNB_LOG_LINE_MAX, format, ap);
+
+    if ( len < 0 ) {
+        return 0;
+    }
+
+    if ( len >= GNB_LOG_LINE_MAX ) {
+        len = GNB_LOG_LINE_MAX - 1;
+    }
+
+    size = (sizeof(gnb_log_record_t) + len + GNB_LOG_RECORD_ALIGN - 1) & ~(GNB_LOG_RECORD_ALIGN - 1);
+
+    head = ring->head;
+    pos  = head & (GNB_LOG_RING_SIZE - 1);
+    contiguous = GNB_LOG_RING_SIZE - pos;
+
+    need = size <= contiguous ? size : contiguous + size;
+
+    if ( need > GNB_LOG_RING_SIZE - (head - ring->tail) ) {
+        ring->dropped++;
+        return 0;
+    }
+
+    if ( size > contiguous ) {
+
+        record = (gnb_log_record_t *)(ring->buffer + pos);
+        record->size     = contiguous;
+        record->log_type = GNB_LOG_RECORD_PAD;
+
+        head += contiguous;
+        pos   = 0;
+
+    }
+
+    record = (gnb_log_record_t *)(ring->buffer + pos);
+
+    record->size     = size;
+    record->log_type = log_type;
+    record->log_id   = log_id;
+    record->data_len = (uint16_t)len;
+    record->ts_sec   = (uint64_t)time(NULL);
+
+    memcpy(record->data, data, len);
+
+    __sync_synchronize();
+
+    ring->head = head + size;
+
+    return 0;
+
+}
+
+
 void gnb_logf(gnb_log_ctx_t *log, uint8_t log_type, uint8_t log_id, uint8_t level, const char *format, ...){
 
     char now_time_string[GNB_TIME_STRING_MAX];
@@ -222,6 +492,20 @@ void gnb_logf(gnb_log_ctx_t *log, uint8_t log_type, uint8_t log_id, uint8_t leve
 
     char *p;
 
+    va_list ap;
+
+    if ( NULL != log->async && log->async->running ) {
+
+        va_start(ap, format);
+        len = log_async_push(log->async, log_type, log_id, format, ap);
+        va_end(ap);
+
+        if ( 0 == len ) {
+            return;
+        }
+
+    }
+
     //加上 一个 offset 4 用于后面的 udp binary output 可以加上一个4字节的 gnb_payload 首部
     log_string = log_string_buffer+4;
 
@@ -239,8 +523,6 @@ void gnb_logf(gnb_log_ctx_t *log, uint8_t log_type, uint8_t log_id, uint8_t leve
 
     p += log_string_len;
 
-    va_list ap;
-
     va_start(ap, format);
 
     len = vsnprintf(p, GNB_LOG_LINE_MAX, format, ap);
@@ -406,7 +688,7 @@ gnb_log_ctx_t* gnb_log_ctx_create(){
 }
 
 
-int gnb_log_file_rotate(gnb_log_ctx_t *log){
+static int log_file_rotate(gnb_log_ctx_t *log){
 
     char now_time_string[GNB_TIME_STRING_MAX];
 
@@ -445,3 +727,291 @@ int gnb_log_file_rotate(gnb_log_ctx_t *log){
     return 0;
 
 }
+
+
+int gnb_log_file_rotate(gnb_log_ctx_t *log){
+
+    //异步输出时日志文件只由 writer 线程切换
+    if ( NULL != log->async && log->async->running ) {
+        return 0;
+    }
+
+    return log_file_rotate(log);
+
+}
+
+
+static void log_batch_flush(gnb_log_async_t *async){
+
+    gnb_log_batch_t *batch;
+
+    uint8_t log_type;
+
+    for ( log_type=GNB_LOG_TYPE_STD; log_type<=GNB_LOG_TYPE_ERROR; log_type++ ) {
+
+        batch = &async->console_batch[log_type];
+
+        if ( batch->len > 0 ) {
+            log_console_output(log_type, batch->data, batch->len);
+            batch->len = 0;
+        }
+
+        batch = &async->file_batch[log_type];
+
+        if ( batch->len > 0 ) {
+            log_file_output(async->log, log_type, batch->data, batch->len);
+            batch->len = 0;
+        }
+
+    }
+
+}
+
+
+static void log_batch_append(gnb_log_async_t *async, gnb_log_batch_t *batch, char *log_string, int log_string_len){
+
+    if ( batch->len + log_string_len > GNB_LOG_BATCH_SIZE ) {
+        log_batch_flush(async);
+    }
+
+    memcpy(batch->data + batch->len, log_string, log_string_len);
+
+    batch->len += log_string_len;
+
+}
+
+
+static void log_async_output(gnb_log_async_t *async, uint8_t log_type, uint8_t log_id, uint64_t ts_sec, char *data, int data_len){
+
+    gnb_log_ctx_t *log = async->log;
+
+    char *log_string;
+
+    int log_string_len;
+
+    if ( log_type > GNB_LOG_TYPE_ERROR ) {
+        return;
+    }
+
+    //同一秒内的日志共用格式化好的时间
+    if ( ts_sec != async->time_string_sec ) {
+        gnb_timef("%y-%m-%d %H:%M:%S", (time_t)ts_sec, async->time_string, GNB_TIME_STRING_MAX);
+        async->time_string_sec = ts_sec;
+    }
+
+    log_string = async->line_buffer + 4;
+
+    log_string_len = snprintf(log_string, 64, "%s %s ", async->time_string, log->config_table[log_id].log_name);
+
+    if ( log_string_len >= 64 ) {
+        log_string_len = 63;
+    }
+
+    memcpy(log_string + log_string_len, data, data_len);
+
+    log_string_len += data_len;
+
+    if ( log->output_type & GNB_LOG_OUTPUT_STDOUT ) {
+        log_batch_append(async, &async->console_batch[log_type], log_string, log_string_len);
+    }
+
+    if ( log->output_type & GNB_LOG_OUTPUT_FILE ) {
+        log_batch_append(async, &async->file_batch[log_type], log_string, log_string_len);
+    }
+
+    if ( log->output_type & GNB_LOG_OUTPUT_UDP ) {
+
+        if (GNB_LOG_UDP_TYPE_BINARY == log->log_udp_type) {
+            log_udp_binary_output(log, log_type, log_id, async->line_buffer, log_string_len);
+        } else {
+            log_udp_output(log, log_type, log_string, log_string_len);
+        }
+
+    }
+
+}
+
+
+static int log_async_drain(gnb_log_async_t *async){
+
+    gnb_log_ring_t *ring;
+
+    gnb_log_record_t *record;
+
+    uint32_t ring_num;
+    uint32_t head;
+    uint32_t tail;
+
+    uint64_t dropped = 0;
+
+    char report[128];
+    int report_len;
+
+    int num = 0;
+
+    int i;
+
+    ring_num = async->ring_num < GNB_LOG_RING_NUM ? async->ring_num : GNB_LOG_RING_NUM;
+
+    for ( i=0; i<ring_num; i++ ) {
+
+        ring = async->ring[i];
+
+        if ( NULL == ring ) {
+            continue;
+        }
+
+        head = ring->head;
+
+        __sync_synchronize();
+
+        tail = ring->tail;
+
+        while ( tail != head ) {
+
+            record = (gnb_log_record_t *)(ring->buffer + (tail & (GNB_LOG_RING_SIZE - 1)));
+
+            if ( GNB_LOG_RECORD_PAD != record->log_type ) {
+                log_async_output(async, record->log_type, record->log_id, record->ts_sec, record->data, record->data_len);
+                num++;
+            }
+
+            tail += record->size;
+
+        }
+
+        __sync_synchronize();
+
+        ring->tail = tail;
+
+        dropped += ring->dropped;
+
+        //线程退出前写入的日志都已经输出
+        if ( GNB_LOG_RING_EXITED == ring->state && ring->head == tail ) {
+            ring->state = GNB_LOG_RING_FREE;
+        }
+
+    }
+
+    if ( dropped > async->reported_dropped ) {
+
+        report_len = snprintf(report, 128, "log ring overflow, %"PRIu64" log records dropped\n", dropped - async->reported_dropped);
+
+        log_async_output(async, GNB_LOG_TYPE_ERROR, 0, (uint64_t)time(NULL), report, report_len);
+
+        async->reported_dropped = dropped;
+
+    }
+
+    log_batch_flush(async);
+
+    return num;
+
+}
+
+
+static void* thread_writer_func(void *data){
+
+    gnb_log_async_t *async = (gnb_log_async_t *)data;
+
+    uint64_t now_sec;
+
+    int num;
+
+    while ( async->running ) {
+
+        pthread_mutex_lock(&async->drain_lock);
+
+        num = log_async_drain(async);
+
+        now_sec = (uint64_t)time(NULL);
+
+        if ( now_sec != async->rotate_ts_sec ) {
+            log_file_rotate(async->log);
+            async->rotate_ts_sec = now_sec;
+        }
+
+        pthread_mutex_unlock(&async->drain_lock);
+
+        if ( 0 == num ) {
+            GNB_SLEEP_MILLISECOND(GNB_LOG_WRITER_IDLE_MS);
+        }
+
+    }
+
+    return NULL;
+
+}
+
+
+static void log_async_atexit(void){
+
+    gnb_log_async_flush(atexit_log);
+
+}
+
+
+int gnb_log_async_start(gnb_log_ctx_t *log){
+
+    gnb_log_async_t *async;
+
+    int ret;
+
+    if ( NULL != log->async ) {
+        return 0;
+    }
+
+    async = (gnb_log_async_t *)malloc(sizeof(gnb_log_async_t));
+
+    if ( NULL == async ) {
+        return -1;
+    }
+
+    memset(async, 0, sizeof(gnb_log_async_t));
+
+    pthread_once(&log_ring_key_once, log_ring_key_create);
+
+    async->log = log;
+    async->running = 1;
+    async->rotate_ts_sec = (uint64_t)time(NULL);
+
+    pthread_mutex_init(&async->drain_lock, NULL);
+
+    ret = pthread_create(&async->thread_writer, NULL, thread_writer_func, async);
+
+    if ( 0 != ret ) {
+        pthread_mutex_destroy(&async->drain_lock);
+        free(async);
+        return -1;
+    }
+
+    pthread_detach(async->thread_writer);
+
+    log->async = async;
+
+    //调用 exit 退出时输出 ring 中剩余的日志
+    if ( NULL == atexit_log ) {
+        atexit_log = log;
+        atexit(log_async_atexit);
+    }
+
+    return 0;
+
+}
+
+
+void gnb_log_async_flush(gnb_log_ctx_t *log){
+
+    gnb_log_async_t *async = log->async;
+
+    if ( NULL == async ) {
+        return;
+    }
+
+    pthread_mutex_lock(&async->drain_lock);
+
+    log_async_drain(async);
+
+    pthread_mutex_unlock(&async->drain_lock);
+
+}
@@ -53,6 +53,15 @@ int gnb_log_udp_open(gnb_log_ctx_t *log);
 
 int gnb_log_file_rotate(gnb_log_ctx_t *log);
 
+/*
+启动 writer 线程，之后各个线程的日志先写入线程自己的 ring, 由 writer 线程输出
+需要在 daemon fork 之后调用
+*/
+int gnb_log_async_start(gnb_log_ctx_t *log);
+
+//在当前线程把 ring 中还没有输出的日志写出去, 用于进程退出前
+void gnb_log_async_flush(gnb_log_ctx_t *log);
+
 
 int gnb_log_udp_set_addr4(gnb_log_ctx_t *log, char *ip, uint16_t port4);
 int gnb_log_udp_set_addr6(gnb_log_ctx_t *log, char *ip, uint16_t port6);
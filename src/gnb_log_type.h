@@ -44,6 +44,8 @@ typedef struct _gnb_log_config_t {
 
 #define GNB_MAX_LOG_ID 128
 
+typedef struct _gnb_log_async_t gnb_log_async_t;
+
 typedef struct _gnb_log_ctx_t {
 
 	#define GNB_LOG_OUTPUT_NONE      (0x0)
@@ -93,6 +95,9 @@ typedef struct _gnb_log_ctx_t {
 
 	gnb_log_config_t config_table[GNB_MAX_LOG_ID];
 
+	//不为 NULL 时日志由 writer 线程异步输出
+	struct _gnb_log_async_t *async;
+
 }gnb_log_ctx_t;
 
 #endif
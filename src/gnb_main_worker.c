@@ -15,6 +15,11 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+//recvmmsg
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -54,23 +59,52 @@
 #include <pthread.h>
 
 #include "gnb_node.h"
+#include "gnb_conf_file.h"
 #include "gnb_ring_buffer.h"
+#include "gnb_packet_pool.h"
 #include "gnb_worker_queue_data.h"
 
+#include "gnb_route_frame_type.h"
+#include "gnb_fwdu0_frame_type.h"
 #include "gnb_fwdu2_frame_type.h"
 
 #include "gnb_time.h"
 #include "gnb_udp.h"
+#include "gnb_speedtest.h"
 
 #ifdef __UNIX_LIKE_OS__
 void bind_socket_if(gnb_core_t *gnb_core);
 #endif
 
 
+//tun 读入的分组在 pf 中处理完就释放，这是可以同时在 pf 中处理的分组数
+#define GNB_MAIN_WORKER_TUN_PACKET_NUM  GNB_PF_BATCH_MAX
+
+//一次从 udp socket 读入的分组数
+#define GNB_MAIN_WORKER_UDP_PACKET_NUM  GNB_PF_BATCH_MAX
+
+//handle_udp_payload 的返回值
+#define GNB_UDP_PAYLOAD_DONE    0
+#define GNB_UDP_PAYLOAD_IPFRAME 1
+//buffer 已经交给 worker
+#define GNB_UDP_PAYLOAD_QUEUED  2
+
+
 typedef struct _main_worker_ctx_t{
 
     gnb_core_t *gnb_core;
 
+    //pool 在读 tun 和 udp 的线程中创建，内存分配在这个线程所在的 NUMA node 上
+    gnb_packet_pool_t *tun_packet_pool;
+
+    //一次从 tun 读入的分组数，tun 是阻塞的时候只能为 1
+    int tun_batch;
+
+    //收到的 index node 分组通过 worker 的 queue 交给 worker, 由 worker 释放
+    gnb_packet_pool_t *inet_packet_pool;
+
+    uint32_t inet_packet_num;
+
 #ifdef __UNIX_LIKE_OS__
     pthread_t tun_udp_loop_thread;
 #endif
@@ -84,26 +118,14 @@ typedef struct _main_worker_ctx_t{
 }main_worker_ctx_t;
 
 
-#pragma pack(push, 1)
-
-typedef struct _gnb_fwdu0_frame_head_t {
-
-    uint8_t  dst_addr4[4];
-    uint16_t dst_port4;
-
-    unsigned char passcode[4];
-
-} __attribute__ ((__packed__)) gnb_fwdu0_frame_head_t;
-
-#pragma pack(pop)
-
-
-
-void gnb_send_fwdu0_frame(gnb_core_t *gnb_core, gnb_node_t *dst_node, gnb_payload16_t *payload){
+/*
+ payload 之前有 headroom 时在 payload 前面填充 fwdu0 的头部直接发出，否则把头部和 payload 作为两段用 sendmsg 发出
+*/
+void gnb_send_fwdu0_frame(gnb_core_t *gnb_core, gnb_node_t *dst_node, gnb_payload16_t *payload, uint16_t headroom){
 
-    unsigned char buffer[GNB_MAX_PAYLOAD_SIZE];
+    unsigned char head[GNB_FWDU0_HEAD_SIZE];
 
-    gnb_payload16_t *fwd_payload = (gnb_payload16_t *)buffer;
+    gnb_payload16_t *fwd_payload = (gnb_payload16_t *)head;
 
     gnb_address_t *dst_address = gnb_select_available_address4(gnb_core, dst_node);
 
@@ -129,6 +151,7 @@ void gnb_send_fwdu0_frame(gnb_core_t *gnb_core, gnb_node_t *dst_node, gnb_payloa
     gnb_fwdu0_frame_head_t *fwdu0_frame_head = (gnb_fwdu0_frame_head_t *)fwd_payload->data;
 
     fwd_payload->type = GNB_PAYLOAD_TYPE_FWDU0;
+    fwd_payload->sub_type = 0;
 
     memcpy(fwdu0_frame_head->dst_addr4, &dst_address->m_address4, 4);
     fwdu0_frame_head->dst_port4 = dst_address->port;
@@ -137,11 +160,18 @@ void gnb_send_fwdu0_frame(gnb_core_t *gnb_core, gnb_node_t *dst_node, gnb_payloa
 
     uint16_t payload_size = gnb_payload16_size(payload);
 
-    memcpy(fwd_payload->data + sizeof(gnb_fwdu0_frame_head_t), payload, payload_size);
+    if ( GNB_FWDU0_HEAD_SIZE + payload_size > GNB_MAX_PAYLOAD_SIZE ) {
+        return;
+    }
 
     gnb_payload16_set_data_len(fwd_payload, sizeof(gnb_fwdu0_frame_head_t) + payload_size);
 
-    gnb_send_to_address(gnb_core, fwd_address, fwd_payload);
+    if ( headroom >= GNB_FWDU0_HEAD_SIZE ) {
+        memcpy((unsigned char *)payload - GNB_FWDU0_HEAD_SIZE, head, GNB_FWDU0_HEAD_SIZE);
+        gnb_send_to_address(gnb_core, fwd_address, (gnb_payload16_t *)((unsigned char *)payload - GNB_FWDU0_HEAD_SIZE));
+    } else {
+        gnb_send_head_payload_to_address(gnb_core, fwd_address, head, GNB_FWDU0_HEAD_SIZE, payload);
+    }
 
     if ( 1==gnb_core->conf->if_dump ){
         GNB_LOG3(gnb_core->log,GNB_LOG_ID_MAIN_WORKER, "send ufwd4 =>[%s]=>dst_addr[%s:%d]\n",GNB_IP_PORT_STR1(fwd_address), GNB_ADDR4STR2(fwdu0_frame_head->dst_addr4), ntohs(fwdu0_frame_head->dst_port4));
@@ -196,10 +226,13 @@ static void handle_fwdu2_frame(gnb_core_t *gnb_core, gnb_payload16_t *payload){
         fwd_node = (gnb_node_t *)GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, dst_uuid32);
 
         if ( NULL==fwd_node ) {
+            GNB_METRICS_INC(gnb_core->inet_metrics, GNB_METRIC_DROP_ROUTE_MISS);
             return;
         }
 
-        gnb_forward_payload_to_node(gnb_core, fwd_node, payload);
+        if ( 0 != gnb_forward_payload_to_node(gnb_core, fwd_node, payload) ) {
+            GNB_METRICS_INC(gnb_core->inet_metrics, GNB_METRIC_SEND_ERROR);
+        }
 
         return;
 
@@ -230,108 +263,131 @@ static void handle_fwdu2_frame(gnb_core_t *gnb_core, gnb_payload16_t *payload){
 }
 
 
-static gnb_worker_queue_data_t* make_worker_receive_queue_data(gnb_worker_t *worker, gnb_sockaddress_t *node_addr, uint8_t socket_idx, gnb_payload16_t *payload){
+static gnb_packet_pool_t* create_packet_pool(gnb_core_t *gnb_core, uint32_t num, uint32_t payload_block_size){
 
-    gnb_worker_queue_data_t *receive_queue_data;
+    gnb_packet_pool_t *packet_pool;
 
-    gnb_ring_node_t *ring_node = gnb_ring_buffer_push(worker->ring_buffer);
+    int flags = 0;
 
-    if (NULL==ring_node) {
-        return NULL;
+    if ( gnb_core->conf->packet_pool_hugepage ) {
+        flags |= GNB_PACKET_POOL_HUGEPAGE;
     }
 
-    receive_queue_data = (gnb_worker_queue_data_t *)ring_node->data;
+    if ( gnb_core->conf->packet_pool_numa ) {
+        flags |= GNB_PACKET_POOL_NUMA_LOCAL;
+    }
 
-    ring_node->size = worker->ring_buffer->block_size;
+    packet_pool = gnb_packet_pool_create(gnb_core->heap, num, GNB_PAYLOAD_HEADROOM, sizeof(gnb_payload16_t) + payload_block_size, GNB_PAYLOAD_TAILROOM, flags);
 
-    receive_queue_data->type = GNB_WORKER_QUEUE_DATA_TYPE_NODE_IN;
+    if ( NULL == packet_pool ) {
+        GNB_LOG1(gnb_core->log, GNB_LOG_ID_MAIN_WORKER, "create packet pool num[%u] error\n", num);
+        return NULL;
+    }
 
-    memcpy(&receive_queue_data->data.node_in.node_addr_st, node_addr, sizeof(gnb_sockaddress_t));
+    GNB_LOG1(gnb_core->log, GNB_LOG_ID_MAIN_WORKER, "create packet pool num[%u] hugepage[%s] numa local[%s]\n", num,
+             (gnb_packet_pool_flags(packet_pool) & GNB_PACKET_POOL_HUGEPAGE) ? "on" : "off",
+             (gnb_packet_pool_flags(packet_pool) & GNB_PACKET_POOL_NUMA_LOCAL) ? "on" : "off");
 
-    receive_queue_data->data.node_in.socket_idx = socket_idx;
+    return packet_pool;
 
-    memcpy(&receive_queue_data->data.node_in.payload_st,payload,gnb_payload16_size(payload));
+}
 
-    return receive_queue_data;
 
-}
+/*
+payload 所在的 buffer 的所有权转给 worker
+*/
+static gnb_worker_queue_data_t* make_worker_receive_queue_data(gnb_core_t *gnb_core, gnb_worker_t *worker, uint16_t trace_queue, gnb_sockaddress_t *node_addr, uint8_t socket_idx, gnb_packet_buf_t *packet_buf, gnb_payload16_t *payload){
 
+    gnb_worker_queue_data_t *receive_queue_data;
 
+    gnb_ring_node_t *ring_node;
 
-static void handle_udp(gnb_core_t *gnb_core, uint8_t socket_idx, int af){
+    ring_node = gnb_ring_buffer_push(worker->ring_buffer);
 
-    ssize_t n_recv;
+    if ( GNB_TRACE_ON(gnb_core->trace, GNB_TRACE_QUEUE_PUSH) ) {
+        gnb_trace_emit(gnb_core->trace, GNB_TRACE_QUEUE_PUSH, trace_queue, payload->type, payload->sub_type, gnb_payload16_size(payload), NULL==ring_node);
+    }
 
-    gnb_sockaddress_t node_addr_st;
+    if (NULL==ring_node) {
+        return NULL;
+    }
 
-    switch (af){
+    receive_queue_data = (gnb_worker_queue_data_t *)ring_node->data;
 
-        case AF_INET6:
+    ring_node->size = worker->ring_buffer->block_size;
 
-            node_addr_st.socklen = sizeof(struct sockaddr_in6);
+    receive_queue_data->type = GNB_WORKER_QUEUE_DATA_TYPE_NODE_IN;
 
-            n_recv = recvfrom(gnb_core->udp_ipv6_sockets[socket_idx], (void *)gnb_core->inet_payload, GNB_INET_PAYLOAD_BLOCK_SIZE, 0, (struct sockaddr *)&node_addr_st.addr.in6, &node_addr_st.socklen);
-            node_addr_st.addr_type = AF_INET6;
+    memcpy(&receive_queue_data->data.node_in.node_addr_st, node_addr, sizeof(gnb_sockaddress_t));
 
-            break;
+    receive_queue_data->data.node_in.socket_idx = socket_idx;
 
-        case AF_INET:
+    receive_queue_data->data.node_in.packet_buf = packet_buf;
 
-            node_addr_st.socklen = sizeof(struct sockaddr_in);
+    receive_queue_data->data.node_in.payload = payload;
 
-            n_recv = recvfrom(gnb_core->udp_ipv4_sockets[socket_idx], (void *)gnb_core->inet_payload, GNB_INET_PAYLOAD_BLOCK_SIZE, 0, (struct sockaddr *)&node_addr_st.addr.in, &node_addr_st.socklen);
-            node_addr_st.addr_type = AF_INET;
+    return receive_queue_data;
 
-            break;
+}
 
-        default:
-            n_recv = 0;
-            break;
 
-    }
 
-    if ( n_recv <= 0 ) {
-        goto finish;
-    }
+/*
+返回 GNB_UDP_PAYLOAD_QUEUED 时 packet_buf 的所有权已经转给 worker
+*/
+static int handle_udp_payload(gnb_core_t *gnb_core, uint8_t socket_idx, gnb_packet_buf_t *packet_buf, gnb_payload16_t *inet_payload, ssize_t n_recv, gnb_sockaddress_t *node_addr_st){
+
+    gnb_worker_queue_data_t *receive_queue_data;
 
-    node_addr_st.protocol = SOCK_DGRAM;
+    uint16_t payload_size;
 
-    uint16_t payload_size = gnb_payload16_size(gnb_core->inet_payload);
+    GNB_METRICS_INC(gnb_core->inet_metrics, GNB_METRIC_RX_PKT);
+    GNB_METRICS_ADD(gnb_core->inet_metrics, GNB_METRIC_RX_BYTES, n_recv);
+
+    payload_size = gnb_payload16_size(inet_payload);
 
     if ( payload_size != n_recv ) {
         GNB_LOG3(gnb_core->log,GNB_LOG_ID_MAIN_WORKER, "handle_udp payload_size != n_recv n_recv[%lu] payload_size[%u]\n", n_recv, payload_size);
-        goto finish;
+        GNB_METRICS_INC(gnb_core->inet_metrics, GNB_METRIC_DROP_BAD_PAYLOAD);
+        return GNB_UDP_PAYLOAD_DONE;
     }
 
-    if ( GNB_PAYLOAD_TYPE_IPFRAME == gnb_core->inet_payload->type ) {
-        gnb_pf_inet(gnb_core, gnb_core->inet_payload, &node_addr_st);
-        goto finish;
+    //ipframe 由 handle_udp 收集后作为一批交给 gnb_pf_inet_batch
+    if ( GNB_PAYLOAD_TYPE_IPFRAME == inet_payload->type ) {
+        return GNB_UDP_PAYLOAD_IPFRAME;
     }
 
-    gnb_worker_queue_data_t *receive_queue_data;
-
     //收到 index 类型的paload 就放到 index_worker 或 index_service_worker queue 中
-    if( GNB_PAYLOAD_TYPE_INDEX == gnb_core->inet_payload->type ){
+    if( GNB_PAYLOAD_TYPE_INDEX == inet_payload->type ){
 
-        switch ( gnb_core->inet_payload->sub_type ) {
+        switch ( inet_payload->sub_type ) {
 
         case PAYLOAD_SUB_TYPE_POST_ADDR    :
         case PAYLOAD_SUB_TYPE_REQUEST_ADDR :
 
                 if ( 0 == gnb_core->conf->activate_index_service_worker) {
-                    goto finish;
+                    return GNB_UDP_PAYLOAD_DONE;
+                }
+
+                //pool 用完时收在 core zone 的 buffer 中，不能交给 worker
+                if ( NULL == packet_buf ) {
+                    GNB_METRICS_INC(gnb_core->inet_metrics, GNB_METRIC_DROP_POOL_EMPTY);
+                    return GNB_UDP_PAYLOAD_DONE;
                 }
 
-                receive_queue_data = make_worker_receive_queue_data(gnb_core->index_service_worker, &node_addr_st, socket_idx, gnb_core->inet_payload);
+                receive_queue_data = make_worker_receive_queue_data(gnb_core, gnb_core->index_service_worker, GNB_TRACE_QUEUE_INDEX_SERVICE, node_addr_st, socket_idx, packet_buf, inet_payload);
 
                 if (NULL==receive_queue_data) {
-                    goto finish;
+                    GNB_METRICS_INC(gnb_core->inet_metrics, GNB_METRIC_DROP_INDEX_SERVICE_QUEUE_FULL);
+                    return GNB_UDP_PAYLOAD_DONE;
                 }
 
                 gnb_ring_buffer_push_submit(gnb_core->index_service_worker->ring_buffer);
 
                 gnb_core->index_service_worker->notify(gnb_core->index_service_worker);
 
+                return GNB_UDP_PAYLOAD_QUEUED;
+
              break;
 
         case PAYLOAD_SUB_TYPE_ECHO_ADDR    :
@@ -339,19 +395,28 @@ static void handle_udp(gnb_core_t *gnb_core, uint8_t socket_idx, int af){
         case PAYLOAD_SUB_TYPE_DETECT_ADDR  :
 
                 if ( 0 == gnb_core->conf->activate_index_worker) {
-                    goto finish;
+                    return GNB_UDP_PAYLOAD_DONE;
+                }
+
+                //pool 用完时收在 core zone 的 buffer 中，不能交给 worker
+                if ( NULL == packet_buf ) {
+                    GNB_METRICS_INC(gnb_core->inet_metrics, GNB_METRIC_DROP_POOL_EMPTY);
+                    return GNB_UDP_PAYLOAD_DONE;
                 }
 
-                receive_queue_data = make_worker_receive_queue_data(gnb_core->index_worker, &node_addr_st, socket_idx, gnb_core->inet_payload);
+                receive_queue_data = make_worker_receive_queue_data(gnb_core, gnb_core->index_worker, GNB_TRACE_QUEUE_INDEX, node_addr_st, socket_idx, packet_buf, inet_payload);
 
                 if (NULL==receive_queue_data) {
-                    goto finish;
+                    GNB_METRICS_INC(gnb_core->inet_metrics, GNB_METRIC_DROP_INDEX_QUEUE_FULL);
+                    return GNB_UDP_PAYLOAD_DONE;
                 }
 
                 gnb_ring_buffer_push_submit(gnb_core->index_worker->ring_buffer);
 
                 gnb_core->index_worker->notify(gnb_core->index_worker);
 
+                return GNB_UDP_PAYLOAD_QUEUED;
+
             break;
 
         default :
@@ -360,65 +425,308 @@ static void handle_udp(gnb_core_t *gnb_core, uint8_t socket_idx, int af){
 
         }
 
-        goto finish;
+        return GNB_UDP_PAYLOAD_DONE;
 
     }
 
     //收到 node 类型的paload 就放到 node_worker queue 中
-    if ( GNB_PAYLOAD_TYPE_NODE == gnb_core->inet_payload->type ) {
+    if ( GNB_PAYLOAD_TYPE_NODE == inet_payload->type ) {
+
+        if ( NULL == packet_buf ) {
+            GNB_METRICS_INC(gnb_core->inet_metrics, GNB_METRIC_DROP_POOL_EMPTY);
+            return GNB_UDP_PAYLOAD_DONE;
+        }
 
-        receive_queue_data = make_worker_receive_queue_data(gnb_core->node_worker, &node_addr_st, socket_idx, gnb_core->inet_payload);
+        receive_queue_data = make_worker_receive_queue_data(gnb_core, gnb_core->node_worker, GNB_TRACE_QUEUE_NODE, node_addr_st, socket_idx, packet_buf, inet_payload);
 
         if (NULL==receive_queue_data) {
             //queue is FULL
-            goto finish;
+            GNB_METRICS_INC(gnb_core->inet_metrics, GNB_METRIC_DROP_NODE_QUEUE_FULL);
+            return GNB_UDP_PAYLOAD_DONE;
         }
 
         gnb_ring_buffer_push_submit(gnb_core->node_worker->ring_buffer);
 
         gnb_core->node_worker->notify(gnb_core->node_worker);
 
-        goto finish;
+        return GNB_UDP_PAYLOAD_QUEUED;
 
     }
 
 
-    if ( GNB_PAYLOAD_TYPE_FWDU2 == gnb_core->inet_payload->type ) {
-        handle_fwdu2_frame(gnb_core, gnb_core->inet_payload);
-        goto finish;
+    if ( GNB_PAYLOAD_TYPE_FWDU2 == inet_payload->type ) {
+        GNB_METRICS_INC(gnb_core->inet_metrics, GNB_METRIC_FWDU_PKT);
+        handle_fwdu2_frame(gnb_core, inet_payload);
+        return GNB_UDP_PAYLOAD_DONE;
     }
 
 
-    if ( 1 == gnb_core->conf->fwdu0 && GNB_PAYLOAD_TYPE_FWDU0 == gnb_core->inet_payload->type ) {
-        handle_fwdu0_frame(gnb_core, gnb_core->inet_payload);
-        goto finish;
+    if ( 1 == gnb_core->conf->fwdu0 && GNB_PAYLOAD_TYPE_FWDU0 == inet_payload->type ) {
+        GNB_METRICS_INC(gnb_core->inet_metrics, GNB_METRIC_FWDU_PKT);
+        handle_fwdu0_frame(gnb_core, inet_payload);
+        return GNB_UDP_PAYLOAD_DONE;
     }
 
-finish:
+    return GNB_UDP_PAYLOAD_DONE;
+
+}
+
+
+
+
+/*
+一次读出 socket 中已有的分组，最多 num 个，每个分组收到 payloads 中对应的 buffer
+linux 下用 recvmmsg, 其他 unix-like 系统用非阻塞的 recvfrom, Windows 下每次读一个
+*/
+static int udp_recv_batch(int sockfd, int af, gnb_payload16_t **payloads, gnb_sockaddress_t *node_addrs, ssize_t *n_recvs, int num){
+
+    int n = 0;
 
-    return;
+#if defined(__linux__)
+
+    struct mmsghdr msgs[GNB_MAIN_WORKER_UDP_PACKET_NUM];
+    struct iovec iovecs[GNB_MAIN_WORKER_UDP_PACKET_NUM];
+
+    int i;
+
+    memset(msgs, 0, sizeof(struct mmsghdr) * num);
+
+    for ( i=0; i<num; i++ ) {
+
+        iovecs[i].iov_base = (void *)payloads[i];
+        iovecs[i].iov_len  = GNB_INET_PAYLOAD_BLOCK_SIZE;
+
+        msgs[i].msg_hdr.msg_name    = (void *)&node_addrs[i].addr;
+        msgs[i].msg_hdr.msg_namelen = AF_INET6 == af ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+        msgs[i].msg_hdr.msg_iov     = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen  = 1;
+
+    }
+
+    //select 返回可读后至少能读到一个
+    n = recvmmsg(sockfd, msgs, num, MSG_DONTWAIT, NULL);
+
+    for ( i=0; i<n; i++ ) {
+        node_addrs[i].socklen = msgs[i].msg_hdr.msg_namelen;
+        n_recvs[i] = msgs[i].msg_len;
+    }
+
+#else
+
+    int flags = 0;
+
+    #ifdef __UNIX_LIKE_OS__
+    flags = MSG_DONTWAIT;
+    #else
+    num = 1;
+    #endif
+
+    while ( n < num ) {
+
+        node_addrs[n].socklen = AF_INET6 == af ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+        n_recvs[n] = recvfrom(sockfd, (void *)payloads[n], GNB_INET_PAYLOAD_BLOCK_SIZE, flags, (struct sockaddr *)&node_addrs[n].addr, &node_addrs[n].socklen);
+
+        if ( n_recvs[n] <= 0 ) {
+            break;
+        }
+
+        n++;
+
+    }
+
+#endif
+
+    return n > 0 ? n : 0;
 
 }
 
 
+/*
+udp 收到的 ipframe 作为一批交给 gnb_pf_inet_batch, 其他分组交给对应的 worker
+*/
+static void handle_udp(gnb_core_t *gnb_core, uint8_t socket_idx, int af){
+
+    main_worker_ctx_t *main_worker_ctx = gnb_core->main_worker->ctx;
+
+    gnb_packet_buf_t  *packet_bufs[GNB_MAIN_WORKER_UDP_PACKET_NUM];
+    gnb_payload16_t   *inet_payloads[GNB_MAIN_WORKER_UDP_PACKET_NUM];
+    gnb_sockaddress_t  node_addrs[GNB_MAIN_WORKER_UDP_PACKET_NUM];
+    ssize_t            n_recvs[GNB_MAIN_WORKER_UDP_PACKET_NUM];
+
+    gnb_packet_buf_t  *ipframe_bufs[GNB_MAIN_WORKER_UDP_PACKET_NUM];
+    gnb_payload16_t   *ipframe_payloads[GNB_MAIN_WORKER_UDP_PACKET_NUM];
+    gnb_sockaddress_t *ipframe_addrs[GNB_MAIN_WORKER_UDP_PACKET_NUM];
+
+    int sockfd;
+    int buf_num;
+    int num;
+    int ipframe_num = 0;
+    int ret;
+    int i;
+
+    switch (af){
+
+        case AF_INET6:
+            sockfd = gnb_core->udp_ipv6_sockets[socket_idx];
+            break;
+
+        case AF_INET:
+            sockfd = gnb_core->udp_ipv4_sockets[socket_idx];
+            break;
+
+        default:
+            return;
+
+    }
+
+    for ( buf_num=0; buf_num<GNB_MAIN_WORKER_UDP_PACKET_NUM; buf_num++ ) {
+
+        packet_bufs[buf_num] = gnb_packet_buf_alloc(main_worker_ctx->inet_packet_pool);
+
+        if ( NULL == packet_bufs[buf_num] ) {
+            break;
+        }
+
+        inet_payloads[buf_num] = (gnb_payload16_t *)gnb_packet_buf_payload(packet_bufs[buf_num]);
+
+    }
+
+    //pool 用完时收到 core zone 的 buffer 中，ipframe 仍然可以处理
+    if ( 0 == buf_num ) {
+        packet_bufs[0]   = NULL;
+        inet_payloads[0] = gnb_core->inet_payload;
+        buf_num = 1;
+    }
+
+    num = udp_recv_batch(sockfd, af, inet_payloads, node_addrs, n_recvs, buf_num);
+
+    for ( i=0; i<num; i++ ) {
+
+        node_addrs[i].addr_type = af;
+        node_addrs[i].protocol  = SOCK_DGRAM;
+
+        ret = handle_udp_payload(gnb_core, socket_idx, packet_bufs[i], inet_payloads[i], n_recvs[i], &node_addrs[i]);
+
+        if ( GNB_UDP_PAYLOAD_IPFRAME == ret ) {
+            ipframe_bufs[ipframe_num]     = packet_bufs[i];
+            ipframe_payloads[ipframe_num] = inet_payloads[i];
+            ipframe_addrs[ipframe_num]    = &node_addrs[i];
+            ipframe_num++;
+            continue;
+        }
+
+        if ( GNB_UDP_PAYLOAD_DONE == ret && NULL != packet_bufs[i] ) {
+            gnb_packet_buf_unref(packet_bufs[i]);
+        }
+
+    }
+
+    //没有用到的 buffer 放回 pool
+    for ( i=num; i<buf_num; i++ ) {
+
+        if ( NULL != packet_bufs[i] ) {
+            gnb_packet_buf_unref(packet_bufs[i]);
+        }
+
+    }
+
+    if ( 0 == ipframe_num ) {
+        return;
+    }
+
+    gnb_pf_inet_batch(gnb_core, ipframe_payloads, ipframe_addrs, ipframe_num);
+
+    for ( i=0; i<ipframe_num; i++ ) {
+
+        if ( NULL != ipframe_bufs[i] ) {
+            gnb_packet_buf_unref(ipframe_bufs[i]);
+        }
+
+    }
+
+}
+
+
+/*
+tun 为非阻塞时一次读出 tun 中已有的分组，最多 tun_batch 个，作为一批交给 gnb_pf_tun_batch
+*/
 static int handle_tun(gnb_core_t *gnb_core){
 
+    main_worker_ctx_t *main_worker_ctx = gnb_core->main_worker->ctx;
+
+    gnb_packet_buf_t *packet_bufs[GNB_MAIN_WORKER_TUN_PACKET_NUM];
+    gnb_payload16_t  *tun_payloads[GNB_MAIN_WORKER_TUN_PACKET_NUM];
+
+    gnb_packet_buf_t *packet_buf;
+    gnb_payload16_t  *tun_payload;
+
     ssize_t rlen;
 
-    //tun模式下这里得到的payload是ip分组, tap模式下是以太网分组,现在都是tun模式
-    rlen = gnb_core->drv->read_tun(gnb_core, gnb_core->tun_payload->data + gnb_core->tun_payload_offset, GNB_TUN_PAYLOAD_BLOCK_SIZE);
+    int num = 0;
+
+    int i;
+
+    while ( num < main_worker_ctx->tun_batch ) {
+
+        packet_buf = gnb_packet_buf_alloc(main_worker_ctx->tun_packet_pool);
+
+        if ( NULL != packet_buf ) {
+            tun_payload = (gnb_payload16_t *)gnb_packet_buf_payload(packet_buf);
+        } else if ( 0 == num ) {
+            tun_payload = gnb_core->tun_payload;
+        } else {
+            break;
+        }
+
+        /*
+        tun模式下这里得到的payload是ip分组, tap模式下是以太网分组,现在都是tun模式
+        gnb_pf_route 中继时在 ip 分组后面就地写入 relay trailer, 读入的长度要为最长的 relay trailer 留出空间，
+        core zone 的 tun_payload 没有 tailroom, 这样 trailer 也不会写到 buffer 之外
+        */
+        rlen = gnb_core->drv->read_tun(gnb_core, tun_payload->data + gnb_core->tun_payload_offset, GNB_TUN_PAYLOAD_BLOCK_SIZE - gnb_core->tun_payload_offset - GNB_ROUTE_RELAY_TRAILER_MAX);
+
+        if ( rlen<=0 ){
+
+            if ( NULL != packet_buf ) {
+                gnb_packet_buf_unref(packet_buf);
+            }
+
+            break;
+
+        }
+
+        gnb_payload16_set_size(tun_payload, GNB_PAYLOAD16_HEAD_SIZE + gnb_core->tun_payload_offset + rlen);
+
+        GNB_METRICS_INC(gnb_core->tun_metrics, GNB_METRIC_RX_PKT);
+        GNB_METRICS_ADD(gnb_core->tun_metrics, GNB_METRIC_RX_BYTES, rlen);
+
+        packet_bufs[num]  = packet_buf;
+        tun_payloads[num] = tun_payload;
+        num++;
+
+        //core zone 的 buffer 只有一个
+        if ( NULL == packet_buf ) {
+            break;
+        }
 
-    if ( rlen<=0 ){
-        goto finish;
     }
 
-    gnb_payload16_set_size(gnb_core->tun_payload, GNB_PAYLOAD16_HEAD_SIZE + gnb_core->tun_payload_offset + rlen);
+    if ( 0 == num ) {
+        return 0;
+    }
 
-    gnb_pf_tun(gnb_core,gnb_core->tun_payload);
+    gnb_pf_tun_batch(gnb_core, tun_payloads, num);
 
-finish:
+    for ( i=0; i<num; i++ ) {
 
-    return rlen;
+        if ( NULL != packet_bufs[i] ) {
+            gnb_packet_buf_unref(packet_bufs[i]);
+        }
+
+    }
+
+    return num;
 
 }
 
@@ -434,22 +742,13 @@ static void* tun_loop_thread_func( void *data ) {
 
     gnb_core_t *gnb_core = main_worker_ctx->gnb_core;
 
-    ssize_t rlen;
+    main_worker_ctx->tun_packet_pool = create_packet_pool(gnb_core, GNB_MAIN_WORKER_TUN_PACKET_NUM, GNB_TUN_PAYLOAD_BLOCK_SIZE);
 
     gnb_core->loop_flag = 1;
 
     while ( gnb_core->loop_flag ) {
-
-        rlen = gnb_core->drv->read_tun(gnb_core, gnb_core->tun_payload->data + gnb_core->tun_payload_offset, GNB_TUN_PAYLOAD_BLOCK_SIZE);
-
-        if (rlen<=0){
-            continue;
-        }
-
-        gnb_payload16_set_size(gnb_core->tun_payload, GNB_PAYLOAD16_HEAD_SIZE + gnb_core->tun_payload_offset + rlen);
-
-        gnb_pf_tun(gnb_core,gnb_core->tun_payload);
-
+        gnb_config_file_reload_quiescent(gnb_core, GNB_NODE_TABLE_READER_TUN);
+        handle_tun(gnb_core);
     }
 
     return NULL;
@@ -465,6 +764,8 @@ static void* udp_loop_thread_func( void *data ) {
 
     gnb_core_t *gnb_core = main_worker_ctx->gnb_core;
 
+    main_worker_ctx->inet_packet_pool = create_packet_pool(gnb_core, main_worker_ctx->inet_packet_num, GNB_INET_PAYLOAD_BLOCK_SIZE);
+
     int n_ready;
 
     struct timeval timeout;
@@ -518,14 +819,30 @@ static void* udp_loop_thread_func( void *data ) {
 
     uint64_t pre_usec = 0l;
 
+    int speedtest_poll_usec;
+
     while (gnb_core->loop_flag) {
 
+        //热加载准备好的 node 表在两次处理之间换入
+        if ( NULL != gnb_core->pending_reload ) {
+            gnb_config_file_reload_apply(gnb_core);
+        }
+
+        gnb_config_file_reload_quiescent(gnb_core, GNB_NODE_TABLE_READER_MAIN);
+
         readfds = allset;
 
         //由于在Windows下pthread_kill不起作用，因此不能依靠信号打断 select，因此把select的超时时间设短
         timeout.tv_sec  = 0l;
         timeout.tv_usec = 10000l;
 
+        //speedtest 进行中时按发送测试分组的间隔缩短超时时间
+        speedtest_poll_usec = gnb_speedtest_poll_usec(gnb_core);
+
+        if ( speedtest_poll_usec >= 0 ) {
+            timeout.tv_usec = speedtest_poll_usec;
+        }
+
         n_ready = select( maxfd + 1, &readfds, NULL, NULL, &timeout );
 
         if (-1 == n_ready) {
@@ -562,6 +879,9 @@ static void* udp_loop_thread_func( void *data ) {
 
         }
 
+        gnb_pf_timer(gnb_core);
+
+        gnb_speedtest_timer(gnb_core);
 
     }//while()
 
@@ -597,6 +917,9 @@ static void* tun_udp_loop_thread_func(void *data){
 
     gnb_core_t *gnb_core = main_worker_ctx->gnb_core;
 
+    main_worker_ctx->tun_packet_pool  = create_packet_pool(gnb_core, GNB_MAIN_WORKER_TUN_PACKET_NUM, GNB_TUN_PAYLOAD_BLOCK_SIZE);
+    main_worker_ctx->inet_packet_pool = create_packet_pool(gnb_core, main_worker_ctx->inet_packet_num, GNB_INET_PAYLOAD_BLOCK_SIZE);
+
 
     int n_ready;
 
@@ -610,6 +933,8 @@ static void* tun_udp_loop_thread_func(void *data){
 
     int maxfd = 0;
 
+    int flags;
+
     if ( gnb_core->conf->activate_tun ) {
 
         if ( -1 == gnb_core->tun_fd ) {
@@ -620,6 +945,13 @@ static void* tun_udp_loop_thread_func(void *data){
         FD_SET(gnb_core->tun_fd, &allset);
         maxfd = gnb_core->tun_fd;
 
+        //select 返回后读出 tun 中所有的分组，设置失败时每次只读一个
+        flags = fcntl(gnb_core->tun_fd, F_GETFL);
+
+        if ( -1 != flags && 0 == fcntl(gnb_core->tun_fd, F_SETFL, flags | O_NONBLOCK) ) {
+            main_worker_ctx->tun_batch = GNB_MAIN_WORKER_TUN_PACKET_NUM;
+        }
+
     }
 
     int i;
@@ -662,13 +994,30 @@ static void* tun_udp_loop_thread_func(void *data){
 
     static unsigned long c = 0;
 
+    int speedtest_poll_usec;
+
     while(gnb_core->loop_flag){
 
+        //热加载准备好的 node 表在两次处理之间换入
+        if ( NULL != gnb_core->pending_reload ) {
+            gnb_config_file_reload_apply(gnb_core);
+        }
+
+        gnb_config_file_reload_quiescent(gnb_core, GNB_NODE_TABLE_READER_MAIN);
+
         readfds = allset;
 
         timeout.tv_sec  = 1l;
         timeout.tv_usec = 10000l;
 
+        //speedtest 进行中时按发送测试分组的间隔缩短超时时间
+        speedtest_poll_usec = gnb_speedtest_poll_usec(gnb_core);
+
+        if ( speedtest_poll_usec >= 0 ) {
+            timeout.tv_sec  = 0l;
+            timeout.tv_usec = speedtest_poll_usec;
+        }
+
         n_ready = select( maxfd + 1, &readfds, NULL, NULL, &timeout );
 
         if (-1 == n_ready) {
@@ -715,6 +1064,9 @@ static void* tun_udp_loop_thread_func(void *data){
 
         }
 
+        gnb_pf_timer(gnb_core);
+
+        gnb_speedtest_timer(gnb_core);
 
     }//while()
 
@@ -751,6 +1103,8 @@ static void init(gnb_worker_t *gnb_worker, void *ctx){
 
     main_worker_ctx_t *main_worker_ctx =  (main_worker_ctx_t *)gnb_heap_alloc(gnb_core->heap, sizeof(main_worker_ctx_t));
 
+    uint32_t packet_num;
+
     memset(main_worker_ctx, 0, sizeof(main_worker_ctx_t));
 
     //没有线程需要投递数据到这个线程
@@ -758,6 +1112,25 @@ static void init(gnb_worker_t *gnb_worker, void *ctx){
 
     main_worker_ctx->gnb_core = (gnb_core_t *)ctx;
 
+    main_worker_ctx->tun_batch = 1;
+
+    //每个 worker 的 queue 中的分组加上 handle_udp 一次最多接收的分组
+    packet_num = GNB_MAIN_WORKER_UDP_PACKET_NUM;
+
+    if ( NULL != gnb_core->node_worker ) {
+        packet_num += gnb_core->conf->node_woker_queue_length;
+    }
+
+    if ( NULL != gnb_core->index_worker ) {
+        packet_num += gnb_core->conf->index_woker_queue_length;
+    }
+
+    if ( NULL != gnb_core->index_service_worker ) {
+        packet_num += gnb_core->conf->index_service_woker_queue_length;
+    }
+
+    main_worker_ctx->inet_packet_num = packet_num;
+
     gnb_worker->ctx = main_worker_ctx;
 
     GNB_LOG1(gnb_core->log,GNB_LOG_ID_MAIN_WORKER,"%s init finish\n", gnb_worker->name);
@@ -770,6 +1143,14 @@ static void release(gnb_worker_t *gnb_worker){
 
     gnb_core_t *gnb_core = main_worker_ctx->gnb_core;
 
+    if ( NULL != main_worker_ctx->tun_packet_pool ) {
+        gnb_packet_pool_release(gnb_core->heap, main_worker_ctx->tun_packet_pool);
+    }
+
+    if ( NULL != main_worker_ctx->inet_packet_pool ) {
+        gnb_packet_pool_release(gnb_core->heap, main_worker_ctx->inet_packet_pool);
+    }
+
     gnb_heap_free(gnb_core->heap, main_worker_ctx);
 
 }
@@ -0,0 +1,91 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GNB_METRICS_TYPE_H
+#define GNB_METRICS_TYPE_H
+
+#include <stdint.h>
+
+#define GNB_METRICS_CACHE_LINE_SIZE  64
+
+/*
+每个线程只写自己的 slot, 因此计数时不需要原子操作
+gnb_ctl 读的时候把各个 slot 加起来
+unix 下 tun 和 inet 由同一个线程处理, windows 下是两个线程
+*/
+#define GNB_METRICS_SLOT_TUN                   0
+#define GNB_METRICS_SLOT_INET                  1
+#define GNB_METRICS_SLOT_NODE_WORKER           2
+#define GNB_METRICS_SLOT_INDEX_WORKER          3
+#define GNB_METRICS_SLOT_INDEX_SERVICE_WORKER  4
+#define GNB_METRICS_SLOT_NUM                   8
+
+
+//进入和离开这个线程处理流程的分组, tun slot 的 rx 来自虚拟网卡, inet slot 的 rx 来自 udp
+#define GNB_METRIC_RX_PKT                       0
+#define GNB_METRIC_RX_BYTES                     1
+#define GNB_METRIC_TX_PKT                       2
+#define GNB_METRIC_TX_BYTES                     3
+
+//进入 pf 各个阶段的分组
+#define GNB_METRIC_PF_FRAME_PKT                 4
+#define GNB_METRIC_PF_ROUTE_PKT                 5
+#define GNB_METRIC_PF_FWD_PKT                   6
+
+//pf 模块在各个阶段返回 GNB_PF_DROP 或 GNB_PF_ERROR 的分组
+#define GNB_METRIC_DROP_PF_FRAME                7
+#define GNB_METRIC_DROP_PF_ROUTE                8
+#define GNB_METRIC_DROP_PF_FWD                  9
+
+//按原因统计的丢弃，与上面按阶段统计的丢弃有重叠
+#define GNB_METRIC_DROP_ROUTE_MISS             10
+#define GNB_METRIC_DROP_UNREACHABLE            11
+#define GNB_METRIC_DROP_CRYPTO                 12
+#define GNB_METRIC_DROP_TTL                    13
+#define GNB_METRIC_DROP_BAD_PAYLOAD            14
+
+//worker queue 满了丢弃的 payload, 由放入 queue 的线程计数
+#define GNB_METRIC_DROP_NODE_QUEUE_FULL        15
+#define GNB_METRIC_DROP_INDEX_QUEUE_FULL       16
+#define GNB_METRIC_DROP_INDEX_SERVICE_QUEUE_FULL 17
+
+#define GNB_METRIC_SEND_ERROR                  18
+#define GNB_METRIC_FWDU_PKT                    19
+
+//worker 从 queue 中取出处理的 payload
+#define GNB_METRIC_WORKER_IN_PKT               20
+
+//inet packet pool 用完，无法交给 worker 而丢弃的 payload
+#define GNB_METRIC_DROP_POOL_EMPTY             21
+
+//补齐到 cache line 的整数倍
+#define GNB_METRIC_NUM                         24
+
+
+typedef struct _gnb_metrics_block_t {
+
+	uint64_t counter[GNB_METRIC_NUM];
+
+}__attribute__ ((aligned (GNB_METRICS_CACHE_LINE_SIZE))) gnb_metrics_block_t;
+
+
+#define GNB_METRICS_INC(metrics,id)    (metrics)->counter[(id)]++
+
+#define GNB_METRICS_ADD(metrics,id,n)  (metrics)->counter[(id)] += (n)
+
+
+#endif
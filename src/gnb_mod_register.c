@@ -20,12 +20,14 @@
 
 extern gnb_pf_t gnb_pf_dump;
 extern gnb_pf_t gnb_pf_route;
+extern gnb_pf_t gnb_pf_flow;
 extern gnb_pf_t gnb_pf_crypto_arc4;
 extern gnb_pf_t gnb_pf_crypto_xor;
 
 gnb_pf_t *gnb_pf_mods[] = {
     &gnb_pf_dump,
     &gnb_pf_route,
+    &gnb_pf_flow,
     &gnb_pf_crypto_xor,
     &gnb_pf_crypto_arc4,
     0
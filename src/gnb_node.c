@@ -26,6 +26,8 @@
 #ifdef __UNIX_LIKE_OS__
 
 #include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #endif
 
@@ -49,6 +51,18 @@
 
 #include "gnb_binary.h"
 
+void gnb_build_node_key512(gnb_core_t *gnb_core, gnb_node_t *node){
+
+    unsigned char buffer[32+4];
+
+    memcpy(buffer,    node->public_key,32);
+    memcpy(buffer+32, gnb_core->conf->crypto_passcode, 4);
+
+    sha512(buffer, 32+4, node->key512);
+
+}
+
+
 void gnb_init_node_key512(gnb_core_t *gnb_core){
 
     uint32_t map_size = gnb_core->uuid_node_map->kv_num;
@@ -67,8 +81,6 @@ void gnb_init_node_key512(gnb_core_t *gnb_core){
 
     gnb_node_t *node;
 
-    unsigned char buffer[32+4];
-
     for (i=0;i<num;i++){
 
         uuid32 = uuid32_array[i];
@@ -79,10 +91,7 @@ void gnb_init_node_key512(gnb_core_t *gnb_core){
             continue;
         }
 
-        memcpy(buffer,    node->public_key,32);
-        memcpy(buffer+32, gnb_core->conf->crypto_passcode, 4);
-
-        sha512(buffer, 32+4, node->key512);
+        gnb_build_node_key512(gnb_core, node);
 
     }
 
@@ -100,6 +109,17 @@ void gnb_add_forward_node_ring(gnb_core_t *gnb_core, uint32_t uuid32){
         return;
     }
 
+    int i;
+
+    //热加载时 address.conf 会被再次加载
+    for ( i=0; i<gnb_core->fwd_node_ring.num; i++ ) {
+
+        if ( node == gnb_core->fwd_node_ring.nodes[i] ) {
+            return;
+        }
+
+    }
+
     if ( gnb_core->fwd_node_ring.num >= GNB_MAX_NODE_RING ){
         gnb_core->fwd_node_ring.num = GNB_MAX_NODE_RING;
         return;
@@ -118,59 +138,247 @@ void gnb_add_forward_node_ring(gnb_core_t *gnb_core, uint32_t uuid32){
 
 gnb_node_t* gnb_select_forward_node(gnb_core_t *gnb_core){
 
-    int i;
+    if ( 0 == gnb_core->fwd_node_ring.num ){
+        return NULL;
+    }
 
-    gnb_node_t *node;
+    if ( NULL == gnb_core->fwd_node_ring.selected_node ){
+        return gnb_core->fwd_node_ring.nodes[0];
+    }
+
+    return gnb_core->fwd_node_ring.selected_node;
+
+}
+
+
+gnb_node_t* gnb_select_forward_node_by_flow(gnb_core_t *gnb_core, uint32_t flow_hash){
+
+    uint8_t idx;
 
     if ( 0 == gnb_core->fwd_node_ring.num ){
         return NULL;
     }
 
-    if ( 1 == gnb_core->fwd_node_ring.num ){
+    if ( 1 == gnb_core->fwd_node_ring.num || GNB_MULTI_ADDRESS_TYPE_SIMPLE_FAULT_TOLERANT == gnb_core->conf->multi_forward_type ){
+        return gnb_select_forward_node(gnb_core);
+    }
+
+    idx = gnb_core->fwd_node_ring.slots[ flow_hash % GNB_NODE_RING_SLOT_NUM ];
+
+    if ( idx >= gnb_core->fwd_node_ring.num ){
         return gnb_core->fwd_node_ring.nodes[0];
     }
 
-    if ( GNB_MULTI_ADDRESS_TYPE_SIMPLE_FAULT_TOLERANT == gnb_core->conf->multi_forward_type ){
-        goto SIMPLE_FAULT_TOLERANT;
+    return gnb_core->fwd_node_ring.nodes[idx];
+
+}
+
+
+static int64_t forward_node_score(gnb_node_t *node){
+
+    int64_t score4;
+    int64_t score6;
+
+    if ( GNB_NODE_PATH_IPV4 == node->selected_path ){
+        return gnb_node_path_score(&node->addr4_path_metric);
     }
 
-    if ( GNB_MULTI_ADDRESS_TYPE_SIMPLE_LOAD_BALANCE == gnb_core->conf->multi_forward_type ){
-        goto SIMPLE_LOAD_BALANCE;
+    if ( GNB_NODE_PATH_IPV6 == node->selected_path ){
+        return gnb_node_path_score(&node->addr6_path_metric);
     }
 
-SIMPLE_FAULT_TOLERANT:
+    score4 = gnb_node_path_score(&node->addr4_path_metric);
+    score6 = gnb_node_path_score(&node->addr6_path_metric);
+
+    return score4 < score6 ? score4 : score6;
+
+}
+
+
+void gnb_update_forward_node_ring(gnb_core_t *gnb_core){
+
+    gnb_node_ring_t *ring = &gnb_core->fwd_node_ring;
+
+    int64_t scores[GNB_MAX_NODE_RING];
+    uint8_t weights[GNB_MAX_NODE_RING];
+    int     current[GNB_MAX_NODE_RING];
+
+    //每个节点按权重应得的 slot 数和当前占有的 slot 数
+    int     quota[GNB_MAX_NODE_RING];
+    int     owned[GNB_MAX_NODE_RING];
+    int     rest[GNB_MAX_NODE_RING];
+
+    int     free_slots[GNB_NODE_RING_SLOT_NUM];
+    int     free_num = 0;
+    int     assigned = 0;
+    int     k;
+
+    int64_t best_score = 0;
+    int64_t weight;
 
-    for( i=0; i<gnb_core->fwd_node_ring.num; i++ ){
+    int total_weight = 0;
+    int changed = 0;
 
-        if( (GNB_NODE_STATUS_IPV6_PONG | GNB_NODE_STATUS_IPV4_PONG) & gnb_core->fwd_node_ring.nodes[i]->udp_addr_status ){
-            return gnb_core->fwd_node_ring.nodes[i];
+    int selected_idx = -1;
+    int max_idx;
+
+    int i;
+    int j;
+
+    if ( 0 == ring->num ){
+        return;
+    }
+
+    for ( i=0; i<ring->num; i++ ){
+
+        if ( (GNB_NODE_STATUS_IPV6_PONG | GNB_NODE_STATUS_IPV4_PONG) & ring->nodes[i]->udp_addr_status ){
+            scores[i] = forward_node_score(ring->nodes[i]);
+        } else {
+            scores[i] = 0;
+            continue;
+        }
+
+        if ( 0 == best_score || scores[i] < best_score ){
+            best_score = scores[i];
         }
 
     }
 
-    return gnb_core->fwd_node_ring.nodes[0];
+    for ( i=0; i<ring->num; i++ ){
 
-SIMPLE_LOAD_BALANCE:
+        if ( 0 == scores[i] ){
+            weights[i] = 0;
+        } else {
+
+            //权重与 score 成反比, 最好的节点权重为 GNB_NODE_RING_MAX_WEIGHT
+            weight = (best_score * GNB_NODE_RING_MAX_WEIGHT + scores[i]/2) / scores[i];
+
+            if ( weight < 1 ){
+                weight = 1;
+            }
+
+            weights[i] = (uint8_t)weight;
+
+        }
 
-    for( i=0; i<gnb_core->fwd_node_ring.num; i++ ){
+        if ( weights[i] != ring->weights[i] ){
+            changed = 1;
+        }
+
+        total_weight += weights[i];
+
+        if ( ring->nodes[i] == ring->selected_node ){
+            selected_idx = i;
+        }
+
+    }
+
+    if ( 0 == changed && NULL != ring->selected_node ){
+        return;
+    }
 
-        node = gnb_core->fwd_node_ring.nodes[ gnb_core->fwd_node_ring.cur_index ];
+    for ( i=0; i<ring->num; i++ ){
+        ring->weights[i] = weights[i];
+    }
 
-        if( (GNB_NODE_STATUS_IPV6_PONG | GNB_NODE_STATUS_IPV4_PONG) & node->udp_addr_status ){
+    if ( 0 == total_weight ){
+        ring->selected_node = ring->nodes[0];
+        memset(ring->slots, 0, GNB_NODE_RING_SLOT_NUM);
+        return;
+    }
 
-            gnb_core->fwd_node_ring.cur_index++;
+    max_idx = 0;
 
-            if ( gnb_core->fwd_node_ring.cur_index >= gnb_core->fwd_node_ring.num  ){
-                gnb_core->fwd_node_ring.cur_index = 0;
+    for ( i=1; i<ring->num; i++ ){
+        if ( weights[i] > weights[max_idx] ){
+            max_idx = i;
+        }
+    }
+
+    //当前选中的节点只比最好的节点差一点就不切换, 避免抖动
+    if ( -1 == selected_idx || weights[selected_idx] + GNB_NODE_RING_MAX_WEIGHT/8 < weights[max_idx] ){
+        ring->selected_node = ring->nodes[max_idx];
+    }
+
+    //按权重计算每个节点的配额，余数按从大到小分配
+    for ( i=0; i<ring->num; i++ ){
+        quota[i] = weights[i] * GNB_NODE_RING_SLOT_NUM / total_weight;
+        rest[i]  = weights[i] * GNB_NODE_RING_SLOT_NUM % total_weight;
+        assigned += quota[i];
+    }
+
+    while ( assigned < GNB_NODE_RING_SLOT_NUM ){
+
+        max_idx = 0;
+
+        for ( i=1; i<ring->num; i++ ){
+            if ( rest[i] > rest[max_idx] ){
+                max_idx = i;
             }
+        }
 
-            return node;
+        quota[max_idx]++;
+        rest[max_idx] = -1;
+        assigned++;
 
+    }
+
+    memset(owned, 0, sizeof(int)*ring->num);
+
+    for ( j=0; j<GNB_NODE_RING_SLOT_NUM; j++ ){
+        if ( ring->slots[j] < ring->num ){
+            owned[ ring->slots[j] ]++;
         }
+    }
+
+    /*
+    只移动超出配额的 slot, 其余 slot 不变，权重的小幅变化只会让少数 flow 换到别的节点
+    超出配额的节点从后向前交出 slot
+    */
+    for ( j=GNB_NODE_RING_SLOT_NUM-1; j>=0; j-- ){
+
+        i = ring->slots[j];
+
+        if ( i < ring->num && owned[i] <= quota[i] ){
+            continue;
+        }
+
+        if ( i < ring->num ){
+            owned[i]--;
+        }
+
+        free_slots[free_num] = j;
+        free_num++;
+
+    }
 
+    //smooth weighted round robin 把交出的 slot 按缺额交错地分配给配额不足的节点，缺额之和等于 free_num
+    for ( i=0; i<ring->num; i++ ){
+        rest[i] = quota[i] - owned[i];
     }
 
-    return gnb_core->fwd_node_ring.nodes[0];
+    memset(current, 0, sizeof(int)*ring->num);
+
+    //free_slots 是从后向前记录的
+    for ( k=free_num-1; k>=0; k-- ){
+
+        max_idx = 0;
+
+        for ( i=0; i<ring->num; i++ ){
+
+            current[i] += rest[i];
+
+            if ( current[i] > current[max_idx] ){
+                max_idx = i;
+            }
+
+        }
+
+        current[max_idx] -= free_num;
+
+        ring->slots[ free_slots[k] ] = (uint8_t)max_idx;
+
+    }
 
 }
 
@@ -249,6 +457,83 @@ void gnb_send_udata_to_address(gnb_core_t *gnb_core, gnb_address_t *address, voi
 }
 
 
+static void send_iov_to_sockaddr(int sockfd, struct sockaddr *sockaddr, socklen_t socklen, void *head, size_t head_size, void *data, size_t data_size){
+
+#ifdef __UNIX_LIKE_OS__
+
+    struct iovec iov[2];
+    struct msghdr msg;
+
+    iov[0].iov_base = head;
+    iov[0].iov_len  = head_size;
+    iov[1].iov_base = data;
+    iov[1].iov_len  = data_size;
+
+    memset(&msg, 0, sizeof(struct msghdr));
+
+    msg.msg_name    = sockaddr;
+    msg.msg_namelen = socklen;
+    msg.msg_iov     = iov;
+    msg.msg_iovlen  = 2;
+
+    sendmsg(sockfd, &msg, 0);
+
+#endif
+
+#ifdef _WIN32
+
+    WSABUF wsa_buf[2];
+    DWORD sent_bytes;
+
+    wsa_buf[0].buf = head;
+    wsa_buf[0].len = head_size;
+    wsa_buf[1].buf = data;
+    wsa_buf[1].len = data_size;
+
+    WSASendTo(sockfd, wsa_buf, 2, &sent_bytes, 0, sockaddr, socklen, NULL, NULL);
+
+#endif
+
+}
+
+
+void gnb_send_head_payload_to_address(gnb_core_t *gnb_core, gnb_address_t *address, void *head, size_t head_size, gnb_payload16_t *payload){
+
+    struct sockaddr_in  in;
+    struct sockaddr_in6 in6;
+
+    if( 0 == address->port ){
+        return;
+    }
+
+    if ( AF_INET6 == address->type ) {
+
+        memset(&in6,0,sizeof(struct sockaddr_in6));
+
+        in6.sin6_family = AF_INET6;
+        in6.sin6_port = address->port;
+
+        memcpy(&in6.sin6_addr, address->address.addr6, 16);
+
+        send_iov_to_sockaddr(gnb_core->udp_ipv6_sockets[0], (struct sockaddr *)&in6, sizeof(struct sockaddr_in6), head, head_size, (void *)payload, GNB_PAYLOAD16_FRAME_SIZE(payload));
+
+    }
+
+    if ( AF_INET == address->type ) {
+
+        memset(&in,0,sizeof(struct sockaddr_in));
+
+        in.sin_family = AF_INET;
+        in.sin_port = address->port;
+        memcpy(&in.sin_addr, address->address.addr4, 4);
+
+        send_iov_to_sockaddr(gnb_core->udp_ipv4_sockets[0], (struct sockaddr *)&in, sizeof(struct sockaddr_in), head, head_size, (void *)payload, GNB_PAYLOAD16_FRAME_SIZE(payload));
+
+    }
+
+}
+
+
 void gnb_send_address_list(gnb_core_t *gnb_core, gnb_address_list_t *address_list, gnb_payload16_t *payload){
 
     int i;
@@ -574,6 +859,16 @@ int gnb_forward_payload_to_node(gnb_core_t *gnb_core, gnb_node_t *node, gnb_payl
 
     unsigned char send;
 
+    ssize_t n_send;
+
+    if ( GNB_NODE_PATH_IPV6 == node->selected_path && (node->udp_addr_status & GNB_NODE_STATUS_IPV6_PONG) ) {
+        goto send_by_ipv6;
+    }
+
+    if ( GNB_NODE_PATH_IPV4 == node->selected_path && (node->udp_addr_status & GNB_NODE_STATUS_IPV4_PONG) ) {
+        goto send_by_ipv4;
+    }
+
     if ( (node->udp_addr_status & GNB_NODE_STATUS_IPV6_PONG) && (node->udp_addr_status & GNB_NODE_STATUS_IPV4_PONG) ){
 
         if ( 0 == node->addr4_ping_latency_usec ){
@@ -596,7 +891,7 @@ send_by_ipv6:
 
     if ( (node->udp_addr_status & GNB_NODE_STATUS_IPV6_PONG) && (gnb_core->conf->udp_socket_type & GNB_ADDR_TYPE_IPV6) && memcmp(&node->udp_sockaddr6.sin6_addr,&in6addr_any,sizeof(struct in6_addr)) ){
 
-        sendto(gnb_core->udp_ipv6_sockets[node->socket6_idx],(void *)payload, GNB_PAYLOAD16_FRAME_SIZE(payload), 0, (struct sockaddr *)&node->udp_sockaddr6, sizeof(struct sockaddr_in6) );
+        n_send = sendto(gnb_core->udp_ipv6_sockets[node->socket6_idx],(void *)payload, GNB_PAYLOAD16_FRAME_SIZE(payload), 0, (struct sockaddr *)&node->udp_sockaddr6, sizeof(struct sockaddr_in6) );
 
         goto finish;
 
@@ -604,11 +899,189 @@ send_by_ipv6:
 
 send_by_ipv4:
 
-    sendto(gnb_core->udp_ipv4_sockets[ node->socket4_idx ], (void *)payload, GNB_PAYLOAD16_FRAME_SIZE(payload), 0, (struct sockaddr *)&node->udp_sockaddr4, sizeof(struct sockaddr_in));
+    n_send = sendto(gnb_core->udp_ipv4_sockets[ node->socket4_idx ], (void *)payload, GNB_PAYLOAD16_FRAME_SIZE(payload), 0, (struct sockaddr *)&node->udp_sockaddr4, sizeof(struct sockaddr_in));
 
 finish:
 
+    if ( n_send < 0 ) {
+        return -1;
+    }
+
     return 0;
 
 }
 
+
+/*
+只按指定的路径发送一份，不考虑 selected_path, 用于 speedtest 测量某一条直连路径
+path 为 GNB_NODE_PATH_IPV4 或 GNB_NODE_PATH_IPV6
+*/
+int gnb_send_to_node_path(gnb_core_t *gnb_core, gnb_node_t *node, gnb_payload16_t *payload, uint8_t path){
+
+    ssize_t n_send;
+
+    if ( GNB_NODE_PATH_IPV6 == path ) {
+
+        if ( !(gnb_core->conf->udp_socket_type & GNB_ADDR_TYPE_IPV6) || !memcmp(&node->udp_sockaddr6.sin6_addr,&in6addr_any,sizeof(struct in6_addr)) ) {
+            return -1;
+        }
+
+        n_send = sendto(gnb_core->udp_ipv6_sockets[node->socket6_idx],(void *)payload, GNB_PAYLOAD16_FRAME_SIZE(payload), 0, (struct sockaddr *)&node->udp_sockaddr6, sizeof(struct sockaddr_in6) );
+
+    } else {
+
+        if ( !(gnb_core->conf->udp_socket_type & GNB_ADDR_TYPE_IPV4) ) {
+            return -1;
+        }
+
+        n_send = sendto(gnb_core->udp_ipv4_sockets[ node->socket4_idx ], (void *)payload, GNB_PAYLOAD16_FRAME_SIZE(payload), 0, (struct sockaddr *)&node->udp_sockaddr4, sizeof(struct sockaddr_in));
+
+    }
+
+    if ( n_send < 0 ) {
+        return -1;
+    }
+
+    return 0;
+
+}
+
+
+//每千分之一的丢包率折算成的 rtt
+#define GNB_NODE_PATH_LOSS_PENALTY_USEC     500
+//还没有 rtt 样本的路径
+#define GNB_NODE_PATH_UNKNOWN_SCORE         (60LL*1000000)
+//切换路径时，新路径的 score 至少要比当前路径好这么多
+#define GNB_NODE_PATH_HYSTERESIS_USEC       2000
+
+
+void gnb_node_path_metric_ping(gnb_node_path_metric_t *path_metric){
+
+    uint32_t loss_sample = 0;
+
+    if ( path_metric->wait_pong ) {
+        loss_sample = 1000;
+    }
+
+    if ( 0 != path_metric->ping_seq ) {
+        path_metric->loss_permille = (path_metric->loss_permille * 7 + loss_sample) / 8;
+    }
+
+    path_metric->ping_seq++;
+    path_metric->wait_pong = 1;
+
+}
+
+
+void gnb_node_path_metric_pong(gnb_node_path_metric_t *path_metric, int64_t rtt_usec){
+
+    int64_t delta_usec;
+
+    if ( 0 == path_metric->wait_pong ) {
+        return;
+    }
+
+    path_metric->wait_pong = 0;
+    path_metric->pong_seq++;
+
+    if ( rtt_usec <= 0 ) {
+        return;
+    }
+
+    if ( 0 == path_metric->srtt_usec ) {
+        path_metric->srtt_usec   = rtt_usec;
+        path_metric->rttvar_usec = rtt_usec / 2;
+        return;
+    }
+
+    delta_usec = path_metric->srtt_usec - rtt_usec;
+
+    if ( delta_usec < 0 ) {
+        delta_usec = -delta_usec;
+    }
+
+    path_metric->rttvar_usec = (path_metric->rttvar_usec * 3 + delta_usec) / 4;
+    path_metric->srtt_usec   = (path_metric->srtt_usec * 7 + rtt_usec) / 8;
+
+}
+
+
+int64_t gnb_node_path_score(gnb_node_path_metric_t *path_metric){
+
+    if ( 0 == path_metric->srtt_usec ) {
+        return GNB_NODE_PATH_UNKNOWN_SCORE;
+    }
+
+    return path_metric->srtt_usec + 4 * path_metric->rttvar_usec + (int64_t)path_metric->loss_permille * GNB_NODE_PATH_LOSS_PENALTY_USEC;
+
+}
+
+
+static int64_t path_hysteresis(int64_t score){
+
+    if ( score/8 > GNB_NODE_PATH_HYSTERESIS_USEC ) {
+        return score/8;
+    }
+
+    return GNB_NODE_PATH_HYSTERESIS_USEC;
+
+}
+
+
+void gnb_node_select_path(gnb_node_t *node){
+
+    int64_t score4;
+    int64_t score6;
+
+    int ipv4_up = node->udp_addr_status & GNB_NODE_STATUS_IPV4_PONG;
+    int ipv6_up = node->udp_addr_status & GNB_NODE_STATUS_IPV6_PONG;
+
+    if ( !ipv4_up && !ipv6_up ) {
+        node->selected_path = GNB_NODE_PATH_NONE;
+        return;
+    }
+
+    if ( !ipv6_up ) {
+        node->selected_path = GNB_NODE_PATH_IPV4;
+        return;
+    }
+
+    if ( !ipv4_up ) {
+        node->selected_path = GNB_NODE_PATH_IPV6;
+        return;
+    }
+
+    score4 = gnb_node_path_score(&node->addr4_path_metric);
+    score6 = gnb_node_path_score(&node->addr6_path_metric);
+
+    switch ( node->selected_path ) {
+
+    case GNB_NODE_PATH_IPV4:
+
+        if ( score6 + path_hysteresis(score4) < score4 ) {
+            node->selected_path = GNB_NODE_PATH_IPV6;
+        }
+
+        break;
+
+    case GNB_NODE_PATH_IPV6:
+
+        if ( score4 + path_hysteresis(score6) < score6 ) {
+            node->selected_path = GNB_NODE_PATH_IPV4;
+        }
+
+        break;
+
+    default:
+
+        if ( score4 < score6 ) {
+            node->selected_path = GNB_NODE_PATH_IPV4;
+        } else {
+            node->selected_path = GNB_NODE_PATH_IPV6;
+        }
+
+        break;
+
+    }
+
+}
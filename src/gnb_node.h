@@ -21,16 +21,25 @@
 #include "gnb.h"
 
 void gnb_init_node_key512(gnb_core_t *gnb_core);
+void gnb_build_node_key512(gnb_core_t *gnb_core, gnb_node_t *node);
 
 void gnb_add_forward_node_ring(gnb_core_t *gnb_core, uint32_t uuid32);
 
+//只读取 gnb_update_forward_node_ring 计算好的结果
 gnb_node_t* gnb_select_forward_node(gnb_core_t *gnb_core);
+gnb_node_t* gnb_select_forward_node_by_flow(gnb_core_t *gnb_core, uint32_t flow_hash);
+
+//fwd_node_ring 中节点的状态或 path metric 发生改变后调用，权重没有变化时不会重建 slot
+void gnb_update_forward_node_ring(gnb_core_t *gnb_core);
 
 int gnb_node_sign_verify(gnb_core_t *gnb_core, uint32_t uuid32, unsigned char *sign, void *data, size_t data_size);
 
 void gnb_send_to_address(gnb_core_t *gnb_core, gnb_address_t *address, gnb_payload16_t *payload);
 void gnb_send_udata_to_address(gnb_core_t *gnb_core, gnb_address_t *address, void *udata, size_t udata_size);
 
+//head 和 payload 作为一个 udp 分组发出，不复制 payload
+void gnb_send_head_payload_to_address(gnb_core_t *gnb_core, gnb_address_t *address, void *head, size_t head_size, gnb_payload16_t *payload);
+
 void gnb_send_address_list(gnb_core_t *gnb_core, gnb_address_list_t *address_list, gnb_payload16_t *payload);
 
 void gnb_send_to_address_through_all_sockets(gnb_core_t *gnb_core, gnb_address_t *address, gnb_payload16_t *payload);
@@ -49,6 +58,20 @@ void gnb_set_node_address6(gnb_node_t *node);
 
 int gnb_send_to_node(gnb_core_t *gnb_core, gnb_node_t *node, gnb_payload16_t *payload, unsigned char addr_type_bits);
 
+//sendto 失败时返回 -1
 int gnb_forward_payload_to_node(gnb_core_t *gnb_core, gnb_node_t *node, gnb_payload16_t *payload);
 
+int gnb_send_to_node_path(gnb_core_t *gnb_core, gnb_node_t *node, gnb_payload16_t *payload, uint8_t path);
+
+//发出 ping 时调用，上一个 ping 没有收到 pong 就计为一次丢包
+void gnb_node_path_metric_ping(gnb_node_path_metric_t *path_metric);
+
+//收到与最后一个 ping 匹配的 pong 时调用
+void gnb_node_path_metric_pong(gnb_node_path_metric_t *path_metric, int64_t rtt_usec);
+
+int64_t gnb_node_path_score(gnb_node_path_metric_t *path_metric);
+
+//根据 udp_addr_status 和 path metric 更新 node->selected_path, 带有滞后，避免两条路径质量接近时来回切换
+void gnb_node_select_path(gnb_node_t *node);
+
 #endif
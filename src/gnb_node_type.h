@@ -22,12 +22,39 @@
 
 #include "gnb_address_type.h"
 
+
+//通过 ping pong 统计的一条路径(ipv4 或 ipv6)的质量
+typedef struct _gnb_node_path_metric_t{
+
+	//平滑后的 rtt 及 rtt 偏差，算法同 RFC6298
+	int64_t  srtt_usec;
+	int64_t  rttvar_usec;
+
+	//丢包率的指数加权平均值，千分比
+	uint32_t loss_permille;
+
+	//在这条路径上发出的 ping 的序号及收到对应 pong 的数量
+	uint32_t ping_seq;
+	uint32_t pong_seq;
+
+	//最后一个 ping 还没有收到 pong
+	uint8_t  wait_pong;
+
+}gnb_node_path_metric_t;
+
+
 typedef struct _gnb_node_t{
 
 	uint32_t uuid32;
 
+	//seqlock, 修改 node 的地址 状态 路由时为奇数, 见 gnb_seqlock.h
+	uint32_t seq;
+
+	//本节点发往这个节点的数据计入 in, 从这个节点收到的数据计入 out
 	uint64_t in_bytes;
 	uint64_t out_bytes;
+	uint64_t in_packets;
+	uint64_t out_packets;
 
 	#define GNB_NODE_TYPE_STD               (0x0)
 	#define GNB_NODE_TYPE_IDX               (0x1)
@@ -39,6 +66,9 @@ typedef struct _gnb_node_t{
 	#define GNB_NODE_TYPE_STATIC_ADDR       (0x1 << 4)
 	#define GNB_NODE_TYPE_DYNAMIC_ADDR      (0x1 << 5)
 
+	//热加载后已从 route.conf 中删除的节点，保留在 node_zone 中使其他节点的下标不变
+	#define GNB_NODE_TYPE_RETIRED           (0x1 << 6)
+
 
 	unsigned char type;
 
@@ -66,9 +96,15 @@ typedef struct _gnb_node_t{
 	#define GNB_NODE_RELAY_FORCE            (0x1 << 1)
 	#define GNB_NODE_RELAY_STATIC           (0x1 << 2)
 	#define GNB_NODE_RELAY_BALANCE          (0x1 << 3)
+	//route_node 由 node worker 根据链路延迟自动计算
+	#define GNB_NODE_RELAY_DYNAMIC          (0x1 << 4)
 
 	uint8_t  node_relay_mode;
 
+	//GNB_NODE_RELAY_BALANCE 模式下每条 relay route 上的 flow 数量和转发的字节数
+	uint32_t route_node_flows[GNB_MAX_NODE_ROUTE];
+	uint64_t route_node_bytes[GNB_MAX_NODE_ROUTE];
+
 	#define GNB_NODE_STATIC_ADDRESS_NUM   6
 	#define GNB_NODE_DYNAMIC_ADDRESS_NUM 16
 	#define GNB_NODE_RESOLV_ADDRESS_NUM   6
@@ -121,6 +157,25 @@ typedef struct _gnb_node_t{
 	//上次node发来 ping6 或 pong6 时间戳
 	uint64_t addr6_update_ts_sec;
 
+	gnb_node_path_metric_t addr4_path_metric;
+	gnb_node_path_metric_t addr6_path_metric;
+
+	#define GNB_NODE_PATH_NONE           (0x0)
+	#define GNB_NODE_PATH_IPV4           (0x1)
+	#define GNB_NODE_PATH_IPV6           (0x2)
+
+	//由 gnb_node_select_path 根据 path metric 选出，gnb_forward_payload_to_node 使用
+	uint8_t selected_path;
+
+	//以下由 gnb_es 在 gossip 地址时维护
+	//udp_sockaddr4 udp_sockaddr6 的摘要, 发生改变时 addr_version 加 1
+	uint32_t addr_digest;
+	uint32_t addr_version;
+	//地址改变后还需要向随机节点 gossip 的轮数
+	uint8_t  addr_gossip_rounds;
+	//已经向这个节点发送过全部节点的地址，节点不可达时清零，再次连通时重新发送
+	uint8_t  addr_gossip_synced;
+
 	//ed25519 public key
 	unsigned char public_key[32];
 
@@ -144,12 +199,23 @@ typedef struct _gnb_node_t{
 
 
 #define GNB_MAX_NODE_RING 128
+#define GNB_NODE_RING_SLOT_NUM      256
+#define GNB_NODE_RING_MAX_WEIGHT    16
 typedef struct _gnb_node_ring_t{
 
 	int num;
 	int cur_index;
 	gnb_node_t *nodes[GNB_MAX_NODE_RING];
 
+	//以下由 gnb_update_forward_node_ring 在节点状态或 path metric 改变时更新，数据通路只读
+	gnb_node_t *selected_node;
+
+	//根据 rtt 和丢包率计算的权重，不可达的节点权重为0
+	uint8_t weights[GNB_MAX_NODE_RING];
+
+	//按权重分配给 nodes 的 slot, 用 flow hash 选 slot，同一个 flow 总是转发到同一个 node
+	uint8_t slots[GNB_NODE_RING_SLOT_NUM];
+
 }gnb_node_ring_t;
 
 
@@ -37,9 +37,12 @@
 #include "gnb_time.h"
 #include "gnb_keys.h"
 #include "gnb_node.h"
+#include "gnb_conf_file.h"
+#include "gnb_seqlock.h"
 #include "gnb_worker.h"
 #include "gnb_ring_buffer.h"
 
+#include "gnb_packet_pool.h"
 #include "gnb_worker_queue_data.h"
 #include "ed25519/ed25519.h"
 
@@ -60,147 +63,959 @@
 
 #define NODE_ED25519_SIGN_SIZE   64
 
+
+//pong 的附件中最多能带上到多少个节点的链路延迟
+#define GNB_NODE_LINK_VECTOR_NUM           26
+
+//超过这个时间没有更新的链路延迟不参与 relay route 的计算
+#define GNB_NODE_LINK_VECTOR_TIMEOUT_SEC   (GNB_NODE_PING_INTERVAL_SEC*3)
+
+//链路延迟的变化超过 1/8 并且超过这个值才认为链路状态发生了改变
+#define GNB_NODE_LINK_RTT_TOLERANCE_USEC   1000
+
+//rtt 在附件中以 100 微秒为单位用 uint16 表示
+#define GNB_NODE_LINK_MAX_RTT_USEC         (0xffff*100)
+
+//每个节点自动计算出的 relay route 数量
+#define GNB_AUTO_RELAY_MAX_ROUTE           3
+
+//计算 route 时每个节点最多保留的第一跳不同的路径，多出的一条是直连的路径
+#define GNB_AUTO_RELAY_MAX_LABEL           (GNB_AUTO_RELAY_MAX_ROUTE + 1)
+
+
+typedef struct _node_link_t {
+
+    uint32_t uuid32;
+
+    //节点在 node_zone 中的下标
+    int      node_idx;
+
+    int64_t  rtt_usec;
+
+}node_link_t;
+
+
+typedef struct _node_link_vector_t {
+
+    uint64_t    update_ts_sec;
+
+    int         num;
+
+    //按 rtt 从小到大排列
+    node_link_t links[GNB_NODE_LINK_VECTOR_NUM];
+
+}node_link_vector_t;
+
+
+typedef struct _auto_relay_route_t {
+
+    int64_t  cost_usec;
+
+    uint8_t  ttl;
+
+    //与 gnb_node_t 的 route_node 的顺序相同，靠近目标节点的在前面
+    uint32_t relay[GNB_MAX_NODE_RELAY];
+
+}auto_relay_route_t;
+
+
 typedef struct _node_worker_ctx_t {
 
-    gnb_core_t *gnb_core;
+    gnb_core_t *gnb_core;
+
+    gnb_payload16_t   *node_frame_payload;
+
+    uint64_t now_time_usec;
+    uint64_t now_time_sec;
+
+    uint64_t last_sync_ts_sec;
+
+    size_t node_num;
+
+    //各节点通过 pong 带来的到其他节点的链路延迟，按节点在 node_zone 中的下标存放
+    node_link_vector_t *link_vectors;
+
+    //本节点到其他节点的链路延迟，附在 pong 中发给对端
+    node_link_vector_t local_link_vector;
+
+    uint8_t link_state_changed;
+
+    //route.conf 中没有配置 relay route 的节点才会自动计算
+    uint8_t *auto_route_nodes;
+
+    //node_num * GNB_AUTO_RELAY_MAX_ROUTE
+    auto_relay_route_t *auto_routes;
+
+    /*
+    一次 SPF 同时计算到各节点第一跳不同的最短路径，
+    每个节点有 GNB_AUTO_RELAY_MAX_LABEL 个 label, 下标为 node_idx * GNB_AUTO_RELAY_MAX_LABEL + n
+    */
+    int64_t *label_dist;
+    //路径上前一个节点的 label, 第一跳为 -1
+    int     *label_prev;
+    int     *label_first_hop;
+    //label 在 label_heap 中的位置，不在 heap 中为 -1
+    int     *label_heap_pos;
+    uint8_t *label_settled;
+    uint8_t *label_num;
+
+    int     *label_heap;
+    int      label_heap_num;
+
+    //热加载后 node_zone 中的节点会发生变化
+    uint32_t node_table_epoch;
+
+    pthread_t thread_worker;
+
+}node_worker_ctx_t;
+
+
+#pragma pack(push, 1)
+
+typedef struct _node_ping_frame_t {
+
+    struct __attribute__((__packed__)) ping_frame_data {
+      uint32_t src_uuid32;   //发送方的uuid32
+      uint32_t dst_uuid32;   //接收方的uuid32
+      uint64_t src_ts_usec;  //发送方的时间戳
+
+      /*让 dst 看到自己的 ip 地址，暂时还没启用*/
+      uint8_t  dst_addr4[4];
+      uint16_t dst_port4;
+      uint8_t  dst_addr6[16];
+      uint16_t dst_port6;
+
+      unsigned char crypto_seed[64];
+
+      unsigned char attachment[128+64];
+
+      unsigned char text[32];
+    }data;
+
+    unsigned char src_sign[NODE_ED25519_SIGN_SIZE];
+
+}__attribute__ ((__packed__)) node_ping_frame_t;
+
+
+typedef struct _node_pong_frame_t {
+
+    struct __attribute__((__packed__)) pong_frame_data {
+      uint32_t src_uuid32;   //发送方的uuid32
+      uint32_t dst_uuid32;   //接收方的uuid32
+      uint64_t src_ts_usec;  //发送方的时间戳
+      uint64_t dst_ts_usec;  //接收方上一个ping frame带来的时间戳
+
+      uint8_t  dst_addr4[4];
+      uint16_t dst_port4;
+      uint8_t  dst_addr6[16];
+      uint16_t dst_port6;
+
+      unsigned char crypto_seed[64];
+
+      unsigned char attachment[128+64];
+
+      unsigned char text[32];
+    }data;
+
+    unsigned char src_sign[NODE_ED25519_SIGN_SIZE];
+
+}__attribute__ ((__packed__)) node_pong_frame_t;
+
+
+#define GNB_NODE_ATTACHMENT_TYPE_TUN_EMPTY         0x0
+#define GNB_NODE_ATTACHMENT_TYPE_TUN_SOCKADDRESS   0x1
+
+
+typedef struct _node_attachment_tun_sockaddress_t {
+
+    struct in_addr  tun_addr4;
+    uint16_t        tun_sin_port4;
+
+    struct in6_addr tun_ipv6_addr;
+    uint16_t        tun_sin_port6;
+
+    uint16_t        es_sin_port4;
+    uint16_t        es_sin_port6;
+
+}__attribute__ ((__packed__)) node_attachment_tun_sockaddress_t;
+
+
+#define GNB_NODE_ATTACHMENT_TYPE_LINK_LATENCY      0x2
+
+typedef struct _node_attachment_link_latency_t {
+
+    uint32_t uuid32;
+
+    //以 100 微秒为单位
+    uint16_t rtt_100usec;
+
+}__attribute__ ((__packed__)) node_attachment_link_latency_t;
+
+
+#pragma pack(pop)
+
+
+static void send_ping_frame(gnb_core_t *gnb_core, gnb_node_t *node);
+
+
+static void send_ping_frame(gnb_core_t *gnb_core, gnb_node_t *node){
+
+    int ret;
+
+    gnb_worker_t *main_worker = gnb_core->main_worker;
+
+    node_worker_ctx_t *node_worker_ctx = gnb_core->node_worker->ctx;
+
+    gnb_worker_queue_data_t *send_queue_data;
+
+    if ( INADDR_ANY == node->udp_sockaddr4.sin_addr.s_addr && 0 == memcmp(&node->udp_sockaddr6.sin6_addr,&in6addr_any,sizeof(struct in6_addr)) ) {
+        return;
+    }
+
+    node_worker_ctx->node_frame_payload->sub_type = PAYLOAD_SUB_TYPE_PING;
+    gnb_payload16_set_data_len(node_worker_ctx->node_frame_payload, sizeof(node_ping_frame_t));
+
+    node_ping_frame_t *node_ping_frame = (node_ping_frame_t *)node_worker_ctx->node_frame_payload->data;
+
+    memset(node_ping_frame,0,sizeof(node_ping_frame_t));
+
+    node_ping_frame->data.src_uuid32 = htonl(gnb_core->local_node->uuid32);
+    node_ping_frame->data.dst_uuid32 = htonl(node->uuid32);
+
+    node_ping_frame->data.src_ts_usec = gnb_htonll(node_worker_ctx->now_time_usec);
+
+    snprintf((char *)node_ping_frame->data.text,32,"%d --PING-> %d",gnb_core->local_node->uuid32,node->uuid32);
+
+    if ( 0 == gnb_core->conf->lite_mode ) {
+        ed25519_sign(node_ping_frame->src_sign, (const unsigned char *)&node_ping_frame->data, sizeof(struct ping_frame_data), gnb_core->ed25519_public_key, gnb_core->ed25519_private_key);
+    }
+
+    GNB_LOG2(gnb_core->log,GNB_LOG_ID_NODE_WORKER, "ping src[%u]->dst[%u] %s %s ping_ts=%"PRIu64"\n",
+            gnb_core->local_node->uuid32, node->uuid32,
+            GNB_SOCKADDR6STR1(&node->udp_sockaddr6), GNB_SOCKADDR4STR2(&node->udp_sockaddr4),
+            node->ping_ts_sec
+    );
+
+
+    gnb_seqlock_write_begin(&node->seq);
+
+    if ( INADDR_ANY != node->udp_sockaddr4.sin_addr.s_addr ) {
+        gnb_node_path_metric_ping(&node->addr4_path_metric);
+    }
+
+    if ( 0 != memcmp(&node->udp_sockaddr6.sin6_addr,&in6addr_any,sizeof(struct in6_addr)) ) {
+        gnb_node_path_metric_ping(&node->addr6_path_metric);
+    }
+
+    gnb_seqlock_write_end(&node->seq);
+
+    //PING frame 尽可能 ipv4 和 ipv6 都发送
+    gnb_send_to_node(gnb_core, node, node_worker_ctx->node_frame_payload, GNB_ADDR_TYPE_IPV6|GNB_ADDR_TYPE_IPV4);
+
+    //更新 node 的ping 时间戳
+    node->ping_ts_sec  = node_worker_ctx->now_time_sec;
+    node->ping_ts_usec = node_worker_ctx->now_time_usec;
+
+}
+
+
+
+static int64_t node_link_rtt_usec(gnb_node_t *node){
+
+    int64_t rtt_usec;
+
+    if ( GNB_NODE_PATH_IPV6 == node->selected_path ) {
+        rtt_usec = gnb_node_path_score(&node->addr6_path_metric);
+    } else if ( GNB_NODE_PATH_IPV4 == node->selected_path ) {
+        rtt_usec = gnb_node_path_score(&node->addr4_path_metric);
+    } else {
+        return -1;
+    }
+
+    if ( rtt_usec >= GNB_NODE_LINK_MAX_RTT_USEC ) {
+        return -1;
+    }
+
+    return rtt_usec;
+
+}
+
+
+static int link_vector_changed(node_link_vector_t *old_vector, node_link_vector_t *new_vector){
+
+    int i;
+
+    int64_t diff;
+
+    if ( old_vector->num != new_vector->num ) {
+        return 1;
+    }
+
+    for ( i=0; i<new_vector->num; i++ ) {
+
+        if ( old_vector->links[i].uuid32 != new_vector->links[i].uuid32 ) {
+            return 1;
+        }
+
+        diff = new_vector->links[i].rtt_usec - old_vector->links[i].rtt_usec;
+
+        if ( diff < 0 ) {
+            diff = -diff;
+        }
+
+        if ( diff > old_vector->links[i].rtt_usec/8 && diff > GNB_NODE_LINK_RTT_TOLERANCE_USEC ) {
+            return 1;
+        }
+
+    }
+
+    return 0;
+
+}
+
+
+static void build_local_link_vector(gnb_core_t *gnb_core){
+
+    node_worker_ctx_t *node_worker_ctx = gnb_core->node_worker->ctx;
+
+    node_link_vector_t link_vector;
+
+    gnb_node_t *node;
+
+    int64_t rtt_usec;
+
+    int i,j;
+
+    memset(&link_vector, 0, sizeof(node_link_vector_t));
+
+    for ( i=0; i<node_worker_ctx->node_num; i++ ) {
+
+        node = &gnb_core->ctl_block->node_zone->node[i];
+
+        if ( gnb_core->local_node->uuid32 == node->uuid32 ) {
+            continue;
+        }
+
+        if ( node->type & (GNB_NODE_TYPE_SLIENCE|GNB_NODE_TYPE_RETIRED) ) {
+            continue;
+        }
+
+        rtt_usec = node_link_rtt_usec(node);
+
+        if ( rtt_usec < 0 ) {
+            continue;
+        }
+
+        //只保留 rtt 最小的 GNB_NODE_LINK_VECTOR_NUM 个节点
+        for ( j=link_vector.num; j>0 && link_vector.links[j-1].rtt_usec > rtt_usec; j-- ) {
+            if ( j < GNB_NODE_LINK_VECTOR_NUM ) {
+                link_vector.links[j] = link_vector.links[j-1];
+            }
+        }
+
+        if ( j >= GNB_NODE_LINK_VECTOR_NUM ) {
+            continue;
+        }
+
+        link_vector.links[j].uuid32   = node->uuid32;
+        link_vector.links[j].node_idx = i;
+        link_vector.links[j].rtt_usec = rtt_usec;
+
+        if ( link_vector.num < GNB_NODE_LINK_VECTOR_NUM ) {
+            link_vector.num++;
+        }
+
+    }
+
+    if ( 0 == link_vector_changed(&node_worker_ctx->local_link_vector, &link_vector) ) {
+        return;
+    }
+
+    link_vector.update_ts_sec = node_worker_ctx->now_time_sec;
+    node_worker_ctx->local_link_vector = link_vector;
+    node_worker_ctx->link_state_changed = 1;
+
+}
+
+
+static void set_link_latency_attachment(gnb_core_t *gnb_core, gnb_payload16_t *payload_attachment, gnb_node_t *dst_node){
+
+    node_worker_ctx_t *node_worker_ctx = gnb_core->node_worker->ctx;
+
+    node_link_vector_t *link_vector = &node_worker_ctx->local_link_vector;
+
+    node_attachment_link_latency_t *link_latency = (node_attachment_link_latency_t *)payload_attachment->data;
+
+    int64_t rtt_100usec;
+
+    int i;
+    int num = 0;
+
+    for ( i=0; i<link_vector->num; i++ ) {
+
+        //对端不需要知道到它自己的延迟
+        if ( dst_node->uuid32 == link_vector->links[i].uuid32 ) {
+            continue;
+        }
+
+        rtt_100usec = link_vector->links[i].rtt_usec / 100 + 1;
+
+        if ( rtt_100usec > 0xffff ) {
+            rtt_100usec = 0xffff;
+        }
+
+        link_latency[num].uuid32      = htonl(link_vector->links[i].uuid32);
+        link_latency[num].rtt_100usec = htons((uint16_t)rtt_100usec);
+        num++;
+
+    }
+
+    gnb_payload16_set_data_len(payload_attachment, num * sizeof(node_attachment_link_latency_t));
+    payload_attachment->type = GNB_NODE_ATTACHMENT_TYPE_LINK_LATENCY;
+
+}
+
+
+static void handle_link_latency_attachment(gnb_core_t *gnb_core, gnb_node_t *src_node, gnb_payload16_t *payload_attachment){
+
+    node_worker_ctx_t *node_worker_ctx = gnb_core->node_worker->ctx;
+
+    node_attachment_link_latency_t *link_latency = (node_attachment_link_latency_t *)payload_attachment->data;
+
+    node_link_vector_t link_vector;
+
+    gnb_node_t *node;
+
+    size_t src_node_idx = src_node - gnb_core->ctl_block->node_zone->node;
+
+    uint32_t uuid32;
+
+    int i;
+    int num;
+
+    if ( src_node_idx >= node_worker_ctx->node_num ) {
+        return;
+    }
+
+    num = GNB_PAYLOAD16_DATA_SIZE(payload_attachment) / sizeof(node_attachment_link_latency_t);
+
+    if ( num > GNB_NODE_LINK_VECTOR_NUM ) {
+        num = GNB_NODE_LINK_VECTOR_NUM;
+    }
+
+    memset(&link_vector, 0, sizeof(node_link_vector_t));
+
+    for ( i=0; i<num; i++ ) {
+
+        uuid32 = ntohl(link_latency[i].uuid32);
+
+        node = GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, uuid32);
+
+        if ( NULL == node || node == src_node ) {
+            continue;
+        }
+
+        link_vector.links[link_vector.num].uuid32   = node->uuid32;
+        link_vector.links[link_vector.num].node_idx = node - gnb_core->ctl_block->node_zone->node;
+        link_vector.links[link_vector.num].rtt_usec = (int64_t)ntohs(link_latency[i].rtt_100usec) * 100;
+
+        if ( link_vector.links[link_vector.num].node_idx >= node_worker_ctx->node_num ) {
+            continue;
+        }
+
+        link_vector.num++;
+
+    }
+
+    if ( 0 == node_worker_ctx->link_vectors[src_node_idx].update_ts_sec || link_vector_changed(&node_worker_ctx->link_vectors[src_node_idx], &link_vector) ) {
+        node_worker_ctx->link_vectors[src_node_idx] = link_vector;
+        node_worker_ctx->link_state_changed = 1;
+    }
+
+    node_worker_ctx->link_vectors[src_node_idx].update_ts_sec = node_worker_ctx->now_time_sec;
+
+}
+
+
+static void label_heap_swap(node_worker_ctx_t *node_worker_ctx, int i, int j){
+
+    int l = node_worker_ctx->label_heap[i];
+
+    node_worker_ctx->label_heap[i] = node_worker_ctx->label_heap[j];
+    node_worker_ctx->label_heap[j] = l;
+
+    node_worker_ctx->label_heap_pos[ node_worker_ctx->label_heap[i] ] = i;
+    node_worker_ctx->label_heap_pos[ node_worker_ctx->label_heap[j] ] = j;
+
+}
+
+
+//label 的 dist 只会减小，只需要上浮
+static void label_heap_up(node_worker_ctx_t *node_worker_ctx, int pos){
+
+    int parent;
+
+    while ( pos > 0 ) {
+
+        parent = (pos - 1) / 2;
+
+        if ( node_worker_ctx->label_dist[ node_worker_ctx->label_heap[parent] ] <= node_worker_ctx->label_dist[ node_worker_ctx->label_heap[pos] ] ) {
+            break;
+        }
+
+        label_heap_swap(node_worker_ctx, pos, parent);
+
+        pos = parent;
+
+    }
+
+}
+
+
+static int label_heap_pop(node_worker_ctx_t *node_worker_ctx){
+
+    int64_t *dist = node_worker_ctx->label_dist;
+    int     *heap = node_worker_ctx->label_heap;
+
+    int l = heap[0];
+
+    int pos = 0;
+    int child;
+
+    node_worker_ctx->label_heap_num--;
+
+    if ( node_worker_ctx->label_heap_num > 0 ) {
+        label_heap_swap(node_worker_ctx, 0, node_worker_ctx->label_heap_num);
+    }
+
+    node_worker_ctx->label_heap_pos[l] = -1;
+
+    while ( 1 ) {
+
+        child = pos * 2 + 1;
+
+        if ( child >= node_worker_ctx->label_heap_num ) {
+            break;
+        }
+
+        if ( child + 1 < node_worker_ctx->label_heap_num && dist[ heap[child+1] ] < dist[ heap[child] ] ) {
+            child++;
+        }
+
+        if ( dist[ heap[pos] ] <= dist[ heap[child] ] ) {
+            break;
+        }
+
+        label_heap_swap(node_worker_ctx, pos, child);
+
+        pos = child;
+
+    }
+
+    return l;
+
+}
+
+
+/*
+经过 prev_label 以 dist 到达 node_idx, 每个节点对每个第一跳只保留一条最短的路径，
+最多保留 GNB_AUTO_RELAY_MAX_LABEL 条，已满时替换掉最差的一条还没有确定的路径
+*/
+static void relax_label(node_worker_ctx_t *node_worker_ctx, int node_idx, int first_hop_idx, int64_t dist, int prev_label){
+
+    int base = node_idx * GNB_AUTO_RELAY_MAX_LABEL;
+
+    int worst = -1;
+    int l;
+    int i;
+
+    for ( i=0; i<node_worker_ctx->label_num[node_idx]; i++ ) {
+
+        l = base + i;
+
+        if ( first_hop_idx == node_worker_ctx->label_first_hop[l] ) {
+
+            if ( node_worker_ctx->label_settled[l] || dist >= node_worker_ctx->label_dist[l] ) {
+                return;
+            }
+
+            node_worker_ctx->label_dist[l] = dist;
+            node_worker_ctx->label_prev[l] = prev_label;
+
+            label_heap_up(node_worker_ctx, node_worker_ctx->label_heap_pos[l]);
+
+            return;
+
+        }
+
+        if ( 0 == node_worker_ctx->label_settled[l] && (-1 == worst || node_worker_ctx->label_dist[l] > node_worker_ctx->label_dist[worst]) ) {
+            worst = l;
+        }
+
+    }
+
+    if ( node_worker_ctx->label_num[node_idx] < GNB_AUTO_RELAY_MAX_LABEL ) {
+
+        l = node_idx * GNB_AUTO_RELAY_MAX_LABEL + node_worker_ctx->label_num[node_idx];
+
+        node_worker_ctx->label_num[node_idx]++;
+
+        node_worker_ctx->label_settled[l]   = 0;
+        node_worker_ctx->label_dist[l]      = dist;
+        node_worker_ctx->label_prev[l]      = prev_label;
+        node_worker_ctx->label_first_hop[l] = first_hop_idx;
+
+        node_worker_ctx->label_heap[ node_worker_ctx->label_heap_num ] = l;
+        node_worker_ctx->label_heap_pos[l] = node_worker_ctx->label_heap_num;
+        node_worker_ctx->label_heap_num++;
+
+        label_heap_up(node_worker_ctx, node_worker_ctx->label_heap_pos[l]);
+
+        return;
+
+    }
+
+    //没有确定的 label 不会是其他 label 的 prev, 可以直接替换
+    if ( -1 == worst || dist >= node_worker_ctx->label_dist[worst] ) {
+        return;
+    }
+
+    node_worker_ctx->label_dist[worst]      = dist;
+    node_worker_ctx->label_prev[worst]      = prev_label;
+    node_worker_ctx->label_first_hop[worst] = first_hop_idx;
+
+    label_heap_up(node_worker_ctx, node_worker_ctx->label_heap_pos[worst]);
+
+}
+
+
+/*
+用一次基于 heap 的 SPF 计算本节点到各节点的最短延迟，并记录每条路径的第一跳
+本节点到直连节点的延迟来自 path metric，其余的边来自各节点 pong 中带来的链路延迟
+每个节点保留第一跳不同的若干条路径，复杂度为 O(E log N)
+*/
+static void compute_link_routes(gnb_core_t *gnb_core, node_worker_ctx_t *node_worker_ctx, int local_idx){
+
+    node_link_vector_t *link_vector;
+
+    gnb_node_t *node;
+
+    int64_t rtt_usec;
+
+    int i,l,u,v;
+
+    memset(node_worker_ctx->label_num, 0, node_worker_ctx->node_num);
+
+    node_worker_ctx->label_heap_num = 0;
+
+    //每个直连的节点都是一个第一跳，这样每个目标节点可以得到第一跳不同的若干条 route
+    for ( i=0; i<node_worker_ctx->node_num; i++ ) {
+
+        if ( i == local_idx ) {
+            continue;
+        }
+
+        node = &gnb_core->ctl_block->node_zone->node[i];
 
-    gnb_payload16_t   *node_frame_payload;
+        if ( node->type & (GNB_NODE_TYPE_SLIENCE|GNB_NODE_TYPE_RETIRED) ) {
+            continue;
+        }
 
-    uint64_t now_time_usec;
-    uint64_t now_time_sec;
+        rtt_usec = node_link_rtt_usec(node);
 
-    uint64_t last_sync_ts_sec;
+        if ( rtt_usec < 0 ) {
+            continue;
+        }
 
-    pthread_t thread_worker;
+        relax_label(node_worker_ctx, i, i, rtt_usec, -1);
 
-}node_worker_ctx_t;
+    }
 
+    while ( node_worker_ctx->label_heap_num > 0 ) {
 
-#pragma pack(push, 1)
+        l = label_heap_pop(node_worker_ctx);
 
-typedef struct _node_ping_frame_t {
+        node_worker_ctx->label_settled[l] = 1;
 
-    struct __attribute__((__packed__)) ping_frame_data {
-      uint32_t src_uuid32;   //发送方的uuid32
-      uint32_t dst_uuid32;   //接收方的uuid32
-      uint64_t src_ts_usec;  //发送方的时间戳
+        u = l / GNB_AUTO_RELAY_MAX_LABEL;
 
-      /*让 dst 看到自己的 ip 地址，暂时还没启用*/
-      uint8_t  dst_addr4[4];
-      uint16_t dst_port4;
-      uint8_t  dst_addr6[16];
-      uint16_t dst_port6;
+        link_vector = &node_worker_ctx->link_vectors[u];
 
-      unsigned char crypto_seed[64];
+        for ( i=0; i<link_vector->num; i++ ) {
 
-      unsigned char attachment[128+64];
+            v = link_vector->links[i].node_idx;
 
-      unsigned char text[32];
-    }data;
+            if ( v == local_idx ) {
+                continue;
+            }
 
-    unsigned char src_sign[NODE_ED25519_SIGN_SIZE];
+            relax_label(node_worker_ctx, v, node_worker_ctx->label_first_hop[l], node_worker_ctx->label_dist[l] + link_vector->links[i].rtt_usec, l);
 
-}__attribute__ ((__packed__)) node_ping_frame_t;
+        }
 
+    }
 
-typedef struct _node_pong_frame_t {
+}
 
-    struct __attribute__((__packed__)) pong_frame_data {
-      uint32_t src_uuid32;   //发送方的uuid32
-      uint32_t dst_uuid32;   //接收方的uuid32
-      uint64_t src_ts_usec;  //发送方的时间戳
-      uint64_t dst_ts_usec;  //接收方上一个ping frame带来的时间戳
 
-      uint8_t  dst_addr4[4];
-      uint16_t dst_port4;
-      uint8_t  dst_addr6[16];
-      uint16_t dst_port6;
+static void collect_auto_relay_route(gnb_core_t *gnb_core, int local_idx){
 
-      unsigned char crypto_seed[64];
+    node_worker_ctx_t *node_worker_ctx = gnb_core->node_worker->ctx;
 
-      unsigned char attachment[128+64];
+    auto_relay_route_t auto_relay_route;
+    auto_relay_route_t *auto_routes;
 
-      unsigned char text[32];
-    }data;
+    int i,j,n,l,u;
 
-    unsigned char src_sign[NODE_ED25519_SIGN_SIZE];
+    for ( i=0; i<node_worker_ctx->node_num; i++ ) {
 
-}__attribute__ ((__packed__)) node_pong_frame_t;
+        if ( i == local_idx || 0 == node_worker_ctx->auto_route_nodes[i] ) {
+            continue;
+        }
 
+        auto_routes = &node_worker_ctx->auto_routes[i * GNB_AUTO_RELAY_MAX_ROUTE];
 
-#define GNB_NODE_ATTACHMENT_TYPE_TUN_EMPTY         0x0
-#define GNB_NODE_ATTACHMENT_TYPE_TUN_SOCKADDRESS   0x1
+        for ( n=0; n<node_worker_ctx->label_num[i]; n++ ) {
 
+            l = i * GNB_AUTO_RELAY_MAX_LABEL + n;
 
-typedef struct _node_attachment_tun_sockaddress_t {
+            //直连的路径不是 relay route
+            if ( 0 == node_worker_ctx->label_settled[l] || i == node_worker_ctx->label_first_hop[l] ) {
+                continue;
+            }
 
-    struct in_addr  tun_addr4;
-    uint16_t        tun_sin_port4;
+            memset(&auto_relay_route, 0, sizeof(auto_relay_route_t));
 
-    struct in6_addr tun_ipv6_addr;
-    uint16_t        tun_sin_port6;
+            auto_relay_route.cost_usec = node_worker_ctx->label_dist[l];
 
-    uint16_t        es_sin_port4;
-    uint16_t        es_sin_port6;
+            //从目标节点回溯到第一跳，得到的顺序正好是 route_node 需要的顺序
+            for ( u = node_worker_ctx->label_prev[l]; -1 != u; u = node_worker_ctx->label_prev[u] ) {
 
-}__attribute__ ((__packed__)) node_attachment_tun_sockaddress_t;
+                if ( auto_relay_route.ttl >= GNB_MAX_NODE_RELAY ) {
+                    break;
+                }
 
+                auto_relay_route.relay[auto_relay_route.ttl] = gnb_core->ctl_block->node_zone->node[u / GNB_AUTO_RELAY_MAX_LABEL].uuid32;
+                auto_relay_route.ttl++;
 
-#pragma pack(pop)
+            }
 
+            if ( -1 != u ) {
+                continue;
+            }
 
-static void send_ping_frame(gnb_core_t *gnb_core, gnb_node_t *node);
+            //按 cost 从小到大插入
+            for ( j=GNB_AUTO_RELAY_MAX_ROUTE; j>0; j-- ) {
 
+                if ( 0 != auto_routes[j-1].ttl && auto_routes[j-1].cost_usec <= auto_relay_route.cost_usec ) {
+                    break;
+                }
 
-static void send_ping_frame(gnb_core_t *gnb_core, gnb_node_t *node){
+                if ( j < GNB_AUTO_RELAY_MAX_ROUTE ) {
+                    auto_routes[j] = auto_routes[j-1];
+                }
 
-    int ret;
+            }
 
-    gnb_worker_t *main_worker = gnb_core->main_worker;
+            if ( j < GNB_AUTO_RELAY_MAX_ROUTE ) {
+                auto_routes[j] = auto_relay_route;
+            }
 
-    node_worker_ctx_t *node_worker_ctx = gnb_core->node_worker->ctx;
+        }
 
-    gnb_worker_queue_data_t *send_queue_data;
+    }
 
-    if ( INADDR_ANY == node->udp_sockaddr4.sin_addr.s_addr && 0 == memcmp(&node->udp_sockaddr6.sin6_addr,&in6addr_any,sizeof(struct in6_addr)) ) {
+}
+
+
+static void install_auto_relay_route(gnb_core_t *gnb_core, gnb_node_t *node, auto_relay_route_t *auto_routes){
+
+    int line;
+
+    uint8_t ttl;
+
+    int changed = 0;
+
+    for ( line=0; line<GNB_MAX_NODE_ROUTE; line++ ) {
+
+        ttl = line < GNB_AUTO_RELAY_MAX_ROUTE ? auto_routes[line].ttl : 0;
+
+        if ( node->route_node_ttls[line] != ttl ) {
+            changed = 1;
+            break;
+        }
+
+        if ( 0 != ttl && 0 != memcmp(node->route_node[line], auto_routes[line].relay, sizeof(uint32_t)*GNB_MAX_NODE_RELAY) ) {
+            changed = 1;
+            break;
+        }
+
+    }
+
+    if ( 0 == changed ) {
         return;
     }
 
-    node_worker_ctx->node_frame_payload->sub_type = PAYLOAD_SUB_TYPE_PING;
-    gnb_payload16_set_data_len(node_worker_ctx->node_frame_payload, sizeof(node_ping_frame_t));
+    gnb_seqlock_write_begin(&node->seq);
 
-    node_ping_frame_t *node_ping_frame = (node_ping_frame_t *)node_worker_ctx->node_frame_payload->data;
+    //先让 pf 看不到旧的 route 再更新
+    for ( line=0; line<GNB_MAX_NODE_ROUTE; line++ ) {
+        node->route_node_ttls[line] = 0;
+    }
 
-    memset(node_ping_frame,0,sizeof(node_ping_frame_t));
+    node->selected_route_node = 0;
 
-    node_ping_frame->data.src_uuid32 = htonl(gnb_core->local_node->uuid32);
-    node_ping_frame->data.dst_uuid32 = htonl(node->uuid32);
+    for ( line=0; line<GNB_MAX_NODE_ROUTE; line++ ) {
 
-    node_ping_frame->data.src_ts_usec = gnb_htonll(node_worker_ctx->now_time_usec);
+        if ( line < GNB_AUTO_RELAY_MAX_ROUTE ) {
+            memcpy(node->route_node[line], auto_routes[line].relay, sizeof(uint32_t)*GNB_MAX_NODE_RELAY);
+        } else {
+            memset(node->route_node[line], 0, sizeof(uint32_t)*GNB_MAX_NODE_RELAY);
+        }
 
-    snprintf((char *)node_ping_frame->data.text,32,"%d --PING-> %d",gnb_core->local_node->uuid32,node->uuid32);
+        node->route_node_flows[line] = 0;
+        node->route_node_bytes[line] = 0;
 
-    if ( 0 == gnb_core->conf->lite_mode ) {
-        ed25519_sign(node_ping_frame->src_sign, (const unsigned char *)&node_ping_frame->data, sizeof(struct ping_frame_data), gnb_core->ed25519_public_key, gnb_core->ed25519_private_key);
     }
 
-    GNB_LOG2(gnb_core->log,GNB_LOG_ID_NODE_WORKER, "ping src[%u]->dst[%u] %s %s ping_ts=%"PRIu64"\n",
-            gnb_core->local_node->uuid32, node->uuid32,
-            GNB_SOCKADDR6STR1(&node->udp_sockaddr6), GNB_SOCKADDR4STR2(&node->udp_sockaddr4),
-            node->ping_ts_sec
-    );
+    for ( line=0; line<GNB_AUTO_RELAY_MAX_ROUTE; line++ ) {
+        node->route_node_ttls[line] = auto_routes[line].ttl;
+    }
 
+    node->node_relay_mode = GNB_NODE_RELAY_AUTO | GNB_NODE_RELAY_DYNAMIC;
 
-    //PING frame 尽可能 ipv4 和 ipv6 都发送
-    gnb_send_to_node(gnb_core, node, node_worker_ctx->node_frame_payload, GNB_ADDR_TYPE_IPV6|GNB_ADDR_TYPE_IPV4);
+    gnb_seqlock_write_end(&node->seq);
 
-    //更新 node 的ping 时间戳
-    node->ping_ts_sec  = node_worker_ctx->now_time_sec;
-    node->ping_ts_usec = node_worker_ctx->now_time_usec;
+    if ( 0 != auto_routes[0].ttl ) {
+        GNB_LOG2(gnb_core->log,GNB_LOG_ID_NODE_WORKER, "auto relay route node[%u] first hop[%u] ttl=%u cost=%"PRId64"us\n",
+                node->uuid32, auto_routes[0].relay[auto_routes[0].ttl-1], auto_routes[0].ttl, auto_routes[0].cost_usec);
+    } else {
+        GNB_LOG2(gnb_core->log,GNB_LOG_ID_NODE_WORKER, "auto relay route node[%u] no route\n", node->uuid32);
+    }
+
+}
+
+
+/*
+热加载换入新的 node 表后，重新确定哪些节点需要自动计算 route，
+并去掉已删除节点的链路
+*/
+static void refresh_auto_route_nodes(gnb_core_t *gnb_core, node_worker_ctx_t *node_worker_ctx){
+
+    node_link_vector_t *link_vector;
+
+    gnb_node_t *node;
+
+    int i,j,num;
+
+    node_worker_ctx->node_table_epoch = gnb_core->ctl_block->status_zone->node_table_epoch;
+
+    node_worker_ctx->node_num = gnb_core->ctl_block->node_zone->node_num;
+
+    for ( i=0; i<node_worker_ctx->node_num; i++ ) {
+
+        node = &gnb_core->ctl_block->node_zone->node[i];
+
+        if ( node->type & GNB_NODE_TYPE_RETIRED ) {
+            node_worker_ctx->auto_route_nodes[i] = 0;
+            memset(&node_worker_ctx->link_vectors[i], 0, sizeof(node_link_vector_t));
+            continue;
+        }
+
+        if ( gnb_core->local_node->uuid32 == node->uuid32 ) {
+            node_worker_ctx->auto_route_nodes[i] = 0;
+        } else if ( 0 == node->route_node_ttls[0] || (node->node_relay_mode & GNB_NODE_RELAY_DYNAMIC) ) {
+            node_worker_ctx->auto_route_nodes[i] = 1;
+        } else {
+            node_worker_ctx->auto_route_nodes[i] = 0;
+        }
+
+    }
+
+    for ( i=0; i<node_worker_ctx->node_num; i++ ) {
+
+        link_vector = &node_worker_ctx->link_vectors[i];
+
+        num = 0;
+
+        for ( j=0; j<link_vector->num; j++ ) {
+
+            if ( gnb_core->ctl_block->node_zone->node[ link_vector->links[j].node_idx ].type & GNB_NODE_TYPE_RETIRED ) {
+                continue;
+            }
+
+            link_vector->links[num] = link_vector->links[j];
+            num++;
+
+        }
+
+        link_vector->num = num;
+
+    }
+
+    node_worker_ctx->link_state_changed = 1;
 
 }
 
 
+//链路状态发生改变后才重新计算
+static void update_auto_relay_route(gnb_core_t *gnb_core){
+
+    node_worker_ctx_t *node_worker_ctx = gnb_core->node_worker->ctx;
+
+    int local_idx;
+
+    int i;
+
+    if ( 0 == gnb_core->conf->auto_relay_route || 0 == node_worker_ctx->node_num ) {
+        return;
+    }
+
+    if ( node_worker_ctx->node_table_epoch != gnb_core->ctl_block->status_zone->node_table_epoch ) {
+        refresh_auto_route_nodes(gnb_core, node_worker_ctx);
+    }
+
+    for ( i=0; i<node_worker_ctx->node_num; i++ ) {
+
+        if ( 0 == node_worker_ctx->link_vectors[i].update_ts_sec ) {
+            continue;
+        }
+
+        if ( (node_worker_ctx->now_time_sec - node_worker_ctx->link_vectors[i].update_ts_sec) > GNB_NODE_LINK_VECTOR_TIMEOUT_SEC ) {
+            memset(&node_worker_ctx->link_vectors[i], 0, sizeof(node_link_vector_t));
+            node_worker_ctx->link_state_changed = 1;
+        }
+
+    }
+
+    build_local_link_vector(gnb_core);
+
+    if ( 0 == node_worker_ctx->link_state_changed ) {
+        return;
+    }
+
+    node_worker_ctx->link_state_changed = 0;
+
+    local_idx = gnb_core->local_node - gnb_core->ctl_block->node_zone->node;
+
+    memset(node_worker_ctx->auto_routes, 0, sizeof(auto_relay_route_t) * node_worker_ctx->node_num * GNB_AUTO_RELAY_MAX_ROUTE);
+
+    compute_link_routes(gnb_core, node_worker_ctx, local_idx);
+
+    collect_auto_relay_route(gnb_core, local_idx);
+
+    for ( i=0; i<node_worker_ctx->node_num; i++ ) {
+
+        if ( 0 == node_worker_ctx->auto_route_nodes[i] ) {
+            continue;
+        }
+
+        install_auto_relay_route(gnb_core, &gnb_core->ctl_block->node_zone->node[i], &node_worker_ctx->auto_routes[i * GNB_AUTO_RELAY_MAX_ROUTE]);
+
+    }
+
+}
+
 
 static void handle_ping_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_worker_in_data){
 
@@ -208,7 +1023,7 @@ static void handle_ping_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_w
 
     node_worker_ctx_t *node_worker_ctx = gnb_core->node_worker->ctx;
 
-    node_ping_frame_t *node_ping_frame = (node_ping_frame_t *)&node_worker_in_data->payload_st.data;
+    node_ping_frame_t *node_ping_frame = (node_ping_frame_t *)&node_worker_in_data->payload->data;
 
     uint32_t src_uuid32 = ntohl(node_ping_frame->data.src_uuid32);
     uint32_t dst_uuid32 = ntohl(node_ping_frame->data.dst_uuid32);
@@ -254,6 +1069,8 @@ static void handle_ping_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_w
 
     if (AF_INET6 == node_addr->addr_type){
 
+        gnb_seqlock_write_begin(&src_node->seq);
+
         src_node->udp_addr_status |= GNB_NODE_STATUS_IPV6_PING;
 
         //只在发生改变的时候才更新
@@ -265,6 +1082,8 @@ static void handle_ping_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_w
 
         src_node->addr6_update_ts_sec = node_worker_ctx->now_time_sec;
 
+        gnb_seqlock_write_end(&src_node->seq);
+
         GNB_LOG2(gnb_core->log,GNB_LOG_ID_NODE_WORKER, "handle_ping_frame IPV6 src[%u]->dst[%u] idx=%u %s now=%"PRIu64" src_ts=%"PRIu64" up=%u different=%"PRId64"\n",
                 src_node->uuid32, dst_uuid32,
                 node_worker_in_data->socket_idx,
@@ -276,6 +1095,8 @@ static void handle_ping_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_w
 
     if (AF_INET == node_addr->addr_type) {
 
+        gnb_seqlock_write_begin(&src_node->seq);
+
         src_node->udp_addr_status |= GNB_NODE_STATUS_IPV4_PING;
 
         //只在发生改变的时候才更新
@@ -287,6 +1108,8 @@ static void handle_ping_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_w
 
         src_node->addr4_update_ts_sec = node_worker_ctx->now_time_sec;
 
+        gnb_seqlock_write_end(&src_node->seq);
+
         GNB_LOG2(gnb_core->log,GNB_LOG_ID_NODE_WORKER, "handle_ping_frame IPV4 src[%u]->dst[%u] idx=%u %s now=%"PRIu64" src_ts=%"PRIu64" up=%u different=%"PRId64"\n",
                 src_node->uuid32, dst_uuid32,
                 node_worker_in_data->socket_idx,
@@ -319,6 +1142,12 @@ static void handle_ping_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_w
     memcpy(&attachment_tun_sockaddress->tun_addr4, &gnb_core->local_node->tun_addr4.s_addr, 4);
     attachment_tun_sockaddress->tun_sin_port4 = gnb_core->local_node->tun_sin_port4;
 
+    //第二个附件是本节点到其他节点的链路延迟
+    if ( gnb_core->conf->auto_relay_route && node_worker_ctx->local_link_vector.num > 0 ) {
+        payload_attachment = (gnb_payload16_t *)( node_pong_frame->data.attachment + GNB_PAYLOAD16_FRAME_SIZE(payload_attachment) );
+        set_link_latency_attachment(gnb_core, payload_attachment, src_node);
+    }
+
     snprintf((char *)node_pong_frame->data.text,32,"%d --PONG-> %d",gnb_core->local_node->uuid32,src_node->uuid32);
 
     if ( 0 == gnb_core->conf->lite_mode ) {
@@ -347,7 +1176,7 @@ static void handle_pong_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_w
 
     node_worker_ctx_t *node_worker_ctx = gnb_core->node_worker->ctx;
 
-    node_pong_frame_t *node_pong_frame = (node_pong_frame_t *)&node_worker_in_data->payload_st.data;
+    node_pong_frame_t *node_pong_frame = (node_pong_frame_t *)&node_worker_in_data->payload->data;
 
     uint32_t src_uuid32 = ntohl(node_pong_frame->data.src_uuid32);
     uint32_t dst_uuid32 = ntohl(node_pong_frame->data.dst_uuid32);
@@ -387,6 +1216,8 @@ static void handle_pong_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_w
 
     if (AF_INET6 == node_addr->addr_type) {
 
+        gnb_seqlock_write_begin(&src_node->seq);
+
         src_node->udp_addr_status |= GNB_NODE_STATUS_IPV6_PONG;
 
         //只在发生改变的时候才更新
@@ -405,8 +1236,12 @@ static void handle_pong_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_w
                 GNB_LOG2(gnb_core->log,GNB_LOG_ID_NODE_WORKER,"addr6_ping_latency_usec==0 now=%"PRIu64" dst_ts=%"PRIu64"\n",node_worker_ctx->now_time_usec, dst_ts_usec);
             }
 
+            gnb_node_path_metric_pong(&src_node->addr6_path_metric, src_node->addr6_ping_latency_usec);
+
         }
 
+        gnb_seqlock_write_end(&src_node->seq);
+
         GNB_LOG2(gnb_core->log,GNB_LOG_ID_NODE_WORKER, "handle_pong_frame IPV6 src[%u]->dst[%u] idx=%u %s now=%"PRIu64" dst_ts=%"PRIu64" up=%u latency=%"PRId64"\n",
                 src_node->uuid32, dst_uuid32,
                 node_worker_in_data->socket_idx,
@@ -418,6 +1253,8 @@ static void handle_pong_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_w
 
     if (AF_INET == node_addr->addr_type) {
 
+        gnb_seqlock_write_begin(&src_node->seq);
+
         src_node->udp_addr_status |= GNB_NODE_STATUS_IPV4_PONG;
 
         //只在发生改变的时候才更新
@@ -436,8 +1273,12 @@ static void handle_pong_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_w
                 GNB_LOG2(gnb_core->log,GNB_LOG_ID_NODE_WORKER,"addr4_ping_latency_usec==0 now=%"PRIu64" dst_ts=%"PRIu64"\n",node_worker_ctx->now_time_usec, dst_ts_usec);
             }
 
+            gnb_node_path_metric_pong(&src_node->addr4_path_metric, src_node->addr4_ping_latency_usec);
+
         }
 
+        gnb_seqlock_write_end(&src_node->seq);
+
         GNB_LOG2(gnb_core->log,GNB_LOG_ID_NODE_WORKER, "handle_pong_frame IPV4 src[%u]->dst[%u] idx=%u %s now=%"PRIu64" dst_ts=%"PRIu64" up=%u latency=%"PRId64"\n",
                 src_node->uuid32, dst_uuid32,
                 node_worker_in_data->socket_idx,
@@ -447,11 +1288,17 @@ static void handle_pong_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_w
     }
 
 
+    gnb_node_select_path(src_node);
+
+    gnb_update_forward_node_ring(gnb_core);
+
     //处理附件
     gnb_payload16_t *payload_attachment = (gnb_payload16_t *)node_pong_frame->data.attachment;
 
     node_attachment_tun_sockaddress_t *attachment_tun_sockaddress;
 
+    size_t attachment_offset;
+
     if ( GNB_NODE_ATTACHMENT_TYPE_TUN_SOCKADDRESS == payload_attachment->type ) {
 
         attachment_tun_sockaddress = (node_attachment_tun_sockaddress_t *)payload_attachment->data;
@@ -460,9 +1307,22 @@ static void handle_pong_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_w
             src_node->tun_sin_port4 = attachment_tun_sockaddress->tun_sin_port4;
         }
 
+        attachment_offset = GNB_PAYLOAD16_FRAME_SIZE(payload_attachment);
+
+        if ( gnb_core->conf->auto_relay_route && attachment_offset + GNB_PAYLOAD16_HEAD_SIZE <= sizeof(node_pong_frame->data.attachment) ) {
+
+            payload_attachment = (gnb_payload16_t *)( node_pong_frame->data.attachment + attachment_offset );
+
+            if ( GNB_NODE_ATTACHMENT_TYPE_LINK_LATENCY == payload_attachment->type &&
+                 attachment_offset + GNB_PAYLOAD16_FRAME_SIZE(payload_attachment) <= sizeof(node_pong_frame->data.attachment) ) {
+                handle_link_latency_attachment(gnb_core, src_node, payload_attachment);
+            }
+
+        }
+
     }
 
-    if ( PAYLOAD_SUB_TYPE_PONG2 == node_worker_in_data->payload_st.sub_type ) {
+    if ( PAYLOAD_SUB_TYPE_PONG2 == node_worker_in_data->payload->sub_type ) {
 
         GNB_LOG2(gnb_core->log,GNB_LOG_ID_NODE_WORKER, "handle_pong2_frame  src[%u]->dst[%u] idx=%u\n",
                 src_node->uuid32, dst_uuid32,
@@ -576,7 +1436,7 @@ static void sync_node(gnb_worker_t *gnb_node_worker){
             continue;
         }
 
-        if ( node->type & GNB_NODE_TYPE_SLIENCE ) {
+        if ( node->type & (GNB_NODE_TYPE_SLIENCE|GNB_NODE_TYPE_RETIRED) ) {
             continue;
         }
 
@@ -596,8 +1456,10 @@ static void sync_node(gnb_worker_t *gnb_node_worker){
 
             if (  (node_worker_ctx->now_time_sec - node->ping_ts_sec) >= GNB_NODE_PING_INTERVAL_SEC ) {
                 //如果地址为 0.0.0.0 或 :: , 需要向 index node 发送 PAYLOAD_SUB_TYPE_ADDR_QUERY
+                gnb_seqlock_write_begin(&node->seq);
                 node->udp_addr_status = GNB_NODE_STATUS_UNREACHABL;
                 node->ping_ts_sec = node_worker_ctx->now_time_sec;
+                gnb_seqlock_write_end(&node->seq);
             }
 
             continue;
@@ -606,6 +1468,8 @@ static void sync_node(gnb_worker_t *gnb_node_worker){
 
         send_ping_frame(gnb_core,node);
 
+        gnb_seqlock_write_begin(&node->seq);
+
         if ( (node_worker_ctx->now_time_sec - node->addr4_update_ts_sec) > GNB_NODE_UPDATE_INTERVAL_SEC ) {
             //节点状态超时，且不是idx node, 可能目标node已经下线或者更换了ip
             //IPV4 需要向 idx node 发送 PAYLOAD_SUB_TYPE_ADDR_QUERY
@@ -624,14 +1488,22 @@ static void sync_node(gnb_worker_t *gnb_node_worker){
 
         }
 
+        gnb_node_select_path(node);
+
+        gnb_seqlock_write_end(&node->seq);
+
     }
 
+    gnb_update_forward_node_ring(gnb_core);
+
+    update_auto_relay_route(gnb_core);
+
 }
 
 
 static void handle_node_frame(gnb_core_t *gnb_core, gnb_worker_in_data_t *node_worker_in_data){
 
-    gnb_payload16_t *payload = &node_worker_in_data->payload_st;
+    gnb_payload16_t *payload = node_worker_in_data->payload;
 
     if ( GNB_PAYLOAD_TYPE_NODE != payload->type ) {
         GNB_LOG2(gnb_core->log,GNB_LOG_ID_NODE_WORKER,"handle_node_frame GNB_PAYLOAD_TYPE_NODE != payload->type[%x]\n",payload->type);
@@ -678,10 +1550,20 @@ static void handle_recv_queue(gnb_core_t *gnb_core){
             break;
         }
 
+        GNB_METRICS_INC(&gnb_core->ctl_block->metrics_zone->slot[GNB_METRICS_SLOT_NODE_WORKER], GNB_METRIC_WORKER_IN_PKT);
+
         receive_queue_data = (gnb_worker_queue_data_t *)ring_node->data;
 
+        if ( GNB_TRACE_ON(gnb_core->trace, GNB_TRACE_QUEUE_POP) ) {
+            gnb_trace_emit(gnb_core->trace, GNB_TRACE_QUEUE_POP, GNB_TRACE_QUEUE_NODE, receive_queue_data->data.node_in.payload->type,
+                           receive_queue_data->data.node_in.payload->sub_type, gnb_payload16_size(receive_queue_data->data.node_in.payload), 0);
+        }
+
         handle_node_frame(gnb_core, &receive_queue_data->data.node_in);
 
+
+        gnb_packet_buf_unref(receive_queue_data->data.node_in.packet_buf);
+
         gnb_ring_buffer_pop_submit( gnb_core->node_worker->ring_buffer );
 
     }
@@ -704,6 +1586,8 @@ static void* thread_worker_func( void *data ) {
 
     do{
 
+        gnb_config_file_reload_quiescent(gnb_core, GNB_NODE_TABLE_READER_NODE);
+
         gnb_worker_sync_time(&node_worker_ctx->now_time_sec, &node_worker_ctx->now_time_usec);
 
         update_node_crypto_key(gnb_core, node_worker_ctx->now_time_sec);
@@ -730,6 +1614,52 @@ static void* thread_worker_func( void *data ) {
 }
 
 
+static void init_auto_relay_route(gnb_core_t *gnb_core, node_worker_ctx_t *node_worker_ctx){
+
+    gnb_node_t *node;
+
+    size_t num = gnb_core->ctl_block->node_zone->node_num;
+
+    //按 node_zone 的容量分配，热加载新增的节点不需要重新分配
+    size_t capacity = gnb_core->ctl_block->node_zone->node_capacity;
+
+    int i;
+
+    if ( 0 == num ) {
+        return;
+    }
+
+    node_worker_ctx->link_vectors     = (node_link_vector_t *)malloc(sizeof(node_link_vector_t) * capacity);
+    node_worker_ctx->auto_route_nodes = (uint8_t *)malloc(capacity);
+    node_worker_ctx->auto_routes      = (auto_relay_route_t *)malloc(sizeof(auto_relay_route_t) * capacity * GNB_AUTO_RELAY_MAX_ROUTE);
+    node_worker_ctx->label_dist       = (int64_t *)malloc(sizeof(int64_t) * capacity * GNB_AUTO_RELAY_MAX_LABEL);
+    node_worker_ctx->label_prev       = (int *)malloc(sizeof(int) * capacity * GNB_AUTO_RELAY_MAX_LABEL);
+    node_worker_ctx->label_first_hop  = (int *)malloc(sizeof(int) * capacity * GNB_AUTO_RELAY_MAX_LABEL);
+    node_worker_ctx->label_heap_pos   = (int *)malloc(sizeof(int) * capacity * GNB_AUTO_RELAY_MAX_LABEL);
+    node_worker_ctx->label_settled    = (uint8_t *)malloc(capacity * GNB_AUTO_RELAY_MAX_LABEL);
+    node_worker_ctx->label_num        = (uint8_t *)malloc(capacity);
+    node_worker_ctx->label_heap       = (int *)malloc(sizeof(int) * capacity * GNB_AUTO_RELAY_MAX_LABEL);
+
+    memset(node_worker_ctx->link_vectors, 0, sizeof(node_link_vector_t) * capacity);
+
+    for ( i=0; i<num; i++ ) {
+
+        node = &gnb_core->ctl_block->node_zone->node[i];
+
+        //route.conf 中配置了 relay route 的节点保持原来的配置
+        if ( gnb_core->local_node->uuid32 == node->uuid32 || 0 != node->route_node_ttls[0] ) {
+            node_worker_ctx->auto_route_nodes[i] = 0;
+        } else {
+            node_worker_ctx->auto_route_nodes[i] = 1;
+        }
+
+    }
+
+    node_worker_ctx->node_num = num;
+
+}
+
+
 static void init(gnb_worker_t *gnb_worker, void *ctx){
 
     gnb_core_t *gnb_core = (gnb_core_t *)ctx;
@@ -745,6 +1675,10 @@ static void init(gnb_worker_t *gnb_worker, void *ctx){
 
     node_worker_ctx->gnb_core = gnb_core;
 
+    if ( gnb_core->conf->auto_relay_route ) {
+        init_auto_relay_route(gnb_core, node_worker_ctx);
+    }
+
     gnb_worker->ctx = node_worker_ctx;
 
     GNB_LOG1(gnb_core->log,GNB_LOG_ID_NODE_WORKER,"%s init finish\n", gnb_worker->name);
@@ -756,6 +1690,19 @@ static void release(gnb_worker_t *gnb_worker){
 
     gnb_ring_buffer_release(gnb_worker->ring_buffer);
 
+    if ( 0 != node_worker_ctx->node_num ) {
+        free(node_worker_ctx->link_vectors);
+        free(node_worker_ctx->auto_route_nodes);
+        free(node_worker_ctx->auto_routes);
+        free(node_worker_ctx->label_dist);
+        free(node_worker_ctx->label_prev);
+        free(node_worker_ctx->label_first_hop);
+        free(node_worker_ctx->label_heap_pos);
+        free(node_worker_ctx->label_settled);
+        free(node_worker_ctx->label_num);
+        free(node_worker_ctx->label_heap);
+    }
+
     free(node_worker_ctx);
 
 }
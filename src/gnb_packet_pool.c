@@ -0,0 +1,277 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__) || defined(__OpenBSD__)
+#define __UNIX_LIKE_OS__ 1
+#endif
+
+#ifdef __UNIX_LIKE_OS__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "gnb_packet_pool.h"
+
+#ifdef __linux__
+//linux/mempolicy.h
+#define GNB_MPOL_LOCAL           4
+#define GNB_HUGEPAGE_SIZE        (2*1024*1024)
+#endif
+
+typedef struct _gnb_packet_pool_t{
+
+    volatile uint32_t lock;
+
+    uint32_t num;
+
+    int flags;
+
+    gnb_packet_buf_t *free_list;
+
+    //block 是 mmap 得到的时候 block_size 不为 0
+    unsigned char *block;
+    size_t block_size;
+
+    gnb_packet_buf_t buf[0];
+
+}gnb_packet_pool_t;
+
+
+static inline void pool_lock(gnb_packet_pool_t *packet_pool){
+
+    while ( __sync_lock_test_and_set(&packet_pool->lock, 1) ) {
+
+        while ( packet_pool->lock ) {
+        }
+
+    }
+
+}
+
+
+static inline void pool_unlock(gnb_packet_pool_t *packet_pool){
+    __sync_lock_release(&packet_pool->lock);
+}
+
+
+#ifdef __UNIX_LIKE_OS__
+
+static unsigned char* mmap_block(gnb_packet_pool_t *packet_pool, size_t size, int flags){
+
+    void *block = MAP_FAILED;
+
+    packet_pool->flags = 0;
+
+#ifdef __linux__
+
+    if ( flags & GNB_PACKET_POOL_HUGEPAGE ) {
+
+        packet_pool->block_size = (size + GNB_HUGEPAGE_SIZE - 1) & ~((size_t)GNB_HUGEPAGE_SIZE - 1);
+
+        block = mmap(NULL, packet_pool->block_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+
+        if ( MAP_FAILED != block ) {
+            packet_pool->flags |= GNB_PACKET_POOL_HUGEPAGE;
+        }
+
+    }
+
+#endif
+
+    if ( MAP_FAILED == block ) {
+
+        packet_pool->block_size = size;
+
+        block = mmap(NULL, packet_pool->block_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+
+        if ( MAP_FAILED == block ) {
+            return NULL;
+        }
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        //没有预留 hugepage 时尝试 transparent hugepage
+        if ( (flags & GNB_PACKET_POOL_HUGEPAGE) && 0 == madvise(block, packet_pool->block_size, MADV_HUGEPAGE) ) {
+            packet_pool->flags |= GNB_PACKET_POOL_HUGEPAGE;
+        }
+#endif
+
+    }
+
+    if ( flags & GNB_PACKET_POOL_NUMA_LOCAL ) {
+
+#ifdef __linux__
+        //内核不支持 NUMA 时 mbind 失败，first touch 仍然会在当前线程所在的 node 上分配
+        syscall(SYS_mbind, block, packet_pool->block_size, GNB_MPOL_LOCAL, NULL, 0, 0);
+#endif
+
+        //在创建 pool 的线程中 first touch
+        memset(block, 0, packet_pool->block_size);
+
+        packet_pool->flags |= GNB_PACKET_POOL_NUMA_LOCAL;
+
+    }
+
+    return (unsigned char *)block;
+
+}
+
+#endif
+
+
+gnb_packet_pool_t* gnb_packet_pool_create(gnb_heap_t *heap, uint32_t num, uint16_t headroom, uint32_t payload_size, uint16_t tailroom, int flags){
+
+    gnb_packet_pool_t *packet_pool;
+
+    uint32_t buf_size;
+
+    uint32_t i;
+
+    packet_pool = (gnb_packet_pool_t *)gnb_heap_alloc(heap, sizeof(gnb_packet_pool_t) + sizeof(gnb_packet_buf_t) * num);
+
+    if ( NULL == packet_pool ) {
+        return NULL;
+    }
+
+    //buffer 的长度按 cache line 对齐
+    buf_size = ((uint32_t)headroom + payload_size + tailroom + 63) & ~63;
+
+    packet_pool->block = NULL;
+    packet_pool->block_size = 0;
+    packet_pool->flags = 0;
+
+#ifdef __UNIX_LIKE_OS__
+    if ( 0 != flags ) {
+        packet_pool->block = mmap_block(packet_pool, (size_t)buf_size * num, flags);
+    }
+#endif
+
+    if ( NULL == packet_pool->block ) {
+
+        packet_pool->block_size = 0;
+
+        //不做 memset, 只有用到的 buffer 才会占用物理内存
+        packet_pool->block = gnb_heap_alloc(heap, buf_size * num);
+
+    }
+
+    if ( NULL == packet_pool->block ) {
+        gnb_heap_free(heap, packet_pool);
+        return NULL;
+    }
+
+    packet_pool->lock = 0;
+    packet_pool->num = num;
+    packet_pool->free_list = NULL;
+
+    //倒序入栈，先分配出去的是 block 前面的 buffer
+    for ( i=num; i>0; i-- ) {
+        packet_pool->buf[i-1].pool     = packet_pool;
+        packet_pool->buf[i-1].ref      = 0;
+        packet_pool->buf[i-1].size     = buf_size;
+        packet_pool->buf[i-1].headroom = headroom;
+        packet_pool->buf[i-1].tailroom = (uint16_t)(buf_size - headroom - payload_size);
+        packet_pool->buf[i-1].data     = packet_pool->block + (size_t)buf_size * (i-1);
+        packet_pool->buf[i-1].next     = packet_pool->free_list;
+        packet_pool->free_list = &packet_pool->buf[i-1];
+    }
+
+    return packet_pool;
+
+}
+
+
+void gnb_packet_pool_release(gnb_heap_t *heap, gnb_packet_pool_t *packet_pool){
+
+#ifdef __UNIX_LIKE_OS__
+    if ( 0 != packet_pool->block_size ) {
+        munmap(packet_pool->block, packet_pool->block_size);
+        gnb_heap_free(heap, packet_pool);
+        return;
+    }
+#endif
+
+    gnb_heap_free(heap, packet_pool->block);
+    gnb_heap_free(heap, packet_pool);
+
+}
+
+
+int gnb_packet_pool_flags(gnb_packet_pool_t *packet_pool){
+    return packet_pool->flags;
+}
+
+
+/*
+后进先出，刚释放的 buffer 最先被再次使用，还在 cache 中
+*/
+gnb_packet_buf_t* gnb_packet_buf_alloc(gnb_packet_pool_t *packet_pool){
+
+    gnb_packet_buf_t *packet_buf;
+
+    if ( NULL == packet_pool ) {
+        return NULL;
+    }
+
+    pool_lock(packet_pool);
+
+    packet_buf = packet_pool->free_list;
+
+    if ( NULL != packet_buf ) {
+        packet_pool->free_list = packet_buf->next;
+    }
+
+    pool_unlock(packet_pool);
+
+    if ( NULL == packet_buf ) {
+        return NULL;
+    }
+
+    packet_buf->next = NULL;
+    packet_buf->ref  = 1;
+
+    return packet_buf;
+
+}
+
+
+void gnb_packet_buf_ref(gnb_packet_buf_t *packet_buf){
+    __sync_add_and_fetch(&packet_buf->ref, 1);
+}
+
+
+void gnb_packet_buf_unref(gnb_packet_buf_t *packet_buf){
+
+    gnb_packet_pool_t *packet_pool = packet_buf->pool;
+
+    if ( 0 != __sync_sub_and_fetch(&packet_buf->ref, 1) ) {
+        return;
+    }
+
+    pool_lock(packet_pool);
+
+    packet_buf->next = packet_pool->free_list;
+    packet_pool->free_list = packet_buf;
+
+    pool_unlock(packet_pool);
+
+}
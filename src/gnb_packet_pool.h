@@ -0,0 +1,81 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef GNB_PACKET_POOL_H
+#define GNB_PACKET_POOL_H
+
+#include <stdint.h>
+
+#include "gnb_alloc.h"
+
+/*
+每个收包的线程有自己的 pool, 只有这个线程 alloc, 任何线程都可以 unref
+main worker 把收到的分组直接收进 pool 的 buffer, 通过 worker 的 queue 只传递 buffer 的指针
+worker 处理完后 unref, 引用计数为 0 时 buffer 回到 pool
+
+buffer 的布局是固定的
+| headroom | payload | tailroom |
+headroom 用于在 payload 前面填充 fwdu0 这类头部，tailroom 用于在 payload 后面追加 relay trailer 这类数据
+*/
+
+//用 hugepage 作为 pool 的内存，不能分配时使用普通的内存页
+#define GNB_PACKET_POOL_HUGEPAGE    (0x1)
+
+//在调用 gnb_packet_pool_create 的线程所在的 NUMA node 上分配内存，并在创建时就占用全部的内存
+#define GNB_PACKET_POOL_NUMA_LOCAL  (0x1 << 1)
+
+
+typedef struct _gnb_packet_pool_t gnb_packet_pool_t;
+
+typedef struct _gnb_packet_buf_t {
+
+	gnb_packet_pool_t *pool;
+
+	struct _gnb_packet_buf_t *next;
+
+	volatile uint32_t ref;
+
+	//headroom payload tailroom 的总长度
+	uint32_t size;
+
+	uint16_t headroom;
+
+	uint16_t tailroom;
+
+	unsigned char *data;
+
+}gnb_packet_buf_t;
+
+
+gnb_packet_pool_t* gnb_packet_pool_create(gnb_heap_t *heap, uint32_t num, uint16_t headroom, uint32_t payload_size, uint16_t tailroom, int flags);
+
+void gnb_packet_pool_release(gnb_heap_t *heap, gnb_packet_pool_t *packet_pool);
+
+//实际使用的 GNB_PACKET_POOL_HUGEPAGE GNB_PACKET_POOL_NUMA_LOCAL
+int gnb_packet_pool_flags(gnb_packet_pool_t *packet_pool);
+
+//pool 中没有空闲的 buffer 时返回 NULL, 返回的 buffer 的 ref 为 1
+gnb_packet_buf_t* gnb_packet_buf_alloc(gnb_packet_pool_t *packet_pool);
+
+void gnb_packet_buf_ref(gnb_packet_buf_t *packet_buf);
+
+void gnb_packet_buf_unref(gnb_packet_buf_t *packet_buf);
+
+static inline void* gnb_packet_buf_payload(gnb_packet_buf_t *packet_buf){
+	return packet_buf->data + packet_buf->headroom;
+}
+
+#endif
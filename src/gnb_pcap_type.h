@@ -0,0 +1,112 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GNB_PCAP_TYPE_H
+#define GNB_PCAP_TYPE_H
+
+#include <stdint.h>
+
+/*
+gnb_pf_dump 抓包用的 mmap ring 文件
+文件开头是 GNB_PCAP_RING_HEAD_SIZE 字节的 gnb_pcap_ring_head_t, 之后是 ring 的数据区
+数据区中每个记录以 gnb_pcap_record_head_t 开头，后面是一个完整的 pcapng Enhanced Packet Block
+gnb_ctl 读 ring 时在前面加上 Section Header Block 和 Interface Description Block 就是合法的 pcapng 流
+head 和 commit 是 32 位的，32 位的 mips 等平台没有 64 位的 __sync 原子操作,
+数据区的大小是 2 的幂，head 回绕后记录的位置 head & (data_size-1) 仍然连续
+*/
+
+#define GNB_PCAP_RING_MAGIC        "GNBPCAP"
+#define GNB_PCAP_RING_VERSION      2
+#define GNB_PCAP_RING_HEAD_SIZE    4096
+
+//记录按 16 字节对齐，ring 尾部剩余的空间总能放下一个 pad 记录
+#define GNB_PCAP_RECORD_ALIGN      16
+
+#define GNB_PCAP_RECORD_TYPE_EPB   1
+#define GNB_PCAP_RECORD_TYPE_PAD   2
+
+#define GNB_PCAP_MAX_SNAPLEN       65535
+
+//数据区最大 2GB, 保证 32 位的位置之差不会溢出
+#define GNB_PCAP_MAX_DATA_SIZE     0x80000000U
+
+
+#define PCAPNG_BLOCK_TYPE_SHB      0x0A0D0D0A
+#define PCAPNG_BLOCK_TYPE_IDB      0x00000001
+#define PCAPNG_BLOCK_TYPE_EPB      0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC    0x1A2B3C4D
+
+#define PCAPNG_OPT_ENDOFOPT        0
+#define PCAPNG_OPT_COMMENT         1
+#define PCAPNG_OPT_IF_NAME         2
+#define PCAPNG_OPT_EPB_FLAGS       2
+
+//epb_flags 的最低两位是方向
+#define PCAPNG_EPB_FLAGS_INBOUND   0x1
+#define PCAPNG_EPB_FLAGS_OUTBOUND  0x2
+
+//tun 设备上是没有链路层头部的 ip 分组
+#define PCAPNG_LINKTYPE_RAW        101
+
+
+typedef struct _gnb_pcap_ring_head_t {
+
+	unsigned char magic[8];
+
+	uint32_t version;
+
+	uint32_t snaplen;
+
+	uint32_t local_uuid;
+
+	uint32_t reserved;
+
+	//2 的幂
+	uint32_t data_size;
+
+	//已经分配出去的字节数，只增不减(会回绕), 记录在数据区的位置是 head & (data_size-1)
+	volatile uint32_t head;
+
+	//写入 ring 的记录数
+	volatile uint32_t records;
+
+	uint32_t reserved2;
+
+}gnb_pcap_ring_head_t;
+
+
+typedef struct _gnb_pcap_record_head_t {
+
+	//写完后设为记录的位置 + 1, 写入过程中为 0
+	volatile uint32_t commit;
+
+	uint32_t reserved;
+
+	//包含本结构和对齐的填充
+	uint32_t size;
+
+	uint32_t type;
+
+}gnb_pcap_record_head_t;
+
+
+#define GNB_PCAP_ALIGN4(n)   ( ((n) + 3) & ~3 )
+
+#define GNB_PCAP_ALIGN16(n)  ( ((n) + GNB_PCAP_RECORD_ALIGN - 1) & ~(GNB_PCAP_RECORD_ALIGN - 1) )
+
+
+#endif
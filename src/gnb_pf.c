@@ -16,12 +16,20 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "gnb.h"
 #include "gnb_node.h"
 #include "gnb_hash32.h"
 #include "gnb_pf.h"
 #include "gnb_payload16.h"
+#include "gnb_time.h"
+#include "gnb_speedtest.h"
+
+#ifdef __UNIX_LIKE_OS__
+#include <errno.h>
+#include <poll.h>
+#endif
 
 /*
   pf call back order
@@ -46,25 +54,121 @@
 */
 
 
-void gnb_send_fwdu0_frame(gnb_core_t *gnb_core, gnb_node_t *dst_node, gnb_payload16_t *payload);
+void gnb_send_fwdu0_frame(gnb_core_t *gnb_core, gnb_node_t *dst_node, gnb_payload16_t *payload, uint16_t headroom);
 
+uint32_t murmurhash_hash(unsigned char *data, size_t len);
 
-gnb_node_t* gnb_query_route4(gnb_core_t *gnb_core, uint32_t dst_ip_int){
 
-    char ip_string[INET_ADDRSTRLEN];
+//写 tun 返回 EAGAIN 时每一批分组最多等待 tun 可写一次
+#define GNB_PF_WRITE_TUN_WAIT_MS  1
+
+/*
+main worker 把 tun_fd 设为非阻塞以便一次读出多个分组，写 tun 也因此变成非阻塞的，
+tun 的队列暂时满了时只在 wait_budget 不为 0 时等待一次，之后同一批中写不进去的分组直接丢弃，
+避免拥塞的 tun 让处理 udp 和 tun 的线程停下来
+*/
+static int pf_write_tun(gnb_core_t *gnb_core, void *buf, size_t buf_size, int *wait_budget_ptr){
+
+    int ret;
+
+    ret = gnb_core->drv->write_tun(gnb_core, buf, buf_size);
+
+#ifdef __UNIX_LIKE_OS__
+
+    struct pollfd pfd;
+
+    if ( ret >= 0 || (EAGAIN != errno && EWOULDBLOCK != errno) || 0 == *wait_budget_ptr ) {
+        return ret;
+    }
+
+    *wait_budget_ptr = 0;
+
+    pfd.fd      = gnb_core->tun_fd;
+    pfd.events  = POLLOUT;
+    pfd.revents = 0;
+
+    if ( poll(&pfd, 1, GNB_PF_WRITE_TUN_WAIT_MS) > 0 ) {
+        ret = gnb_core->drv->write_tun(gnb_core, buf, buf_size);
+    }
+
+#endif
+
+    return ret;
+
+}
+
+
+uint32_t gnb_pf_flow_hash(void *ip_frame, ssize_t ip_frame_size){
+
+    unsigned char *p = (unsigned char *)ip_frame;
+
+    unsigned char key[40];
+    size_t key_len;
+
+    size_t head_len;
+    uint8_t protocol;
+
+    if ( NULL == ip_frame || ip_frame_size < 20 ) {
+        return 0;
+    }
+
+    if ( 0x4 == (p[0] >> 4) ) {
+
+        head_len = (p[0] & 0x0f) * 4;
+        protocol = p[9];
+
+        //src addr + dst addr
+        memcpy(key, p+12, 8);
+        key[8] = protocol;
+        key_len = 9;
+
+        //分片的分组只有第一片有端口号，MF 置位或 offset 不为 0 时都不使用端口号，同一个分组的各个分片才会有相同的 hash
+        if ( (p[6] & 0x20) || 0 != ( ((p[6] & 0x1f) << 8) | p[7] ) ) {
+            goto finish;
+        }
+
+    } else if ( 0x6 == (p[0] >> 4) && ip_frame_size >= 40 ) {
 
-    inet_ntop(AF_INET, &dst_ip_int, ip_string, INET_ADDRSTRLEN);
+        head_len = 40;
+        protocol = p[6];
+
+        memcpy(key, p+8, 32);
+        key[32] = protocol;
+        key_len = 33;
+
+    } else {
+        return 0;
+    }
+
+    //tcp udp sctp 的端口号
+    if ( (6 == protocol || 17 == protocol || 132 == protocol) && ip_frame_size >= head_len + 4 ) {
+        memcpy(key+key_len, p+head_len, 4);
+        key_len += 4;
+    }
+
+finish:
+
+    return murmurhash_hash(key, key_len);
+
+}
+
+
+
+gnb_node_t* gnb_query_route4(gnb_core_t *gnb_core, uint32_t dst_ip_int){
 
     gnb_node_t *node=NULL;
 
     uint32_t dsp_ip_key = dst_ip_int;
 
+    uint16_t match = GNB_TRACE_ROUTE4_HOST;
+
     node = GNB_HASH32_UINT32_GET_PTR(gnb_core->ipv4_node_map, dsp_ip_key);
 
     if (node){
         goto finish;
     }
 
+    match = GNB_TRACE_ROUTE4_SUBNETC;
     dsp_ip_key = dst_ip_int & htonl(IN_CLASSC_NET);
     node = GNB_HASH32_UINT32_GET_PTR(gnb_core->subnetc_node_map, dsp_ip_key);
 
@@ -72,6 +176,7 @@ gnb_node_t* gnb_query_route4(gnb_core_t *gnb_core, uint32_t dst_ip_int){
         goto finish;
     }
 
+    match = GNB_TRACE_ROUTE4_SUBNETB;
     dsp_ip_key = dst_ip_int & htonl(IN_CLASSB_NET);
     node = GNB_HASH32_UINT32_GET_PTR(gnb_core->subnetb_node_map, dsp_ip_key);
 
@@ -79,6 +184,7 @@ gnb_node_t* gnb_query_route4(gnb_core_t *gnb_core, uint32_t dst_ip_int){
         goto finish;
     }
 
+    match = GNB_TRACE_ROUTE4_SUBNETA;
     dsp_ip_key = dst_ip_int & htonl(IN_CLASSA_NET);
     node = GNB_HASH32_UINT32_GET_PTR(gnb_core->subneta_node_map, dsp_ip_key);
 
@@ -86,8 +192,14 @@ gnb_node_t* gnb_query_route4(gnb_core_t *gnb_core, uint32_t dst_ip_int){
         goto finish;
     }
 
+    match = GNB_TRACE_ROUTE4_MISS;
+
 finish:
 
+    if ( GNB_TRACE_ON(gnb_core->trace, GNB_TRACE_ROUTE4) ) {
+        gnb_trace_emit(gnb_core->trace, GNB_TRACE_ROUTE4, match, dst_ip_int, NULL != node ? node->uuid32 : 0, 0, 0);
+    }
+
     return node;
 
 }
@@ -242,6 +354,17 @@ void gnb_pf_init(gnb_core_t *gnb_core){
 
     int i;
 
+    //gnb_ctl 按 pf 的安装顺序显示各个模块的耗时
+    if ( NULL != gnb_core->latency_zone ) {
+
+        gnb_core->latency_zone->pf_num = gnb_core->pf_array->num < GNB_LATENCY_PF_MAX ? gnb_core->pf_array->num : GNB_LATENCY_PF_MAX;
+
+        for( i=0; i<gnb_core->latency_zone->pf_num; i++ ){
+            snprintf((char *)gnb_core->latency_zone->pf_name[i], 32, "%s", gnb_core->pf_array->pf[i]->name);
+        }
+
+    }
+
     for( i=0; i<gnb_core->pf_array->num; i++ ){
 
         if (NULL==gnb_core->pf_array->pf[i]->pf_init){
@@ -273,335 +396,950 @@ void gnb_pf_conf(gnb_core_t *gnb_core){
 
 
 
+static void record_forward_payload(gnb_core_t *gnb_core, gnb_metrics_block_t *metrics, gnb_node_t *fwd_node, gnb_payload16_t *fwd_payload, uint8_t path){
+
+    int ret;
+
+    //不可达的节点仍然按原来的地址尝试发送
+    if ( !(fwd_node->udp_addr_status & (GNB_NODE_STATUS_IPV4_PONG|GNB_NODE_STATUS_IPV6_PONG)) ) {
+        GNB_METRICS_INC(metrics, GNB_METRIC_DROP_UNREACHABLE);
+    }
+
+    if ( GNB_PF_PATH_DIRECT4 == path || GNB_PF_PATH_DIRECT6 == path ) {
+        ret = gnb_send_to_node_path(gnb_core, fwd_node, fwd_payload, path);
+    } else {
+        ret = gnb_forward_payload_to_node(gnb_core, fwd_node, fwd_payload);
+    }
+
+    if ( 0 != ret ) {
+        GNB_METRICS_INC(metrics, GNB_METRIC_SEND_ERROR);
+        return;
+    }
+
+    GNB_METRICS_INC(metrics, GNB_METRIC_TX_PKT);
+    GNB_METRICS_ADD(metrics, GNB_METRIC_TX_BYTES, GNB_PAYLOAD16_FRAME_SIZE(fwd_payload));
+
+}
+
+
 /*
-把输入的 payload 加上offset，这样pf模块处理的时候，就可以在offset之前填充pf的头部，减少一次通过 memcpy 重组payload
+latency 只在 gnb_ctl 打开时记录，关闭时每个记录点只多一次对 latency 是否为 NULL 的判断
+pf_ts 是上一个 pf 模块结束的时间, 每个 pf 模块的耗时记在所在阶段 histogram 的 pf_idx+1 上
+一批分组的耗时平均分给处理过的 num 个分组
 */
-void gnb_pf_tun(gnb_core_t *gnb_core, gnb_payload16_t *payload){
+static gnb_latency_histogram_t (*latency_begin(gnb_core_t *gnb_core, int path, uint64_t *begin_ts_ptr))[GNB_LATENCY_PF_MAX+1]{
+
+    if ( NULL == gnb_core->latency_zone || 0 == gnb_core->latency_zone->enable ) {
+        return NULL;
+    }
+
+    *begin_ts_ptr = gnb_monotonic_nsec();
+
+    return gnb_core->latency_zone->histogram[path];
+
+}
+
+
+static inline void latency_pf_end(gnb_latency_histogram_t *stage_histogram, int pf_idx, uint64_t *pf_ts_ptr, int num){
+
+    uint64_t now_ts = gnb_monotonic_nsec();
 
     int i;
 
-    gnb_pf_ctx_t pf_ctx_st;
+    if ( pf_idx < GNB_LATENCY_PF_MAX ) {
+        for ( i=0; i<num; i++ ) {
+            gnb_latency_record(&stage_histogram[pf_idx+1], (now_ts - *pf_ts_ptr) / num);
+        }
+    }
 
-    memset(&pf_ctx_st,0,sizeof(gnb_pf_ctx_t));
+    *pf_ts_ptr = now_ts;
 
-    pf_ctx_st.pf_fwd = GNB_PF_FWD_INIT;
+}
 
-    pf_ctx_st.fwd_payload = payload;
 
-    pf_ctx_st.fwd_payload->type = GNB_PAYLOAD_TYPE_IPFRAME;
-    pf_ctx_st.fwd_payload->sub_type = GNB_PAYLOAD_SUB_TYPE_IPFRAME_INIT;
+static inline void latency_stage_end(gnb_latency_histogram_t *stage_histogram, uint64_t *stage_ts_ptr, uint64_t *pf_ts_ptr, int num){
+
+    uint64_t now_ts = gnb_monotonic_nsec();
+
+    int i;
+
+    for ( i=0; i<num; i++ ) {
+        gnb_latency_record(&stage_histogram[0], (now_ts - *stage_ts_ptr) / num);
+    }
+
+    *stage_ts_ptr = now_ts;
+    *pf_ts_ptr    = now_ts;
 
+}
+
+
+/*
+与各个阶段一样按分组平均，total 的每个记录都是一个分组的耗时
+*/
+static inline void latency_batch_total(gnb_latency_histogram_t *total_histogram, uint64_t begin_ts, int num){
+
+    uint64_t total = (gnb_monotonic_nsec() - begin_ts) / num;
+
+    int i;
+
+    for ( i=0; i<num; i++ ) {
+        gnb_latency_record(&total_histogram[0], total);
+    }
+
+}
 
-    int pf_tun_frame_status   = GNB_PF_TUN_FRAME_INIT;
-    int pf_tun_route_status   = GNB_PF_TUN_ROUTE_INIT;
-    int pf_tun_forward_status = GNB_PF_TUN_FORWARD_INIT;
 
-    uint32_t fwd_uuid32 = 0;
+//只在 tracepoint 打开时调用，由各个阶段的状态得出 payload 的去向
+static uint16_t trace_pf_result(int frame_status, int route_status, int forward_status){
+
+    switch ( frame_status ) {
+    case GNB_PF_TUN_FRAME_ERROR:
+    case GNB_PF_TUN_FRAME_DROP:
+    case GNB_PF_INET_FRAME_ERROR:
+    case GNB_PF_INET_FRAME_DROP:
+        return GNB_TRACE_RESULT_DROP_FRAME;
+    default:
+        break;
+    }
+
+    switch ( route_status ) {
+    case GNB_PF_TUN_ROUTE_ERROR:
+    case GNB_PF_TUN_ROUTE_DROP:
+    case GNB_PF_INET_ROUTE_ERROR:
+    case GNB_PF_INET_ROUTE_DROP:
+        return GNB_TRACE_RESULT_DROP_ROUTE;
+    default:
+        break;
+    }
+
+    switch ( forward_status ) {
+    case GNB_PF_TUN_FORWARD_ERROR:
+    case GNB_PF_INET_FORWARD_ERROR:
+    case GNB_PF_INET_FORWARD_DROP:
+        return GNB_TRACE_RESULT_DROP_FWD;
+    case GNB_PF_INET_FORWARD_TO_TUN:
+        return GNB_TRACE_RESULT_TO_TUN;
+    case GNB_PF_INET_FORWARD_TO_INET:
+        return GNB_TRACE_RESULT_OUT;
+    default:
+        break;
+    }
+
+    //tun 方向 route 阶段完成后 pf_tun_route_status 才会是 FINISH
+    if ( GNB_PF_TUN_ROUTE_FINISH == route_status ) {
+        return GNB_TRACE_RESULT_OUT;
+    }
+
+    return GNB_TRACE_RESULT_NOROUTE;
+
+}
+
+
+/*
+一批分组按阶段处理，每个阶段中对整批分组依次调用同一个 pf 模块，处理整批分组时 pf 模块的代码和数据留在 cache 中
+gnb_select_forward_node 每批只调用一次，处理当前分组时预取下一个分组的数据和转发节点
+*/
+typedef struct _gnb_pf_batch_item_t {
+
+    gnb_pf_ctx_t pf_ctx;
+
+    int frame_status;
+    int route_status;
+    int forward_status;
+
+    uint32_t fwd_uuid32;
+
+    //分组已经被丢弃或者已经处理完，后面的阶段不再处理
+    uint8_t done;
+
+    //当前阶段中有 pf 模块返回了 GNB_PF_FINISH，这个阶段后面的 pf 模块不再处理这个分组
+    uint8_t stage_finish;
+
+}gnb_pf_batch_item_t;
+
+
+/*
+把输入的 payload 加上offset，这样pf模块处理的时候，就可以在offset之前填充pf的头部，减少一次通过 memcpy 重组payload
+*/
+static void pf_tun(gnb_core_t *gnb_core, gnb_payload16_t **payloads, int num, uint16_t headroom, uint8_t sub_type, uint8_t path, uint8_t route_idx){
+
+    gnb_pf_batch_item_t items[GNB_PF_BATCH_MAX];
+    gnb_pf_batch_item_t *item;
+
+    int (*pf_cb)(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx);
+
+    //进入当前阶段的分组数和调用当前 pf 模块的分组数
+    int active;
+    int called;
+
+    int i;
+    int j;
+
+    gnb_latency_histogram_t (*latency)[GNB_LATENCY_PF_MAX+1];
+    uint64_t latency_begin_ts = 0;
+    uint64_t latency_stage_ts;
+    uint64_t latency_pf_ts;
+
+    latency = latency_begin(gnb_core, GNB_LATENCY_PATH_TUN, &latency_begin_ts);
+    latency_stage_ts = latency_pf_ts = latency_begin_ts;
+
+    memset(items, 0, sizeof(gnb_pf_batch_item_t) * num);
+
     gnb_core->select_fwd_node = gnb_select_forward_node(gnb_core);
 
-    pf_ctx_st.pf_status = GNB_PF_TUN_FRAME_INIT;
+    for ( j=0; j<num; j++ ) {
+
+        item = &items[j];
+
+        item->pf_ctx.pf_fwd = GNB_PF_FWD_INIT;
+
+        item->pf_ctx.fwd_payload = payloads[j];
+        item->pf_ctx.fwd_payload_headroom = headroom;
+
+        item->pf_ctx.metrics = gnb_core->tun_metrics;
+
+        item->pf_ctx.path = path;
+        item->pf_ctx.path_route_idx = route_idx;
+
+        item->pf_ctx.fwd_payload->type = GNB_PAYLOAD_TYPE_IPFRAME;
+        item->pf_ctx.fwd_payload->sub_type = sub_type;
+
+        item->frame_status   = GNB_PF_TUN_FRAME_INIT;
+        item->route_status   = GNB_PF_TUN_ROUTE_INIT;
+        item->forward_status = GNB_PF_TUN_FORWARD_INIT;
+
+        item->pf_ctx.pf_status = GNB_PF_TUN_FRAME_INIT;
+
+    }
+
+    GNB_METRICS_ADD(gnb_core->tun_metrics, GNB_METRIC_PF_FRAME_PKT, num);
 
     if ( 1 == gnb_core->conf->if_dump ){
         GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF,"----- GNB PF TUN BEGIN -----\n");
     }
 
+    active = num;
+
     for( i=0; i<gnb_core->pf_array->num; i++ ){
 
-        if (NULL==gnb_core->pf_array->pf[i]->pf_tun_frame){
+        pf_cb = gnb_core->pf_array->pf[i]->pf_tun_frame;
+
+        if (NULL==pf_cb){
             continue;
         }
 
-        pf_ctx_st.pf_status = gnb_core->pf_array->pf[i]->pf_tun_frame(gnb_core, &pf_ctx_st);
+        called = 0;
 
-        if ( GNB_PF_ERROR == pf_ctx_st.pf_status ){
-            pf_tun_frame_status = GNB_PF_TUN_FRAME_ERROR;
-            goto pf_tun_log;
-        }
+        for ( j=0; j<num; j++ ) {
+
+            item = &items[j];
+
+            if ( item->done || item->stage_finish ) {
+                continue;
+            }
+
+            if ( j+1 < num ) {
+                __builtin_prefetch(payloads[j+1]->data + gnb_core->tun_payload_offset);
+            }
+
+            item->pf_ctx.pf_status = pf_cb(gnb_core, &item->pf_ctx);
+
+            called++;
+
+            if ( GNB_PF_ERROR == item->pf_ctx.pf_status ){
+                item->frame_status = GNB_PF_TUN_FRAME_ERROR;
+                GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_DROP_PF_FRAME);
+                item->done = 1;
+                active--;
+                continue;
+            }
+
+            if ( GNB_PF_DROP == item->pf_ctx.pf_status ){
+                item->frame_status = GNB_PF_TUN_FRAME_DROP;
+                GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_DROP_PF_FRAME);
+                item->done = 1;
+                active--;
+                continue;
+            }
+
+            if ( GNB_PF_NEXT == item->pf_ctx.pf_status ){
+                item->frame_status = GNB_PF_TUN_FRAME_NEXT;
+            }
+
+            if ( GNB_PF_FINISH == item->pf_ctx.pf_status ){
+                item->frame_status = GNB_PF_TUN_FRAME_FINISH;
+                item->stage_finish = 1;
+            }
 
-        if ( GNB_PF_DROP == pf_ctx_st.pf_status ){
-            pf_tun_frame_status = GNB_PF_TUN_FRAME_DROP;
-            goto pf_tun_log;
         }
 
-        if ( GNB_PF_NEXT == pf_ctx_st.pf_status ){
-            pf_tun_frame_status = GNB_PF_TUN_FRAME_NEXT;
+        if ( NULL != latency ) {
+            latency_pf_end(latency[GNB_LATENCY_STAGE_FRAME], i, &latency_pf_ts, called);
         }
 
-        if ( GNB_PF_FINISH == pf_ctx_st.pf_status ){
-            pf_tun_frame_status = GNB_PF_TUN_FRAME_FINISH;
-            break;
+    }
+
+    for ( j=0; j<num; j++ ) {
+
+        item = &items[j];
+
+        if ( item->done ) {
+            continue;
         }
 
+        item->frame_status = GNB_PF_TUN_FRAME_FINISH;
+        item->stage_finish = 0;
+        item->pf_ctx.pf_status = GNB_PF_TUN_ROUTE_INIT;
+
     }
 
-    pf_tun_frame_status = GNB_PF_TUN_FRAME_FINISH;
+    if ( NULL != latency ) {
+        latency_stage_end(latency[GNB_LATENCY_STAGE_FRAME], &latency_stage_ts, &latency_pf_ts, active);
+    }
 
-    pf_ctx_st.pf_status = GNB_PF_TUN_ROUTE_INIT;
+    GNB_METRICS_ADD(gnb_core->tun_metrics, GNB_METRIC_PF_ROUTE_PKT, active);
 
     for( i=0; i<gnb_core->pf_array->num; i++ ){
 
-        if (NULL==gnb_core->pf_array->pf[i]->pf_tun_route){
+        pf_cb = gnb_core->pf_array->pf[i]->pf_tun_route;
+
+        if (NULL==pf_cb){
             continue;
         }
 
-        pf_ctx_st.pf_status = gnb_core->pf_array->pf[i]->pf_tun_route(gnb_core, &pf_ctx_st);
+        called = 0;
 
-        if ( GNB_PF_ERROR == pf_ctx_st.pf_status ){
-            pf_tun_route_status = GNB_PF_TUN_ROUTE_ERROR;
-            goto pf_tun_log;
-        }
+        for ( j=0; j<num; j++ ) {
 
-        if ( GNB_PF_NOROUTE == pf_ctx_st.pf_status ){
-            pf_tun_route_status = GNB_PF_TUN_ROUTE_NOROUTE;
-        }
+            item = &items[j];
+
+            if ( item->done ) {
+                continue;
+            }
+
+            item->pf_ctx.pf_status = pf_cb(gnb_core, &item->pf_ctx);
+
+            called++;
+
+            if ( GNB_PF_ERROR == item->pf_ctx.pf_status ){
+                item->route_status = GNB_PF_TUN_ROUTE_ERROR;
+                GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_DROP_PF_ROUTE);
+                item->done = 1;
+                active--;
+                continue;
+            }
+
+            if ( GNB_PF_NOROUTE == item->pf_ctx.pf_status ){
+                item->route_status = GNB_PF_TUN_ROUTE_NOROUTE;
+            }
+
+            if ( GNB_PF_DROP == item->pf_ctx.pf_status ){
+                item->route_status = GNB_PF_TUN_ROUTE_DROP;
+                GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_DROP_PF_ROUTE);
+                item->done = 1;
+                active--;
+                continue;
+            }
+
+            if ( GNB_PF_NEXT == item->pf_ctx.pf_status ){
+                item->route_status = GNB_PF_TUN_ROUTE_NEXT;
+            }
 
-        if ( GNB_PF_DROP == pf_ctx_st.pf_status ){
-            pf_tun_route_status = GNB_PF_TUN_ROUTE_DROP;
-            goto pf_tun_log;
         }
 
-        if ( GNB_PF_NEXT == pf_ctx_st.pf_status ){
-            pf_tun_route_status = GNB_PF_TUN_ROUTE_NEXT;
+        if ( NULL != latency ) {
+            latency_pf_end(latency[GNB_LATENCY_STAGE_ROUTE], i, &latency_pf_ts, called);
         }
 
     }
 
-    fwd_uuid32 = NULL!=pf_ctx_st.fwd_node ? pf_ctx_st.fwd_node->uuid32:0;
+    if ( NULL != latency ) {
+        latency_stage_end(latency[GNB_LATENCY_STAGE_ROUTE], &latency_stage_ts, &latency_pf_ts, active);
+    }
 
-    if( NULL == pf_ctx_st.fwd_node && gnb_core->fwdu0_address_ring.address_list->num > 0 ){
+    for ( j=0; j<num; j++ ) {
 
-        gnb_send_fwdu0_frame(gnb_core, pf_ctx_st.dst_node, pf_ctx_st.fwd_payload);
+        item = &items[j];
 
-        if ( 1 == gnb_core->conf->if_dump ){
-            GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF, "tun try to universal forward src[%u] dst[%u]\n", pf_ctx_st.src_uuid32, pf_ctx_st.dst_uuid32);
+        if ( item->done ) {
+            continue;
         }
 
-    }
+        item->fwd_uuid32 = NULL!=item->pf_ctx.fwd_node ? item->pf_ctx.fwd_node->uuid32:0;
 
+        //指定了路径的测试分组不通过 fwdu0 发送
+        if( NULL == item->pf_ctx.fwd_node && GNB_PF_PATH_AUTO == item->pf_ctx.path && gnb_core->fwdu0_address_ring.address_list->num > 0 ){
 
-    if ( NULL == pf_ctx_st.fwd_node ){
-        goto pf_tun_log;
-    }
+            gnb_send_fwdu0_frame(gnb_core, item->pf_ctx.dst_node, item->pf_ctx.fwd_payload, item->pf_ctx.fwd_payload_headroom);
 
+            GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_FWDU_PKT);
 
-    pf_tun_route_status = GNB_PF_TUN_ROUTE_FINISH;
-    pf_ctx_st.pf_status = GNB_PF_TUN_FORWARD_INIT;
+            if ( 1 == gnb_core->conf->if_dump ){
+                GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF, "tun try to universal forward src[%u] dst[%u]\n", item->pf_ctx.src_uuid32, item->pf_ctx.dst_uuid32);
+            }
 
-    for( i=gnb_core->pf_array->num-1; i>=0; i-- ){
+        }
 
-        if (NULL==gnb_core->pf_array->pf[i]->pf_tun_fwd){
+        if ( NULL == item->pf_ctx.fwd_node ){
+            GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_DROP_ROUTE_MISS);
+            item->done = 1;
+            active--;
             continue;
         }
 
-        pf_ctx_st.pf_status = gnb_core->pf_array->pf[i]->pf_tun_fwd(gnb_core, &pf_ctx_st);
+        item->route_status = GNB_PF_TUN_ROUTE_FINISH;
+        item->pf_ctx.pf_status = GNB_PF_TUN_FORWARD_INIT;
+
+    }
+
+    GNB_METRICS_ADD(gnb_core->tun_metrics, GNB_METRIC_PF_FWD_PKT, active);
+
+    for( i=gnb_core->pf_array->num-1; i>=0; i-- ){
+
+        pf_cb = gnb_core->pf_array->pf[i]->pf_tun_fwd;
 
-        if ( GNB_PF_ERROR == pf_ctx_st.pf_status ){
-            pf_tun_forward_status = GNB_PF_TUN_FORWARD_ERROR;
-            goto pf_tun_log;
+        if (NULL==pf_cb){
+            continue;
         }
 
-        if ( GNB_PF_NEXT == pf_ctx_st.pf_status ){
-            pf_tun_forward_status = GNB_PF_TUN_FORWARD_NEXT;
+        called = 0;
+
+        for ( j=0; j<num; j++ ) {
+
+            item = &items[j];
+
+            if ( item->done || item->stage_finish ) {
+                continue;
+            }
+
+            //crypto 模块要读取转发节点的密钥
+            if ( j+1 < num && NULL != items[j+1].pf_ctx.fwd_node ) {
+                __builtin_prefetch(items[j+1].pf_ctx.fwd_node);
+            }
+
+            item->pf_ctx.pf_status = pf_cb(gnb_core, &item->pf_ctx);
+
+            called++;
+
+            if ( GNB_PF_ERROR == item->pf_ctx.pf_status ){
+                item->forward_status = GNB_PF_TUN_FORWARD_ERROR;
+                GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_DROP_PF_FWD);
+                item->done = 1;
+                active--;
+                continue;
+            }
+
+            if ( GNB_PF_NEXT == item->pf_ctx.pf_status ){
+                item->forward_status = GNB_PF_TUN_FORWARD_NEXT;
+            }
+
+            if ( GNB_PF_FINISH == item->pf_ctx.pf_status ){
+                item->forward_status = GNB_PF_TUN_FORWARD_FINISH;
+                item->stage_finish = 1;
+            }
+
         }
 
-        if ( GNB_PF_FINISH == pf_ctx_st.pf_status ){
-            pf_tun_forward_status = GNB_PF_TUN_FORWARD_FINISH;
-            break;
+        if ( NULL != latency ) {
+            latency_pf_end(latency[GNB_LATENCY_STAGE_FWD], i, &latency_pf_ts, called);
         }
+
     }
 
+    if ( NULL != latency ) {
+        latency_stage_end(latency[GNB_LATENCY_STAGE_FWD], &latency_stage_ts, &latency_pf_ts, active);
+    }
 
-    gnb_forward_payload_to_node(gnb_core, pf_ctx_st.fwd_node, pf_ctx_st.fwd_payload);
+    for ( j=0; j<num; j++ ) {
 
-    pf_ctx_st.fwd_node->in_bytes     += pf_ctx_st.ip_frame_size;
-    gnb_core->local_node->out_bytes  += pf_ctx_st.ip_frame_size;
+        item = &items[j];
 
+        if ( item->done ) {
+            continue;
+        }
 
-pf_tun_log:
+        record_forward_payload(gnb_core, item->pf_ctx.metrics, item->pf_ctx.fwd_node, item->pf_ctx.fwd_payload, item->pf_ctx.path);
 
-    if ( 1 != gnb_core->conf->if_dump ){
-        goto finish;
-    }
+        if ( NULL != latency ) {
+            latency_stage_end(latency[GNB_LATENCY_STAGE_OUTPUT], &latency_stage_ts, &latency_pf_ts, 1);
+        }
 
-    if ( 1 == gnb_core->conf->if_dump ){
-        GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF, "tun src[%u] dst[%u] fwd[%u] [%s] [%s] ip_frame_size[%u]\n",
-                   pf_ctx_st.src_uuid32, pf_ctx_st.dst_uuid32, fwd_uuid32,
-                   gnb_pf_status_strings[pf_tun_frame_status], gnb_pf_status_strings[pf_tun_route_status],
-                   pf_ctx_st.ip_frame_size);
+        item->pf_ctx.fwd_node->in_bytes  += item->pf_ctx.ip_frame_size;
+        gnb_core->local_node->out_bytes  += item->pf_ctx.ip_frame_size;
+        item->pf_ctx.fwd_node->in_packets++;
+        gnb_core->local_node->out_packets++;
 
     }
 
-finish:
+    //整批的耗时按分组数平均后记录，与单个处理的分组一样每个分组一个记录
+    if ( NULL != latency ) {
+        latency_batch_total(latency[GNB_LATENCY_STAGE_TOTAL], latency_begin_ts, num);
+    }
+
+    for ( j=0; j<num; j++ ) {
+
+        item = &items[j];
+
+        if ( GNB_TRACE_ON(gnb_core->trace, GNB_TRACE_PF_TUN) ) {
+            gnb_trace_emit(gnb_core->trace, GNB_TRACE_PF_TUN, trace_pf_result(item->frame_status, item->route_status, item->forward_status),
+                           item->pf_ctx.src_uuid32, item->pf_ctx.dst_uuid32, item->fwd_uuid32, item->pf_ctx.ip_frame_size);
+        }
+
+        if ( 1 == gnb_core->conf->if_dump ){
+            GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF, "tun src[%u] dst[%u] fwd[%u] [%s] [%s] ip_frame_size[%u]\n",
+                       item->pf_ctx.src_uuid32, item->pf_ctx.dst_uuid32, item->fwd_uuid32,
+                       gnb_pf_status_strings[item->frame_status], gnb_pf_status_strings[item->route_status],
+                       item->pf_ctx.ip_frame_size);
+        }
+
+    }
 
     if ( 1 == gnb_core->conf->if_dump ){
         GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF,"----- GNB PF TUN   END -----\n");
     }
 
-    return;
+}
+
 
+void gnb_pf_tun(gnb_core_t *gnb_core, gnb_payload16_t *payload){
+    pf_tun(gnb_core, &payload, 1, GNB_PAYLOAD_HEADROOM, GNB_PAYLOAD_SUB_TYPE_IPFRAME_INIT, GNB_PF_PATH_AUTO, 0);
 }
 
 
+void gnb_pf_tun_batch(gnb_core_t *gnb_core, gnb_payload16_t **payloads, int num){
 
-void gnb_pf_inet(gnb_core_t *gnb_core, gnb_payload16_t *payload, gnb_sockaddress_t *source_node_addr){
+    int n;
+
+    while ( num > 0 ) {
+        n = num > GNB_PF_BATCH_MAX ? GNB_PF_BATCH_MAX : num;
+        pf_tun(gnb_core, payloads, n, GNB_PAYLOAD_HEADROOM, GNB_PAYLOAD_SUB_TYPE_IPFRAME_INIT, GNB_PF_PATH_AUTO, 0);
+        payloads += n;
+        num -= n;
+    }
 
-    gnb_pf_ctx_t pf_ctx_st;
+}
+
+
+void gnb_pf_tun_test(gnb_core_t *gnb_core, gnb_payload16_t *payload, uint8_t path, uint8_t route_idx){
+    pf_tun(gnb_core, &payload, 1, 0, GNB_PAYLOAD_SUB_TYPE_IPFRAME_TEST, path, route_idx);
+}
+
+
+void gnb_pf_tun_test_batch(gnb_core_t *gnb_core, gnb_payload16_t **payloads, int num, uint8_t path, uint8_t route_idx){
+
+    int n;
+
+    while ( num > 0 ) {
+        n = num > GNB_PF_BATCH_MAX ? GNB_PF_BATCH_MAX : num;
+        pf_tun(gnb_core, payloads, n, 0, GNB_PAYLOAD_SUB_TYPE_IPFRAME_TEST, path, route_idx);
+        payloads += n;
+        num -= n;
+    }
+
+}
+
+
+static void pf_inet(gnb_core_t *gnb_core, gnb_payload16_t **payloads, gnb_sockaddress_t **source_node_addrs, int num){
 
-    memset(&pf_ctx_st,0,sizeof(gnb_pf_ctx_t));
+    gnb_pf_batch_item_t items[GNB_PF_BATCH_MAX];
+    gnb_pf_batch_item_t *item;
 
-    pf_ctx_st.pf_fwd = GNB_PF_FWD_INIT;
-    pf_ctx_st.fwd_payload = payload;
-    pf_ctx_st.source_node_addr = source_node_addr;
+    int (*pf_cb)(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx);
+
+    int active;
+    int called;
+
+    //这一批分组写 tun 时可以等待 tun 可写的次数
+    int tun_wait_budget = 1;
+    int write_ret;
 
     int i;
+    int j;
+
+    gnb_latency_histogram_t (*latency)[GNB_LATENCY_PF_MAX+1];
+    uint64_t latency_begin_ts = 0;
+    uint64_t latency_stage_ts;
+    uint64_t latency_pf_ts;
 
-    int pf_inet_frame_status  = GNB_PF_INET_FRAME_INIT;
-    int pf_inet_route_status  = GNB_PF_INET_ROUTE_INIT;
-    int pf_inet_forwad_status = GNB_PF_INET_FORWARD_INIT;
+    latency = latency_begin(gnb_core, GNB_LATENCY_PATH_INET, &latency_begin_ts);
+    latency_stage_ts = latency_pf_ts = latency_begin_ts;
 
-    uint32_t fwd_uuid32 = 0;
+    memset(items, 0, sizeof(gnb_pf_batch_item_t) * num);
 
     gnb_core->select_fwd_node = gnb_select_forward_node(gnb_core);
 
+    for ( j=0; j<num; j++ ) {
+
+        item = &items[j];
+
+        item->pf_ctx.pf_fwd = GNB_PF_FWD_INIT;
+        item->pf_ctx.fwd_payload = payloads[j];
+        item->pf_ctx.source_node_addr = source_node_addrs[j];
+        item->pf_ctx.metrics = gnb_core->inet_metrics;
+
+        item->frame_status   = GNB_PF_INET_FRAME_INIT;
+        item->route_status   = GNB_PF_INET_ROUTE_INIT;
+        item->forward_status = GNB_PF_INET_FORWARD_INIT;
+
+    }
+
     if ( 1 == gnb_core->conf->if_dump ){
         GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF,"----- GNB PF INET BEGIN -----\n");
     }
 
+    GNB_METRICS_ADD(gnb_core->inet_metrics, GNB_METRIC_PF_FRAME_PKT, num);
+
+    active = num;
+
     for( i=gnb_core->pf_array->num-1; i>=0; i-- ){
 
-        if (NULL==gnb_core->pf_array->pf[i]->pf_inet_frame){
+        pf_cb = gnb_core->pf_array->pf[i]->pf_inet_frame;
+
+        if (NULL==pf_cb){
             continue;
         }
 
-        pf_ctx_st.pf_status = gnb_core->pf_array->pf[i]->pf_inet_frame(gnb_core,  &pf_ctx_st);
+        called = 0;
 
-        if ( GNB_PF_ERROR == pf_ctx_st.pf_status ){
-            pf_inet_frame_status = GNB_PF_INET_FRAME_ERROR;
-            goto pf_inet_log;
-        }
+        for ( j=0; j<num; j++ ) {
+
+            item = &items[j];
+
+            if ( item->done || item->stage_finish ) {
+                continue;
+            }
+
+            if ( j+1 < num ) {
+                __builtin_prefetch(payloads[j+1]->data);
+            }
+
+            item->pf_ctx.pf_status = pf_cb(gnb_core, &item->pf_ctx);
+
+            called++;
+
+            if ( GNB_PF_ERROR == item->pf_ctx.pf_status ){
+                item->frame_status = GNB_PF_INET_FRAME_ERROR;
+                GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_DROP_PF_FRAME);
+                item->done = 1;
+                active--;
+                continue;
+            }
+
+            if ( GNB_PF_DROP == item->pf_ctx.pf_status ){
+                item->frame_status = GNB_PF_INET_FRAME_DROP;
+                GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_DROP_PF_FRAME);
+                item->done = 1;
+                active--;
+                continue;
+            }
+
+            if ( GNB_PF_NEXT == item->pf_ctx.pf_status ){
+                item->frame_status = GNB_PF_INET_FRAME_NEXT;
+            }
+
+            if ( GNB_PF_FINISH == item->pf_ctx.pf_status ){
+                item->stage_finish = 1;
+            }
 
-        if ( GNB_PF_DROP == pf_ctx_st.pf_status ){
-            pf_inet_frame_status = GNB_PF_INET_FRAME_DROP;
-            goto pf_inet_log;
         }
 
-        if ( GNB_PF_NEXT == pf_ctx_st.pf_status ){
-            pf_inet_frame_status = GNB_PF_INET_FRAME_NEXT;
+        if ( NULL != latency ) {
+            latency_pf_end(latency[GNB_LATENCY_STAGE_FRAME], i, &latency_pf_ts, called);
         }
 
-        if ( GNB_PF_FINISH == pf_ctx_st.pf_status ){
-            break;
+    }
+
+    for ( j=0; j<num; j++ ) {
+
+        item = &items[j];
+
+        if ( item->done ) {
+            continue;
         }
 
+        item->frame_status = GNB_PF_INET_FRAME_FINISH;
+        item->stage_finish = 0;
+
     }
 
-    pf_inet_frame_status = GNB_PF_INET_FRAME_FINISH;
+    if ( NULL != latency ) {
+        latency_stage_end(latency[GNB_LATENCY_STAGE_FRAME], &latency_stage_ts, &latency_pf_ts, active);
+    }
+
+    GNB_METRICS_ADD(gnb_core->inet_metrics, GNB_METRIC_PF_ROUTE_PKT, active);
 
     for( i=0; i<gnb_core->pf_array->num; i++ ){
 
-        if (NULL==gnb_core->pf_array->pf[i]->pf_inet_route){
+        pf_cb = gnb_core->pf_array->pf[i]->pf_inet_route;
+
+        if (NULL==pf_cb){
             continue;
         }
 
-        pf_ctx_st.pf_status = gnb_core->pf_array->pf[i]->pf_inet_route(gnb_core, &pf_ctx_st);
+        called = 0;
 
-        if ( GNB_PF_ERROR == pf_ctx_st.pf_status ){
-            pf_inet_route_status = GNB_PF_INET_ROUTE_ERROR;
-            goto pf_inet_log;
-        }
+        for ( j=0; j<num; j++ ) {
+
+            item = &items[j];
+
+            if ( item->done || item->stage_finish ) {
+                continue;
+            }
+
+            item->pf_ctx.pf_status = pf_cb(gnb_core, &item->pf_ctx);
+
+            called++;
+
+            if ( GNB_PF_ERROR == item->pf_ctx.pf_status ){
+                item->route_status = GNB_PF_INET_ROUTE_ERROR;
+                GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_DROP_PF_ROUTE);
+                item->done = 1;
+                active--;
+                continue;
+            }
+
+            if ( GNB_PF_DROP == item->pf_ctx.pf_status ){
+                item->route_status = GNB_PF_INET_ROUTE_DROP;
+                GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_DROP_PF_ROUTE);
+                item->done = 1;
+                active--;
+                continue;
+            }
+
+            if ( GNB_PF_NEXT == item->pf_ctx.pf_status ){
+                item->route_status = GNB_PF_INET_ROUTE_NEXT;
+            }
+
+            if ( GNB_PF_FINISH == item->pf_ctx.pf_status ){
+                item->stage_finish = 1;
+            }
 
-        if ( GNB_PF_DROP == pf_ctx_st.pf_status ){
-            pf_inet_route_status = GNB_PF_INET_ROUTE_DROP;
-            goto pf_inet_log;
         }
 
-        if ( GNB_PF_NEXT == pf_ctx_st.pf_status ){
-            pf_inet_route_status = GNB_PF_INET_ROUTE_NEXT;
+        if ( NULL != latency ) {
+            latency_pf_end(latency[GNB_LATENCY_STAGE_ROUTE], i, &latency_pf_ts, called);
         }
 
+    }
+
+    for ( j=0; j<num; j++ ) {
+
+        item = &items[j];
 
-        if ( GNB_PF_FINISH == pf_ctx_st.pf_status ){
-            break;
+        if ( item->done ) {
+            continue;
         }
 
+        item->route_status = GNB_PF_INET_ROUTE_FINISH;
+        item->stage_finish = 0;
+
+    }
+
+    if ( NULL != latency ) {
+        latency_stage_end(latency[GNB_LATENCY_STAGE_ROUTE], &latency_stage_ts, &latency_pf_ts, active);
     }
 
-    pf_inet_route_status = GNB_PF_INET_ROUTE_FINISH;
+    GNB_METRICS_ADD(gnb_core->inet_metrics, GNB_METRIC_PF_FWD_PKT, active);
 
     for( i=0; i<gnb_core->pf_array->num; i++ ){
 
-        if (NULL==gnb_core->pf_array->pf[i]->pf_inet_fwd){
+        pf_cb = gnb_core->pf_array->pf[i]->pf_inet_fwd;
+
+        if (NULL==pf_cb){
             continue;
         }
 
-        pf_ctx_st.pf_status = gnb_core->pf_array->pf[i]->pf_inet_fwd(gnb_core, &pf_ctx_st);
+        called = 0;
+
+        for ( j=0; j<num; j++ ) {
+
+            item = &items[j];
+
+            if ( item->done || item->stage_finish ) {
+                continue;
+            }
+
+            //作为中继时 crypto 模块要读取下一跳节点的密钥
+            if ( j+1 < num && NULL != items[j+1].pf_ctx.fwd_node ) {
+                __builtin_prefetch(items[j+1].pf_ctx.fwd_node);
+            }
+
+            item->pf_ctx.pf_status = pf_cb(gnb_core, &item->pf_ctx);
+
+            called++;
+
+            if ( GNB_PF_ERROR == item->pf_ctx.pf_status ){
+                item->forward_status = GNB_PF_INET_FORWARD_ERROR;
+                GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_DROP_PF_FWD);
+                item->done = 1;
+                active--;
+                continue;
+            }
+
+            if ( GNB_PF_DROP == item->pf_ctx.pf_status ){
+                item->forward_status = GNB_PF_INET_FORWARD_DROP;
+                GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_DROP_PF_FWD);
+                item->done = 1;
+                active--;
+                continue;
+            }
+
+            if ( GNB_PF_NEXT == item->pf_ctx.pf_status ){
+                item->forward_status = GNB_PF_INET_FORWARD_NEXT;
+            }
+
+            if ( GNB_PF_FINISH == item->pf_ctx.pf_status ){
+                item->stage_finish = 1;
+            }
 
-        if ( GNB_PF_ERROR == pf_ctx_st.pf_status ){
-            pf_inet_forwad_status = GNB_PF_INET_FORWARD_ERROR;
-            goto pf_inet_log;
         }
 
-        if ( GNB_PF_DROP == pf_ctx_st.pf_status ){
-            pf_inet_forwad_status = GNB_PF_INET_FORWARD_DROP;
-            goto pf_inet_log;
+        if ( NULL != latency ) {
+            latency_pf_end(latency[GNB_LATENCY_STAGE_FWD], i, &latency_pf_ts, called);
+        }
+
+    }
+
+    if ( NULL != latency ) {
+        latency_stage_end(latency[GNB_LATENCY_STAGE_FWD], &latency_stage_ts, &latency_pf_ts, active);
+    }
+
+    for ( j=0; j<num; j++ ) {
+
+        item = &items[j];
+
+        if ( item->done ) {
+            continue;
         }
 
-        if ( GNB_PF_NEXT == pf_ctx_st.pf_status ){
-            pf_inet_forwad_status = GNB_PF_INET_FORWARD_NEXT;
+        item->fwd_uuid32 = NULL!=item->pf_ctx.fwd_node ? item->pf_ctx.fwd_node->uuid32:0;
+
+        if ( NULL == item->pf_ctx.src_node ){
+            continue;
         }
 
-        if ( GNB_PF_FINISH == pf_ctx_st.pf_status ){
-            break;
+        //speedtest 的测试分组由 gnb_speedtest_inet 计数和回应，不写入 tun
+        if ( GNB_PF_FWD_TUN == item->pf_ctx.pf_fwd && (item->pf_ctx.fwd_payload->sub_type & GNB_PAYLOAD_SUB_TYPE_IPFRAME_TEST) ) {
+
+            gnb_speedtest_inet(gnb_core, &item->pf_ctx);
+
+            item->fwd_uuid32 = item->pf_ctx.dst_uuid32;
+
+            //本节点是目的节点，trace 中与写入 tun 的分组一样
+            item->forward_status = GNB_PF_INET_FORWARD_TO_TUN;
+
+            //回应的耗时不计入 output
+            if ( NULL != latency ) {
+                latency_stage_ts = latency_pf_ts = gnb_monotonic_nsec();
+            }
+
+            continue;
+
         }
 
-    }
+        if ( gnb_core->conf->activate_tun && GNB_PF_FWD_TUN == item->pf_ctx.pf_fwd ){
 
-    fwd_uuid32 = NULL!=pf_ctx_st.fwd_node ? pf_ctx_st.fwd_node->uuid32:0;
+            write_ret = pf_write_tun(gnb_core, item->pf_ctx.ip_frame, item->pf_ctx.ip_frame_size, &tun_wait_budget);
 
-    if ( NULL == pf_ctx_st.src_node ){
-        goto pf_inet_log;
-    }
+            if ( NULL != latency ) {
+                latency_stage_end(latency[GNB_LATENCY_STAGE_OUTPUT], &latency_stage_ts, &latency_pf_ts, 1);
+            }
 
-    if ( gnb_core->conf->activate_tun && GNB_PF_FWD_TUN == pf_ctx_st.pf_fwd ){
+            item->fwd_uuid32 = item->pf_ctx.dst_uuid32;
 
-        gnb_core->drv->write_tun(gnb_core, pf_ctx_st.ip_frame, pf_ctx_st.ip_frame_size);
+            item->forward_status = GNB_PF_INET_FORWARD_TO_TUN;
 
-        fwd_uuid32 = pf_ctx_st.dst_uuid32;
+            if ( write_ret < 0 ) {
+                GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_SEND_ERROR);
+                continue;
+            }
 
-        pf_inet_forwad_status = GNB_PF_INET_FORWARD_TO_TUN;
+            GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_TX_PKT);
+            GNB_METRICS_ADD(item->pf_ctx.metrics, GNB_METRIC_TX_BYTES, item->pf_ctx.ip_frame_size);
 
-        gnb_core->local_node->in_bytes += pf_ctx_st.ip_frame_size;
-        pf_ctx_st.src_node->out_bytes  += pf_ctx_st.ip_frame_size;
+            gnb_core->local_node->in_bytes     += item->pf_ctx.ip_frame_size;
+            item->pf_ctx.src_node->out_bytes   += item->pf_ctx.ip_frame_size;
+            gnb_core->local_node->in_packets++;
+            item->pf_ctx.src_node->out_packets++;
 
-        goto pf_inet_log;
+            continue;
 
-    }
+        }
+
+        if ( GNB_PF_FWD_INET == item->pf_ctx.pf_fwd && NULL != item->pf_ctx.fwd_node && NULL != item->pf_ctx.fwd_payload ){
+
+            record_forward_payload(gnb_core, item->pf_ctx.metrics, item->pf_ctx.fwd_node, item->pf_ctx.fwd_payload, GNB_PF_PATH_AUTO);
+
+            if ( NULL != latency ) {
+                latency_stage_end(latency[GNB_LATENCY_STAGE_OUTPUT], &latency_stage_ts, &latency_pf_ts, 1);
+            }
+
+            item->forward_status = GNB_PF_INET_FORWARD_TO_INET;
+
+            if ( GNB_TRACE_ON(gnb_core->trace, GNB_TRACE_RELAY) ) {
+                gnb_trace_emit(gnb_core->trace, GNB_TRACE_RELAY, item->pf_ctx.in_ttl, item->pf_ctx.src_uuid32, item->pf_ctx.dst_uuid32, item->pf_ctx.fwd_node->uuid32, item->pf_ctx.ip_frame_size);
+            }
 
-    if ( GNB_PF_FWD_INET == pf_ctx_st.pf_fwd && NULL != pf_ctx_st.fwd_node && NULL != pf_ctx_st.fwd_payload ){
+            gnb_core->local_node->out_bytes     += item->pf_ctx.ip_frame_size;
+            item->pf_ctx.fwd_node->in_bytes     += item->pf_ctx.ip_frame_size;
+            gnb_core->local_node->out_packets++;
+            item->pf_ctx.fwd_node->in_packets++;
 
-        gnb_forward_payload_to_node(gnb_core, pf_ctx_st.fwd_node, pf_ctx_st.fwd_payload);
+            continue;
 
-        pf_inet_forwad_status = GNB_PF_INET_FORWARD_TO_INET;
+        }
 
-        gnb_core->local_node->out_bytes += pf_ctx_st.ip_frame_size;
-        pf_ctx_st.fwd_node->in_bytes    += pf_ctx_st.ip_frame_size;
+        if ( GNB_PF_FWD_INET == item->pf_ctx.pf_fwd ) {
+            GNB_METRICS_INC(item->pf_ctx.metrics, GNB_METRIC_DROP_ROUTE_MISS);
+        }
 
     }
 
-pf_inet_log:
+    if ( NULL != latency ) {
+        latency_batch_total(latency[GNB_LATENCY_STAGE_TOTAL], latency_begin_ts, num);
+    }
+
+    for ( j=0; j<num; j++ ) {
+
+        item = &items[j];
+
+        if ( GNB_TRACE_ON(gnb_core->trace, GNB_TRACE_PF_INET) ) {
+            gnb_trace_emit(gnb_core->trace, GNB_TRACE_PF_INET, trace_pf_result(item->frame_status, item->route_status, item->forward_status),
+                           item->pf_ctx.src_uuid32, item->pf_ctx.dst_uuid32, item->fwd_uuid32, item->pf_ctx.ip_frame_size);
+        }
+
+        if ( 1 == gnb_core->conf->if_dump ){
+            GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF, "inet src[%u] dst[%u] fwd[%u] [%s] [%s] [%s] ip_frame_size[%u]\n",
+                       item->pf_ctx.src_uuid32, item->pf_ctx.dst_uuid32, item->fwd_uuid32,
+                       gnb_pf_status_strings[item->frame_status], gnb_pf_status_strings[item->route_status], gnb_pf_status_strings[item->forward_status],
+                       item->pf_ctx.ip_frame_size);
+        }
 
-    if ( 1 == gnb_core->conf->if_dump ){
-        GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF, "inet src[%u] dst[%u] fwd[%u] [%s] [%s] [%s] ip_frame_size[%u]\n",
-                   pf_ctx_st.src_uuid32, pf_ctx_st.dst_uuid32, fwd_uuid32,
-                   gnb_pf_status_strings[pf_inet_frame_status], gnb_pf_status_strings[pf_inet_route_status], gnb_pf_status_strings[pf_inet_forwad_status],
-                   pf_ctx_st.ip_frame_size);
     }
 
     if ( 1 == gnb_core->conf->if_dump ){
         GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF,"----- GNB PF INET END -----\n");
     }
 
-    return;
+}
+
+
+void gnb_pf_inet(gnb_core_t *gnb_core, gnb_payload16_t *payload, gnb_sockaddress_t *source_node_addr){
+    pf_inet(gnb_core, &payload, &source_node_addr, 1);
+}
+
+
+void gnb_pf_inet_batch(gnb_core_t *gnb_core, gnb_payload16_t **payloads, gnb_sockaddress_t **source_node_addrs, int num){
+
+    int n;
+
+    while ( num > 0 ) {
+        n = num > GNB_PF_BATCH_MAX ? GNB_PF_BATCH_MAX : num;
+        pf_inet(gnb_core, payloads, source_node_addrs, n);
+        payloads += n;
+        source_node_addrs += n;
+        num -= n;
+    }
 
 }
 
@@ -620,3 +1358,69 @@ void gnb_pf_release(gnb_core_t *gnb_core){
     }
 
 }
+
+
+void gnb_pf_timer(gnb_core_t *gnb_core){
+
+    int i;
+
+    for( i=0; i<gnb_core->pf_array->num; i++ ){
+
+        if (NULL==gnb_core->pf_array->pf[i]->pf_timer){
+            continue;
+        }
+
+        gnb_core->pf_array->pf[i]->pf_timer(gnb_core);
+    }
+
+}
+
+
+void gnb_pf_reload_prepare(gnb_core_t *gnb_core, void **reload_ctx_array, gnb_node_t **nodes, size_t num){
+
+    int i;
+
+    for( i=0; i<gnb_core->pf_array->num; i++ ){
+
+        if (NULL==gnb_core->pf_array->pf[i]->pf_reload_prepare){
+            reload_ctx_array[i] = NULL;
+            continue;
+        }
+
+        reload_ctx_array[i] = gnb_core->pf_array->pf[i]->pf_reload_prepare(gnb_core, nodes, num);
+    }
+
+}
+
+
+void gnb_pf_reload_apply(gnb_core_t *gnb_core, void **reload_ctx_array){
+
+    int i;
+
+    for( i=0; i<gnb_core->pf_array->num; i++ ){
+
+        if (NULL==gnb_core->pf_array->pf[i]->pf_reload_apply || NULL==reload_ctx_array[i]){
+            continue;
+        }
+
+        gnb_core->pf_array->pf[i]->pf_reload_apply(gnb_core, reload_ctx_array[i]);
+    }
+
+}
+
+
+void gnb_pf_reload_release(gnb_core_t *gnb_core, void **reload_ctx_array){
+
+    int i;
+
+    for( i=0; i<gnb_core->pf_array->num; i++ ){
+
+        if (NULL==gnb_core->pf_array->pf[i]->pf_reload_release || NULL==reload_ctx_array[i]){
+            continue;
+        }
+
+        gnb_core->pf_array->pf[i]->pf_reload_release(gnb_core, reload_ctx_array[i]);
+        reload_ctx_array[i] = NULL;
+    }
+
+}
@@ -21,6 +21,8 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#include "gnb_metrics_type.h"
+
 typedef struct _gnb_core_t gnb_core_t;
 
 typedef struct _gnb_payload16_t gnb_payload16_t;
@@ -65,9 +67,27 @@ typedef struct _gnb_pf_ctx_t {
 	void *ip_frame;
 	ssize_t ip_frame_size;
 
+	//当前线程的计数器, pf 模块用它记录丢弃的原因
+	gnb_metrics_block_t *metrics;
+
+	//GNB_PF_PATH_*, 只有 speedtest 的测试分组指定路径，其他分组为 GNB_PF_PATH_AUTO
+	uint8_t path;
+	//path 为 GNB_PF_PATH_RELAY 时使用的 dst_node->route_node 的下标
+	//分组经过中继时 pf_route 把实际使用的下标写回这里，后面的 pf 模块从这里得到中继路径
+	uint8_t path_route_idx;
+
+	//fwd_payload 之前可以填充头部的字节数，没有保留时为 0
+	uint16_t fwd_payload_headroom;
+
 }gnb_pf_ctx_t;
 
 
+#define GNB_PF_PATH_AUTO     0x0    //由 pf_route 按 route.conf 和节点的状态选择路径
+#define GNB_PF_PATH_DIRECT4  0x1    //与 GNB_NODE_PATH_IPV4 相同
+#define GNB_PF_PATH_DIRECT6  0x2    //与 GNB_NODE_PATH_IPV6 相同
+#define GNB_PF_PATH_RELAY    0x3
+
+
 #define GNB_PF_ERROR    0xFF    //当前PF模块过程中出错了，上层调用应该终止这个分组的处理
 #define GNB_PF_NEXT     0x00    //当前PF模块处理完成，可以进行一个PF模块的处理，如果是最后一个调用的PF模块， 上层调用
 #define GNB_PF_FINISH   0x01    //当前PF模块认为数据分组的处理应该到此为止，上层调用收到这个返回，就不再调用后面的PF模块处理
@@ -93,6 +113,12 @@ typedef int(*gnb_pf_inet_fwd_cb_t)(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx);
 
 typedef void(*gnb_pf_release_cb_t)(gnb_core_t *gnb_core);
 
+typedef void(*gnb_pf_timer_cb_t)(gnb_core_t *gnb_core);
+
+typedef void*(*gnb_pf_reload_prepare_cb_t)(gnb_core_t *gnb_core, gnb_node_t **nodes, size_t num);
+typedef void(*gnb_pf_reload_apply_cb_t)(gnb_core_t *gnb_core, void *reload_ctx);
+typedef void(*gnb_pf_reload_release_cb_t)(gnb_core_t *gnb_core, void *reload_ctx);
+
 
 typedef struct _gnb_pf_t {
 
@@ -113,6 +139,19 @@ typedef struct _gnb_pf_t {
 
 	gnb_pf_release_cb_t  pf_release;
 
+	//main worker 的循环中每轮调用一次，至少每秒一次，不处理分组的模块不需要设置
+	gnb_pf_timer_cb_t    pf_timer;
+
+	/*
+	热加载 route.conf 时使用，没有按节点保存数据的模块不需要设置
+	pf_reload_prepare 在 primary process 中为新的 node 表准备数据，nodes 中新增的节点还没有复制到 node_zone
+	pf_reload_apply   在数据通路线程中换入 prepare 准备的数据，只做指针交换，被换下的数据留在 reload_ctx 中
+	pf_reload_release 在所有线程都不再使用被换下的 node 表后释放 reload_ctx
+	*/
+	gnb_pf_reload_prepare_cb_t  pf_reload_prepare;
+	gnb_pf_reload_apply_cb_t    pf_reload_apply;
+	gnb_pf_reload_release_cb_t  pf_reload_release;
+
 }gnb_pf_t;
 
 
@@ -120,12 +159,37 @@ void gnb_pf_init(gnb_core_t *gnb_core);
 
 void gnb_pf_conf(gnb_core_t *gnb_core);
 
+//*_batch 一次最多处理的分组数，超过时分成多批处理
+#define GNB_PF_BATCH_MAX     64
+
+//payload 之前要保留 GNB_PAYLOAD_HEADROOM 字节，如 gnb_core->tun_payload
 void gnb_pf_tun(gnb_core_t *gnb_core, gnb_payload16_t *payload);
 
+void gnb_pf_tun_batch(gnb_core_t *gnb_core, gnb_payload16_t **payloads, int num);
+
+//以 GNB_PAYLOAD_SUB_TYPE_IPFRAME_TEST 发送 speedtest 的测试分组，path 和 route_idx 指定发往目的节点的路径
+void gnb_pf_tun_test(gnb_core_t *gnb_core, gnb_payload16_t *payload, uint8_t path, uint8_t route_idx);
+
+void gnb_pf_tun_test_batch(gnb_core_t *gnb_core, gnb_payload16_t **payloads, int num, uint8_t path, uint8_t route_idx);
+
 void gnb_pf_inet(gnb_core_t *gnb_core, gnb_payload16_t *payload, gnb_sockaddress_t *source_node_addr);
 
+void gnb_pf_inet_batch(gnb_core_t *gnb_core, gnb_payload16_t **payloads, gnb_sockaddress_t **source_node_addrs, int num);
+
 void gnb_pf_release(gnb_core_t *gnb_core);
 
+void gnb_pf_timer(gnb_core_t *gnb_core);
+
+//reload_ctx_array 按 pf_array 的下标保存各个 pf 模块的 reload_ctx, 长度不小于 pf_array->num
+void gnb_pf_reload_prepare(gnb_core_t *gnb_core, void **reload_ctx_array, gnb_node_t **nodes, size_t num);
+
+void gnb_pf_reload_apply(gnb_core_t *gnb_core, void **reload_ctx_array);
+
+void gnb_pf_reload_release(gnb_core_t *gnb_core, void **reload_ctx_array);
+
+//根据 ip 分组的 5 元组(src,dst,protocol,sport,dport)计算 hash, 同一个 flow 的分组得到相同的值
+uint32_t gnb_pf_flow_hash(void *ip_frame, ssize_t ip_frame_size);
+
 typedef struct _gnb_pf_array_t {
 
 	size_t size;
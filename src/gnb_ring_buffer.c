@@ -132,8 +132,13 @@ gnb_ring_node_t *gnb_ring_buffer_push(gnb_ring_buffer_t *ring_buffer){
     return ring_buffer->nodes[ring_buffer->tail_idx];
 }
 
+/*
+queue 中传递的是 buffer 的指针，写入 node 的数据要在 tail_idx 改变之前对 pop 的线程可见
+*/
 void gnb_ring_buffer_push_submit(gnb_ring_buffer_t *ring_buffer){
 
+    __sync_synchronize();
+
     int tail_next_idx = ring_buffer->tail_idx + 1;
 
     if ( tail_next_idx >= ring_buffer->num ){
@@ -152,12 +157,16 @@ gnb_ring_node_t *gnb_ring_buffer_pop(gnb_ring_buffer_t *ring_buffer){
         return NULL;
     }
 
+    __sync_synchronize();
+
     return ring_buffer->nodes[ring_buffer->head_idx];
 
 }
 
 void gnb_ring_buffer_pop_submit(gnb_ring_buffer_t *ring_buffer){
 
+    __sync_synchronize();
+
     int head_next_idx = ring_buffer->head_idx + 1;
 
     if ( head_next_idx >= ring_buffer->num ){
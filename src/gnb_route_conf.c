@@ -0,0 +1,519 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "gnb_route_conf.h"
+#include "gnb_mmap.h"
+#include "gnb_time.h"
+
+uint32_t murmurhash_hash(unsigned char *data, size_t len);
+
+#define GNB_ROUTE_CONF_CACHE_MAGIC   "GNBRTC01"
+
+typedef struct _gnb_route_conf_cache_head_t {
+
+	char     magic[8];
+
+	uint32_t record_size;
+
+	uint32_t num;
+
+	uint32_t node_num;
+
+	uint32_t source_hash;
+
+	int64_t  source_mtime;
+
+	int64_t  source_size;
+
+}gnb_route_conf_cache_head_t;
+
+
+#define IS_SPACE(c)  ( ' ' == (c) || '\t' == (c) || '\r' == (c) || '\n' == (c) )
+#define IS_DIGIT(c)  ( (c) >= '0' && (c) <= '9' )
+
+
+static const char* parse_uint32(const char *p, const char *end, uint32_t *value){
+
+    uint64_t v = 0;
+
+    const char *start = p;
+
+    while ( p < end && IS_DIGIT(*p) ) {
+
+        v = v*10 + (*p - '0');
+
+        if ( v > UINT32_MAX ) {
+            return NULL;
+        }
+
+        p++;
+
+    }
+
+    if ( p == start ) {
+        return NULL;
+    }
+
+    *value = (uint32_t)v;
+
+    return p;
+
+}
+
+
+//解析 a.b.c.d, 结果是网络字节序
+static int parse_ipv4(const char *p, const char *end, uint32_t *addr4){
+
+    unsigned char *b = (unsigned char *)addr4;
+
+    uint32_t v;
+
+    int i;
+
+    for ( i=0; i<4; i++ ) {
+
+        p = parse_uint32(p, end, &v);
+
+        if ( NULL == p || v > 255 ) {
+            return -1;
+        }
+
+        b[i] = (unsigned char)v;
+
+        if ( 3 == i ) {
+            break;
+        }
+
+        if ( p >= end || '.' != *p ) {
+            return -1;
+        }
+
+        p++;
+
+    }
+
+    if ( p != end ) {
+        return -1;
+    }
+
+    return 0;
+
+}
+
+
+static const char* find_char(const char *p, const char *end, char c){
+
+    while ( p < end && c != *p ) {
+        p++;
+    }
+
+    return p;
+
+}
+
+
+static int has_substring(const char *p, const char *end, const char *s){
+
+    size_t len = strlen(s);
+
+    for ( ; p + len <= end; p++ ) {
+
+        if ( 0 == memcmp(p, s, len) ) {
+            return 1;
+        }
+
+    }
+
+    return 0;
+
+}
+
+
+static void parse_relay_mode(gnb_route_conf_record_t *record, const char *p, const char *end){
+
+    record->type = GNB_ROUTE_CONF_RECORD_MODE;
+    record->relay_mode = GNB_NODE_RELAY_DISABLE;
+
+    if ( has_substring(p, end, "force") ) {
+        record->relay_mode &= ~GNB_NODE_RELAY_AUTO;
+        record->relay_mode |= GNB_NODE_RELAY_FORCE;
+    }
+
+    if ( has_substring(p, end, "auto") ) {
+        record->relay_mode &= ~GNB_NODE_RELAY_FORCE;
+        record->relay_mode |= GNB_NODE_RELAY_AUTO;
+    }
+
+    if ( has_substring(p, end, "balance") ) {
+        record->relay_mode |= GNB_NODE_RELAY_BALANCE;
+    }
+
+    if ( has_substring(p, end, "static") ) {
+        record->relay_mode |= GNB_NODE_RELAY_STATIC;
+    }
+
+}
+
+
+//relay nodeid 之间用一个非数字的字符分隔，遇到 0 结束
+static void parse_relay_node(gnb_route_conf_record_t *record, const char *p, const char *end){
+
+    uint32_t relay_nodeid;
+
+    record->type = GNB_ROUTE_CONF_RECORD_RELAY;
+
+    while ( record->relay_count < GNB_MAX_NODE_RELAY ) {
+
+        p = parse_uint32(p, end, &relay_nodeid);
+
+        if ( NULL == p || 0 == relay_nodeid ) {
+            break;
+        }
+
+        record->relay_nodeid[record->relay_count] = relay_nodeid;
+        record->relay_count++;
+
+        if ( p >= end ) {
+            break;
+        }
+
+        p++;
+
+    }
+
+}
+
+
+/*
+一个 token 是以下三种之一:
+uuid32|tun_ipv4|tun_netmask
+uuid32|relay_nodeid,relay_nodeid...
+uuid32|force/auto/balance/static
+分隔符也可以是 '/'
+*/
+static int parse_token(gnb_route_conf_record_t *record, const char *token, const char *end){
+
+    const char *p;
+    const char *field_end;
+
+    char separator;
+
+    int is_node_line = 0;
+
+    memset(record, 0, sizeof(gnb_route_conf_record_t));
+
+    for ( p=token; p<end; p++ ) {
+
+        if ( '.' == *p || ':' == *p ) {
+            is_node_line = 1;
+            break;
+        }
+
+    }
+
+    p = parse_uint32(token, end, &record->uuid32);
+
+    if ( NULL == p || p >= end ) {
+        return -1;
+    }
+
+    separator = *p;
+
+    if ( '|' != separator && '/' != separator ) {
+        return -1;
+    }
+
+    p++;
+
+    if ( 0 == is_node_line ) {
+
+        if ( p >= end ) {
+            return -1;
+        }
+
+        if ( IS_DIGIT(*p) ) {
+            parse_relay_node(record, p, end);
+        } else {
+            parse_relay_mode(record, p, end);
+        }
+
+        return 0;
+
+    }
+
+    record->type = GNB_ROUTE_CONF_RECORD_NODE;
+
+    field_end = find_char(p, end, separator);
+
+    if ( field_end >= end || field_end == p ) {
+        return -1;
+    }
+
+    //和 inet_pton 一样，解析失败时地址为 0
+    if ( 0 != parse_ipv4(p, field_end, &record->tun_addr4) ) {
+        record->tun_addr4 = 0;
+    }
+
+    p = field_end + 1;
+
+    field_end = find_char(p, end, separator);
+
+    if ( field_end == p ) {
+        return -1;
+    }
+
+    if ( 0 != parse_ipv4(p, field_end, &record->tun_netmask_addr4) ) {
+        record->tun_netmask_addr4 = 0;
+    }
+
+    return 0;
+
+}
+
+
+static gnb_route_conf_t* parse_route_conf(const char *data, size_t size){
+
+    gnb_route_conf_t *route_conf;
+
+    gnb_route_conf_record_t record;
+
+    const char *p = data;
+    const char *end = data + size;
+    const char *token;
+
+    size_t records_size = 1024;
+
+    route_conf = (gnb_route_conf_t *)malloc(sizeof(gnb_route_conf_t));
+    memset(route_conf, 0, sizeof(gnb_route_conf_t));
+
+    route_conf->records = (gnb_route_conf_record_t *)malloc(sizeof(gnb_route_conf_record_t) * records_size);
+
+    while ( p < end ) {
+
+        if ( IS_SPACE(*p) ) {
+            p++;
+            continue;
+        }
+
+        //注释到行尾
+        if ( '#' == *p ) {
+            p = find_char(p, end, '\n');
+            continue;
+        }
+
+        token = p;
+
+        while ( p < end && !IS_SPACE(*p) ) {
+            p++;
+        }
+
+        if ( 0 != parse_token(&record, token, p) ) {
+            continue;
+        }
+
+        if ( route_conf->num == records_size ) {
+            records_size *= 2;
+            route_conf->records = (gnb_route_conf_record_t *)realloc(route_conf->records, sizeof(gnb_route_conf_record_t) * records_size);
+        }
+
+        route_conf->records[route_conf->num] = record;
+        route_conf->num++;
+
+        if ( GNB_ROUTE_CONF_RECORD_NODE == record.type ) {
+            route_conf->node_num++;
+        }
+
+    }
+
+    return route_conf;
+
+}
+
+
+static gnb_route_conf_t* load_route_conf_cache(const char *cache_file, struct stat *source_stat, uint32_t source_hash){
+
+    gnb_route_conf_t *route_conf = NULL;
+
+    gnb_route_conf_cache_head_t head;
+
+    FILE *file;
+
+    file = fopen(cache_file, "rb");
+
+    if ( NULL == file ) {
+        return NULL;
+    }
+
+    if ( 1 != fread(&head, sizeof(gnb_route_conf_cache_head_t), 1, file) ) {
+        goto finish;
+    }
+
+    if ( 0 != memcmp(head.magic, GNB_ROUTE_CONF_CACHE_MAGIC, 8) ||
+         sizeof(gnb_route_conf_record_t) != head.record_size   ||
+         (int64_t)source_stat->st_mtime != head.source_mtime    ||
+         (int64_t)source_stat->st_size  != head.source_size     ||
+         source_hash != head.source_hash ) {
+        goto finish;
+    }
+
+    route_conf = (gnb_route_conf_t *)malloc(sizeof(gnb_route_conf_t));
+    memset(route_conf, 0, sizeof(gnb_route_conf_t));
+
+    route_conf->records = (gnb_route_conf_record_t *)malloc(sizeof(gnb_route_conf_record_t) * (head.num + 1));
+
+    if ( head.num != fread(route_conf->records, sizeof(gnb_route_conf_record_t), head.num, file) ) {
+        gnb_route_conf_release(route_conf);
+        route_conf = NULL;
+        goto finish;
+    }
+
+    route_conf->num      = head.num;
+    route_conf->node_num = head.node_num;
+    route_conf->from_cache = 1;
+
+finish:
+
+    fclose(file);
+
+    return route_conf;
+
+}
+
+
+static void save_route_conf_cache(const char *cache_file, gnb_route_conf_t *route_conf, struct stat *source_stat, uint32_t source_hash){
+
+    //cache_file 最长为 PATH_MAX+NAME_MAX, 还要加上 ".tmp"
+    char cache_tmp_file[PATH_MAX+NAME_MAX+sizeof(".tmp")];
+
+    gnb_route_conf_cache_head_t head;
+
+    FILE *file;
+
+    snprintf(cache_tmp_file, sizeof(cache_tmp_file), "%s.tmp", cache_file);
+
+    //conf_dir 不可写时不使用 cache
+    file = fopen(cache_tmp_file, "wb");
+
+    if ( NULL == file ) {
+        return;
+    }
+
+    memset(&head, 0, sizeof(gnb_route_conf_cache_head_t));
+
+    memcpy(head.magic, GNB_ROUTE_CONF_CACHE_MAGIC, 8);
+    head.record_size  = sizeof(gnb_route_conf_record_t);
+    head.num          = (uint32_t)route_conf->num;
+    head.node_num     = (uint32_t)route_conf->node_num;
+    head.source_hash  = source_hash;
+    head.source_mtime = (int64_t)source_stat->st_mtime;
+    head.source_size  = (int64_t)source_stat->st_size;
+
+    if ( 1 != fwrite(&head, sizeof(gnb_route_conf_cache_head_t), 1, file) ||
+         route_conf->num != fwrite(route_conf->records, sizeof(gnb_route_conf_record_t), route_conf->num, file) ) {
+        fclose(file);
+        remove(cache_tmp_file);
+        return;
+    }
+
+    fclose(file);
+
+    #ifdef _WIN32
+    remove(cache_file);
+    #endif
+
+    rename(cache_tmp_file, cache_file);
+
+}
+
+
+gnb_route_conf_t* gnb_route_conf_load(const char *conf_dir){
+
+    gnb_route_conf_t *route_conf;
+
+    gnb_mmap_block_t *mmap_block = NULL;
+
+    char route_file[PATH_MAX+NAME_MAX];
+    char cache_file[PATH_MAX+NAME_MAX];
+
+    struct stat source_stat;
+
+    const char *data = "";
+
+    uint32_t source_hash;
+
+    uint64_t start_usec;
+
+    int ret;
+
+    start_usec = gnb_timestamp_usec();
+
+    snprintf(route_file, PATH_MAX+NAME_MAX, "%s/%s", conf_dir, "route.conf");
+    snprintf(cache_file, PATH_MAX+NAME_MAX, "%s/%s", conf_dir, "route.conf.cache");
+
+    ret = stat(route_file, &source_stat);
+
+    if ( 0 != ret ) {
+        return NULL;
+    }
+
+    //空文件无法 mmap
+    if ( source_stat.st_size > 0 ) {
+
+        mmap_block = gnb_mmap_create(route_file, source_stat.st_size, GNB_MMAP_TYPE_READONLY);
+
+        if ( NULL == mmap_block ) {
+            return NULL;
+        }
+
+        data = (const char *)gnb_mmap_get_block(mmap_block);
+
+    }
+
+    source_hash = murmurhash_hash((unsigned char *)data, source_stat.st_size);
+
+    route_conf = load_route_conf_cache(cache_file, &source_stat, source_hash);
+
+    if ( NULL == route_conf ) {
+        route_conf = parse_route_conf(data, source_stat.st_size);
+        save_route_conf_cache(cache_file, route_conf, &source_stat, source_hash);
+    }
+
+    if ( NULL != mmap_block ) {
+        gnb_mmap_release(mmap_block);
+    }
+
+    route_conf->load_usec = gnb_timestamp_usec() - start_usec;
+
+    return route_conf;
+
+}
+
+
+void gnb_route_conf_release(gnb_route_conf_t *route_conf){
+
+    free(route_conf->records);
+
+    free(route_conf);
+
+}
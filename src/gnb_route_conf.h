@@ -0,0 +1,79 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GNB_ROUTE_CONF_H
+#define GNB_ROUTE_CONF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "gnb_node_type.h"
+
+#define GNB_ROUTE_CONF_RECORD_NODE   0x1
+#define GNB_ROUTE_CONF_RECORD_RELAY  0x2
+#define GNB_ROUTE_CONF_RECORD_MODE   0x3
+
+//route.conf 中的一行
+typedef struct _gnb_route_conf_record_t {
+
+	uint32_t uuid32;
+
+	//GNB_ROUTE_CONF_RECORD_NODE, 网络字节序
+	uint32_t tun_addr4;
+	uint32_t tun_netmask_addr4;
+
+	//GNB_ROUTE_CONF_RECORD_RELAY
+	uint32_t relay_nodeid[GNB_MAX_NODE_RELAY];
+
+	uint8_t  type;
+
+	uint8_t  relay_count;
+
+	//GNB_ROUTE_CONF_RECORD_MODE, GNB_NODE_RELAY_XXX
+	uint8_t  relay_mode;
+
+}gnb_route_conf_record_t;
+
+
+typedef struct _gnb_route_conf_t {
+
+	size_t num;
+
+	//GNB_ROUTE_CONF_RECORD_NODE 的数量，可能有重复的 uuid32
+	size_t node_num;
+
+	//记录是从 route.conf.cache 加载的
+	uint8_t from_cache;
+
+	uint64_t load_usec;
+
+	gnb_route_conf_record_t *records;
+
+}gnb_route_conf_t;
+
+
+/*
+用 mmap 一次读入 route.conf 并解析成 gnb_route_conf_t,
+解析的结果保存在 conf_dir 下的 route.conf.cache 中，
+route.conf 的 mtime size 和 hash 没有变化时直接加载 cache
+route.conf 不存在时返回 NULL
+*/
+gnb_route_conf_t* gnb_route_conf_load(const char *conf_dir);
+
+void gnb_route_conf_release(gnb_route_conf_t *route_conf);
+
+#endif
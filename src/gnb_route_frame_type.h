@@ -0,0 +1,55 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GNB_ROUTE_FRAME_TYPE_H
+#define GNB_ROUTE_FRAME_TYPE_H
+
+#include "stdint.h"
+
+#pragma pack(push, 1)
+
+typedef struct _gnb_route_frame_head_t {
+
+	unsigned char magic[2];
+
+	unsigned char pf_type_bits; //可用于加密标识
+
+	uint8_t ttl;
+
+	uint32_t src_uuid32;     //网络字节序
+
+	uint32_t dst_uuid32;     //网络字节序
+
+}__attribute__ ((__packed__)) gnb_route_frame_head_t;
+
+#pragma pack(pop)
+
+
+#define GNB_PAYLOAD_MAX_TTL     0x05
+
+/*
+经过中继的 payload 在 ip frame 后面是 relay trailer: 中继节点的 uuid32 和上一跳节点的 uuid32, 个数与 ttl 相同
+带有 GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH 的 payload 在 ip frame 和 relay trailer 之间有一个 relay tag,
+relay tag 是用上一跳与下一跳之间的密钥对 route frame head 和 relay trailer 计算的 HMAC-SHA512 的前 8 字节,
+中继节点只加密、验证和改写 route frame head、relay tag 和 relay trailer, ip frame 保持用源节点与目的节点之间的密钥加密
+*/
+#define GNB_ROUTE_RELAY_TAG_SIZE     8
+
+//relay trailer 最大的长度: relay tag 加上最多 GNB_PAYLOAD_MAX_TTL 个中继节点和上一跳节点的 uuid32
+#define GNB_ROUTE_RELAY_TRAILER_MAX  (GNB_ROUTE_RELAY_TAG_SIZE + (GNB_PAYLOAD_MAX_TTL + 1) * sizeof(uint32_t))
+
+#endif
@@ -0,0 +1,143 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GNB_SEQLOCK_H
+#define GNB_SEQLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ctl block 中的 seqlock, seq 为奇数时表示有写者正在修改
+写者之间用 cas 互斥，gnb 的多个 worker 和 gnb_es 进程都可能修改同一个 node
+读者不加锁，读前后 seq 不一致或为奇数时重读
+in_bytes out_bytes 这类只做累加的计数器不在 seqlock 的保护范围内
+*/
+
+//读者等待写者的最大次数，防止写者进程在持有锁时退出导致读者一直等待
+#define GNB_SEQLOCK_READ_SPIN   4096
+
+//写者每等待这么多次检查一次时间
+#define GNB_SEQLOCK_WRITE_SPIN  4096
+
+//seq 保持同一个奇数超过这个时间就认为持有锁的写者已经退出，写者的临界区只有几次内存复制
+#define GNB_SEQLOCK_WRITE_TIMEOUT_SEC  2
+
+//一个 node 或整个 node_zone 重读的最大次数
+#define GNB_SEQLOCK_READ_RETRY  64
+
+
+static inline void gnb_seqlock_write_begin(volatile uint32_t *seq){
+
+    uint32_t s;
+    uint32_t last = 0;
+
+    time_t stall_ts_sec = 0;
+
+    int spin = 0;
+
+    for ( ;; ) {
+
+        s = *seq;
+
+        if ( 0 == (s & 0x1) ) {
+
+            if ( __sync_bool_compare_and_swap(seq, s, s+1) ) {
+                break;
+            }
+
+            continue;
+
+        }
+
+        if ( s != last ) {
+            last = s;
+            spin = 0;
+            stall_ts_sec = 0;
+            continue;
+        }
+
+        spin++;
+
+        if ( spin < GNB_SEQLOCK_WRITE_SPIN ) {
+            continue;
+        }
+
+        spin = 0;
+
+        if ( 0 == stall_ts_sec ) {
+            stall_ts_sec = time(NULL);
+            continue;
+        }
+
+        /*
+        写者在持有锁时退出(比如 gnb_es 进程被杀死), seq 会一直保持同一个奇数,
+        超过 GNB_SEQLOCK_WRITE_TIMEOUT_SEC 后接管这个锁，seq 加 2 后仍是奇数，由本写者的 write_end 恢复为偶数
+        */
+        if ( time(NULL) - stall_ts_sec >= GNB_SEQLOCK_WRITE_TIMEOUT_SEC && __sync_bool_compare_and_swap(seq, s, s+2) ) {
+            break;
+        }
+
+    }
+
+}
+
+
+static inline void gnb_seqlock_write_end(volatile uint32_t *seq){
+
+    __sync_fetch_and_add(seq, 1);
+
+}
+
+
+static inline uint32_t gnb_seqlock_read_begin(volatile uint32_t *seq){
+
+    uint32_t s;
+
+    int i;
+
+    for ( i=0; i<GNB_SEQLOCK_READ_SPIN; i++ ) {
+
+        s = *seq;
+
+        if ( 0 == (s & 0x1) ) {
+            break;
+        }
+
+    }
+
+    __sync_synchronize();
+
+    return s;
+
+}
+
+
+//返回 1 表示读的过程中有写入，需要重读
+static inline int gnb_seqlock_read_retry(volatile uint32_t *seq, uint32_t start){
+
+    __sync_synchronize();
+
+    if ( (start & 0x1) || *seq != start ) {
+        return 1;
+    }
+
+    return 0;
+
+}
+
+#endif
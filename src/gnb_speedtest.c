@@ -0,0 +1,753 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gnb.h"
+#include "gnb_pf.h"
+#include "gnb_time.h"
+#include "gnb_address.h"
+#include "gnb_speedtest.h"
+
+/*
+测试分组是从本节点 tun 地址发往对端 tun 地址的 udp 分组，端口为 9(discard)
+分组带上 GNB_PAYLOAD_SUB_TYPE_IPFRAME_TEST 后像从 tun 读入的分组一样经过 pf 的处理，加密和中继都与真实的流量相同
+对端在 gnb_pf_inet 中识别出测试分组后不写入 tun，而是把回应放入队列，在 gnb_speedtest_timer 中通过 gnb_pf_tun_test_batch 发回
+回应不能在 gnb_pf_inet 的 batch 中直接进入 pf, 否则会改写 gnb_core->select_fwd_node, 并且 tun 的延迟采样会被计入 inet 的阶段耗时
+不认识 TEST 的旧版本 gnb 会把测试分组写入 tun, 发往 discard 端口的 udp 分组会被系统丢弃
+*/
+
+#define GNB_SPEEDTEST_MAGIC          "GNBT"
+
+#define GNB_SPEEDTEST_FLAG_REPLY     0x1
+#define GNB_SPEEDTEST_FLAG_SINK      0x2
+
+#define GNB_SPEEDTEST_UDP_PORT       9
+
+#define GNB_SPEEDTEST_IP_HEAD_SIZE   20
+#define GNB_SPEEDTEST_UDP_HEAD_SIZE  8
+
+//每次调用 gnb_speedtest_timer 最多发送的测试分组数，避免长时间占用 main worker
+#define GNB_SPEEDTEST_BURST          64
+
+//一条路径发送结束后等待迟到的回应的时间
+#define GNB_SPEEDTEST_DRAIN_MSEC     500
+
+#define GNB_SPEEDTEST_PEER_NUM       16
+
+//中继时在 ip 分组后面追加的节点 id 和 route frame head 需要的空间
+#define GNB_SPEEDTEST_TAIL_ROOM      128
+
+
+typedef struct _gnb_speedtest_frame_head_t {
+
+	unsigned char magic[4];
+
+	uint8_t flags;
+
+	//请求方 gnb_speedtest_t 中 path 的下标
+	uint8_t path_idx;
+
+	uint16_t reserved;
+
+	uint32_t test_id;
+
+	uint32_t seq;
+
+	//请求方的单调时钟，对端原样带回
+	uint64_t send_nsec;
+
+	//对端在这个 test_id 和 path_idx 上收到的测试分组数和 udp 负载的字节数
+	uint64_t peer_recv_packets;
+	uint64_t peer_recv_bytes;
+
+}__attribute__ ((__packed__)) gnb_speedtest_frame_head_t;
+
+
+#define GNB_SPEEDTEST_FRAME_MIN_SIZE (GNB_SPEEDTEST_IP_HEAD_SIZE + GNB_SPEEDTEST_UDP_HEAD_SIZE + sizeof(gnb_speedtest_frame_head_t))
+
+
+typedef struct _gnb_speedtest_peer_t {
+
+	uint32_t uuid32;
+
+	uint32_t test_id;
+
+	uint8_t path_idx;
+
+	uint64_t recv_packets;
+	uint64_t recv_bytes;
+
+}gnb_speedtest_peer_t;
+
+
+struct _gnb_speedtest_ctx_t {
+
+	//本节点发起的测试正在进行
+	int running;
+
+	uint32_t test_id;
+
+	uint32_t seq;
+
+	//当前路径开始发送的时间
+	uint64_t path_begin_nsec;
+
+	uint32_t frame_size;
+
+	unsigned char *frame;
+
+	//按 batch 一次填充多个测试分组
+	gnb_payload16_t *send_payload[GNB_SPEEDTEST_MAX_BATCH];
+
+	//等待在 gnb_speedtest_timer 中发出的回应
+	gnb_payload16_t **reply_payload;
+
+	uint8_t *reply_path;
+
+	int reply_num;
+
+	//main worker 每轮最多从每个 udp socket 收一个 batch, 按此分配的队列不会溢出
+	int reply_queue_size;
+
+	//作为对端时按请求方记录收到的测试分组
+	gnb_speedtest_peer_t peer[GNB_SPEEDTEST_PEER_NUM];
+
+	int peer_next;
+
+};
+
+
+void gnb_speedtest_init(gnb_core_t *gnb_core){
+
+    gnb_speedtest_ctx_t *ctx;
+
+    int i;
+
+    if ( NULL == gnb_core->speedtest ) {
+        return;
+    }
+
+    ctx = (gnb_speedtest_ctx_t *)gnb_heap_alloc(gnb_core->heap, sizeof(gnb_speedtest_ctx_t));
+    memset(ctx, 0, sizeof(gnb_speedtest_ctx_t));
+
+    ctx->frame         = (unsigned char *)gnb_heap_alloc(gnb_core->heap, GNB_SPEEDTEST_MAX_FRAME_SIZE);
+
+    for ( i=0; i<GNB_SPEEDTEST_MAX_BATCH; i++ ) {
+        ctx->send_payload[i] = (gnb_payload16_t *)gnb_heap_alloc(gnb_core->heap, sizeof(gnb_payload16_t) + GNB_TUN_PAYLOAD_BLOCK_SIZE);
+    }
+
+    ctx->reply_queue_size = (gnb_core->conf->udp4_socket_num + gnb_core->conf->udp6_socket_num) * GNB_PF_BATCH_MAX;
+
+    ctx->reply_payload = (gnb_payload16_t **)gnb_heap_alloc(gnb_core->heap, sizeof(gnb_payload16_t *) * ctx->reply_queue_size);
+    ctx->reply_path    = (uint8_t *)gnb_heap_alloc(gnb_core->heap, ctx->reply_queue_size);
+
+    for ( i=0; i<ctx->reply_queue_size; i++ ) {
+        ctx->reply_payload[i] = (gnb_payload16_t *)gnb_heap_alloc(gnb_core->heap, sizeof(gnb_payload16_t) + GNB_TUN_PAYLOAD_BLOCK_SIZE);
+    }
+
+    gnb_core->speedtest_ctx = ctx;
+
+}
+
+
+void gnb_speedtest_release(gnb_core_t *gnb_core){
+
+    gnb_speedtest_ctx_t *ctx = gnb_core->speedtest_ctx;
+
+    int i;
+
+    if ( NULL == ctx ) {
+        return;
+    }
+
+    gnb_core->speedtest_ctx = NULL;
+
+    for ( i=0; i<ctx->reply_queue_size; i++ ) {
+        gnb_heap_free(gnb_core->heap, ctx->reply_payload[i]);
+    }
+
+    gnb_heap_free(gnb_core->heap, ctx->reply_path);
+    gnb_heap_free(gnb_core->heap, ctx->reply_payload);
+
+    for ( i=0; i<GNB_SPEEDTEST_MAX_BATCH; i++ ) {
+        gnb_heap_free(gnb_core->heap, ctx->send_payload[i]);
+    }
+
+    gnb_heap_free(gnb_core->heap, ctx->frame);
+    gnb_heap_free(gnb_core->heap, ctx);
+
+}
+
+
+static uint16_t ip_checksum(unsigned char *ip_head, int len){
+
+    uint32_t sum = 0;
+    int i;
+
+    for ( i=0; i<len; i+=2 ) {
+        sum += (ip_head[i] << 8) | ip_head[i+1];
+    }
+
+    while ( sum >> 16 ) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return (uint16_t)~sum;
+
+}
+
+
+//在 frame 中填写 ip 头和 udp 头，udp 的 checksum 为 0
+static void fill_ip_udp_head(unsigned char *frame, uint32_t frame_size, struct in_addr *src_addr, struct in_addr *dst_addr){
+
+    uint16_t v16;
+
+    memset(frame, 0, GNB_SPEEDTEST_IP_HEAD_SIZE + GNB_SPEEDTEST_UDP_HEAD_SIZE);
+
+    frame[0] = 0x45;
+    v16 = htons((uint16_t)frame_size);
+    memcpy(frame+2, &v16, 2);
+    frame[8] = 64;
+    frame[9] = 17;
+    memcpy(frame+12, src_addr, 4);
+    memcpy(frame+16, dst_addr, 4);
+
+    v16 = htons(ip_checksum(frame, GNB_SPEEDTEST_IP_HEAD_SIZE));
+    memcpy(frame+10, &v16, 2);
+
+    v16 = htons(GNB_SPEEDTEST_UDP_PORT);
+    memcpy(frame+20, &v16, 2);
+    memcpy(frame+22, &v16, 2);
+    v16 = htons((uint16_t)(frame_size - GNB_SPEEDTEST_IP_HEAD_SIZE));
+    memcpy(frame+24, &v16, 2);
+
+}
+
+
+static int set_test_error(gnb_speedtest_t *test, const char *error){
+
+    snprintf(test->error, sizeof(test->error), "%s", error);
+
+    __sync_bool_compare_and_swap(&test->state, GNB_SPEEDTEST_STATE_REQUEST, GNB_SPEEDTEST_STATE_ERROR);
+
+    return -1;
+
+}
+
+
+//按 dst_node 当前的状态列出要测试的路径
+static uint32_t setup_test_path(gnb_core_t *gnb_core, gnb_speedtest_t *test, gnb_node_t *dst_node){
+
+    gnb_speedtest_path_t *path;
+
+    uint32_t path_num = 0;
+    uint8_t relay_count;
+
+    int route_idx;
+    int i;
+
+    memset(test->path, 0, sizeof(test->path));
+
+    if ( (gnb_core->conf->udp_socket_type & GNB_ADDR_TYPE_IPV4) && (dst_node->udp_addr_status & GNB_NODE_STATUS_IPV4_PONG) ) {
+        test->path[path_num].path = GNB_PF_PATH_DIRECT4;
+        path_num++;
+    }
+
+    if ( (gnb_core->conf->udp_socket_type & GNB_ADDR_TYPE_IPV6) && (dst_node->udp_addr_status & GNB_NODE_STATUS_IPV6_PONG) ) {
+        test->path[path_num].path = GNB_PF_PATH_DIRECT6;
+        path_num++;
+    }
+
+    for ( route_idx=0; route_idx<GNB_MAX_NODE_ROUTE; route_idx++ ) {
+
+        relay_count = dst_node->route_node_ttls[route_idx];
+
+        if ( 0 == relay_count || relay_count > GNB_MAX_NODE_RELAY || 0 == dst_node->route_node[route_idx][0] ) {
+            continue;
+        }
+
+        path = &test->path[path_num];
+
+        path->path      = GNB_PF_PATH_RELAY;
+        path->route_idx = (uint8_t)route_idx;
+        path->relay_num = relay_count;
+
+        //route_node 中最后一个是第一跳
+        for ( i=0; i<relay_count; i++ ) {
+            path->relay[i] = dst_node->route_node[route_idx][relay_count-1-i];
+        }
+
+        path_num++;
+
+    }
+
+    return path_num;
+
+}
+
+
+static int start_test(gnb_core_t *gnb_core, gnb_speedtest_ctx_t *ctx, gnb_speedtest_t *test){
+
+    gnb_node_t *dst_node;
+
+    uint32_t dst_uuid32 = test->dst_uuid32;
+    uint32_t frame_size;
+    uint32_t path_num;
+
+    test->error[0] = '\0';
+
+    dst_node = GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, dst_uuid32);
+
+    if ( NULL == dst_node || dst_node == gnb_core->local_node ) {
+        return set_test_error(test, "node not found");
+    }
+
+    if ( 0 == dst_node->tun_addr4.s_addr || 0 == gnb_core->local_node->tun_addr4.s_addr ) {
+        return set_test_error(test, "no ipv4 tun address");
+    }
+
+    frame_size = test->frame_size;
+
+    if ( frame_size < GNB_SPEEDTEST_MIN_FRAME_SIZE ) {
+        frame_size = GNB_SPEEDTEST_MIN_FRAME_SIZE;
+    }
+
+    if ( frame_size > GNB_SPEEDTEST_MAX_FRAME_SIZE ) {
+        frame_size = GNB_SPEEDTEST_MAX_FRAME_SIZE;
+    }
+
+    if ( gnb_core->tun_payload_offset + frame_size + GNB_SPEEDTEST_TAIL_ROOM > GNB_TUN_PAYLOAD_BLOCK_SIZE ) {
+        frame_size = GNB_TUN_PAYLOAD_BLOCK_SIZE - gnb_core->tun_payload_offset - GNB_SPEEDTEST_TAIL_ROOM;
+    }
+
+    test->frame_size = frame_size;
+
+    if ( 0 == test->duration_msec ) {
+        test->duration_msec = 3000;
+    }
+
+    if ( 0 == test->batch ) {
+        test->batch = 1;
+    }
+
+    if ( test->batch > GNB_SPEEDTEST_MAX_BATCH ) {
+        test->batch = GNB_SPEEDTEST_MAX_BATCH;
+    }
+
+    path_num = setup_test_path(gnb_core, test, dst_node);
+
+    if ( 0 == path_num ) {
+        return set_test_error(test, "no reachable path");
+    }
+
+    test->path_num = path_num;
+    test->current_path = 0;
+
+    memset(ctx->frame, 0, frame_size);
+    fill_ip_udp_head(ctx->frame, frame_size, &gnb_core->local_node->tun_addr4, &dst_node->tun_addr4);
+
+    gnb_speedtest_frame_head_t *frame_head = (gnb_speedtest_frame_head_t *)(ctx->frame + GNB_SPEEDTEST_IP_HEAD_SIZE + GNB_SPEEDTEST_UDP_HEAD_SIZE);
+
+    memcpy(frame_head->magic, GNB_SPEEDTEST_MAGIC, 4);
+    frame_head->flags   = GNB_SPEEDTEST_MODE_SINK == test->mode ? GNB_SPEEDTEST_FLAG_SINK : 0;
+    frame_head->test_id = htonl(test->test_id);
+
+    ctx->frame_size = frame_size;
+    ctx->test_id = test->test_id;
+    ctx->seq = 0;
+    ctx->path_begin_nsec = gnb_monotonic_nsec();
+
+    test->path[0].begin_nsec = ctx->path_begin_nsec;
+
+    if ( !__sync_bool_compare_and_swap(&test->state, GNB_SPEEDTEST_STATE_REQUEST, GNB_SPEEDTEST_STATE_RUNNING) ) {
+        return -1;
+    }
+
+    ctx->running = 1;
+
+    GNB_LOG1(gnb_core->log, GNB_LOG_ID_MAIN_WORKER, "speedtest start dst[%u] path[%u] duration[%u]ms rate[%u]pps frame_size[%u] batch[%u]\n",
+             test->dst_uuid32, path_num, test->duration_msec, test->rate_pps, frame_size, test->batch);
+
+    return 0;
+
+}
+
+
+/*
+填充 num 个测试分组，作为一批交给 pf 处理，不同的 batch 测得的 pps 反映了 pf 批处理的效果
+*/
+static void send_test_frame(gnb_core_t *gnb_core, gnb_speedtest_ctx_t *ctx, gnb_speedtest_t *test, gnb_speedtest_path_t *path, int num){
+
+    gnb_speedtest_frame_head_t *frame_head;
+
+    unsigned char *frame;
+
+    uint64_t now_nsec = gnb_monotonic_nsec();
+
+    int i;
+
+    for ( i=0; i<num; i++ ) {
+
+        frame = ctx->send_payload[i]->data + gnb_core->tun_payload_offset;
+
+        //pf 会在 payload 中就地加密和追加中继的节点，每次都从模板复制
+        memcpy(frame, ctx->frame, ctx->frame_size);
+
+        frame_head = (gnb_speedtest_frame_head_t *)(frame + GNB_SPEEDTEST_IP_HEAD_SIZE + GNB_SPEEDTEST_UDP_HEAD_SIZE);
+
+        frame_head->path_idx  = (uint8_t)test->current_path;
+        frame_head->seq       = htonl(ctx->seq);
+        frame_head->send_nsec = gnb_htonll(now_nsec);
+
+        ctx->seq++;
+
+        gnb_payload16_set_size(ctx->send_payload[i], GNB_PAYLOAD16_HEAD_SIZE + gnb_core->tun_payload_offset + ctx->frame_size);
+
+    }
+
+    gnb_pf_tun_test_batch(gnb_core, ctx->send_payload, num, path->path, path->route_idx);
+
+    path->send_packets += num;
+
+}
+
+
+//发出 gnb_speedtest_inet 放入队列的回应，相同路径的回应作为一批交给 pf
+static void send_reply(gnb_core_t *gnb_core, gnb_speedtest_ctx_t *ctx){
+
+    int begin = 0;
+    int i;
+
+    for ( i=1; i<=ctx->reply_num; i++ ) {
+
+        if ( i < ctx->reply_num && ctx->reply_path[i] == ctx->reply_path[begin] ) {
+            continue;
+        }
+
+        gnb_pf_tun_test_batch(gnb_core, ctx->reply_payload + begin, i - begin, ctx->reply_path[begin], 0);
+
+        begin = i;
+
+    }
+
+    ctx->reply_num = 0;
+
+}
+
+
+void gnb_speedtest_timer(gnb_core_t *gnb_core){
+
+    gnb_speedtest_ctx_t *ctx = gnb_core->speedtest_ctx;
+    gnb_speedtest_t *test = gnb_core->speedtest;
+
+    gnb_speedtest_path_t *path;
+
+    uint64_t now_nsec;
+    uint64_t elapsed_nsec;
+    uint64_t duration_nsec;
+    uint64_t target;
+
+    int num;
+    int n;
+
+    if ( NULL == ctx ) {
+        return;
+    }
+
+    if ( ctx->reply_num > 0 ) {
+        send_reply(gnb_core, ctx);
+    }
+
+    if ( GNB_SPEEDTEST_STATE_REQUEST == test->state ) {
+        start_test(gnb_core, ctx, test);
+        return;
+    }
+
+    //gnb_ctl 中止了测试
+    if ( GNB_SPEEDTEST_STATE_RUNNING != test->state || ctx->test_id != test->test_id ) {
+        ctx->running = 0;
+        return;
+    }
+
+    if ( 0 == ctx->running ) {
+        return;
+    }
+
+    now_nsec = gnb_monotonic_nsec();
+
+    path = &test->path[test->current_path];
+
+    elapsed_nsec  = now_nsec - ctx->path_begin_nsec;
+    duration_nsec = (uint64_t)test->duration_msec * 1000000;
+
+    if ( elapsed_nsec < duration_nsec ) {
+
+        if ( 0 == test->rate_pps ) {
+            num = GNB_SPEEDTEST_BURST;
+        } else {
+
+            target = (uint64_t)test->rate_pps * elapsed_nsec / 1000000000 + 1;
+
+            num = target > path->send_packets ? (int)(target - path->send_packets) : 0;
+
+            if ( num > GNB_SPEEDTEST_BURST ) {
+                num = GNB_SPEEDTEST_BURST;
+            }
+
+        }
+
+        while ( num > 0 ) {
+            n = num > (int)test->batch ? (int)test->batch : num;
+            send_test_frame(gnb_core, ctx, test, path, n);
+            num -= n;
+        }
+
+        path->end_nsec = gnb_monotonic_nsec();
+
+        return;
+
+    }
+
+    if ( elapsed_nsec < duration_nsec + (uint64_t)GNB_SPEEDTEST_DRAIN_MSEC * 1000000 ) {
+        return;
+    }
+
+    if ( test->current_path + 1 >= test->path_num ) {
+
+        ctx->running = 0;
+
+        __sync_bool_compare_and_swap(&test->state, GNB_SPEEDTEST_STATE_RUNNING, GNB_SPEEDTEST_STATE_DONE);
+
+        GNB_LOG1(gnb_core->log, GNB_LOG_ID_MAIN_WORKER, "speedtest finish dst[%u]\n", test->dst_uuid32);
+
+        return;
+
+    }
+
+    ctx->path_begin_nsec = now_nsec;
+    test->path[test->current_path + 1].begin_nsec = now_nsec;
+
+    __sync_synchronize();
+
+    test->current_path++;
+
+}
+
+
+int gnb_speedtest_poll_usec(gnb_core_t *gnb_core){
+
+    gnb_speedtest_ctx_t *ctx = gnb_core->speedtest_ctx;
+
+    if ( NULL == ctx || 0 == ctx->running ) {
+        return -1;
+    }
+
+    if ( 0 == gnb_core->speedtest->rate_pps ) {
+        return 0;
+    }
+
+    return 1000;
+
+}
+
+
+static gnb_speedtest_peer_t* find_peer(gnb_speedtest_ctx_t *ctx, uint32_t uuid32){
+
+    gnb_speedtest_peer_t *peer;
+
+    int i;
+
+    for ( i=0; i<GNB_SPEEDTEST_PEER_NUM; i++ ) {
+
+        if ( uuid32 == ctx->peer[i].uuid32 ) {
+            return &ctx->peer[i];
+        }
+
+    }
+
+    peer = &ctx->peer[ctx->peer_next];
+    ctx->peer_next = (ctx->peer_next + 1) % GNB_SPEEDTEST_PEER_NUM;
+
+    memset(peer, 0, sizeof(gnb_speedtest_peer_t));
+    peer->uuid32 = uuid32;
+
+    return peer;
+
+}
+
+
+//本节点是测试的对端
+static void handle_test_request(gnb_core_t *gnb_core, gnb_speedtest_ctx_t *ctx, gnb_pf_ctx_t *pf_ctx, gnb_speedtest_frame_head_t *frame_head, int ip_head_size){
+
+    gnb_speedtest_peer_t *peer;
+    gnb_speedtest_frame_head_t *reply_frame_head;
+
+    gnb_payload16_t *reply_payload;
+
+    unsigned char *reply_frame;
+
+    uint32_t test_id = ntohl(frame_head->test_id);
+    uint32_t reply_size;
+
+    uint8_t path;
+
+    peer = find_peer(ctx, pf_ctx->src_uuid32);
+
+    if ( test_id != peer->test_id || frame_head->path_idx != peer->path_idx ) {
+        peer->test_id      = test_id;
+        peer->path_idx     = frame_head->path_idx;
+        peer->recv_packets = 0;
+        peer->recv_bytes   = 0;
+    }
+
+    peer->recv_packets++;
+    peer->recv_bytes += pf_ctx->ip_frame_size - ip_head_size - GNB_SPEEDTEST_UDP_HEAD_SIZE;
+
+    //sink 模式只回应头部，请求方仍然可以得到 rtt 和丢包
+    if ( frame_head->flags & GNB_SPEEDTEST_FLAG_SINK ) {
+        reply_size = GNB_SPEEDTEST_FRAME_MIN_SIZE;
+    } else {
+        reply_size = (uint32_t)pf_ctx->ip_frame_size - ip_head_size + GNB_SPEEDTEST_IP_HEAD_SIZE;
+    }
+
+    if ( gnb_core->tun_payload_offset + reply_size + GNB_SPEEDTEST_TAIL_ROOM > GNB_TUN_PAYLOAD_BLOCK_SIZE ) {
+        return;
+    }
+
+    if ( ctx->reply_num >= ctx->reply_queue_size ) {
+        return;
+    }
+
+    reply_payload = ctx->reply_payload[ctx->reply_num];
+
+    reply_frame = reply_payload->data + gnb_core->tun_payload_offset;
+
+    fill_ip_udp_head(reply_frame, reply_size, (struct in_addr *)((unsigned char *)pf_ctx->ip_frame + 16), (struct in_addr *)((unsigned char *)pf_ctx->ip_frame + 12));
+
+    memcpy(reply_frame + GNB_SPEEDTEST_IP_HEAD_SIZE + GNB_SPEEDTEST_UDP_HEAD_SIZE, frame_head, reply_size - GNB_SPEEDTEST_IP_HEAD_SIZE - GNB_SPEEDTEST_UDP_HEAD_SIZE);
+
+    reply_frame_head = (gnb_speedtest_frame_head_t *)(reply_frame + GNB_SPEEDTEST_IP_HEAD_SIZE + GNB_SPEEDTEST_UDP_HEAD_SIZE);
+
+    reply_frame_head->flags |= GNB_SPEEDTEST_FLAG_REPLY;
+    reply_frame_head->peer_recv_packets = gnb_htonll(peer->recv_packets);
+    reply_frame_head->peer_recv_bytes   = gnb_htonll(peer->recv_bytes);
+
+    gnb_payload16_set_size(reply_payload, GNB_PAYLOAD16_HEAD_SIZE + gnb_core->tun_payload_offset + reply_size);
+
+    //直连的请求从收到它的地址族回应，经过中继的请求由 pf_route 选择回应的路径
+    if ( pf_ctx->fwd_payload->sub_type & GNB_PAYLOAD_SUB_TYPE_IPFRAME_RELAY ) {
+        path = GNB_PF_PATH_AUTO;
+    } else if ( AF_INET6 == pf_ctx->source_node_addr->addr_type ) {
+        path = GNB_PF_PATH_DIRECT6;
+    } else {
+        path = GNB_PF_PATH_DIRECT4;
+    }
+
+    ctx->reply_path[ctx->reply_num] = path;
+    ctx->reply_num++;
+
+}
+
+
+//本节点是测试的请求方
+static void handle_test_reply(gnb_core_t *gnb_core, gnb_speedtest_ctx_t *ctx, gnb_speedtest_frame_head_t *frame_head){
+
+    gnb_speedtest_t *test = gnb_core->speedtest;
+    gnb_speedtest_path_t *path;
+
+    uint64_t now_nsec;
+    uint64_t send_nsec;
+    uint64_t peer_recv_packets;
+    uint64_t peer_recv_bytes;
+
+    if ( 0 == ctx->running || ntohl(frame_head->test_id) != ctx->test_id || frame_head->path_idx >= test->path_num ) {
+        return;
+    }
+
+    path = &test->path[frame_head->path_idx];
+
+    now_nsec  = gnb_monotonic_nsec();
+    send_nsec = gnb_ntohll(frame_head->send_nsec);
+
+    if ( now_nsec >= send_nsec ) {
+        gnb_latency_record(&path->rtt, now_nsec - send_nsec);
+    }
+
+    path->recv_packets++;
+
+    //回应可能乱序，取最大的值
+    peer_recv_packets = gnb_ntohll(frame_head->peer_recv_packets);
+    peer_recv_bytes   = gnb_ntohll(frame_head->peer_recv_bytes);
+
+    if ( peer_recv_packets > path->peer_recv_packets ) {
+        path->peer_recv_packets = peer_recv_packets;
+    }
+
+    if ( peer_recv_bytes > path->peer_recv_bytes ) {
+        path->peer_recv_bytes = peer_recv_bytes;
+    }
+
+}
+
+
+void gnb_speedtest_inet(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
+
+    gnb_speedtest_ctx_t *ctx = gnb_core->speedtest_ctx;
+
+    gnb_speedtest_frame_head_t *frame_head;
+
+    unsigned char *ip_frame = (unsigned char *)pf_ctx->ip_frame;
+
+    int ip_head_size;
+    uint16_t dst_port;
+
+    if ( NULL == ctx || NULL == ip_frame || pf_ctx->ip_frame_size < (ssize_t)GNB_SPEEDTEST_FRAME_MIN_SIZE ) {
+        return;
+    }
+
+    if ( 0x4 != (ip_frame[0] >> 4) || 17 != ip_frame[9] ) {
+        return;
+    }
+
+    ip_head_size = (ip_frame[0] & 0x0f) * 4;
+
+    if ( ip_head_size < GNB_SPEEDTEST_IP_HEAD_SIZE || pf_ctx->ip_frame_size < (ssize_t)(ip_head_size + GNB_SPEEDTEST_UDP_HEAD_SIZE + sizeof(gnb_speedtest_frame_head_t)) ) {
+        return;
+    }
+
+    memcpy(&dst_port, ip_frame + ip_head_size + 2, 2);
+
+    if ( GNB_SPEEDTEST_UDP_PORT != ntohs(dst_port) ) {
+        return;
+    }
+
+    frame_head = (gnb_speedtest_frame_head_t *)(ip_frame + ip_head_size + GNB_SPEEDTEST_UDP_HEAD_SIZE);
+
+    if ( 0 != memcmp(frame_head->magic, GNB_SPEEDTEST_MAGIC, 4) ) {
+        return;
+    }
+
+    if ( frame_head->flags & GNB_SPEEDTEST_FLAG_REPLY ) {
+        handle_test_reply(gnb_core, ctx, frame_head);
+    } else {
+        handle_test_request(gnb_core, ctx, pf_ctx, frame_head, ip_head_size);
+    }
+
+}
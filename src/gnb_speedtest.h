@@ -0,0 +1,37 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GNB_SPEEDTEST_H
+#define GNB_SPEEDTEST_H
+
+#include "gnb.h"
+#include "gnb_pf.h"
+
+void gnb_speedtest_init(gnb_core_t *gnb_core);
+
+void gnb_speedtest_release(gnb_core_t *gnb_core);
+
+//在 main worker 的循环中每轮调用，开始 gnb_ctl 请求的测试并按 rate 发送测试分组
+void gnb_speedtest_timer(gnb_core_t *gnb_core);
+
+//main worker 的 select 的超时时间，没有进行中的测试时返回 -1
+int gnb_speedtest_poll_usec(gnb_core_t *gnb_core);
+
+//gnb_pf_inet 收到发往本节点的测试分组，对请求作出回应，对回应记录结果
+void gnb_speedtest_inet(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx);
+
+#endif
@@ -0,0 +1,121 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GNB_SPEEDTEST_TYPE_H
+#define GNB_SPEEDTEST_TYPE_H
+
+#include <stdint.h>
+
+#include "gnb_node_type.h"
+#include "gnb_latency_type.h"
+
+/*
+gnb_ctl 把测试的参数写入 ctl block 中的 speedtest zone, 由 gnb 的 main worker 产生测试分组
+测试分组经过 pf 的处理后按指定的路径发往对端，对端回应后在这里记录每条路径的结果
+*/
+
+//ipv4 ipv6 直连加上每条 relay route
+#define GNB_SPEEDTEST_PATH_MAX       (2 + GNB_MAX_NODE_ROUTE)
+
+//gnb_ctl 在 IDLE DONE ERROR 时写入请求并设为 REQUEST, gnb 开始测试时设为 RUNNING
+//gnb_ctl 把 RUNNING 设为 IDLE 可以中止测试
+#define GNB_SPEEDTEST_STATE_IDLE     0
+#define GNB_SPEEDTEST_STATE_REQUEST  1
+#define GNB_SPEEDTEST_STATE_RUNNING  2
+#define GNB_SPEEDTEST_STATE_DONE     3
+#define GNB_SPEEDTEST_STATE_ERROR    4
+
+//对端把测试分组原样发回
+#define GNB_SPEEDTEST_MODE_ECHO      0
+//对端只回应测试分组的头部，用于测量单向的吞吐
+#define GNB_SPEEDTEST_MODE_SINK      1
+
+#define GNB_SPEEDTEST_MIN_FRAME_SIZE 128
+#define GNB_SPEEDTEST_MAX_FRAME_SIZE 4000
+
+//与 GNB_PF_BATCH_MAX 相同
+#define GNB_SPEEDTEST_MAX_BATCH      64
+
+
+typedef struct _gnb_speedtest_path_t {
+
+	//GNB_PF_PATH_*
+	uint8_t path;
+
+	uint8_t route_idx;
+
+	uint8_t relay_num;
+
+	uint8_t reserved;
+
+	//按经过的顺序排列的中继节点
+	uint32_t relay[GNB_MAX_NODE_RELAY];
+
+	//发送测试分组的开始和结束时间，单调时钟
+	uint64_t begin_nsec;
+	uint64_t end_nsec;
+
+	uint64_t send_packets;
+
+	//收到的回应
+	uint64_t recv_packets;
+
+	//对端在回应中带回的收到的测试分组数和 udp 负载的字节数
+	uint64_t peer_recv_packets;
+	uint64_t peer_recv_bytes;
+
+	gnb_latency_histogram_t rtt;
+
+}gnb_speedtest_path_t;
+
+
+typedef struct _gnb_speedtest_t {
+
+	volatile uint32_t state;
+
+	//每次测试不同，忽略上一次测试迟到的回应
+	uint32_t test_id;
+
+	uint32_t dst_uuid32;
+
+	//每条路径的测试时间
+	uint32_t duration_msec;
+
+	//每秒发送的测试分组数，0 为不限制
+	uint32_t rate_pps;
+
+	//测试分组的 ip 分组大小
+	uint32_t frame_size;
+
+	uint32_t mode;
+
+	//每次交给 gnb_pf_tun_test_batch 的测试分组数，1 ~ GNB_SPEEDTEST_MAX_BATCH
+	uint32_t batch;
+
+	uint32_t path_num;
+
+	//正在测试的路径
+	volatile uint32_t current_path;
+
+	char error[64];
+
+	gnb_speedtest_path_t path[GNB_SPEEDTEST_PATH_MAX];
+
+}gnb_speedtest_t;
+
+
+#endif
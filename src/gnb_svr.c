@@ -48,6 +48,7 @@
 #include "gnb_keys.h"
 #include "gnb_mmap.h"
 #include "gnb_time.h"
+#include "gnb_speedtest.h"
 
 gnb_pf_t* gnb_find_pf_mod_by_name(const char *name);
 
@@ -62,6 +63,16 @@ void signal_handler(int signum){
 }
 
 
+#ifdef __UNIX_LIKE_OS__
+//收到 SIGHUP 后由 primary_process_loop 热加载 route.conf 和 address.conf
+static volatile sig_atomic_t reload_signal_flag = 0;
+
+static void reload_signal_handler(int signum){
+    reload_signal_flag = 1;
+}
+#endif
+
+
 static void gnb_setup_env(gnb_core_t *gnb_core){
 
     char env_value_string[64];
@@ -86,13 +97,24 @@ static void init_ctl_block(gnb_core_t *gnb_core, gnb_conf_t *conf){
     if ( 0 == conf->public_index_service && 0 == conf->lite_mode ) {
         //大致算出 node 的数量
         node_num = gnb_get_node_num_from_file(conf);
+        //给热加载时新增的节点预留空间
+        node_num += node_num/4 + GNB_NODE_ZONE_RESERVE_NUM;
     }
 
     if ( 0==node_num ) {
         node_num = 256;
     }
 
-    size_t block_size = sizeof(uint32_t)*256 + sizeof(gnb_ctl_magic_number_t) + sizeof(gnb_ctl_conf_zone_t) + sizeof(gnb_ctl_core_zone_t) + sizeof(gnb_ctl_status_zone_t) + sizeof(gnb_ctl_node_zone_t) + sizeof(gnb_node_t)*node_num + sizeof(gnb_block32_t) * 5;
+    size_t block_size = sizeof(uint32_t)*256 + sizeof(gnb_ctl_magic_number_t) + sizeof(gnb_ctl_conf_zone_t) + sizeof(gnb_ctl_core_zone_t) + sizeof(gnb_ctl_status_zone_t) + sizeof(gnb_ctl_node_zone_t) + sizeof(gnb_node_t)*node_num + sizeof(gnb_block32_t) * 6;
+
+    //metrics zone 需要按 cache line 对齐
+    block_size += sizeof(gnb_ctl_metrics_zone_t) + GNB_METRICS_CACHE_LINE_SIZE;
+
+    block_size += sizeof(gnb_block32_t) + sizeof(gnb_ctl_latency_zone_t);
+
+    block_size += sizeof(gnb_block32_t) + sizeof(gnb_ctl_trace_zone_t);
+
+    block_size += sizeof(gnb_block32_t) + sizeof(gnb_ctl_speedtest_zone_t);
 
     unlink(conf->map_file);
 
@@ -450,6 +472,8 @@ gnb_core_t* gnb_core_create(gnb_conf_t *conf){
 
     gnb_core_t *gnb_core;
 
+    int i;
+
     gnb_heap_t *heap = gnb_heap_create(8192);
 
     gnb_core = gnb_heap_alloc(heap, sizeof(gnb_core_t));
@@ -458,8 +482,18 @@ gnb_core_t* gnb_core_create(gnb_conf_t *conf){
 
     gnb_core->heap = heap;
 
+    for ( i=0; i<GNB_NODE_TABLE_READER_NUM; i++ ) {
+        gnb_core->node_table_reader_epoch[i] = GNB_NODE_TABLE_READER_OFFLINE;
+    }
+
     init_ctl_block(gnb_core, conf);
 
+    gnb_core->tun_metrics  = &gnb_core->ctl_block->metrics_zone->slot[GNB_METRICS_SLOT_TUN];
+    gnb_core->inet_metrics = &gnb_core->ctl_block->metrics_zone->slot[GNB_METRICS_SLOT_INET];
+    gnb_core->latency_zone = gnb_core->ctl_block->latency_zone;
+    gnb_core->trace = &gnb_core->ctl_block->trace_zone->ring;
+    gnb_core->speedtest = &gnb_core->ctl_block->speedtest_zone->test;
+
     gnb_core->conf = &gnb_core->ctl_block->conf_zone->conf_st;
     memcpy(gnb_core->conf, conf, sizeof(gnb_conf_t));
 
@@ -515,7 +549,7 @@ gnb_core_t* gnb_core_create(gnb_conf_t *conf){
 
     pf = gnb_find_pf_mod_by_name("gnb_pf_dump");
 
-    if ( 1==gnb_core->conf->if_dump ) {
+    if ( 1==gnb_core->conf->if_dump || '\0' != gnb_core->conf->pcap_file[0] ) {
         gnb_pf_install(gnb_core->pf_array, pf);
     }
 
@@ -528,6 +562,12 @@ gnb_core_t* gnb_core_create(gnb_conf_t *conf){
 
     gnb_pf_install(gnb_core->pf_array, pf);
 
+    //安装在 route 之后 crypto 之前，tun_route 和 inet_fwd 中看到的都是已经确定了转发节点的明文分组
+    if ( '\0' != gnb_core->conf->flow_export[0] ) {
+        pf = gnb_find_pf_mod_by_name("gnb_pf_flow");
+        gnb_pf_install(gnb_core->pf_array, pf);
+    }
+
     if ( GNB_PF_TYPE_CRYPTO_NONE == conf->crypto_type ) {
         goto skip_crypto;
     }
@@ -554,7 +594,9 @@ skip_crypto:
         return NULL;
     }
 
-    gnb_core->tun_payload  = (gnb_payload16_t *)gnb_core->ctl_block->core_zone->tun_payload_block;
+    gnb_speedtest_init(gnb_core);
+
+    gnb_core->tun_payload  = (gnb_payload16_t *)(gnb_core->ctl_block->core_zone->tun_payload_block + GNB_PAYLOAD_HEADROOM);
     gnb_core->inet_payload = (gnb_payload16_t *)gnb_core->ctl_block->core_zone->inet_payload_block;
 
 
@@ -623,6 +665,12 @@ gnb_core_t* gnb_core_index_service_create(gnb_conf_t *conf){
 
     init_ctl_block(gnb_core, conf);
 
+    gnb_core->tun_metrics  = &gnb_core->ctl_block->metrics_zone->slot[GNB_METRICS_SLOT_TUN];
+    gnb_core->inet_metrics = &gnb_core->ctl_block->metrics_zone->slot[GNB_METRICS_SLOT_INET];
+    gnb_core->latency_zone = gnb_core->ctl_block->latency_zone;
+    gnb_core->trace = &gnb_core->ctl_block->trace_zone->ring;
+    gnb_core->speedtest = &gnb_core->ctl_block->speedtest_zone->test;
+
     gnb_core->conf = &gnb_core->ctl_block->conf_zone->conf_st;
     memcpy(gnb_core->conf, conf, sizeof(gnb_conf_t));
 
@@ -646,7 +694,7 @@ gnb_core_t* gnb_core_index_service_create(gnb_conf_t *conf){
 
     snprintf(gnb_core->ifname,256,"%s", gnb_core->conf->ifname);
 
-    gnb_core->tun_payload  = (gnb_payload16_t *)gnb_core->ctl_block->core_zone->tun_payload_block;
+    gnb_core->tun_payload  = (gnb_payload16_t *)(gnb_core->ctl_block->core_zone->tun_payload_block + GNB_PAYLOAD_HEADROOM);
     gnb_core->inet_payload = (gnb_payload16_t *)gnb_core->ctl_block->core_zone->inet_payload_block;
 
     gnb_core->index_service_worker  = gnb_worker_init("gnb_index_service_worker",  gnb_core);
@@ -663,6 +711,8 @@ void gnb_core_release(gnb_core_t *gnb_core){
         goto PUBLIC_INDEX_RELEASE;
     }
 
+    gnb_speedtest_release(gnb_core);
+
     gnb_pf_release(gnb_core);
 
     gnb_pf_array_release(gnb_core->heap, gnb_core->pf_array);
@@ -686,6 +736,10 @@ void gnb_core_index_service_start(gnb_core_t *gnb_core){
     signal(SIGALRM,signal_handler);
 #endif
 
+    if ( gnb_core->conf->log_async ) {
+        gnb_log_async_start(gnb_core->log);
+    }
+
     GNB_LOG1(gnb_core->log,GNB_LOG_ID_CORE,"GNB Public Index Service Start.....\n");
 
     gnb_core->index_service_worker->start(gnb_core->index_service_worker);
@@ -705,8 +759,14 @@ void gnb_core_start(gnb_core_t *gnb_core){
 
 #ifdef __UNIX_LIKE_OS__
     signal(SIGALRM,signal_handler);
+    signal(SIGHUP,reload_signal_handler);
 #endif
 
+    //writer 线程要在 daemon fork 之后启动
+    if ( gnb_core->conf->log_async ) {
+        gnb_log_async_start(gnb_core->log);
+    }
+
     GNB_LOG1(gnb_core->log,GNB_LOG_ID_CORE,"Start.....\n");
 
     gnb_setup_env(gnb_core);
@@ -879,8 +939,169 @@ static void exec_es(gnb_core_t *gnb_core) {
 #endif
 
 
+//gnb_es 以 service 方式运行时退出后重新启动的间隔
+#define GNB_ES_SERVICE_RESTART_INTERVAL_SEC  10
+
+static void append_es_service_arg(void) {
+
+    static int es_service_arg_appended = 0;
+
+    if ( es_service_arg_appended ) {
+        return;
+    }
+
+    gnb_arg_append(gnb_es_arg_list, "-s");
+    gnb_arg_append(gnb_es_arg_list, "--exit-with-gnb");
+
+    es_service_arg_appended = 1;
+
+}
+
+
+#ifdef __UNIX_LIKE_OS__
+static void check_es_service(gnb_core_t *gnb_core) {
+
+    static pid_t    pid_gnb_es_service = 0;
+    static uint64_t last_exec_es_service_ts_sec = 0;
+
+    pid_t pid;
+    int ret;
+    char gnb_es_bin_path[PATH_MAX+NAME_MAX];
+    char es_arg_string[GNB_ARG_STRING_MAX_SIZE];
+
+    if ( 0 != pid_gnb_es_service ) {
+
+        pid = waitpid(pid_gnb_es_service, NULL, WNOHANG);
+
+        //还在运行
+        if ( 0 == pid ) {
+            return;
+        }
+
+        GNB_LOG3(gnb_core->log, GNB_LOG_ID_CORE, "gnb_es service pid=%d exited\n", pid_gnb_es_service);
+
+        pid_gnb_es_service = 0;
+
+    }
+
+    if ( gnb_core->ctl_block->status_zone->keep_alive_ts_sec - last_exec_es_service_ts_sec < GNB_ES_SERVICE_RESTART_INTERVAL_SEC ) {
+        return;
+    }
+
+    last_exec_es_service_ts_sec = gnb_core->ctl_block->status_zone->keep_alive_ts_sec;
+
+    snprintf(gnb_es_bin_path,   PATH_MAX+NAME_MAX, "%s/gnb_es",       gnb_core->conf->binary_dir);
+
+    if ( gnb_es_arg_list->argc < 4 ) {
+    	GNB_LOG3(gnb_core->log, GNB_LOG_ID_CORE, "gnb_es argv error, skip exec '%s'\n", gnb_es_bin_path);
+    	return;
+    }
+
+    append_es_service_arg();
+
+    ret = gnb_arg_list_to_string(gnb_es_arg_list, es_arg_string, GNB_ARG_STRING_MAX_SIZE);
+
+    if ( 0 != ret ) {
+    	GNB_LOG3(gnb_core->log, GNB_LOG_ID_CORE, "gnb_es argv error, skip exec '%s'\n", gnb_es_bin_path);
+    	return;
+    }
+
+    pid = gnb_exec(gnb_es_bin_path, gnb_core->conf->binary_dir, gnb_es_arg_list, GNB_EXEC_BACKGROUND);
+
+    if ( -1 == pid ) {
+        return;
+    }
+
+    pid_gnb_es_service = pid;
+
+    GNB_LOG3(gnb_core->log, GNB_LOG_ID_CORE, "exec gnb_es service pid=%d argv '%s'\n", pid, es_arg_string);
+
+}
+#endif
+
+
+#ifdef _WIN32
+//windows 下无法等待 gnb_es 退出，只启动一次
+static void check_es_service(gnb_core_t *gnb_core) {
+
+    static int es_service_started = 0;
+
+    int ret;
+    char gnb_es_bin_path[PATH_MAX+NAME_MAX];
+    char es_arg_string[GNB_ARG_STRING_MAX_SIZE];
+
+    if ( es_service_started ) {
+        return;
+    }
+
+    snprintf(gnb_es_bin_path,   PATH_MAX+NAME_MAX, "%s\\gnb_es.exe",      gnb_core->conf->binary_dir);
+
+    if ( gnb_es_arg_list->argc < 4 ) {
+    	GNB_LOG3(gnb_core->log, GNB_LOG_ID_CORE, "gnb_es argv error, skip exec '%s'\n", gnb_es_bin_path);
+    	es_service_started = 1;
+    	return;
+    }
+
+    append_es_service_arg();
+
+    ret = gnb_arg_list_to_string(gnb_es_arg_list, es_arg_string, GNB_ARG_STRING_MAX_SIZE);
+
+    if ( 0 != ret ) {
+    	GNB_LOG3(gnb_core->log, GNB_LOG_ID_CORE, "gnb_es argv error, skip exec '%s'\n", gnb_es_bin_path);
+    	es_service_started = 1;
+    	return;
+    }
+
+    GNB_LOG3(gnb_core->log, GNB_LOG_ID_CORE, "exec gnb_es service argv '%s'\n", es_arg_string);
+
+    gnb_exec(gnb_es_bin_path, gnb_core->conf->binary_dir, gnb_es_arg_list, GNB_EXEC_BACKGROUND);
+
+    es_service_started = 1;
+
+}
+#endif
+
+
 #define GNB_EXEC_ES_INTERVAL_TIME_SEC  (60*5)
 
+
+static void check_reload(gnb_core_t *gnb_core){
+
+    int ret;
+
+    int reload_request = gnb_core->ctl_block->status_zone->reload_request;
+
+    #ifdef __UNIX_LIKE_OS__
+    if ( reload_signal_flag ) {
+        reload_request = 1;
+    }
+    #endif
+
+    if ( reload_request ) {
+
+        ret = gnb_config_file_reload(gnb_core);
+
+        //上一次热加载还没有完成时保留请求
+        if ( 1 != ret ) {
+
+            #ifdef __UNIX_LIKE_OS__
+            reload_signal_flag = 0;
+            #endif
+
+        }
+
+        //成功时 reload_request 在换入后由 gnb_config_file_reload_finish 清零，gnb_ctl 据此判断是否出错
+        if ( -1 == ret ) {
+            gnb_core->ctl_block->status_zone->reload_request = 0;
+        }
+
+    }
+
+    gnb_config_file_reload_finish(gnb_core);
+
+}
+
+
 void primary_process_loop( gnb_core_t *gnb_core ){
 
     int ret;
@@ -908,6 +1129,15 @@ void primary_process_loop( gnb_core_t *gnb_core ){
         Sleep(1000);
         #endif
 
+        if ( 0 == gnb_core->conf->public_index_service ) {
+            check_reload(gnb_core);
+        }
+
+        if ( 0 == gnb_core->conf->public_index_service && gnb_core->conf->es_service ) {
+            check_es_service(gnb_core);
+            continue;
+        }
+
         if ( gnb_core->ctl_block->status_zone->keep_alive_ts_sec - last_exec_es_ts_sec > GNB_EXEC_ES_INTERVAL_TIME_SEC ) {
 
             if ( 0 == gnb_core->conf->public_index_service ) {
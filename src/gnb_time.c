@@ -63,6 +63,39 @@ uint64_t gnb_timestamp_usec(){
 }
 
 
+uint64_t gnb_monotonic_nsec(){
+
+#ifdef _WIN32
+
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if ( 0 == frequency.QuadPart ) {
+        QueryPerformanceFrequency(&frequency);
+    }
+
+    QueryPerformanceCounter(&counter);
+
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+
+#else
+
+    struct timespec ts;
+
+    //CLOCK_MONOTONIC_RAW 不受 ntp 调整频率的影响
+    #ifdef CLOCK_MONOTONIC_RAW
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    #else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    #endif
+
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+
+#endif
+
+}
+
+
 
 void gnb_now_timef(const char *format, char *buffer, size_t buffer_size){
 
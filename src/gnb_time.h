@@ -31,6 +31,9 @@ uint64_t gnb_timestamp_sec();
 /*微秒*/
 uint64_t gnb_timestamp_usec();
 
+/*纳秒, 单调时钟, 只用于计算时间间隔*/
+uint64_t gnb_monotonic_nsec();
+
 
 //format:"%Y_%m_%d_%H.%M.%S"
 void gnb_now_timef(const char *format, char *buffer, size_t buffer_size);
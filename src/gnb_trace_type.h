@@ -0,0 +1,138 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GNB_TRACE_TYPE_H
+#define GNB_TRACE_TYPE_H
+
+#include <stdint.h>
+
+#include "gnb_time.h"
+
+/*
+数据通路上的静态 tracepoint, 每个 tracepoint 在 enable_mask 中占一位
+关闭时每个 tracepoint 只有一次对 enable_mask 的读和一个不跳转的分支
+enable_mask 由 gnb_ctl 设置，打开的 tracepoint 把事件写入 ctl block 中的 ring
+*/
+
+//arg: src_uuid dst_uuid fwd_uuid ip_frame_size, status: GNB_TRACE_RESULT_*
+#define GNB_TRACE_PF_TUN       0
+//arg: src_uuid dst_uuid fwd_uuid ip_frame_size, status: GNB_TRACE_RESULT_*
+#define GNB_TRACE_PF_INET      1
+//arg: dst_ip(网络字节序) node_uuid, status: GNB_TRACE_ROUTE4_*
+#define GNB_TRACE_ROUTE4       2
+//作为中继节点转发, arg: src_uuid dst_uuid next_uuid ip_frame_size, status: in_ttl
+#define GNB_TRACE_RELAY        3
+//main worker 把 payload 放入 worker queue, arg: type sub_type payload_size full, status: GNB_TRACE_QUEUE_*
+#define GNB_TRACE_QUEUE_PUSH   4
+//worker 从 queue 中取出 payload, arg: type sub_type payload_size, status: GNB_TRACE_QUEUE_*
+#define GNB_TRACE_QUEUE_POP    5
+#define GNB_TRACE_NUM          6
+
+
+#define GNB_TRACE_RESULT_OUT         0
+#define GNB_TRACE_RESULT_TO_TUN      1
+#define GNB_TRACE_RESULT_DROP_FRAME  2
+#define GNB_TRACE_RESULT_DROP_ROUTE  3
+#define GNB_TRACE_RESULT_NOROUTE     4
+#define GNB_TRACE_RESULT_DROP_FWD    5
+#define GNB_TRACE_RESULT_NUM         6
+
+
+#define GNB_TRACE_ROUTE4_HOST        0
+#define GNB_TRACE_ROUTE4_SUBNETC     1
+#define GNB_TRACE_ROUTE4_SUBNETB     2
+#define GNB_TRACE_ROUTE4_SUBNETA     3
+#define GNB_TRACE_ROUTE4_MISS        4
+
+
+#define GNB_TRACE_QUEUE_NODE           0
+#define GNB_TRACE_QUEUE_INDEX          1
+#define GNB_TRACE_QUEUE_INDEX_SERVICE  2
+
+
+//必须是 2 的幂
+#define GNB_TRACE_EVENT_NUM    8192
+
+
+typedef struct _gnb_trace_event_t {
+
+	//写完后设为 下标+1, 写入过程中为 0
+	volatile uint32_t seq;
+
+	uint16_t id;
+	uint16_t status;
+
+	uint64_t ts_nsec;
+
+	uint32_t arg[4];
+
+}gnb_trace_event_t;
+
+
+/*
+多个线程共同写入，用 head 的原子加分配事件的位置，ring 满了覆盖最旧的事件
+读者自己保存读到的位置，通过事件的 seq 判断事件是否已经写完或者被覆盖
+head 是 32 位的，32 位的 mips 等平台没有 64 位的 __sync 原子操作，读者按回绕比较位置
+*/
+typedef struct _gnb_trace_ring_t {
+
+	volatile uint32_t enable_mask;
+
+	uint32_t event_num;
+
+	volatile uint32_t head;
+
+	uint32_t pad;
+
+	gnb_trace_event_t event[GNB_TRACE_EVENT_NUM];
+
+}gnb_trace_ring_t;
+
+
+#define GNB_TRACE_ON(ring,id)  __builtin_expect( ((ring)->enable_mask >> (id)) & 0x1, 0 )
+
+
+static inline void gnb_trace_emit(gnb_trace_ring_t *ring, uint16_t id, uint16_t status, uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3){
+
+    uint32_t idx;
+
+    gnb_trace_event_t *event;
+
+    idx = __sync_fetch_and_add(&ring->head, 1);
+
+    event = &ring->event[ idx & (GNB_TRACE_EVENT_NUM - 1) ];
+
+    event->seq = 0;
+
+    __sync_synchronize();
+
+    event->id      = id;
+    event->status  = status;
+    event->ts_nsec = gnb_monotonic_nsec();
+    event->arg[0]  = arg0;
+    event->arg[1]  = arg1;
+    event->arg[2]  = arg2;
+    event->arg[3]  = arg3;
+
+    __sync_synchronize();
+
+    event->seq = idx + 1;
+
+}
+
+
+#endif
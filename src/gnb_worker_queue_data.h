@@ -26,6 +26,8 @@ typedef struct _gnb_payload16_t gnb_payload16_t;
 
 typedef struct _gnb_sockaddress_t gnb_sockaddress_t;
 
+typedef struct _gnb_packet_buf_t gnb_packet_buf_t;
+
 
 typedef struct _gnb_node_worker_in_data_t {
 
@@ -33,7 +35,10 @@ typedef struct _gnb_node_worker_in_data_t {
 
 	uint8_t            socket_idx;
 
-	gnb_payload16_t    payload_st;
+	//main worker 收到的分组所在的 buffer, worker 处理完后 unref
+	gnb_packet_buf_t   *packet_buf;
+
+	gnb_payload16_t    *payload;
 
 }gnb_worker_in_data_t;
 
@@ -53,7 +58,7 @@ typedef struct _gnb_worker_queue_data_t {
 
 }gnb_worker_queue_data_t;
 
-//这个块不能太大，在嵌入设备上，这里是占用内存的大头
-#define GNB_WORKER_QUEUE_BLOCK_SIZE  720
+//queue 中只有分组的描述，分组在 main worker 的 packet pool 中
+#define GNB_WORKER_QUEUE_BLOCK_SIZE  sizeof(gnb_worker_queue_data_t)
 
 #endif
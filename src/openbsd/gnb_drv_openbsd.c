@@ -390,8 +390,7 @@ static int write_tun_openbsd(gnb_core_t *gnb_core, void *buf, size_t buf_size){
     iv[1].iov_base = buf;
     iv[1].iov_len  = buf_size;
     
-    writev(gnb_core->tun_fd, iv, 2);
-    return 0;
+    return writev(gnb_core->tun_fd, iv, 2);
 
 }
 
@@ -15,11 +15,14 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdlib.h>
+
 #include "gnb.h"
 #include "gnb_payload16.h"
 #include "gnb_hash32.h"
 #include "crypto/arc4/arc4.h"
 #include "gnb_keys.h"
+#include "gnb_route_frame_type.h"
 #include "protocol/network_protocol.h"
 
 typedef struct _gnb_pf_private_ctx_t {
@@ -29,6 +32,17 @@ typedef struct _gnb_pf_private_ctx_t {
 
 }gnb_pf_private_ctx_t;
 
+
+//热加载为新的 node 表建立的 sbox 表，换入后保存被换下的表
+typedef struct _gnb_pf_arc4_reload_t {
+
+    gnb_hash32_map_t *arc4_ctx_map;
+
+    //建立 sbox 时的 time_seed_update_factor
+    int time_seed_update_factor;
+
+}gnb_pf_arc4_reload_t;
+
 gnb_pf_t gnb_pf_crypto_arc4;
 
 static void init_arc4_keys(gnb_core_t *gnb_core){
@@ -89,6 +103,48 @@ static void init_arc4_keys(gnb_core_t *gnb_core){
 }
 
 
+/*
+ cut through 的 payload 只加解密 route frame head、relay tag 和 relay trailer，不包括最后的上一跳节点的 uuid32
+ 加密时在 route frame head 加密之前取得 ttl，解密时在 route frame head 解密之后取得 ttl
+*/
+static int crypt_cut_through(struct arc4_sbox *sbox, gnb_payload16_t *payload, int decrypt){
+
+    gnb_route_frame_head_t *route_frame_head = (gnb_route_frame_head_t *)payload->data;
+
+    uint16_t data_len = gnb_payload16_data_len(payload);
+    uint16_t trailer_size;
+
+    uint8_t ttl;
+
+    if ( data_len < sizeof(gnb_route_frame_head_t) ) {
+        return -1;
+    }
+
+    ttl = route_frame_head->ttl;
+
+    arc4_crypt(sbox, payload->data, sizeof(gnb_route_frame_head_t));
+
+    if ( decrypt ) {
+        ttl = route_frame_head->ttl;
+    }
+
+    if ( 0 == ttl || ttl > GNB_PAYLOAD_MAX_TTL ) {
+        return -1;
+    }
+
+    trailer_size = GNB_ROUTE_RELAY_TAG_SIZE + ttl*sizeof(uint32_t);
+
+    if ( data_len < sizeof(gnb_route_frame_head_t) + trailer_size ) {
+        return -1;
+    }
+
+    arc4_crypt(sbox, payload->data + data_len - trailer_size, trailer_size - sizeof(uint32_t));
+
+    return 0;
+
+}
+
+
 static void pf_init_cb(gnb_core_t *gnb_core){
 
     gnb_pf_private_ctx_t *ctx = (gnb_pf_private_ctx_t*)gnb_heap_alloc(gnb_core->heap,sizeof(gnb_pf_private_ctx_t));
@@ -152,6 +208,78 @@ static void pf_conf_cb(gnb_core_t *gnb_core) {
 }
 
 
+/*
+在 primary process 中为新的 node 表中的每个节点建立 sbox, 新的 sbox 表在单独的 heap 上
+数据通路只在换入时交换 arc4_ctx_map 指针
+*/
+static void* pf_reload_prepare_cb(gnb_core_t *gnb_core, gnb_node_t **nodes, size_t num){
+
+    gnb_pf_arc4_reload_t *reload;
+
+    gnb_heap_t *heap;
+
+    struct arc4_sbox *sbox;
+
+    size_t i;
+
+    reload = (gnb_pf_arc4_reload_t *)malloc(sizeof(gnb_pf_arc4_reload_t));
+
+    reload->time_seed_update_factor = gnb_core->time_seed_update_factor;
+
+    __sync_synchronize();
+
+    //hash map 占用 3 个 fragment, 每个节点的 kv 和 sbox 各占 1 个
+    heap = gnb_heap_create(num*2 + 8);
+
+    reload->arc4_ctx_map = gnb_hash32_create(heap, num, num);
+
+    for ( i=0; i<num; i++ ) {
+
+        sbox = gnb_heap_alloc(heap, sizeof(struct arc4_sbox));
+
+        arc4_init(sbox, nodes[i]->crypto_key, 64);
+
+        GNB_HASH32_UINT32_SET(reload->arc4_ctx_map, nodes[i]->uuid32, sbox);
+
+    }
+
+    return reload;
+
+}
+
+
+static void pf_reload_apply_cb(gnb_core_t *gnb_core, void *reload_ctx){
+
+    gnb_pf_private_ctx_t *ctx = (gnb_pf_private_ctx_t *)GNB_PF_GET_CTX(gnb_core, gnb_pf_crypto_arc4);
+
+    gnb_pf_arc4_reload_t *reload = (gnb_pf_arc4_reload_t *)reload_ctx;
+
+    gnb_hash32_map_t *map;
+
+    map = ctx->arc4_ctx_map;
+    ctx->arc4_ctx_map = reload->arc4_ctx_map;
+    reload->arc4_ctx_map = map;
+
+    //准备之后 time seed 发生了变化，下一个分组会按新的 time seed 重建 sbox
+    ctx->save_time_seed_update_factor = reload->time_seed_update_factor;
+
+}
+
+
+static void pf_reload_release_cb(gnb_core_t *gnb_core, void *reload_ctx){
+
+    gnb_pf_arc4_reload_t *reload = (gnb_pf_arc4_reload_t *)reload_ctx;
+
+    //启动时建立的 sbox 表在 gnb_core->heap 上，不单独释放
+    if ( gnb_core->heap != reload->arc4_ctx_map->heap ) {
+        gnb_heap_release(reload->arc4_ctx_map->heap);
+    }
+
+    free(reload);
+
+}
+
+
 /*
  用dst node 的key 加密 ip frmae
 */
@@ -173,6 +301,7 @@ static int pf_tun_route_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
 
     if (NULL==sbox_init){
         GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF, "gnb_pf_crypto_arc4 tun_frame node[%u] miss key\n", pf_ctx->dst_node->uuid32);
+        GNB_METRICS_INC(pf_ctx->metrics, GNB_METRIC_DROP_CRYPTO);
         return GNB_PF_ERROR;
     }
 
@@ -208,11 +337,22 @@ static int pf_tun_fwd_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
 
         if (NULL==sbox_init){
             GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF, "gnb_pf_crypto_arc4 tun_frame node[%u] miss key\n", pf_ctx->dst_node->uuid32);
+            GNB_METRICS_INC(pf_ctx->metrics, GNB_METRIC_DROP_CRYPTO);
             return GNB_PF_ERROR;
         }
 
         sbox = *sbox_init;
 
+        if ( pf_ctx->fwd_payload->sub_type & GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH ) {
+
+            if ( 0 != crypt_cut_through(&sbox, pf_ctx->fwd_payload, 0) ) {
+                return GNB_PF_ERROR;
+            }
+
+            return pf_ctx->pf_status;
+
+        }
+
         arc4_crypt(&sbox, pf_ctx->fwd_payload->data, gnb_payload16_data_len(pf_ctx->fwd_payload)-sizeof(uint32_t));
         //arc4_crypt(&sbox, pf_ctx->fwd_payload->data, gnb_core->route_frame_head_size);
 
@@ -253,11 +393,23 @@ static int pf_inet_frame_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
 
     if (NULL==sbox_init){
         GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF, "gnb_pf_crypto_arc4 pf_inet_frame_cb node[%u] miss key\n", pf_ctx->src_fwd_uuid32);
+        GNB_METRICS_INC(pf_ctx->metrics, GNB_METRIC_DROP_CRYPTO);
         return GNB_PF_ERROR;
     }
 
     sbox = *sbox_init;
 
+    //ip frame 是用源节点的密钥加密的，由目的节点在 inet_route 中解密
+    if ( pf_ctx->fwd_payload->sub_type & GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH ) {
+
+        if ( 0 != crypt_cut_through(&sbox, pf_ctx->fwd_payload, 1) ) {
+            return GNB_PF_ERROR;
+        }
+
+        goto finish;
+
+    }
+
     arc4_crypt(&sbox, pf_ctx->fwd_payload->data, gnb_payload16_data_len(pf_ctx->fwd_payload)-sizeof(uint32_t));
     //arc4_crypt(&sbox, pf_ctx->fwd_payload->data, gnb_core->route_frame_head_size);
 
@@ -282,6 +434,7 @@ static int pf_inet_route_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
 
         if (NULL==sbox_init){
             GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF, "gnb_pf_crypto_arc4 inet_route node[%u] miss key\n", pf_ctx->src_uuid32);
+            GNB_METRICS_INC(pf_ctx->metrics, GNB_METRIC_DROP_CRYPTO);
             return GNB_PF_ERROR;
         }
 
@@ -321,11 +474,22 @@ static int pf_inet_fwd_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
 
         if (NULL==sbox_init){
             GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF, "gnb_pf_crypto_arc4 pf_inet_frame_cb node[%u] miss key\n", pf_ctx->fwd_node->uuid32);
+            GNB_METRICS_INC(pf_ctx->metrics, GNB_METRIC_DROP_CRYPTO);
             return GNB_PF_ERROR;
         }
 
         sbox = *sbox_init;
 
+        if ( pf_ctx->fwd_payload->sub_type & GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH ) {
+
+            if ( 0 != crypt_cut_through(&sbox, pf_ctx->fwd_payload, 0) ) {
+                return GNB_PF_ERROR;
+            }
+
+            goto finish;
+
+        }
+
         arc4_crypt(&sbox, pf_ctx->fwd_payload->data, gnb_payload16_data_len(pf_ctx->fwd_payload)-sizeof(uint32_t));
         //arc4_crypt(&sbox, pf_ctx->fwd_payload->data, gnb_core->route_frame_head_size);
 
@@ -360,5 +524,9 @@ gnb_pf_t gnb_pf_crypto_arc4 = {
     pf_inet_frame_cb,
     pf_inet_route_cb,
     pf_inet_fwd_cb,
-    pf_release_cb
+    pf_release_cb,
+    NULL,
+    pf_reload_prepare_cb,
+    pf_reload_apply_cb,
+    pf_reload_release_cb
 };
@@ -17,6 +17,7 @@
 
 #include "gnb.h"
 #include "gnb_payload16.h"
+#include "gnb_route_frame_type.h"
 #include "protocol/network_protocol.h"
 
 typedef struct _gnb_pf_private_ctx_t {
@@ -29,6 +30,74 @@ typedef struct _gnb_pf_private_ctx_t {
 gnb_pf_t gnb_pf_crypto_xor;
 
 
+/*
+ cut through 的 payload 只加解密 route frame head、relay tag 和 relay trailer，不包括最后的上一跳节点的 uuid32
+ 加密时在 route frame head 加密之前取得 ttl，解密时在 route frame head 解密之后取得 ttl
+*/
+static int crypt_cut_through(unsigned char *crypto_key, gnb_payload16_t *payload, int decrypt){
+
+    gnb_route_frame_head_t *route_frame_head = (gnb_route_frame_head_t *)payload->data;
+
+    uint16_t data_len = gnb_payload16_data_len(payload);
+    uint16_t trailer_size;
+
+    uint8_t ttl;
+
+    int i;
+    int j = 0;
+
+    unsigned char *p;
+
+    if ( data_len < sizeof(gnb_route_frame_head_t) ) {
+        return -1;
+    }
+
+    ttl = route_frame_head->ttl;
+
+    p = (unsigned char *)payload->data;
+
+    for ( i=0; i<sizeof(gnb_route_frame_head_t); i++ ){
+        *p = *p ^ crypto_key[j];
+        p++;
+        j++;
+    }
+
+    if ( decrypt ) {
+        ttl = route_frame_head->ttl;
+    }
+
+    if ( 0 == ttl || ttl > GNB_PAYLOAD_MAX_TTL ) {
+        return -1;
+    }
+
+    trailer_size = GNB_ROUTE_RELAY_TAG_SIZE + ttl*sizeof(uint32_t);
+
+    if ( data_len < sizeof(gnb_route_frame_head_t) + trailer_size ) {
+        return -1;
+    }
+
+    //接着 route frame head 使用密钥
+    p = (unsigned char *)payload->data + data_len - trailer_size;
+
+    for ( i=0; i < trailer_size - sizeof(uint32_t); i++ ){
+
+        *p = *p ^ crypto_key[j];
+
+        p++;
+
+        j++;
+
+        if (j>=64){
+            j = 0;
+        }
+
+    }
+
+    return 0;
+
+}
+
+
 static void pf_init_cb(gnb_core_t *gnb_core){
 
     gnb_pf_private_ctx_t *ctx = (gnb_pf_private_ctx_t*)gnb_heap_alloc(gnb_core->heap,sizeof(gnb_pf_private_ctx_t));
@@ -100,6 +169,16 @@ static int pf_tun_fwd_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
 
     if (GNB_PF_FWD_INET==pf_ctx->pf_fwd) {
 
+        if ( pf_ctx->fwd_payload->sub_type & GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH ) {
+
+            if ( 0 != crypt_cut_through(pf_ctx->fwd_node->crypto_key, pf_ctx->fwd_payload, 0) ) {
+                return GNB_PF_ERROR;
+            }
+
+            goto finish;
+
+        }
+
         p = (unsigned char *)pf_ctx->fwd_payload->data;
 
         //for ( i=0; i < gnb_core->route_frame_head_size; i++ ){
@@ -164,6 +243,17 @@ static int pf_inet_frame_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
 
     unsigned char *p;
 
+    //ip frame 是用源节点的密钥加密的，由目的节点在 inet_route 中解密
+    if ( pf_ctx->fwd_payload->sub_type & GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH ) {
+
+        if ( 0 != crypt_cut_through(pf_ctx->src_fwd_node->crypto_key, pf_ctx->fwd_payload, 1) ) {
+            return GNB_PF_ERROR;
+        }
+
+        goto finish;
+
+    }
+
     p = (unsigned char *)pf_ctx->fwd_payload->data;
 
     //for ( i=0; i<gnb_core->route_frame_head_size; i++ ){
@@ -251,6 +341,16 @@ static int pf_inet_fwd_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
             goto finish;
         }
 
+        if ( pf_ctx->fwd_payload->sub_type & GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH ) {
+
+            if ( 0 != crypt_cut_through(pf_ctx->fwd_node->crypto_key, pf_ctx->fwd_payload, 0) ) {
+                return GNB_PF_ERROR;
+            }
+
+            goto finish;
+
+        }
+
         p = (unsigned char *)pf_ctx->fwd_payload->data;
 
         //for ( i=0; i < gnb_core->route_frame_head_size; i++ ){
@@ -295,5 +395,9 @@ gnb_pf_t gnb_pf_crypto_xor = {
     pf_inet_frame_cb,
     pf_inet_route_cb,
     pf_inet_fwd_cb,
-    pf_release_cb
+    pf_release_cb,
+    NULL,
+    NULL,
+    NULL,
+    NULL
 };
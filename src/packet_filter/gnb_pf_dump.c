@@ -15,9 +15,15 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdio.h>
+#include <string.h>
+
 #include "gnb.h"
 #include "gnb_pf.h"
 #include "gnb_payload16.h"
+#include "gnb_mmap.h"
+#include "gnb_time.h"
+#include "gnb_pcap_type.h"
 #include "protocol/network_protocol.h"
 
 #ifdef __UNIX_LIKE_OS__
@@ -42,8 +48,383 @@
 
 gnb_pf_t gnb_pf_dump;
 
+gnb_node_t* gnb_query_route4(gnb_core_t *gnb_core, uint32_t dst_ip_int);
+
+
+#define GNB_PCAP_FILTER_MAX  16
+
+
+typedef struct _gnb_pf_dump_ctx_t {
+
+    gnb_mmap_block_t *mmap_block;
+
+    //为 NULL 时没有打开抓包，按 if_dump 输出文本日志
+    gnb_pcap_ring_head_t *ring_head;
+
+    unsigned char *ring_data;
+
+    uint32_t snaplen;
+
+    uint32_t sample;
+    uint32_t sample_counter;
+
+    //同类的条件之间是或，node 和协议之间是与
+    int filter_node_num;
+    uint32_t filter_node[GNB_PCAP_FILTER_MAX];
+
+    int filter_proto_num;
+    uint8_t filter_proto[GNB_PCAP_FILTER_MAX];
+
+}gnb_pf_dump_ctx_t;
+
+
+static const struct {
+    const char *name;
+    uint8_t proto;
+} pcap_proto_names[] = {
+    { "icmp",  1  },
+    { "tcp",   6  },
+    { "udp",   17 },
+    { "gre",   47 },
+    { "esp",   50 },
+    { "icmp6", 58 },
+    { NULL,    0  }
+};
+
+
+/*
+filter 是空格分隔的条件: node <uuid>  proto <number>  tcp udp icmp icmp6 gre esp
+*/
+static int pcap_parse_filter(gnb_pf_dump_ctx_t *ctx, const char *filter){
+
+    char buffer[256];
+
+    char *token;
+
+    int i;
+
+    snprintf(buffer, sizeof(buffer), "%s", filter);
+
+    for ( token = strtok(buffer, " "); NULL != token; token = strtok(NULL, " ") ) {
+
+        if ( 0 == strcmp(token, "node") || 0 == strcmp(token, "proto") ) {
+
+            char *value = strtok(NULL, " ");
+
+            if ( NULL == value ) {
+                return -1;
+            }
+
+            if ( 'n' == token[0] ) {
+
+                if ( ctx->filter_node_num >= GNB_PCAP_FILTER_MAX ) {
+                    return -1;
+                }
+
+                ctx->filter_node[ctx->filter_node_num++] = (uint32_t)strtoul(value, NULL, 10);
+
+            } else {
+
+                if ( ctx->filter_proto_num >= GNB_PCAP_FILTER_MAX ) {
+                    return -1;
+                }
+
+                ctx->filter_proto[ctx->filter_proto_num++] = (uint8_t)strtoul(value, NULL, 10);
+
+            }
+
+            continue;
+
+        }
+
+        for ( i=0; NULL != pcap_proto_names[i].name; i++ ) {
+            if ( 0 == strcmp(token, pcap_proto_names[i].name) ) {
+                break;
+            }
+        }
+
+        if ( NULL == pcap_proto_names[i].name || ctx->filter_proto_num >= GNB_PCAP_FILTER_MAX ) {
+            return -1;
+        }
+
+        ctx->filter_proto[ctx->filter_proto_num++] = pcap_proto_names[i].proto;
+
+    }
+
+    return 0;
+
+}
+
+
+static void pcap_ring_init(gnb_core_t *gnb_core, gnb_pf_dump_ctx_t *ctx){
+
+    size_t block_size;
+
+    uint32_t data_size;
+
+    void *memory;
+
+    if ( 0 != pcap_parse_filter(ctx, gnb_core->conf->pcap_filter) ) {
+        GNB_ERROR1(gnb_core->log, GNB_LOG_ID_PF, "pcap filter '%s' error, capture disabled\n", gnb_core->conf->pcap_filter);
+        return;
+    }
+
+    if ( 0 == gnb_core->conf->pcap_size_mb ) {
+        gnb_core->conf->pcap_size_mb = 1;
+    }
+
+    if ( gnb_core->conf->pcap_size_mb > GNB_PCAP_MAX_DATA_SIZE / (1024*1024) ) {
+        gnb_core->conf->pcap_size_mb = GNB_PCAP_MAX_DATA_SIZE / (1024*1024);
+    }
+
+    //数据区取不超过 pcap_size_mb 的 2 的幂
+    data_size = 1024*1024;
+
+    while ( (uint64_t)data_size * 2 <= (uint64_t)gnb_core->conf->pcap_size_mb * 1024 * 1024 ) {
+        data_size *= 2;
+    }
+
+    gnb_core->conf->pcap_size_mb = data_size / (1024*1024);
+
+    block_size = (size_t)data_size + GNB_PCAP_RING_HEAD_SIZE;
+
+    unlink(gnb_core->conf->pcap_file);
+
+    ctx->mmap_block = gnb_mmap_create(gnb_core->conf->pcap_file, block_size, GNB_MMAP_TYPE_READWRITE|GNB_MMAP_TYPE_CREATE);
+
+    if ( NULL == ctx->mmap_block ) {
+        GNB_ERROR1(gnb_core->log, GNB_LOG_ID_PF, "pcap file '%s' create error, capture disabled\n", gnb_core->conf->pcap_file);
+        return;
+    }
+
+    memory = gnb_mmap_get_block(ctx->mmap_block);
+
+    ctx->snaplen = gnb_core->conf->pcap_snaplen;
+
+    if ( 0 == ctx->snaplen || ctx->snaplen > GNB_PCAP_MAX_SNAPLEN ) {
+        ctx->snaplen = GNB_PCAP_MAX_SNAPLEN;
+    }
+
+    ctx->sample = gnb_core->conf->pcap_sample > 0 ? gnb_core->conf->pcap_sample : 1;
+
+    ctx->ring_data = (unsigned char *)memory + GNB_PCAP_RING_HEAD_SIZE;
+
+    ctx->ring_head = (gnb_pcap_ring_head_t *)memory;
+    ctx->ring_head->version    = GNB_PCAP_RING_VERSION;
+    ctx->ring_head->snaplen    = ctx->snaplen;
+    ctx->ring_head->local_uuid = gnb_core->local_node->uuid32;
+    ctx->ring_head->data_size  = data_size;
+
+    __sync_synchronize();
+
+    //最后写入 magic, gnb_ctl 据此判断 ring 已经初始化完成
+    memcpy(ctx->ring_head->magic, GNB_PCAP_RING_MAGIC, sizeof(GNB_PCAP_RING_MAGIC));
+
+    GNB_LOG1(gnb_core->log, GNB_LOG_ID_PF, "pcap capture to '%s' size %uMB snaplen %u sample 1/%u filter '%s'\n",
+             gnb_core->conf->pcap_file, gnb_core->conf->pcap_size_mb, ctx->snaplen, ctx->sample, gnb_core->conf->pcap_filter);
+
+}
+
+
+static int pcap_filter_match(gnb_pf_dump_ctx_t *ctx, void *ip_frame, ssize_t ip_frame_size, uint32_t src_uuid32, uint32_t dst_uuid32){
+
+    struct iphdr   *ip_frame_head  = (struct iphdr  *)ip_frame;
+    struct ip6_hdr *ip6_frame_head = (struct ip6_hdr*)ip_frame;
+
+    uint8_t proto;
+
+    int i;
+
+    if ( ctx->filter_node_num > 0 ) {
+
+        for ( i=0; i<ctx->filter_node_num; i++ ) {
+            if ( src_uuid32 == ctx->filter_node[i] || dst_uuid32 == ctx->filter_node[i] ) {
+                break;
+            }
+        }
+
+        if ( i == ctx->filter_node_num ) {
+            return 0;
+        }
+
+    }
+
+    if ( 0 == ctx->filter_proto_num ) {
+        return 1;
+    }
+
+    if ( 0x4 == ip_frame_head->version && ip_frame_size >= (ssize_t)sizeof(struct iphdr) ) {
+        proto = ip_frame_head->protocol;
+    } else if ( 0x6 == ip_frame_head->version && ip_frame_size >= (ssize_t)sizeof(struct ip6_hdr) ) {
+        proto = ip6_frame_head->ip6_ctlun.ip6_un1.ip6_un1_nxt;
+    } else {
+        return 0;
+    }
+
+    for ( i=0; i<ctx->filter_proto_num; i++ ) {
+        if ( proto == ctx->filter_proto[i] ) {
+            return 1;
+        }
+    }
+
+    return 0;
+
+}
+
+
+static inline unsigned char* pcap_put32(unsigned char *p, uint32_t v){
+    memcpy(p, &v, sizeof(uint32_t));
+    return p + sizeof(uint32_t);
+}
+
+
+/*
+在 ring 中分配一个不跨越数据区末尾的记录，末尾放不下时先用 pad 记录填满
+多个线程可能同时写入, 用 cas 分配
+*/
+static gnb_pcap_record_head_t* pcap_ring_alloc(gnb_pf_dump_ctx_t *ctx, uint32_t record_size, uint32_t *pos_ptr){
+
+    gnb_pcap_record_head_t *pad;
+
+    uint32_t data_size = ctx->ring_head->data_size;
+    uint32_t pos;
+    uint32_t off;
+    uint32_t need;
+
+    do {
+
+        pos  = ctx->ring_head->head;
+        off  = pos & (data_size - 1);
+        need = record_size;
+
+        if ( off + record_size > data_size ) {
+            need += data_size - off;
+        }
+
+    } while ( !__sync_bool_compare_and_swap(&ctx->ring_head->head, pos, pos + need) );
+
+    if ( need != record_size ) {
+
+        pad = (gnb_pcap_record_head_t *)(ctx->ring_data + off);
+        pad->commit = 0;
+        __sync_synchronize();
+        pad->size = data_size - off;
+        pad->type = GNB_PCAP_RECORD_TYPE_PAD;
+        __sync_synchronize();
+        pad->commit = pos + 1;
+
+        pos += data_size - off;
+        off  = 0;
+
+    }
+
+    *pos_ptr = pos;
+
+    return (gnb_pcap_record_head_t *)(ctx->ring_data + off);
+
+}
+
+
+static void pcap_capture(gnb_core_t *gnb_core, gnb_pf_dump_ctx_t *ctx, void *ip_frame, ssize_t ip_frame_size,
+                         uint32_t epb_flags, const char *direction, const char *stage, uint32_t src_uuid32, uint32_t dst_uuid32){
+
+    gnb_pcap_record_head_t *record;
+
+    unsigned char *p;
+
+    char comment[96];
+    int  comment_len;
+
+    uint32_t cap_len;
+    uint32_t epb_size;
+    uint32_t record_size;
+
+    uint32_t pos;
+
+    uint64_t ts_usec;
+
+    if ( ip_frame_size <= 0 ) {
+        return;
+    }
+
+    if ( !pcap_filter_match(ctx, ip_frame, ip_frame_size, src_uuid32, dst_uuid32) ) {
+        return;
+    }
+
+    if ( ctx->sample > 1 && 0 != (ctx->sample_counter++ % ctx->sample) ) {
+        return;
+    }
+
+    ts_usec = gnb_timestamp_usec();
+
+    cap_len = (uint32_t)ip_frame_size < ctx->snaplen ? (uint32_t)ip_frame_size : ctx->snaplen;
+
+    comment_len = snprintf(comment, sizeof(comment), "%s src=%u dst=%u stage=%s", direction, src_uuid32, dst_uuid32, stage);
+
+    if ( comment_len < 0 || comment_len >= (int)sizeof(comment) ) {
+        comment_len = sizeof(comment) - 1;
+    }
+
+    //block 头 8 + interface id 4 + 时间戳 8 + 长度 8 + 数据 + comment + flags + end of opt 4 + block 尾 4
+    epb_size = 28 + GNB_PCAP_ALIGN4(cap_len) + 4 + GNB_PCAP_ALIGN4(comment_len) + 8 + 4 + 4;
+
+    record_size = GNB_PCAP_ALIGN16(sizeof(gnb_pcap_record_head_t) + epb_size);
+
+    record = pcap_ring_alloc(ctx, record_size, &pos);
+
+    record->commit = 0;
+
+    __sync_synchronize();
+
+    record->size = record_size;
+    record->type = GNB_PCAP_RECORD_TYPE_EPB;
+
+    p = (unsigned char *)record + sizeof(gnb_pcap_record_head_t);
+
+    p = pcap_put32(p, PCAPNG_BLOCK_TYPE_EPB);
+    p = pcap_put32(p, epb_size);
+    p = pcap_put32(p, 0);
+    p = pcap_put32(p, (uint32_t)(ts_usec >> 32));
+    p = pcap_put32(p, (uint32_t)ts_usec);
+    p = pcap_put32(p, cap_len);
+    p = pcap_put32(p, (uint32_t)ip_frame_size);
+
+    memcpy(p, ip_frame, cap_len);
+    memset(p + cap_len, 0, GNB_PCAP_ALIGN4(cap_len) - cap_len);
+    p += GNB_PCAP_ALIGN4(cap_len);
+
+    p = pcap_put32(p, PCAPNG_OPT_COMMENT | ((uint32_t)comment_len << 16));
+    memcpy(p, comment, comment_len);
+    memset(p + comment_len, 0, GNB_PCAP_ALIGN4(comment_len) - comment_len);
+    p += GNB_PCAP_ALIGN4(comment_len);
+
+    p = pcap_put32(p, PCAPNG_OPT_EPB_FLAGS | (4 << 16));
+    p = pcap_put32(p, epb_flags);
+
+    p = pcap_put32(p, PCAPNG_OPT_ENDOFOPT);
+    p = pcap_put32(p, epb_size);
+
+    __sync_synchronize();
+
+    record->commit = pos + 1;
+
+    __sync_fetch_and_add(&ctx->ring_head->records, 1);
+
+}
+
+
 static void pf_init_cb(gnb_core_t *gnb_core){
 
+    gnb_pf_dump_ctx_t *ctx = (gnb_pf_dump_ctx_t *)gnb_heap_alloc(gnb_core->heap, sizeof(gnb_pf_dump_ctx_t));
+
+    memset(ctx, 0, sizeof(gnb_pf_dump_ctx_t));
+
+    GNB_PF_SET_CTX(gnb_core, gnb_pf_dump, ctx);
+
+    if ( '\0' != gnb_core->conf->pcap_file[0] ) {
+        pcap_ring_init(gnb_core, ctx);
+    }
+
 }
 
 static void pf_conf_cb(gnb_core_t *gnb_core){
@@ -62,8 +443,37 @@ static int pf_tun_frame_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
     struct iphdr   *ip_frame_head  = (struct iphdr*  )(pf_ctx->fwd_payload->data + gnb_core->tun_payload_offset);
     struct ip6_hdr *ip6_frame_head = (struct ip6_hdr*)(pf_ctx->fwd_payload->data + gnb_core->tun_payload_offset);
 
+    gnb_pf_dump_ctx_t *ctx = (gnb_pf_dump_ctx_t *)GNB_PF_GET_CTX(gnb_core, gnb_pf_dump);
+
+    gnb_node_t *dst_node;
+    uint32_t dst_ip_key;
+
     static uint64_t seq = 0;
 
+    if ( NULL != ctx->ring_head ) {
+
+        if ( 0x4 == ip_frame_head->version ) {
+            dst_ip_key = *((uint32_t *)&ip_frame_head->daddr);
+        } else if ( 0x6 == ip_frame_head->version ) {
+            dst_ip_key = ip6_frame_head->ip6_dst.__in6_u.__u6_addr32[3];
+        } else {
+            return pf_ctx->pf_status;
+        }
+
+        //这时 gnb_pf_route 还没有处理，用同样的方法查出目的节点
+        dst_node = gnb_query_route4(gnb_core, dst_ip_key);
+
+        pcap_capture(gnb_core, ctx, ip_frame_head, (ssize_t)gnb_payload16_data_len(pf_ctx->fwd_payload) - (ssize_t)gnb_core->tun_payload_offset,
+                     PCAPNG_EPB_FLAGS_OUTBOUND, "out", "tun_frame", gnb_core->local_node->uuid32, NULL != dst_node ? dst_node->uuid32 : 0);
+
+        return pf_ctx->pf_status;
+
+    }
+
+    if ( 1 != gnb_core->conf->if_dump ){
+        return pf_ctx->pf_status;
+    }
+
     seq++;
 
     if ( 0x4 != ip_frame_head->version && 0x6 != ip_frame_head->version ){
@@ -141,8 +551,27 @@ static int pf_inet_fwd_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
     struct iphdr   *ip_frame_head  = (struct iphdr  *)pf_ctx->ip_frame;
     struct ip6_hdr *ip6_frame_head = (struct ip6_hdr*)pf_ctx->ip_frame;
 
+    gnb_pf_dump_ctx_t *ctx = (gnb_pf_dump_ctx_t *)GNB_PF_GET_CTX(gnb_core, gnb_pf_dump);
+
     static uint64_t seq = 0;
 
+    if ( NULL != ctx->ring_head ) {
+
+        if ( gnb_core->local_node->uuid32 == pf_ctx->dst_uuid32 ) {
+            pcap_capture(gnb_core, ctx, pf_ctx->ip_frame, pf_ctx->ip_frame_size, PCAPNG_EPB_FLAGS_INBOUND, "in", "inet_fwd", pf_ctx->src_uuid32, pf_ctx->dst_uuid32);
+        } else {
+            //中继的分组，ip_frame 是加密后的数据
+            pcap_capture(gnb_core, ctx, pf_ctx->ip_frame, pf_ctx->ip_frame_size, 0, "relay", "inet_fwd", pf_ctx->src_uuid32, pf_ctx->dst_uuid32);
+        }
+
+        return pf_ctx->pf_status;
+
+    }
+
+    if ( 1 != gnb_core->conf->if_dump ){
+        return pf_ctx->pf_status;
+    }
+
     seq++;
 
     if ( gnb_core->local_node->uuid32 != pf_ctx->dst_uuid32 ){
@@ -188,6 +617,13 @@ static int pf_inet_fwd_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
 
 static void pf_release_cb(gnb_core_t *gnb_core){
 
+    gnb_pf_dump_ctx_t *ctx = (gnb_pf_dump_ctx_t *)GNB_PF_GET_CTX(gnb_core, gnb_pf_dump);
+
+    if ( NULL != ctx->mmap_block ) {
+        gnb_mmap_release(ctx->mmap_block);
+        ctx->mmap_block = NULL;
+        ctx->ring_head  = NULL;
+    }
 
 }
 
@@ -202,7 +638,11 @@ gnb_pf_t gnb_pf_dump = {
     pf_inet_frame_cb,
     pf_inet_route_cb,
     pf_inet_fwd_cb,
-    pf_release_cb
+    pf_release_cb,
+    NULL,
+    NULL,
+    NULL,
+    NULL
 };
 
 
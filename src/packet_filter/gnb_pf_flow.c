@@ -0,0 +1,1049 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "gnb.h"
+#include "gnb_pf.h"
+#include "gnb_time.h"
+#include "gnb_ring_buffer.h"
+
+#ifdef __UNIX_LIKE_OS__
+
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#endif
+
+
+#ifdef _WIN32
+
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#endif
+
+/*
+按 flow 聚合经过本节点的分组，以 IPFIX(RFC 7011) 格式输出到 collector 或者文件
+out:   从 tun 读入发往其他节点的分组，在 tun_route 中统计，这时已经确定了下一跳，ip 分组还没有加密
+in:    发往本节点 tun 的分组，在 inet_fwd 中统计，这时 ip 分组已经解密
+relay: 作为中继转发的分组，在 inet_fwd 中统计，ip 分组是加密的，只按源和目的节点聚合
+
+数据通路上只把 flow 记录写进 IPFIX message, 写满的 message 放入 export_queue,
+由 exporter 线程写文件或发给 collector, 队列满时丢弃 message, collector 可以从 sequence 看出丢失
+*/
+
+gnb_pf_t gnb_pf_flow;
+
+uint32_t murmurhash_hash(unsigned char *data, size_t len);
+
+
+#define GNB_FLOW_TYPE_OUT    0
+#define GNB_FLOW_TYPE_IN     1
+#define GNB_FLOW_TYPE_RELAY  2
+
+//一个 flow 在表中最多探测的位置，都被占用时提前输出其中最旧的 flow
+#define GNB_FLOW_PROBE_NUM   8
+
+#define GNB_FLOW_TABLE_MIN   64
+
+//每次 timer 最多扫描的 flow 数，持有锁的时间不随 flow 表的大小增长
+#define GNB_FLOW_SCAN_MAX    4096
+//扫描完整个 flow 表的周期
+#define GNB_FLOW_SCAN_PERIOD_MSEC  1000
+
+#define GNB_FLOW_EXPORT_QUEUE_NUM  256
+
+//exporter 线程没有 message 可输出时的休眠时间
+#define GNB_FLOW_EXPORTER_IDLE_MS  10
+
+
+#define IPFIX_VERSION               10
+#define IPFIX_MESSAGE_HEAD_SIZE     16
+#define IPFIX_SET_HEAD_SIZE         4
+#define IPFIX_SET_ID_TEMPLATE       2
+
+#define IPFIX_TEMPLATE_ID_IPV4      256
+#define IPFIX_TEMPLATE_ID_IPV6      257
+
+//不超过常见的 path mtu，发给 collector 时不会分片
+#define IPFIX_MESSAGE_MAX           1400
+
+//udp 传输的 collector 可能重启，定时重发 template
+#define IPFIX_TEMPLATE_REFRESH_SEC  30
+
+#define IPFIX_END_REASON_IDLE       1
+#define IPFIX_END_REASON_ACTIVE     2
+#define IPFIX_END_REASON_FORCED     4
+#define IPFIX_END_REASON_RESOURCES  5
+
+//RFC 5612 中用于文档和示例的 Private Enterprise Number
+#define GNB_IPFIX_PEN               32473
+
+#define GNB_IPFIX_IE_FLOW_TYPE      1
+#define GNB_IPFIX_IE_SRC_NODE       2
+#define GNB_IPFIX_IE_DST_NODE       3
+#define GNB_IPFIX_IE_NEXT_HOP_NODE  4
+#define GNB_IPFIX_IE_RELAY_PATH     5
+
+
+typedef struct _gnb_ipfix_field_t {
+
+    uint16_t id;
+
+    //ipv6 模板中使用的 IE, 为 0 时和 id 相同
+    uint16_t id6;
+
+    uint16_t length;
+    uint32_t pen;
+
+}gnb_ipfix_field_t;
+
+
+//length 为 0 的字段按 ip 版本取 4 或 16, 写记录的顺序必须和这里一致
+static const gnb_ipfix_field_t ipfix_fields[] = {
+    {   8,  27, 0,  0 },    //sourceIPv4Address / sourceIPv6Address
+    {  12,  28, 0,  0 },    //destinationIPv4Address / destinationIPv6Address
+    {   7,   0, 2,  0 },    //sourceTransportPort
+    {  11,   0, 2,  0 },    //destinationTransportPort
+    {   4,   0, 1,  0 },    //protocolIdentifier
+    {  61,   0, 1,  0 },    //flowDirection
+    { 136,   0, 1,  0 },    //flowEndReason
+    {   1,   0, 8,  0 },    //octetDeltaCount
+    {   2,   0, 8,  0 },    //packetDeltaCount
+    { 152,   0, 8,  0 },    //flowStartMilliseconds
+    { 153,   0, 8,  0 },    //flowEndMilliseconds
+    { GNB_IPFIX_IE_FLOW_TYPE,     0, 1,                    GNB_IPFIX_PEN },
+    { GNB_IPFIX_IE_SRC_NODE,      0, 4,                    GNB_IPFIX_PEN },
+    { GNB_IPFIX_IE_DST_NODE,      0, 4,                    GNB_IPFIX_PEN },
+    { GNB_IPFIX_IE_NEXT_HOP_NODE, 0, 4,                    GNB_IPFIX_PEN },
+    { GNB_IPFIX_IE_RELAY_PATH,    0, 4*GNB_MAX_NODE_RELAY, GNB_IPFIX_PEN },
+};
+
+#define IPFIX_FIELD_NUM  ( sizeof(ipfix_fields) / sizeof(gnb_ipfix_field_t) )
+
+#define IPFIX_RECORD_SIZE(addr_len)  ( 2*(addr_len) + 2 + 2 + 1 + 1 + 1 + 8*4 + 1 + 4*3 + 4*GNB_MAX_NODE_RELAY )
+
+
+typedef struct _gnb_flow_key_t {
+
+    uint8_t  type;
+    uint8_t  ip_version;
+    uint8_t  protocol;
+    uint8_t  reserved;
+
+    uint16_t src_port;
+    uint16_t dst_port;
+
+    uint32_t src_uuid32;
+    uint32_t dst_uuid32;
+
+    unsigned char src_addr[16];
+    unsigned char dst_addr[16];
+
+}gnb_flow_key_t;
+
+
+typedef struct _gnb_flow_t {
+
+    gnb_flow_key_t key;
+
+    uint8_t used;
+
+    uint8_t relay_num;
+
+    //out relay 是发往的下一跳节点，in 是分组来自的上一跳节点
+    uint32_t next_uuid32;
+
+    //按经过的顺序排列的中继节点
+    uint32_t relay_path[GNB_MAX_NODE_RELAY];
+
+    uint64_t bytes;
+    uint64_t packets;
+
+    uint64_t first_msec;
+    uint64_t last_msec;
+
+}gnb_flow_t;
+
+
+typedef struct _gnb_pf_flow_ctx_t {
+
+    //为 NULL 时没有打开 flow 统计
+    gnb_flow_t *table;
+
+    uint32_t table_mask;
+
+    //Windows 下 tun 和 udp 在不同的线程处理
+    volatile int lock;
+
+    uint64_t idle_msec;
+    uint64_t active_msec;
+
+    //下一次 timer 开始扫描的位置
+    uint32_t scan_idx;
+
+    uint64_t last_scan_msec;
+
+    uint64_t last_flush_sec;
+
+    gnb_ring_buffer_t *export_queue;
+
+    pthread_t thread_exporter;
+
+    volatile int exporter_running;
+
+    FILE *fp;
+
+    int socket;
+    struct sockaddr_storage collector;
+    socklen_t collector_len;
+
+    unsigned char template_set[IPFIX_SET_HEAD_SIZE + 2 * (4 + IPFIX_FIELD_NUM * 8)];
+    size_t template_set_len;
+
+    uint64_t last_template_sec;
+
+    unsigned char msg[IPFIX_MESSAGE_MAX];
+    size_t msg_len;
+
+    //当前 data set 在 msg 中的位置，0 表示还没有打开 data set
+    size_t set_offset;
+    uint16_t set_template_id;
+
+    uint32_t msg_records;
+
+    //已经输出的 data record 数
+    uint32_t sequence;
+
+    uint64_t export_flows;
+    uint64_t evict_flows;
+    uint64_t drop_msgs;
+
+}gnb_pf_flow_ctx_t;
+
+
+static inline unsigned char* ipfix_put16(unsigned char *p, uint16_t v){
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+    return p + 2;
+}
+
+static inline unsigned char* ipfix_put32(unsigned char *p, uint32_t v){
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+    return p + 4;
+}
+
+static inline unsigned char* ipfix_put64(unsigned char *p, uint64_t v){
+    p = ipfix_put32(p, (uint32_t)(v >> 32));
+    return ipfix_put32(p, (uint32_t)v);
+}
+
+
+static inline void flow_lock(gnb_pf_flow_ctx_t *ctx){
+    while ( __sync_lock_test_and_set(&ctx->lock, 1) ) {
+    }
+}
+
+static inline void flow_unlock(gnb_pf_flow_ctx_t *ctx){
+    __sync_lock_release(&ctx->lock);
+}
+
+
+static size_t ipfix_build_template(unsigned char *buffer, uint16_t template_id, int addr_len){
+
+    unsigned char *p = buffer;
+
+    int i;
+
+    p = ipfix_put16(p, template_id);
+    p = ipfix_put16(p, IPFIX_FIELD_NUM);
+
+    for ( i=0; i<IPFIX_FIELD_NUM; i++ ) {
+
+        if ( 0 == ipfix_fields[i].length ) {
+            p = ipfix_put16(p, 16 == addr_len ? ipfix_fields[i].id6 : ipfix_fields[i].id);
+            p = ipfix_put16(p, addr_len);
+            continue;
+        }
+
+        if ( 0 != ipfix_fields[i].pen ) {
+            p = ipfix_put16(p, 0x8000 | ipfix_fields[i].id);
+            p = ipfix_put16(p, ipfix_fields[i].length);
+            p = ipfix_put32(p, ipfix_fields[i].pen);
+        } else {
+            p = ipfix_put16(p, ipfix_fields[i].id);
+            p = ipfix_put16(p, ipfix_fields[i].length);
+        }
+
+    }
+
+    return p - buffer;
+
+}
+
+
+static void ipfix_init_template(gnb_pf_flow_ctx_t *ctx){
+
+    size_t len = IPFIX_SET_HEAD_SIZE;
+
+    len += ipfix_build_template(ctx->template_set + len, IPFIX_TEMPLATE_ID_IPV4, 4);
+    len += ipfix_build_template(ctx->template_set + len, IPFIX_TEMPLATE_ID_IPV6, 16);
+
+    ipfix_put16(ctx->template_set, IPFIX_SET_ID_TEMPLATE);
+    ipfix_put16(ctx->template_set + 2, (uint16_t)len);
+
+    ctx->template_set_len = len;
+
+}
+
+
+static void ipfix_close_set(gnb_pf_flow_ctx_t *ctx){
+
+    if ( 0 == ctx->set_offset ) {
+        return;
+    }
+
+    ipfix_put16(ctx->msg + ctx->set_offset + 2, (uint16_t)(ctx->msg_len - ctx->set_offset));
+
+    ctx->set_offset = 0;
+    ctx->set_template_id = 0;
+
+}
+
+
+static void ipfix_output(gnb_core_t *gnb_core, gnb_pf_flow_ctx_t *ctx, void *msg, size_t msg_len){
+
+    ssize_t ret;
+
+    if ( NULL != ctx->fp ) {
+        fwrite(msg, msg_len, 1, ctx->fp);
+        fflush(ctx->fp);
+        return;
+    }
+
+    ret = sendto(ctx->socket, (const char *)msg, msg_len, 0, (struct sockaddr *)&ctx->collector, ctx->collector_len);
+
+    if ( -1 == ret ) {
+        GNB_LOG3(gnb_core->log, GNB_LOG_ID_PF, "flow export sendto error\n");
+    }
+
+}
+
+
+//把 message 放入 export_queue, 不在数据通路上做 io
+static void ipfix_flush(gnb_core_t *gnb_core, gnb_pf_flow_ctx_t *ctx){
+
+    gnb_ring_node_t *ring_node;
+
+    unsigned char *p;
+
+    if ( 0 == ctx->msg_len ) {
+        return;
+    }
+
+    ipfix_close_set(ctx);
+
+    p = ctx->msg;
+    p = ipfix_put16(p, IPFIX_VERSION);
+    p = ipfix_put16(p, (uint16_t)ctx->msg_len);
+    p = ipfix_put32(p, (uint32_t)gnb_timestamp_sec());
+    p = ipfix_put32(p, ctx->sequence);
+    p = ipfix_put32(p, gnb_core->local_node->uuid32);
+
+    ring_node = gnb_ring_buffer_push(ctx->export_queue);
+
+    if ( NULL != ring_node ) {
+        memcpy(ring_node->data, ctx->msg, ctx->msg_len);
+        ring_node->size = ctx->msg_len;
+        gnb_ring_buffer_push_submit(ctx->export_queue);
+    } else {
+        ctx->drop_msgs++;
+    }
+
+    ctx->sequence += ctx->msg_records;
+
+    ctx->msg_len     = 0;
+    ctx->msg_records = 0;
+
+}
+
+
+static int ipfix_drain(gnb_core_t *gnb_core, gnb_pf_flow_ctx_t *ctx){
+
+    gnb_ring_node_t *ring_node;
+
+    int num = 0;
+
+    while ( NULL != (ring_node = gnb_ring_buffer_pop(ctx->export_queue)) ) {
+
+        ipfix_output(gnb_core, ctx, ring_node->data, ring_node->size);
+
+        gnb_ring_buffer_pop_submit(ctx->export_queue);
+
+        num++;
+
+    }
+
+    return num;
+
+}
+
+
+static void* thread_exporter_func(void *data){
+
+    gnb_core_t *gnb_core = (gnb_core_t *)data;
+
+    gnb_pf_flow_ctx_t *ctx = (gnb_pf_flow_ctx_t *)GNB_PF_GET_CTX(gnb_core, gnb_pf_flow);
+
+    while ( ctx->exporter_running ) {
+
+        if ( 0 == ipfix_drain(gnb_core, ctx) ) {
+            GNB_SLEEP_MILLISECOND(GNB_FLOW_EXPORTER_IDLE_MS);
+        }
+
+    }
+
+    return NULL;
+
+}
+
+
+static void ipfix_begin(gnb_pf_flow_ctx_t *ctx){
+
+    uint64_t now_sec = gnb_timestamp_sec();
+
+    ctx->msg_len = IPFIX_MESSAGE_HEAD_SIZE;
+
+    if ( now_sec - ctx->last_template_sec >= IPFIX_TEMPLATE_REFRESH_SEC ) {
+        memcpy(ctx->msg + ctx->msg_len, ctx->template_set, ctx->template_set_len);
+        ctx->msg_len += ctx->template_set_len;
+        ctx->last_template_sec = now_sec;
+    }
+
+}
+
+
+static void flow_export(gnb_core_t *gnb_core, gnb_pf_flow_ctx_t *ctx, gnb_flow_t *flow, uint8_t reason){
+
+    unsigned char *p;
+
+    uint16_t template_id;
+    int addr_len;
+    size_t need;
+
+    int i;
+
+    if ( 0 == flow->packets ) {
+        return;
+    }
+
+    if ( 6 == flow->key.ip_version ) {
+        template_id = IPFIX_TEMPLATE_ID_IPV6;
+        addr_len = 16;
+    } else {
+        template_id = IPFIX_TEMPLATE_ID_IPV4;
+        addr_len = 4;
+    }
+
+    need = IPFIX_RECORD_SIZE(addr_len);
+
+    if ( template_id != ctx->set_template_id ) {
+        need += IPFIX_SET_HEAD_SIZE;
+    }
+
+    if ( 0 != ctx->msg_len && ctx->msg_len + need > IPFIX_MESSAGE_MAX ) {
+        ipfix_flush(gnb_core, ctx);
+    }
+
+    if ( 0 == ctx->msg_len ) {
+        ipfix_begin(ctx);
+    }
+
+    if ( template_id != ctx->set_template_id ) {
+        ipfix_close_set(ctx);
+        ctx->set_offset = ctx->msg_len;
+        ctx->set_template_id = template_id;
+        ipfix_put16(ctx->msg + ctx->msg_len, template_id);
+        ctx->msg_len += IPFIX_SET_HEAD_SIZE;
+    }
+
+    p = ctx->msg + ctx->msg_len;
+
+    memcpy(p, flow->key.src_addr, addr_len);
+    p += addr_len;
+    memcpy(p, flow->key.dst_addr, addr_len);
+    p += addr_len;
+
+    p = ipfix_put16(p, flow->key.src_port);
+    p = ipfix_put16(p, flow->key.dst_port);
+
+    *p++ = flow->key.protocol;
+    //flowDirection: 0 ingress, 1 egress, 以 tun 为观察点
+    *p++ = GNB_FLOW_TYPE_OUT == flow->key.type ? 1 : 0;
+    *p++ = reason;
+
+    p = ipfix_put64(p, flow->bytes);
+    p = ipfix_put64(p, flow->packets);
+    p = ipfix_put64(p, flow->first_msec);
+    p = ipfix_put64(p, flow->last_msec);
+
+    *p++ = flow->key.type;
+
+    p = ipfix_put32(p, flow->key.src_uuid32);
+    p = ipfix_put32(p, flow->key.dst_uuid32);
+    p = ipfix_put32(p, flow->next_uuid32);
+
+    for ( i=0; i<GNB_MAX_NODE_RELAY; i++ ) {
+        p = ipfix_put32(p, i < flow->relay_num ? flow->relay_path[i] : 0);
+    }
+
+    ctx->msg_len = p - ctx->msg;
+    ctx->msg_records++;
+
+    ctx->export_flows++;
+
+}
+
+
+static void flow_key_from_ip(gnb_flow_key_t *key, unsigned char *p, ssize_t ip_frame_size){
+
+    size_t head_len;
+
+    if ( NULL == p || ip_frame_size < 20 ) {
+        return;
+    }
+
+    if ( 0x4 == (p[0] >> 4) ) {
+
+        head_len = (p[0] & 0x0f) * 4;
+
+        key->ip_version = 4;
+        key->protocol   = p[9];
+        memcpy(key->src_addr, p+12, 4);
+        memcpy(key->dst_addr, p+16, 4);
+
+        //分片后的分组没有端口号
+        if ( 0 != ( ((p[6] & 0x1f) << 8) | p[7] ) ) {
+            return;
+        }
+
+    } else if ( 0x6 == (p[0] >> 4) && ip_frame_size >= 40 ) {
+
+        head_len = 40;
+
+        key->ip_version = 6;
+        key->protocol   = p[6];
+        memcpy(key->src_addr, p+8,  16);
+        memcpy(key->dst_addr, p+24, 16);
+
+    } else {
+        return;
+    }
+
+    //tcp udp sctp 的端口号
+    if ( (6 == key->protocol || 17 == key->protocol || 132 == key->protocol) && ip_frame_size >= head_len + 4 ) {
+        key->src_port = (p[head_len]   << 8) | p[head_len+1];
+        key->dst_port = (p[head_len+2] << 8) | p[head_len+3];
+    }
+
+}
+
+
+/*
+在 key 的 hash 位置开始的 GNB_FLOW_PROBE_NUM 个位置中查找 flow，没有找到时使用空闲的位置
+删除 flow 后不留标记，所以查找时总是检查全部的位置
+*/
+static gnb_flow_t* flow_lookup(gnb_core_t *gnb_core, gnb_pf_flow_ctx_t *ctx, gnb_flow_key_t *key, uint64_t now_msec){
+
+    gnb_flow_t *flow;
+    gnb_flow_t *empty  = NULL;
+    gnb_flow_t *oldest = NULL;
+
+    uint32_t hash = murmurhash_hash((unsigned char *)key, sizeof(gnb_flow_key_t));
+
+    int i;
+
+    for ( i=0; i<GNB_FLOW_PROBE_NUM; i++ ) {
+
+        flow = &ctx->table[ (hash + i) & ctx->table_mask ];
+
+        if ( 0 == flow->used ) {
+
+            if ( NULL == empty ) {
+                empty = flow;
+            }
+
+            continue;
+        }
+
+        if ( 0 == memcmp(&flow->key, key, sizeof(gnb_flow_key_t)) ) {
+            return flow;
+        }
+
+        if ( NULL == oldest || flow->last_msec < oldest->last_msec ) {
+            oldest = flow;
+        }
+
+    }
+
+    if ( NULL == empty ) {
+        flow_export(gnb_core, ctx, oldest, IPFIX_END_REASON_RESOURCES);
+        ctx->evict_flows++;
+        empty = oldest;
+    }
+
+    memset(empty, 0, sizeof(gnb_flow_t));
+    memcpy(&empty->key, key, sizeof(gnb_flow_key_t));
+    empty->used = 1;
+    empty->first_msec = now_msec;
+
+    return empty;
+
+}
+
+
+static void flow_account(gnb_core_t *gnb_core, gnb_pf_flow_ctx_t *ctx, gnb_flow_key_t *key, ssize_t bytes, uint32_t next_uuid32, uint32_t *relay_path, int relay_num){
+
+    gnb_flow_t *flow;
+
+    uint64_t now_msec = gnb_timestamp_usec() / 1000;
+
+    flow_lock(ctx);
+
+    flow = flow_lookup(gnb_core, ctx, key, now_msec);
+
+    //持续时间超过 active timeout 的 flow 先输出已经统计的部分
+    if ( now_msec - flow->first_msec >= ctx->active_msec && flow->packets > 0 ) {
+        flow_export(gnb_core, ctx, flow, IPFIX_END_REASON_ACTIVE);
+        flow->bytes   = 0;
+        flow->packets = 0;
+        flow->first_msec = now_msec;
+    }
+
+    flow->bytes += bytes;
+    flow->packets++;
+    flow->last_msec = now_msec;
+
+    flow->next_uuid32 = next_uuid32;
+
+    if ( relay_num > GNB_MAX_NODE_RELAY ) {
+        relay_num = GNB_MAX_NODE_RELAY;
+    }
+
+    flow->relay_num = relay_num;
+
+    if ( relay_num > 0 ) {
+        memcpy(flow->relay_path, relay_path, relay_num * sizeof(uint32_t));
+    }
+
+    flow_unlock(ctx);
+
+}
+
+
+static int flow_open_export(gnb_core_t *gnb_core, gnb_pf_flow_ctx_t *ctx, const char *target){
+
+    char host[256];
+
+    const char *port_string;
+
+    size_t host_len;
+
+    struct sockaddr_in  *in  = (struct sockaddr_in  *)&ctx->collector;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&ctx->collector;
+
+    if ( 0 != strncmp(target, "udp:", 4) ) {
+
+        ctx->fp = fopen(target, "ab");
+
+        if ( NULL == ctx->fp ) {
+            return -1;
+        }
+
+        return 0;
+
+    }
+
+    target += 4;
+
+    port_string = strrchr(target, ':');
+
+    if ( NULL == port_string ) {
+        return -1;
+    }
+
+    host_len = port_string - target;
+
+    //ipv6 地址写成 [::1]:4739
+    if ( host_len >= 2 && '[' == target[0] && ']' == target[host_len-1] ) {
+        target++;
+        host_len -= 2;
+    }
+
+    if ( 0 == host_len || host_len >= sizeof(host) ) {
+        return -1;
+    }
+
+    memcpy(host, target, host_len);
+    host[host_len] = '\0';
+
+    memset(&ctx->collector, 0, sizeof(struct sockaddr_storage));
+
+    if ( 1 == inet_pton(AF_INET, host, &in->sin_addr) ) {
+        in->sin_family = AF_INET;
+        in->sin_port   = htons((uint16_t)strtoul(port_string+1, NULL, 10));
+        ctx->collector_len = sizeof(struct sockaddr_in);
+    } else if ( 1 == inet_pton(AF_INET6, host, &in6->sin6_addr) ) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port   = htons((uint16_t)strtoul(port_string+1, NULL, 10));
+        ctx->collector_len = sizeof(struct sockaddr_in6);
+    } else {
+        return -1;
+    }
+
+    ctx->socket = socket(ctx->collector.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+
+    if ( -1 == ctx->socket ) {
+        return -1;
+    }
+
+    return 0;
+
+}
+
+
+static void pf_init_cb(gnb_core_t *gnb_core){
+
+    gnb_pf_flow_ctx_t *ctx = (gnb_pf_flow_ctx_t *)gnb_heap_alloc(gnb_core->heap, sizeof(gnb_pf_flow_ctx_t));
+
+    uint32_t table_size = GNB_FLOW_TABLE_MIN;
+
+    memset(ctx, 0, sizeof(gnb_pf_flow_ctx_t));
+
+    ctx->socket = -1;
+
+    GNB_PF_SET_CTX(gnb_core, gnb_pf_flow, ctx);
+
+    if ( 0 != flow_open_export(gnb_core, ctx, gnb_core->conf->flow_export) ) {
+        GNB_ERROR1(gnb_core->log, GNB_LOG_ID_PF, "flow export '%s' open error, flow export disabled\n", gnb_core->conf->flow_export);
+        return;
+    }
+
+    while ( table_size < gnb_core->conf->flow_table_size && table_size < (1u << 24) ) {
+        table_size <<= 1;
+    }
+
+    ctx->table = (gnb_flow_t *)gnb_heap_alloc(gnb_core->heap, sizeof(gnb_flow_t) * table_size);
+
+    if ( NULL == ctx->table ) {
+        GNB_ERROR1(gnb_core->log, GNB_LOG_ID_PF, "flow table size %u alloc error, flow export disabled\n", table_size);
+        return;
+    }
+
+    memset(ctx->table, 0, sizeof(gnb_flow_t) * table_size);
+
+    ctx->export_queue = gnb_ring_buffer_init(GNB_FLOW_EXPORT_QUEUE_NUM, IPFIX_MESSAGE_MAX);
+
+    ctx->exporter_running = 1;
+
+    if ( 0 != pthread_create(&ctx->thread_exporter, NULL, thread_exporter_func, gnb_core) ) {
+        GNB_ERROR1(gnb_core->log, GNB_LOG_ID_PF, "flow exporter thread create error, flow export disabled\n");
+        gnb_ring_buffer_release(ctx->export_queue);
+        ctx->export_queue = NULL;
+        ctx->table = NULL;
+        return;
+    }
+
+    ctx->table_mask  = table_size - 1;
+    ctx->idle_msec   = (uint64_t)gnb_core->conf->flow_idle_timeout * 1000;
+    ctx->active_msec = (uint64_t)gnb_core->conf->flow_active_timeout * 1000;
+
+    ipfix_init_template(ctx);
+
+    GNB_LOG1(gnb_core->log, GNB_LOG_ID_PF, "flow export to '%s' table %u idle %us active %us\n",
+             gnb_core->conf->flow_export, table_size, gnb_core->conf->flow_idle_timeout, gnb_core->conf->flow_active_timeout);
+
+}
+
+
+static void pf_conf_cb(gnb_core_t *gnb_core){
+
+}
+
+
+static int pf_tun_route_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
+
+    gnb_pf_flow_ctx_t *ctx = (gnb_pf_flow_ctx_t *)GNB_PF_GET_CTX(gnb_core, gnb_pf_flow);
+
+    gnb_flow_key_t key;
+
+    uint32_t relay_path[GNB_MAX_NODE_RELAY];
+    int relay_num = 0;
+
+    gnb_node_t *dst_node = pf_ctx->dst_node;
+
+    uint8_t relay_count;
+    int i;
+
+    if ( NULL == ctx->table || NULL == dst_node ) {
+        return pf_ctx->pf_status;
+    }
+
+    memset(&key, 0, sizeof(gnb_flow_key_t));
+
+    key.type       = GNB_FLOW_TYPE_OUT;
+    key.src_uuid32 = gnb_core->local_node->uuid32;
+    key.dst_uuid32 = dst_node->uuid32;
+
+    flow_key_from_ip(&key, pf_ctx->ip_frame, pf_ctx->ip_frame_size);
+
+    //gnb_pf_route 选择了中继路径, route_node 中第一跳在最后
+    //speedtest 的测试分组指定的路径不一定是 selected_route_node, 使用 pf_route 实际使用的下标
+    if ( (pf_ctx->fwd_payload->sub_type & GNB_PAYLOAD_SUB_TYPE_IPFRAME_RELAY) && pf_ctx->path_route_idx < GNB_MAX_NODE_ROUTE ) {
+
+        relay_count = dst_node->route_node_ttls[pf_ctx->path_route_idx];
+
+        if ( relay_count > GNB_MAX_NODE_RELAY ) {
+            relay_count = GNB_MAX_NODE_RELAY;
+        }
+
+        for ( i=relay_count-1; i>=0; i-- ) {
+            relay_path[relay_num++] = dst_node->route_node[pf_ctx->path_route_idx][i];
+        }
+
+    }
+
+    flow_account(gnb_core, ctx, &key, pf_ctx->ip_frame_size, NULL != pf_ctx->fwd_node ? pf_ctx->fwd_node->uuid32 : 0, relay_path, relay_num);
+
+    return pf_ctx->pf_status;
+
+}
+
+
+static int pf_inet_fwd_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
+
+    gnb_pf_flow_ctx_t *ctx = (gnb_pf_flow_ctx_t *)GNB_PF_GET_CTX(gnb_core, gnb_pf_flow);
+
+    gnb_flow_key_t key;
+
+    uint32_t prev_uuid32;
+
+    if ( NULL == ctx->table ) {
+        return pf_ctx->pf_status;
+    }
+
+    memset(&key, 0, sizeof(gnb_flow_key_t));
+
+    key.src_uuid32 = pf_ctx->src_uuid32;
+    key.dst_uuid32 = pf_ctx->dst_uuid32;
+
+    if ( GNB_PF_FWD_TUN == pf_ctx->pf_fwd ) {
+
+        key.type = GNB_FLOW_TYPE_IN;
+
+        flow_key_from_ip(&key, pf_ctx->ip_frame, pf_ctx->ip_frame_size);
+
+        //只有经过中继的 payload 尾部带有上一跳节点的 uuid
+        prev_uuid32 = (pf_ctx->fwd_payload->sub_type & GNB_PAYLOAD_SUB_TYPE_IPFRAME_RELAY) ? pf_ctx->src_fwd_uuid32 : pf_ctx->src_uuid32;
+
+        flow_account(gnb_core, ctx, &key, pf_ctx->ip_frame_size, prev_uuid32, NULL, 0);
+
+    } else if ( GNB_PF_FWD_INET == pf_ctx->pf_fwd && NULL != pf_ctx->fwd_node ) {
+
+        //中继的分组是加密的，只按节点聚合
+        key.type = GNB_FLOW_TYPE_RELAY;
+
+        flow_account(gnb_core, ctx, &key, pf_ctx->ip_frame_size, pf_ctx->fwd_node->uuid32, NULL, 0);
+
+    }
+
+    return pf_ctx->pf_status;
+
+}
+
+
+/*
+分段扫描 flow 表，输出超时的 flow, 每次最多扫描 GNB_FLOW_SCAN_MAX 个位置，
+按经过的时间决定扫描的数量，大约每 GNB_FLOW_SCAN_PERIOD_MSEC 扫描完整个表
+每秒把未满的 message 放入 export_queue
+*/
+static void pf_timer_cb(gnb_core_t *gnb_core){
+
+    gnb_pf_flow_ctx_t *ctx = (gnb_pf_flow_ctx_t *)GNB_PF_GET_CTX(gnb_core, gnb_pf_flow);
+
+    gnb_flow_t *flow;
+
+    uint64_t now_sec;
+    uint64_t now_msec;
+    uint64_t scan_num;
+
+    uint32_t i;
+
+    if ( NULL == ctx->table ) {
+        return;
+    }
+
+    now_msec = gnb_timestamp_usec() / 1000;
+
+    if ( 0 == ctx->last_scan_msec ) {
+        ctx->last_scan_msec = now_msec;
+        return;
+    }
+
+    scan_num = (uint64_t)(ctx->table_mask + 1) * (now_msec - ctx->last_scan_msec) / GNB_FLOW_SCAN_PERIOD_MSEC;
+
+    //经过的时间太短，累积到下一次
+    if ( 0 == scan_num ) {
+        return;
+    }
+
+    if ( scan_num > GNB_FLOW_SCAN_MAX ) {
+        scan_num = GNB_FLOW_SCAN_MAX;
+    }
+
+    if ( scan_num > ctx->table_mask + 1 ) {
+        scan_num = ctx->table_mask + 1;
+    }
+
+    ctx->last_scan_msec = now_msec;
+
+    now_sec = now_msec / 1000;
+
+    flow_lock(ctx);
+
+    for ( i=0; i<scan_num; i++ ) {
+
+        flow = &ctx->table[ ctx->scan_idx ];
+
+        ctx->scan_idx = (ctx->scan_idx + 1) & ctx->table_mask;
+
+        if ( 0 == flow->used ) {
+            continue;
+        }
+
+        if ( now_msec - flow->last_msec >= ctx->idle_msec ) {
+            flow_export(gnb_core, ctx, flow, IPFIX_END_REASON_IDLE);
+            flow->used = 0;
+            continue;
+        }
+
+        if ( now_msec - flow->first_msec >= ctx->active_msec && flow->packets > 0 ) {
+            flow_export(gnb_core, ctx, flow, IPFIX_END_REASON_ACTIVE);
+            flow->bytes   = 0;
+            flow->packets = 0;
+            flow->first_msec = now_msec;
+        }
+
+    }
+
+    if ( now_sec != ctx->last_flush_sec ) {
+        ipfix_flush(gnb_core, ctx);
+        ctx->last_flush_sec = now_sec;
+    }
+
+    flow_unlock(ctx);
+
+}
+
+
+static void pf_release_cb(gnb_core_t *gnb_core){
+
+    gnb_pf_flow_ctx_t *ctx = (gnb_pf_flow_ctx_t *)GNB_PF_GET_CTX(gnb_core, gnb_pf_flow);
+
+    uint32_t i;
+
+    if ( NULL == ctx->table ) {
+        return;
+    }
+
+    flow_lock(ctx);
+
+    for ( i=0; i<=ctx->table_mask; i++ ) {
+
+        if ( 0 == ctx->table[i].used ) {
+            continue;
+        }
+
+        flow_export(gnb_core, ctx, &ctx->table[i], IPFIX_END_REASON_FORCED);
+        ctx->table[i].used = 0;
+
+    }
+
+    ipfix_flush(gnb_core, ctx);
+
+    //exporter 线程退出后输出队列中剩余的 message
+    ctx->exporter_running = 0;
+
+    pthread_join(ctx->thread_exporter, NULL);
+
+    ipfix_drain(gnb_core, ctx);
+
+    gnb_ring_buffer_release(ctx->export_queue);
+    ctx->export_queue = NULL;
+
+    GNB_LOG1(gnb_core->log, GNB_LOG_ID_PF, "flow export records %"PRIu64" evicted %"PRIu64" dropped messages %"PRIu64"\n", ctx->export_flows, ctx->evict_flows, ctx->drop_msgs);
+
+    if ( NULL != ctx->fp ) {
+        fclose(ctx->fp);
+        ctx->fp = NULL;
+    }
+
+    if ( -1 != ctx->socket ) {
+        #ifdef _WIN32
+        closesocket(ctx->socket);
+        #else
+        close(ctx->socket);
+        #endif
+        ctx->socket = -1;
+    }
+
+    ctx->table = NULL;
+
+    flow_unlock(ctx);
+
+}
+
+
+gnb_pf_t gnb_pf_flow = {
+    0,
+    "gnb_pf_flow",
+    pf_init_cb,
+    pf_conf_cb,
+    NULL,
+    pf_tun_route_cb,
+    NULL,
+    NULL,
+    NULL,
+    pf_inet_fwd_cb,
+    pf_release_cb,
+    pf_timer_cb,
+    NULL,
+    NULL,
+    NULL
+};
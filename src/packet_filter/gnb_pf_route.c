@@ -19,45 +19,120 @@
 #include "gnb_pf.h"
 #include "gnb_node.h"
 #include "gnb_payload16.h"
+#include "gnb_route_frame_type.h"
 #include "protocol/network_protocol.h"
+#include "ed25519/sha512.h"
+
+#define GNB_ROUTE_FLOW_TABLE_SIZE        1024
+#define GNB_ROUTE_FLOW_TIMEOUT_SEC       120
+
+//记录 flow 选择的 relay route，直接映射，冲突时覆盖旧的 flow
+typedef struct _gnb_route_flow_t {
+
+    uint32_t flow_hash;
+
+    gnb_node_t *dst_node;
+
+    uint8_t route_idx;
+
+    uint64_t last_ts_sec;
+
+}gnb_route_flow_t;
 
-#define GNB_PAYLOAD_MAX_TTL     0x05
 
 typedef struct _gnb_route_ctx_t {
 
     void *udata;
 
+    gnb_route_flow_t flow_table[GNB_ROUTE_FLOW_TABLE_SIZE];
+
+    uint64_t last_expire_ts_sec;
+
 }gnb_route_ctx_t;
 
 
 gnb_node_t* gnb_query_route4(gnb_core_t *gnb_core, uint32_t dst_ip_int);
 
-#pragma pack(push, 1)
+uint32_t murmurhash_hash(unsigned char *data, size_t len);
 
-typedef struct _gnb_route_frame_head_t {
+#define MIN_ROUTE_FRAME_SIZE ( sizeof(gnb_route_frame_head_t) + sizeof(struct iphdr) )
 
-    unsigned char magic[2];
+extern gnb_pf_t gnb_pf_route;
 
-    unsigned char pf_type_bits; //可用于加密标识
 
-    uint8_t ttl;
+//HMAC-SHA512 的分组长度
+#define GNB_ROUTE_RELAY_HMAC_BLOCK_SIZE  128
 
-    uint32_t src_uuid32;
+/*
+用本节点与 hop_node 之间的密钥对 route frame head、relay trailer 和 payload 的长度计算 HMAC-SHA512, 取前 GNB_ROUTE_RELAY_TAG_SIZE 字节作为 relay tag
+relay tag 在 ip frame 之后，relay trailer 在 relay tag 之后直到 payload 的末尾
+*/
+static void relay_tag(gnb_node_t *hop_node, gnb_payload16_t *payload, uint16_t ip_frame_size, unsigned char *tag){
 
-    uint32_t dst_uuid32;
+    sha512_context ctx;
 
-} __attribute__ ((__packed__)) gnb_route_frame_head_t;
+    unsigned char pad[GNB_ROUTE_RELAY_HMAC_BLOCK_SIZE];
 
-#pragma pack(pop)
+    unsigned char digest[64];
 
-#define MIN_ROUTE_FRAME_SIZE ( sizeof(gnb_route_frame_head_t) + sizeof(struct iphdr) )
+    uint16_t data_len = gnb_payload16_data_len(payload);
+    uint16_t trailer_offset = sizeof(gnb_route_frame_head_t) + ip_frame_size + GNB_ROUTE_RELAY_TAG_SIZE;
+    uint16_t data_len_n = htons(data_len);
+
+    int i;
+
+    //crypto_key 是 64 字节，比分组短，不需要先做摘要
+    memset(pad, 0, GNB_ROUTE_RELAY_HMAC_BLOCK_SIZE);
+    memcpy(pad, hop_node->crypto_key, 64);
+
+    for ( i=0; i<GNB_ROUTE_RELAY_HMAC_BLOCK_SIZE; i++ ) {
+        pad[i] ^= 0x36;
+    }
+
+    sha512_init(&ctx);
+    sha512_update(&ctx, pad, GNB_ROUTE_RELAY_HMAC_BLOCK_SIZE);
+    sha512_update(&ctx, payload->data, sizeof(gnb_route_frame_head_t));
+    sha512_update(&ctx, payload->data + trailer_offset, data_len - trailer_offset);
+    sha512_update(&ctx, (const unsigned char *)&data_len_n, sizeof(uint16_t));
+    sha512_final(&ctx, digest);
+
+    //ipad 转为 opad
+    for ( i=0; i<GNB_ROUTE_RELAY_HMAC_BLOCK_SIZE; i++ ) {
+        pad[i] ^= 0x36 ^ 0x5c;
+    }
+
+    sha512_init(&ctx);
+    sha512_update(&ctx, pad, GNB_ROUTE_RELAY_HMAC_BLOCK_SIZE);
+    sha512_update(&ctx, digest, 64);
+    sha512_final(&ctx, digest);
+
+    memcpy(tag, digest, GNB_ROUTE_RELAY_TAG_SIZE);
+
+}
+
+
+//比较的时间与 tag 的内容无关
+static int relay_tag_equal(const unsigned char *a, const unsigned char *b){
+
+    unsigned char diff = 0;
+
+    int i;
+
+    for ( i=0; i<GNB_ROUTE_RELAY_TAG_SIZE; i++ ) {
+        diff |= a[i] ^ b[i];
+    }
+
+    return 0 == diff;
+
+}
 
-extern gnb_pf_t gnb_pf_route;
 
 static void pf_init_cb(gnb_core_t *gnb_core){
 
     gnb_route_ctx_t *ctx = (gnb_route_ctx_t*)gnb_heap_alloc(gnb_core->heap,sizeof(gnb_route_ctx_t));
 
+    memset(ctx, 0, sizeof(gnb_route_ctx_t));
+
     GNB_PF_SET_CTX(gnb_core,gnb_pf_route,ctx);
     ctx->udata = NULL;
     gnb_core->tun_payload_offset += sizeof(gnb_route_frame_head_t);
@@ -117,6 +192,7 @@ handle_ip_frame:
     pf_ctx->dst_node = gnb_query_route4(gnb_core,dst_ip_int);
 
     if ( NULL==pf_ctx->dst_node ){
+        GNB_METRICS_INC(pf_ctx->metrics, GNB_METRIC_DROP_ROUTE_MISS);
         return GNB_PF_DROP;
     }
 
@@ -163,6 +239,111 @@ handle_ip_frame:
 }
 
 
+static int check_relay_route_available(gnb_core_t *gnb_core, gnb_node_t *dst_node, uint8_t route_idx){
+
+    gnb_node_t *relay_node;
+
+    uint8_t relay_count = dst_node->route_node_ttls[route_idx];
+
+    if ( 0 == relay_count || relay_count > GNB_MAX_NODE_RELAY || 0 == dst_node->route_node[route_idx][0] ) {
+        return 0;
+    }
+
+    //只能知道第一跳的 relay 节点是否可达
+    relay_node = GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, dst_node->route_node[route_idx][relay_count-1]);
+
+    if ( NULL == relay_node ) {
+        return 0;
+    }
+
+    if ( (GNB_NODE_STATUS_IPV6_PONG | GNB_NODE_STATUS_IPV4_PONG) & relay_node->udp_addr_status ) {
+        return 1;
+    }
+
+    return 0;
+
+}
+
+
+/*
+用 rendezvous hash 为 flow 选择 relay route，
+每条 route 的 flow 数量大致相同，某条 route 不可用时只有经过这条 route 的 flow 会被重新分配
+*/
+static uint8_t select_balance_relay_route(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
+
+    gnb_route_ctx_t *ctx = (gnb_route_ctx_t *)GNB_PF_GET_CTX(gnb_core,gnb_pf_route);
+
+    gnb_node_t *dst_node = pf_ctx->dst_node;
+
+    gnb_route_flow_t *flow;
+
+    uint32_t flow_hash;
+    uint32_t key[3];
+    uint32_t weight;
+    uint32_t max_weight = 0;
+
+    uint8_t route_idx;
+    int selected_idx = -1;
+
+    uint64_t now_sec = (uint64_t)gnb_core->now_timeval.tv_sec;
+
+    flow_hash = gnb_pf_flow_hash(pf_ctx->ip_frame, pf_ctx->ip_frame_size);
+
+    flow = &ctx->flow_table[ (flow_hash ^ dst_node->uuid32) % GNB_ROUTE_FLOW_TABLE_SIZE ];
+
+    if ( flow->dst_node == dst_node && flow->flow_hash == flow_hash && (now_sec - flow->last_ts_sec) < GNB_ROUTE_FLOW_TIMEOUT_SEC ) {
+
+        if ( check_relay_route_available(gnb_core, dst_node, flow->route_idx) ) {
+            flow->last_ts_sec = now_sec;
+            return flow->route_idx;
+        }
+
+    }
+
+    for ( route_idx=0; route_idx<GNB_MAX_NODE_ROUTE; route_idx++ ) {
+
+        if ( 0 == dst_node->route_node[route_idx][0] ) {
+            break;
+        }
+
+        if ( !check_relay_route_available(gnb_core, dst_node, route_idx) ) {
+            continue;
+        }
+
+        key[0] = flow_hash;
+        key[1] = dst_node->route_node[route_idx][0];
+        key[2] = route_idx;
+
+        weight = murmurhash_hash((unsigned char *)key, sizeof(key));
+
+        if ( -1 == selected_idx || weight > max_weight ) {
+            max_weight = weight;
+            selected_idx = route_idx;
+        }
+
+    }
+
+    //所有 route 都不可用，仍然使用原来的 route
+    if ( -1 == selected_idx ) {
+        return dst_node->selected_route_node;
+    }
+
+    if ( NULL != flow->dst_node && flow->dst_node->route_node_flows[flow->route_idx] > 0 ) {
+        flow->dst_node->route_node_flows[flow->route_idx]--;
+    }
+
+    flow->flow_hash   = flow_hash;
+    flow->dst_node    = dst_node;
+    flow->route_idx   = (uint8_t)selected_idx;
+    flow->last_ts_sec = now_sec;
+
+    dst_node->route_node_flows[selected_idx]++;
+
+    return (uint8_t)selected_idx;
+
+}
+
+
 /*
  * route，得到fwd_node
 */
@@ -172,14 +353,20 @@ static int pf_tun_route_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
 
     uint8_t relay_count;
 
+    uint8_t route_idx;
+
     uint16_t org_payload_size;
     uint16_t new_payload_size;
 
+    uint16_t tag_size;
+
     uint32_t *src_fwd_nodeid_ptr;
     uint32_t *relay_nodeid_ptr;
 
     int relay_nodeid_idx;
 
+    gnb_node_t *select_fwd_node;
+
     gnb_route_ctx_t *ctx = (gnb_route_ctx_t *)GNB_PF_GET_CTX(gnb_core,gnb_pf_route);
 
     gnb_route_frame_head_t *route_frame_head = (gnb_route_frame_head_t *)pf_ctx->fwd_payload->data;
@@ -189,10 +376,30 @@ static int pf_tun_route_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
         goto handle_relay;
     }
 
+    //speedtest 的测试分组指定了路径，不受 route.conf 和 relay mode 的影响
+    if ( GNB_PF_PATH_DIRECT4 == pf_ctx->path || GNB_PF_PATH_DIRECT6 == pf_ctx->path ) {
+        pf_ctx->fwd_node = pf_ctx->dst_node;
+        ret = GNB_PF_NEXT;
+        goto finish;
+    }
+
+    if ( GNB_PF_PATH_RELAY == pf_ctx->path ) {
+
+        if ( pf_ctx->path_route_idx >= GNB_MAX_NODE_ROUTE ) {
+            ret = GNB_PF_DROP;
+            goto finish;
+        }
+
+        route_idx = pf_ctx->path_route_idx;
+        goto relay;
+
+    }
+
     if ( 0 == gnb_core->conf->direct_forwarding ){
 
         if( NULL != gnb_core->select_fwd_node ){
-            pf_ctx->fwd_node = gnb_core->select_fwd_node;
+            //同一个 flow 的分组总是经过同一个 forward node，避免 tcp 乱序
+            pf_ctx->fwd_node = gnb_select_forward_node_by_flow(gnb_core, gnb_pf_flow_hash(pf_ctx->ip_frame, pf_ctx->ip_frame_size));
             ret = GNB_PF_NEXT;
             goto handle_relay;
         }else{
@@ -228,8 +435,10 @@ static int pf_tun_route_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
         goto handle_relay;
     }
 
-    if ( (gnb_core->select_fwd_node->udp_addr_status & GNB_NODE_STATUS_IPV6_PONG) || (gnb_core->select_fwd_node->udp_addr_status & GNB_NODE_STATUS_IPV4_PONG) ){
-        pf_ctx->fwd_node = gnb_core->select_fwd_node;
+    select_fwd_node = gnb_select_forward_node_by_flow(gnb_core, gnb_pf_flow_hash(pf_ctx->ip_frame, pf_ctx->ip_frame_size));
+
+    if ( (select_fwd_node->udp_addr_status & GNB_NODE_STATUS_IPV6_PONG) || (select_fwd_node->udp_addr_status & GNB_NODE_STATUS_IPV4_PONG) ){
+        pf_ctx->fwd_node = select_fwd_node;
         pf_ctx->fwd_payload->sub_type |= GNB_PAYLOAD_SUB_TYPE_IPFRAME_STD;
         ret = GNB_PF_NEXT;
         goto handle_relay;
@@ -253,7 +462,19 @@ handle_relay:
         goto finish;
     }
 
-    relay_count = pf_ctx->dst_node->route_node_ttls[pf_ctx->dst_node->selected_route_node];
+    if ( GNB_NODE_RELAY_STATIC & pf_ctx->dst_node->node_relay_mode ){
+        pf_ctx->dst_node->selected_route_node = 0;
+    } else if ( GNB_NODE_RELAY_BALANCE & pf_ctx->dst_node->node_relay_mode ){
+        pf_ctx->dst_node->selected_route_node = select_balance_relay_route(gnb_core, pf_ctx);
+    }
+
+    route_idx = pf_ctx->dst_node->selected_route_node;
+
+relay:
+
+    pf_ctx->path_route_idx = route_idx;
+
+    relay_count = pf_ctx->dst_node->route_node_ttls[route_idx];
 
     if ( 0 == relay_count || relay_count > GNB_MAX_NODE_RELAY ) {
         goto finish;
@@ -261,15 +482,19 @@ handle_relay:
 
     pf_ctx->fwd_payload->sub_type |= GNB_PAYLOAD_SUB_TYPE_IPFRAME_RELAY;
 
-    if ( GNB_NODE_RELAY_STATIC & pf_ctx->dst_node->node_relay_mode ){
-        pf_ctx->dst_node->selected_route_node = 0;
+    //cut through 的 payload 在 ip frame 和 relay trailer 之间留出 relay tag
+    if ( gnb_core->conf->relay_cut_through ) {
+        pf_ctx->fwd_payload->sub_type |= GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH;
+        tag_size = GNB_ROUTE_RELAY_TAG_SIZE;
+    } else {
+        tag_size = 0;
     }
 
-    relay_nodeid_ptr = (uint32_t *)( pf_ctx->fwd_payload->data + sizeof(gnb_route_frame_head_t) + pf_ctx->ip_frame_size );
+    relay_nodeid_ptr = (uint32_t *)( pf_ctx->fwd_payload->data + sizeof(gnb_route_frame_head_t) + pf_ctx->ip_frame_size + tag_size );
 
     for ( relay_nodeid_idx=0; relay_nodeid_idx < relay_count; relay_nodeid_idx++ ) {
 
-        relay_nodeid_ptr[ relay_nodeid_idx ] = htonl( pf_ctx->dst_node->route_node[ pf_ctx->dst_node->selected_route_node ][ relay_nodeid_idx ] );
+        relay_nodeid_ptr[ relay_nodeid_idx ] = htonl( pf_ctx->dst_node->route_node[ route_idx ][ relay_nodeid_idx ] );
 
     }
 
@@ -279,7 +504,7 @@ handle_relay:
 
     route_frame_head->ttl = relay_count + 1;
 
-    new_payload_size = org_payload_size + relay_count*sizeof(uint32_t) + sizeof(uint32_t);
+    new_payload_size = org_payload_size + tag_size + relay_count*sizeof(uint32_t) + sizeof(uint32_t);
 
     if ( new_payload_size > GNB_MAX_PAYLOAD_SIZE ){
         ret = GNB_PF_DROP;
@@ -288,7 +513,7 @@ handle_relay:
 
     gnb_payload16_set_size(pf_ctx->fwd_payload, new_payload_size);
 
-    pf_ctx->fwd_node = GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, pf_ctx->dst_node->route_node[ pf_ctx->dst_node->selected_route_node ][ relay_count-1 ]);
+    pf_ctx->fwd_node = GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, pf_ctx->dst_node->route_node[ route_idx ][ relay_count-1 ]);
 
     if ( NULL==pf_ctx->fwd_node ){
         ret = GNB_PF_NOROUTE;
@@ -297,22 +522,18 @@ handle_relay:
 
     route_frame_head->pf_type_bits = gnb_core->conf->crypto_type;
 
-    ret = GNB_PF_NEXT;
-
-    if ( GNB_NODE_RELAY_BALANCE & pf_ctx->dst_node->node_relay_mode ){
-
-        pf_ctx->dst_node->selected_route_node++;
+    if ( tag_size > 0 ) {
+        relay_tag(pf_ctx->fwd_node, pf_ctx->fwd_payload, pf_ctx->ip_frame_size, pf_ctx->fwd_payload->data + sizeof(gnb_route_frame_head_t) + pf_ctx->ip_frame_size);
+    }
 
-        if ( 0 == pf_ctx->dst_node->route_node[pf_ctx->dst_node->selected_route_node][0] ){
-            pf_ctx->dst_node->selected_route_node = 0;
-        }
+    ret = GNB_PF_NEXT;
 
-    }
+    pf_ctx->dst_node->route_node_bytes[route_idx] += pf_ctx->ip_frame_size;
 
     if ( 1==gnb_core->conf->if_dump ) {
 
         for ( relay_nodeid_idx=0; relay_nodeid_idx < relay_count; relay_nodeid_idx++ ) {
-            GNB_LOG3(gnb_core->log,GNB_LOG_ID_PF,"pf_tun_route_cb idx[%u] relay[%u]\n", relay_nodeid_idx, pf_ctx->dst_node->route_node[ pf_ctx->dst_node->selected_route_node ][ relay_nodeid_idx ]);
+            GNB_LOG3(gnb_core->log,GNB_LOG_ID_PF,"pf_tun_route_cb idx[%u] relay[%u]\n", relay_nodeid_idx, pf_ctx->dst_node->route_node[ route_idx ][ relay_nodeid_idx ]);
         }
 
     }
@@ -333,6 +554,12 @@ static int pf_inet_frame_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
     uint16_t payload_data_size;
     uint32_t *pre_src_fwd_nodeid_ptr;
 
+    uint16_t trailer_size;
+
+    gnb_node_t *src_fwd_node;
+
+    unsigned char tag[GNB_ROUTE_RELAY_TAG_SIZE];
+
     gnb_route_ctx_t *ctx = (gnb_route_ctx_t *)GNB_PF_GET_CTX(gnb_core,gnb_pf_route);
 
     gnb_route_frame_head_t *route_frame_head;
@@ -352,9 +579,11 @@ static int pf_inet_frame_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
         goto finish;
     }
 
-    pre_src_fwd_nodeid_ptr = (uint32_t *)( pf_ctx->fwd_payload->data + payload_data_size );
-
-    pf_ctx->src_fwd_uuid32 = ntohl(*pre_src_fwd_nodeid_ptr);
+    //上一跳节点的 uuid32 在 relay trailer 的最后
+    if( GNB_PAYLOAD_SUB_TYPE_IPFRAME_RELAY & pf_ctx->fwd_payload->sub_type ) {
+        pre_src_fwd_nodeid_ptr = (uint32_t *)( pf_ctx->fwd_payload->data + payload_data_size - sizeof(uint32_t) );
+        pf_ctx->src_fwd_uuid32 = ntohl(*pre_src_fwd_nodeid_ptr);
+    }
 
     //从payload中得到 route_frame 首地址
     route_frame_head = (gnb_route_frame_head_t *)pf_ctx->fwd_payload->data;
@@ -371,6 +600,7 @@ static int pf_inet_frame_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
     pf_ctx->pf_type_bits = &route_frame_head->pf_type_bits;
 
     if ( route_frame_head->ttl > GNB_PAYLOAD_MAX_TTL ) {
+        GNB_METRICS_INC(pf_ctx->metrics, GNB_METRIC_DROP_TTL);
         ret = GNB_PF_DROP;
         goto finish;
     }
@@ -379,9 +609,43 @@ static int pf_inet_frame_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
     pf_ctx->ip_frame = pf_ctx->fwd_payload->data + sizeof(gnb_route_frame_head_t);
 
     if( GNB_PAYLOAD_SUB_TYPE_IPFRAME_RELAY & pf_ctx->fwd_payload->sub_type ) {
-        pf_ctx->ip_frame_size = gnb_payload16_data_len(pf_ctx->fwd_payload) - sizeof(gnb_route_frame_head_t) - route_frame_head->ttl*sizeof(uint32_t);
+
+        trailer_size = route_frame_head->ttl*sizeof(uint32_t);
+
+        if ( GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH & pf_ctx->fwd_payload->sub_type ) {
+            trailer_size += GNB_ROUTE_RELAY_TAG_SIZE;
+        }
+
+        if ( 0 == route_frame_head->ttl || payload_data_size < sizeof(gnb_route_frame_head_t) + trailer_size ) {
+            ret = GNB_PF_ERROR;
+            goto finish;
+        }
+
+        pf_ctx->ip_frame_size = payload_data_size - sizeof(gnb_route_frame_head_t) - trailer_size;
+
     } else {
-        pf_ctx->ip_frame_size = gnb_payload16_data_len(pf_ctx->fwd_payload) - sizeof(gnb_route_frame_head_t);
+        pf_ctx->ip_frame_size = payload_data_size - sizeof(gnb_route_frame_head_t);
+    }
+
+    //ttl 减一之前验证上一跳节点写入的 relay tag
+    if ( GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH & pf_ctx->fwd_payload->sub_type ) {
+
+        src_fwd_node = GNB_HASH32_UINT32_GET_PTR(gnb_core->uuid_node_map, pf_ctx->src_fwd_uuid32);
+
+        if ( NULL == src_fwd_node ) {
+            ret = GNB_PF_NOROUTE;
+            goto finish;
+        }
+
+        relay_tag(src_fwd_node, pf_ctx->fwd_payload, pf_ctx->ip_frame_size, tag);
+
+        if ( !relay_tag_equal(tag, pf_ctx->ip_frame + pf_ctx->ip_frame_size) ) {
+            GNB_LOG3(gnb_core->log,GNB_LOG_ID_PF, "pf_inet_frame_cb src_fwd[%u] [%u]>[%u] relay tag mismatch\n", pf_ctx->src_fwd_uuid32, pf_ctx->src_uuid32, pf_ctx->dst_uuid32);
+            GNB_METRICS_INC(pf_ctx->metrics, GNB_METRIC_DROP_CRYPTO);
+            ret = GNB_PF_DROP;
+            goto finish;
+        }
+
     }
 
     pf_ctx->in_ttl = route_frame_head->ttl;
@@ -404,6 +668,10 @@ finish:
 
             nodeid_ptr = (uint32_t *)(pf_ctx->fwd_payload->data + sizeof(gnb_route_frame_head_t) + pf_ctx->ip_frame_size);
 
+            if ( GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH & pf_ctx->fwd_payload->sub_type ) {
+                nodeid_ptr = (uint32_t *)((unsigned char *)nodeid_ptr + GNB_ROUTE_RELAY_TAG_SIZE);
+            }
+
             GNB_LOG3(gnb_core->log,GNB_LOG_ID_PF, "pf_inet_frame_cb src_fwd[%u] [%u]>[%u] in_ttl[%u] ip_frame_size[%u]\n", pf_ctx->src_fwd_uuid32,
                                                 pf_ctx->src_uuid32, pf_ctx->dst_uuid32, pf_ctx->in_ttl, pf_ctx->ip_frame_size);
 
@@ -469,6 +737,7 @@ static int pf_inet_route_cb(gnb_core_t *gnb_core, gnb_pf_ctx_t *pf_ctx){
     }
 
     if ( 0x0 == route_frame_head->ttl ) {
+        GNB_METRICS_INC(pf_ctx->metrics, GNB_METRIC_DROP_TTL);
         ret = GNB_PF_DROP;
         goto finish;
     }
@@ -485,7 +754,7 @@ route_default:
         pf_ctx->fwd_node = pf_ctx->dst_node;
         pf_ctx->pf_fwd = GNB_PF_FWD_INET;
     } else {
-        pf_ctx->fwd_node = gnb_core->select_fwd_node;
+        pf_ctx->fwd_node = gnb_select_forward_node_by_flow(gnb_core, gnb_pf_flow_hash(pf_ctx->ip_frame, pf_ctx->ip_frame_size));
         pf_ctx->pf_fwd = GNB_PF_FWD_INET;
     }
 
@@ -550,6 +819,11 @@ route_relay:
 
     gnb_payload16_set_data_len(pf_ctx->fwd_payload, payload_data_size- sizeof(uint32_t) );
 
+    //去掉上一跳节点的 uuid32 后，用下一跳节点的密钥重新计算 relay tag
+    if ( GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH & pf_ctx->fwd_payload->sub_type ) {
+        relay_tag(pf_ctx->fwd_node, pf_ctx->fwd_payload, pf_ctx->ip_frame_size, pf_ctx->ip_frame + pf_ctx->ip_frame_size);
+    }
+
     ret = GNB_PF_NEXT;
 
     if ( 1==gnb_core->conf->if_dump ) {
@@ -558,6 +832,10 @@ route_relay:
 
         nodeid_ptr = (uint32_t *)(pf_ctx->fwd_payload->data + sizeof(gnb_route_frame_head_t) + pf_ctx->ip_frame_size);
 
+        if ( GNB_PAYLOAD_SUB_TYPE_IPFRAME_CUT_THROUGH & pf_ctx->fwd_payload->sub_type ) {
+            nodeid_ptr = (uint32_t *)((unsigned char *)nodeid_ptr + GNB_ROUTE_RELAY_TAG_SIZE);
+        }
+
         for ( i=0; i<(pf_ctx->in_ttl-1); i++ ) {
             GNB_LOG3( gnb_core->log,GNB_LOG_ID_PF, "pf_inet_frame_cb [%u]>[%u] in_ttl[%u] relay[%u]\n",
                     pf_ctx->src_uuid32, pf_ctx->dst_uuid32, pf_ctx->in_ttl,
@@ -575,6 +853,45 @@ finish:
 }
 
 
+/*
+每秒清除一次空闲超时的 flow，从 route_node_flows 中减去，使 route_node_flows 是当前活动的 flow 数量
+与 select_balance_relay_route 都在 main worker 中调用
+*/
+static void pf_timer_cb(gnb_core_t *gnb_core){
+
+    gnb_route_ctx_t *ctx = (gnb_route_ctx_t *)GNB_PF_GET_CTX(gnb_core,gnb_pf_route);
+
+    gnb_route_flow_t *flow;
+
+    uint64_t now_sec = (uint64_t)gnb_core->now_timeval.tv_sec;
+
+    int i;
+
+    if ( now_sec == ctx->last_expire_ts_sec ) {
+        return;
+    }
+
+    ctx->last_expire_ts_sec = now_sec;
+
+    for ( i=0; i<GNB_ROUTE_FLOW_TABLE_SIZE; i++ ) {
+
+        flow = &ctx->flow_table[i];
+
+        if ( NULL == flow->dst_node || (now_sec - flow->last_ts_sec) < GNB_ROUTE_FLOW_TIMEOUT_SEC ) {
+            continue;
+        }
+
+        if ( flow->dst_node->route_node_flows[flow->route_idx] > 0 ) {
+            flow->dst_node->route_node_flows[flow->route_idx]--;
+        }
+
+        flow->dst_node = NULL;
+
+    }
+
+}
+
+
 static void pf_release_cb(gnb_core_t *gnb_core){
 
     gnb_route_ctx_t *ctx = (gnb_route_ctx_t *)GNB_PF_GET_CTX(gnb_core,gnb_pf_route);
@@ -597,5 +914,9 @@ gnb_pf_t gnb_pf_route = {
     pf_inet_route_cb,
     NULL,
 
-    pf_release_cb
+    pf_release_cb,
+    pf_timer_cb,
+    NULL,
+    NULL,
+    NULL
 };
@@ -0,0 +1,416 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+模拟 gnb_detect_worker (src/gnb_detect_worker.c) 对 NAT 后面的节点的端口探测，比较在 push address 窗口内打通的节点比例
+
+  cc -O2 -o gnb_detect_sim tools/gnb_detect_sim.c
+  ./gnb_detect_sim --peers=50 --rate=1000 --trials=10
+
+模型:
+  本节点同时探测 peers 个节点，每个节点都在 symmetric NAT 后面，
+  对端同样在探测本节点，它每秒发出 --peer-rate 个探测包，每个探测包在它的 NAT 上打开一个随机的公网端口,
+  映射在 --mapping-timeout 秒后失效，NAT 按地址过滤，来自本节点 ip 的分组可以从打开的端口进入
+  本节点的探测包落在对端 NAT 上仍然有效的端口时这个节点打通
+  --dead 指定节点列表最前面有多少个节点不在线，它们永远打不通，会一直消耗令牌
+  时间按 detect worker 发出探测后的 10ms 间隔推进，窗口是 GNB_DETECT_PUSH_ADDRESS_INTERVAL_SEC - GNB_DETECT_INTERVAL_SEC
+
+比较的策略:
+  seq:          以前的 detect worker, 每轮对每个节点顺序发出一个端口，没有速率限制
+  rand-fixed:   随机端口、令牌桶和 burst, 每轮都从第 0 个节点开始
+  rand-rotate:  随机端口、令牌桶和 burst, 每轮从上一轮停下的节点开始，与现在的 detect_loop 相同
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+
+//与 gnb_detect_worker.c 和 gnb_argv.c 相同
+#define GNB_DETECT_PUSH_ADDRESS_INTERVAL_SEC   60*10
+#define GNB_DETECT_INTERVAL_SEC                60*3
+#define GNB_DETECT_BURST_NUM                   64
+#define DETECT_PORT_START                      1024
+#define DETECT_PORT_END                        65535
+
+#define SIM_TICK_MS       10
+#define SIM_PORT_NUM      65536
+#define SIM_MAX_PEERS     4096
+#define SIM_MAX_TRIALS    1024
+
+#define SIM_STRATEGY_SEQ          0
+#define SIM_STRATEGY_RAND_FIXED   1
+#define SIM_STRATEGY_RAND_ROTATE  2
+
+
+typedef struct _sim_peer_t {
+
+    //对端 NAT 上每个公网端口的映射失效的时间，单位 ms
+    uint32_t *open_until_ms;
+
+    uint32_t next_port;
+
+    uint64_t probe_num;
+
+    //打通的时间，单位 ms, 0 为没有打通
+    uint32_t connect_ms;
+
+    //不在线的节点
+    int dead;
+
+}sim_peer_t;
+
+
+static int peer_rate = 100;
+static int mapping_timeout_sec = 30;
+
+static uint32_t random_state = 1;
+
+
+static uint32_t sim_random(void){
+
+    //xorshift32, 与 detect_random 相同
+    uint32_t x = random_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    random_state = x;
+
+    return x;
+
+}
+
+
+//对端发出的探测包在它的 NAT 上打开新的映射
+static void peer_open_ports(sim_peer_t *peer, uint32_t now_ms, int num){
+
+    uint32_t port;
+
+    int i;
+
+    for ( i=0; i<num; i++ ) {
+        port = DETECT_PORT_START + sim_random() % (SIM_PORT_NUM - DETECT_PORT_START);
+        peer->open_until_ms[port] = now_ms + mapping_timeout_sec * 1000;
+    }
+
+}
+
+
+static void probe_peer(sim_peer_t *peer, uint32_t port, uint32_t now_ms){
+
+    peer->probe_num++;
+
+    if ( 0 == peer->connect_ms && peer->open_until_ms[port] > now_ms ) {
+        peer->connect_ms = now_ms;
+    }
+
+}
+
+
+/*
+返回打通的节点数, connect_ms_array 中是各个节点打通的时间，probes 累加发出的探测包数
+*/
+static int sim_run(int strategy, sim_peer_t *peers, int peer_num, int dead_num, int rate, uint32_t window_ms, uint32_t *connect_ms_array, uint64_t *probes){
+
+    uint32_t port_range = DETECT_PORT_END - DETECT_PORT_START;
+
+    uint32_t now_ms;
+
+    uint64_t tokens = rate;
+    uint64_t refill_acc = 0;
+
+    int peer_open_acc = 0;
+    int peer_open_num;
+
+    int next_idx = 0;
+    int connected = 0;
+
+    int n,i,j;
+
+    for ( i=0; i<peer_num; i++ ) {
+        memset(peers[i].open_until_ms, 0, sizeof(uint32_t) * SIM_PORT_NUM);
+        peers[i].next_port  = DETECT_PORT_START;
+        peers[i].probe_num  = 0;
+        peers[i].connect_ms = 0;
+        peers[i].dead       = i < dead_num;
+    }
+
+    for ( now_ms=SIM_TICK_MS; now_ms<=window_ms; now_ms+=SIM_TICK_MS ) {
+
+        peer_open_acc += peer_rate * SIM_TICK_MS;
+        peer_open_num  = peer_open_acc / 1000;
+        peer_open_acc %= 1000;
+
+        for ( i=0; i<peer_num; i++ ) {
+
+            if ( 0 == peers[i].connect_ms && 0 == peers[i].dead ) {
+                peer_open_ports(&peers[i], now_ms, peer_open_num);
+            }
+
+        }
+
+        if ( SIM_STRATEGY_SEQ == strategy ) {
+
+            for ( i=0; i<peer_num; i++ ) {
+
+                if ( 0 != peers[i].connect_ms ) {
+                    continue;
+                }
+
+                probe_peer(&peers[i], peers[i].next_port, now_ms);
+
+                peers[i].next_port++;
+
+                if ( peers[i].next_port >= DETECT_PORT_END ) {
+                    peers[i].next_port = DETECT_PORT_START;
+                }
+
+            }
+
+            continue;
+
+        }
+
+        //与 detect_refill_tokens 相同，最多积累1秒的令牌
+        refill_acc += (uint64_t)rate * SIM_TICK_MS;
+        tokens     += refill_acc / 1000;
+        refill_acc %= 1000;
+
+        if ( tokens > (uint64_t)rate ) {
+            tokens = rate;
+        }
+
+        if ( SIM_STRATEGY_RAND_FIXED == strategy ) {
+            next_idx = 0;
+        }
+
+        for ( n=0; n<peer_num; n++ ) {
+
+            i = (next_idx + n) % peer_num;
+
+            if ( 0 != peers[i].connect_ms ) {
+                continue;
+            }
+
+            if ( 0 == tokens ) {
+                next_idx = i;
+                break;
+            }
+
+            for ( j=0; j<GNB_DETECT_BURST_NUM && tokens > 0 && 0 == peers[i].connect_ms; j++ ) {
+                probe_peer(&peers[i], DETECT_PORT_START + sim_random() % port_range, now_ms);
+                tokens--;
+            }
+
+            next_idx = i + 1;
+
+        }
+
+    }
+
+    for ( i=0; i<peer_num; i++ ) {
+
+        *probes += peers[i].probe_num;
+
+        if ( 0 != peers[i].connect_ms ) {
+            connect_ms_array[connected] = peers[i].connect_ms;
+            connected++;
+        }
+
+    }
+
+    return connected;
+
+}
+
+
+static int cmp_uint32(const void *a, const void *b){
+
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+
+}
+
+
+static void show_useage(char *argv0){
+
+    printf("Usage: %s [OPTION]\n", argv0);
+    printf("      --peers             nodes probed at the same time, default 50\n");
+    printf("      --rate              port-detect-rate in probes per second, default 1000\n");
+    printf("      --dead              offline nodes at the head of the node list, default 0\n");
+    printf("      --peer-rate         probes per second each peer sends to this node, default 100\n");
+    printf("      --mapping-timeout   nat mapping timeout in seconds, default 30\n");
+    printf("      --trials            runs per strategy, default 10\n");
+    printf("      --seed              random seed, default 1\n");
+    printf("      --help\n");
+
+}
+
+
+int main(int argc, char *argv[]){
+
+    static const char *strategy_names[] = { "seq", "rand-fixed", "rand-rotate" };
+
+    sim_peer_t *peers;
+
+    uint32_t *connect_ms_array;
+
+    uint32_t window_ms = (GNB_DETECT_PUSH_ADDRESS_INTERVAL_SEC - GNB_DETECT_INTERVAL_SEC) * 1000;
+
+    uint64_t probes;
+
+    int peer_num = 50;
+    int dead_num = 0;
+    int live_num;
+    int rate = 1000;
+    int trials = 10;
+    int seed = 1;
+
+    int connected_total;
+    int connected_num;
+    int strategy;
+    int t,i;
+
+    static struct option long_options[] = {
+        { "peers",           required_argument, 0, 'p' },
+        { "rate",            required_argument, 0, 'r' },
+        { "dead",            required_argument, 0, 'd' },
+        { "peer-rate",       required_argument, 0, 'P' },
+        { "mapping-timeout", required_argument, 0, 'm' },
+        { "trials",          required_argument, 0, 't' },
+        { "seed",            required_argument, 0, 's' },
+        { "help",            no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    int opt;
+
+    while ( -1 != (opt = getopt_long(argc, argv, "p:d:r:P:m:t:s:h", long_options, NULL)) ) {
+
+        switch (opt) {
+
+        case 'p':
+            peer_num = atoi(optarg);
+            break;
+
+        case 'd':
+            dead_num = atoi(optarg);
+            break;
+
+        case 'r':
+            rate = atoi(optarg);
+            break;
+
+        case 'P':
+            peer_rate = atoi(optarg);
+            break;
+
+        case 'm':
+            mapping_timeout_sec = atoi(optarg);
+            break;
+
+        case 't':
+            trials = atoi(optarg);
+            break;
+
+        case 's':
+            seed = atoi(optarg);
+            break;
+
+        default:
+            show_useage(argv[0]);
+            return 0;
+
+        }
+
+    }
+
+    if ( peer_num < 1 || peer_num > SIM_MAX_PEERS || dead_num < 0 || dead_num >= peer_num || rate < 1 || peer_rate < 0 || mapping_timeout_sec < 1 ) {
+        show_useage(argv[0]);
+        return 1;
+    }
+
+    live_num = peer_num - dead_num;
+
+    if ( trials < 1 ) {
+        trials = 1;
+    }
+
+    if ( trials > SIM_MAX_TRIALS ) {
+        trials = SIM_MAX_TRIALS;
+    }
+
+    peers = (sim_peer_t *)malloc(sizeof(sim_peer_t) * peer_num);
+    connect_ms_array = (uint32_t *)malloc(sizeof(uint32_t) * peer_num * trials);
+
+    if ( NULL == peers || NULL == connect_ms_array ) {
+        return 1;
+    }
+
+    for ( i=0; i<peer_num; i++ ) {
+
+        peers[i].open_until_ms = (uint32_t *)malloc(sizeof(uint32_t) * SIM_PORT_NUM);
+
+        if ( NULL == peers[i].open_until_ms ) {
+            return 1;
+        }
+
+    }
+
+    printf("peers[%d] dead[%d] rate[%d] peer_rate[%d] mapping_timeout[%d]s window[%u]s trials[%d]\n",
+           peer_num, dead_num, rate, peer_rate, mapping_timeout_sec, window_ms/1000, trials);
+
+    printf("%-12s %10s %9s %9s %12s %14s\n", "STRATEGY", "CONNECTED", "P50_S", "P90_S", "PROBES/PEER", "PROBES/CONNECT");
+
+    for ( strategy=SIM_STRATEGY_SEQ; strategy<=SIM_STRATEGY_RAND_ROTATE; strategy++ ) {
+
+        random_state = (uint32_t)seed;
+
+        connected_total = 0;
+        probes = 0;
+
+        for ( t=0; t<trials; t++ ) {
+            connected_num = sim_run(strategy, peers, peer_num, dead_num, rate, window_ms, connect_ms_array + connected_total, &probes);
+            connected_total += connected_num;
+        }
+
+        qsort(connect_ms_array, connected_total, sizeof(uint32_t), cmp_uint32);
+
+        printf("%-12s %9.1f%% %9.1f %9.1f %12.1f %14.1f\n", strategy_names[strategy],
+               100.0 * connected_total / (live_num * trials),
+               connected_total > 0 ? connect_ms_array[connected_total/2] / 1000.0 : 0.0,
+               connected_total > 0 ? connect_ms_array[(connected_total*9)/10] / 1000.0 : 0.0,
+               (double)probes / (peer_num * trials),
+               connected_total > 0 ? (double)probes / connected_total : 0.0);
+
+    }
+
+    for ( i=0; i<peer_num; i++ ) {
+        free(peers[i].open_until_ms);
+    }
+
+    free(peers);
+    free(connect_ms_array);
+
+    return 0;
+
+}
@@ -0,0 +1,400 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+模拟 gnb_es 的地址 gossip (src/es/gnb_es_broadcast_address.c)，验证地址的改变在 O(logN) 轮内传遍所有节点
+
+  cc -O2 -o gnb_gossip_sim tools/gnb_gossip_sim.c
+  ./gnb_gossip_sim --nodes=100,1000,10000 --trials=20 --loss=5
+
+change: 一个节点的地址发生改变，最初只有一个节点看到新的地址，统计所有节点都得到新地址的轮数和每个节点发出的地址数
+join:   一个节点加入已经稳定的网络，统计它得到全部节点的地址的轮数和其他节点为此发出的地址数
+
+每轮的间隔对应 GNB_BROADCAST_INTERVAL_SEC，anti-entropy 每 GNB_GOSSIP_ANTI_ENTROPY_INTERVAL_SEC 进行一次
+模型假设所有节点两两可达，一轮内发出的地址在下一轮开始前到达，收到新地址的节点在下一轮开始 gossip
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+
+//与 gnb_es_broadcast_address.c 和 gnb_environment_service.c 相同
+#define GNB_GOSSIP_FANOUT                      3
+#define GNB_GOSSIP_NEW_PEER_FANOUT             6
+#define GNB_GOSSIP_ANTI_ENTROPY_INTERVAL_SEC   300
+#define GNB_BROADCAST_INTERVAL_SEC             30
+
+#define GNB_GOSSIP_ANTI_ENTROPY_ROUNDS  (GNB_GOSSIP_ANTI_ENTROPY_INTERVAL_SEC / GNB_BROADCAST_INTERVAL_SEC)
+
+#define SIM_MAX_ROUNDS   10000
+#define SIM_MAX_NODES    1000000
+
+
+typedef struct _sim_node_t {
+
+    uint8_t knows;
+
+    //这一轮刚收到，下一轮才开始 gossip
+    uint8_t learned;
+
+    uint8_t gossip_rounds;
+
+    //anti-entropy 的相位，各节点的 gnb_es 不是同时启动的
+    int ae_phase;
+
+}sim_node_t;
+
+
+static int loss_percent = 0;
+static int new_peer_sync = 1;
+
+
+static uint32_t sim_rand(void){
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+
+static int sim_deliver(void){
+
+    if ( 0 == loss_percent ) {
+        return 1;
+    }
+
+    return (int)(sim_rand() % 100) >= loss_percent;
+
+}
+
+
+static int sim_random_peer(int node_num, int self){
+
+    int peer;
+
+    do{
+        peer = (int)(sim_rand() % node_num);
+    }while( peer == self );
+
+    return peer;
+
+}
+
+
+static int gossip_rounds(int node_num){
+
+    int rounds;
+    int i;
+
+    for ( rounds=2, i=node_num; i>1; i>>=1 ) {
+        rounds++;
+    }
+
+    return rounds;
+
+}
+
+
+static int cmp_int(const void *a, const void *b){
+    return *(const int *)a - *(const int *)b;
+}
+
+
+/*
+返回所有节点都得到新地址的轮数，sent 累加发出的地址数
+*/
+static int sim_change(sim_node_t *nodes, int node_num, uint64_t *sent){
+
+    int rounds = gossip_rounds(node_num);
+    int known_num = 1;
+    int round;
+    int peer;
+    int i,j;
+
+    memset(nodes, 0, sizeof(sim_node_t) * node_num);
+
+    for ( i=0; i<node_num; i++ ) {
+        nodes[i].ae_phase = (int)(sim_rand() % GNB_GOSSIP_ANTI_ENTROPY_ROUNDS);
+    }
+
+    nodes[0].knows = 1;
+    nodes[0].gossip_rounds = (uint8_t)rounds;
+
+    for ( round=1; round<SIM_MAX_ROUNDS; round++ ) {
+
+        for ( i=0; i<node_num; i++ ) {
+
+            if ( 0 == nodes[i].knows || nodes[i].learned ) {
+                continue;
+            }
+
+            if ( nodes[i].gossip_rounds > 0 ) {
+
+                for ( j=0; j<GNB_GOSSIP_FANOUT; j++ ) {
+
+                    peer = sim_random_peer(node_num, i);
+
+                    (*sent)++;
+
+                    if ( 0 == nodes[peer].knows && sim_deliver() ) {
+                        nodes[peer].knows = 1;
+                        nodes[peer].learned = 1;
+                        known_num++;
+                    }
+
+                }
+
+                nodes[i].gossip_rounds--;
+
+            }
+
+            //anti-entropy 发送全部节点的地址，这里只统计改变了的这一个
+            if ( round % GNB_GOSSIP_ANTI_ENTROPY_ROUNDS == nodes[i].ae_phase ) {
+
+                peer = sim_random_peer(node_num, i);
+
+                (*sent)++;
+
+                if ( 0 == nodes[peer].knows && sim_deliver() ) {
+                    nodes[peer].knows = 1;
+                    nodes[peer].learned = 1;
+                    known_num++;
+                }
+
+            }
+
+        }
+
+        //收到新地址的节点连通后在下一轮也会 gossip 这个地址
+        for ( i=0; i<node_num; i++ ) {
+
+            if ( nodes[i].learned ) {
+                nodes[i].learned = 0;
+                nodes[i].gossip_rounds = (uint8_t)rounds;
+            }
+
+        }
+
+        if ( known_num == node_num ) {
+            return round;
+        }
+
+    }
+
+    return SIM_MAX_ROUNDS;
+
+}
+
+
+/*
+节点 node_num-1 在稳定的网络中加入，返回它收到全部节点的地址的轮数，sent 累加其他节点发给它的地址数
+*/
+static int sim_join(sim_node_t *nodes, int node_num, uint64_t *sent){
+
+    int reachable_num = node_num - 1;
+    int joiner = node_num - 1;
+    int synced = 0;
+    int round;
+    int peer;
+    int i;
+
+    for ( i=0; i<joiner; i++ ) {
+        nodes[i].ae_phase = (int)(sim_rand() % GNB_GOSSIP_ANTI_ENTROPY_ROUNDS);
+    }
+
+    for ( round=1; round<SIM_MAX_ROUNDS; round++ ) {
+
+        for ( i=0; i<joiner; i++ ) {
+
+            //每个节点第一次看到 joiner 时以 GNB_GOSSIP_NEW_PEER_FANOUT/N 的概率发送全部节点的地址
+            if ( 1 == round && new_peer_sync ) {
+
+                if ( reachable_num <= GNB_GOSSIP_NEW_PEER_FANOUT || (int)(sim_rand() % reachable_num) < GNB_GOSSIP_NEW_PEER_FANOUT ) {
+
+                    *sent += node_num - 2;
+
+                    if ( sim_deliver() ) {
+                        synced = 1;
+                    }
+
+                }
+
+            }
+
+            if ( round % GNB_GOSSIP_ANTI_ENTROPY_ROUNDS != nodes[i].ae_phase ) {
+                continue;
+            }
+
+            peer = sim_random_peer(node_num, i);
+
+            if ( peer != joiner ) {
+                continue;
+            }
+
+            *sent += node_num - 2;
+
+            if ( sim_deliver() ) {
+                synced = 1;
+            }
+
+        }
+
+        if ( synced ) {
+            return round;
+        }
+
+    }
+
+    return SIM_MAX_ROUNDS;
+
+}
+
+
+static void show_useage(char *argv0){
+
+    printf("Usage: %s [OPTION]\n", argv0);
+    printf("      --nodes         comma separated node counts, default 100,1000,10000\n");
+    printf("      --trials        runs per node count, default 20\n");
+    printf("      --loss          percent of gossip messages lost, default 0\n");
+    printf("      --seed          random seed, default 1\n");
+    printf("      --no-new-peer-sync  joining nodes only receive addresses from anti-entropy\n");
+    printf("      --help\n");
+
+}
+
+
+int main(int argc, char *argv[]){
+
+    char nodes_opt[256] = "100,1000,10000";
+
+    sim_node_t *nodes;
+
+    int rounds_array[1024];
+
+    uint64_t sent;
+
+    char *p;
+    char *saveptr;
+
+    int node_num;
+    int trials = 20;
+    int seed = 1;
+    int t;
+
+    static struct option long_options[] = {
+        { "nodes",            required_argument, 0, 'n' },
+        { "trials",           required_argument, 0, 't' },
+        { "loss",             required_argument, 0, 'l' },
+        { "seed",             required_argument, 0, 's' },
+        { "no-new-peer-sync", no_argument,       0, 'N' },
+        { "help",             no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    int opt;
+
+    while ( -1 != (opt = getopt_long(argc, argv, "n:t:l:s:Nh", long_options, NULL)) ) {
+
+        switch (opt) {
+
+        case 'n':
+            snprintf(nodes_opt, sizeof(nodes_opt), "%s", optarg);
+            break;
+
+        case 't':
+            trials = atoi(optarg);
+            break;
+
+        case 'l':
+            loss_percent = atoi(optarg);
+            break;
+
+        case 's':
+            seed = atoi(optarg);
+            break;
+
+        case 'N':
+            new_peer_sync = 0;
+            break;
+
+        default:
+            show_useage(argv[0]);
+            return 0;
+
+        }
+
+    }
+
+    if ( trials < 1 ) {
+        trials = 1;
+    }
+
+    if ( trials > 1024 ) {
+        trials = 1024;
+    }
+
+    if ( loss_percent < 0 || loss_percent > 90 ) {
+        loss_percent = 0;
+    }
+
+    srand(seed);
+
+    printf("fanout[%d] interval[%d]s anti_entropy[%d]s loss[%d]%% trials[%d] new_peer_sync[%s]\n",
+           GNB_GOSSIP_FANOUT, GNB_BROADCAST_INTERVAL_SEC, GNB_GOSSIP_ANTI_ENTROPY_INTERVAL_SEC, loss_percent, trials, new_peer_sync ? "on" : "off");
+
+    printf("%-7s %8s %7s %7s %7s %7s %12s\n", "CASE", "NODES", "LOG2N", "P50", "P99", "MAX", "SENT/NODE");
+
+    for ( p = strtok_r(nodes_opt, ",", &saveptr); NULL != p; p = strtok_r(NULL, ",", &saveptr) ) {
+
+        node_num = atoi(p);
+
+        if ( node_num < 2 || node_num > SIM_MAX_NODES ) {
+            continue;
+        }
+
+        nodes = (sim_node_t *)malloc(sizeof(sim_node_t) * node_num);
+
+        sent = 0;
+
+        for ( t=0; t<trials; t++ ) {
+            rounds_array[t] = sim_change(nodes, node_num, &sent);
+        }
+
+        qsort(rounds_array, trials, sizeof(int), cmp_int);
+
+        printf("%-7s %8d %7d %7d %7d %7d %12.1f\n", "change", node_num, gossip_rounds(node_num) - 2,
+               rounds_array[trials/2], rounds_array[(trials*99)/100], rounds_array[trials-1], (double)sent / trials / node_num);
+
+        sent = 0;
+
+        for ( t=0; t<trials; t++ ) {
+            rounds_array[t] = sim_join(nodes, node_num, &sent);
+        }
+
+        qsort(rounds_array, trials, sizeof(int), cmp_int);
+
+        printf("%-7s %8d %7d %7d %7d %7d %12.1f\n", "join", node_num, gossip_rounds(node_num) - 2,
+               rounds_array[trials/2], rounds_array[(trials*99)/100], rounds_array[trials-1], (double)sent / trials / node_num);
+
+        free(nodes);
+
+    }
+
+    printf("rounds are %ds apart; sent/node counts addresses sent per node per run\n", GNB_BROADCAST_INTERVAL_SEC);
+
+    return 0;
+
+}
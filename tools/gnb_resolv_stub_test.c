@@ -0,0 +1,375 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+用本地的 DNS stub 检查 src/es/gnb_es_resolv.c 对应答的校验，直接包含 gnb_es_resolv.c 以调用其中的 static 函数
+
+  cc -O2 -I./src -I./libs -o gnb_resolv_stub_test tools/gnb_resolv_stub_test.c src/gnb_address.c src/gnb_hash32.c src/gnb_log.c src/gnb_alloc.c src/gnb_time.c src/gnb_payload16.c libs/hash/murmurhash.c -lpthread
+  ./gnb_resolv_stub_test
+
+stub 在 127.0.0.1 的同一个端口上监听 udp 和 tcp, 对每个 udp 查询先发出三个应当被丢弃的应答:
+  id 不一致的应答
+  question 不一致的应答
+  id 和 question 都正确但来自其他端口的应答
+这些应答都带有 STUB_BAD_ADDR4 STUB_BAD_ADDR6, 然后按 case 发出:
+  mismatch:  不再应答，查询应当超时并且没有地址
+  udp:       正确的应答，应当得到 STUB_UDP_ADDR4 STUB_UDP_ADDR6
+  truncated: 带有 TC 标志的应答，应当改用 tcp 查询并只得到 STUB_TCP_ADDR4 STUB_TCP_ADDR6
+返回 0 表示所有 case 通过
+*/
+
+#include "es/gnb_es_resolv.c"
+
+#include <pthread.h>
+#include <netinet/in.h>
+
+#define STUB_HOST        "node.gnb.test"
+#define STUB_OTHER_HOST  "evil.gnb.test"
+
+#define STUB_QUERY_ID_A     0x1111
+#define STUB_QUERY_ID_AAAA  0x2222
+
+#define STUB_BAD_ADDR4   "192.0.2.66"
+#define STUB_BAD_ADDR6   "2001:db8::66"
+#define STUB_UDP_ADDR4   "192.0.2.1"
+#define STUB_UDP_ADDR6   "2001:db8::1"
+#define STUB_TCP_ADDR4   "192.0.2.2"
+#define STUB_TCP_ADDR6   "2001:db8::2"
+
+#define STUB_CASE_MISMATCH   0
+#define STUB_CASE_UDP        1
+#define STUB_CASE_TRUNCATED  2
+
+
+static volatile int stub_case;
+
+static int stub_udp_fd;
+static int stub_other_fd;
+static int stub_tcp_fd;
+
+static uint16_t stub_port;
+
+
+/*
+生成一个应答，question 的域名为 host_string, 有一条 qtype 的记录
+*/
+static int build_stub_reply(unsigned char *buffer, uint16_t id, uint8_t flags, const char *host_string, uint16_t qtype, const char *addr_string){
+
+    int len;
+
+    len = build_dns_query(buffer, 512, id, (char *)host_string, qtype);
+
+    if ( len <= 0 ) {
+        return -1;
+    }
+
+    buffer[2] = DNS_FLAG_QR | flags;
+    buffer[3] = 0;
+    buffer[7] = 1;
+
+    //指向 question 中的域名
+    buffer[len++] = 0xc0;
+    buffer[len++] = DNS_HEAD_SIZE;
+
+    buffer[len++] = qtype >> 8;
+    buffer[len++] = qtype & 0xff;
+    buffer[len++] = 0;
+    buffer[len++] = DNS_CLASS_IN;
+
+    //ttl 300
+    buffer[len++] = 0;
+    buffer[len++] = 0;
+    buffer[len++] = 0x01;
+    buffer[len++] = 0x2c;
+
+    if ( DNS_TYPE_A == qtype ) {
+        buffer[len++] = 0;
+        buffer[len++] = 4;
+        inet_pton(AF_INET, addr_string, buffer + len);
+        len += 4;
+    } else {
+        buffer[len++] = 0;
+        buffer[len++] = 16;
+        inet_pton(AF_INET6, addr_string, buffer + len);
+        len += 16;
+    }
+
+    return len;
+
+}
+
+
+static void stub_handle_udp(void){
+
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(struct sockaddr_in);
+
+    unsigned char query[512];
+    unsigned char reply[512];
+
+    ssize_t n;
+
+    uint16_t id;
+    uint16_t qtype;
+
+    int is_a;
+    int len;
+
+    n = recvfrom(stub_udp_fd, query, sizeof(query), 0, (struct sockaddr *)&from, &from_len);
+
+    if ( n < DNS_HEAD_SIZE ) {
+        return;
+    }
+
+    id    = (query[0] << 8) | query[1];
+    qtype = (query[n-4] << 8) | query[n-3];
+    is_a  = DNS_TYPE_A == qtype;
+
+    len = build_stub_reply(reply, id ^ 0x0f0f, 0, STUB_HOST, qtype, is_a ? STUB_BAD_ADDR4 : STUB_BAD_ADDR6);
+    sendto(stub_udp_fd, reply, len, 0, (struct sockaddr *)&from, from_len);
+
+    len = build_stub_reply(reply, id, 0, STUB_OTHER_HOST, qtype, is_a ? STUB_BAD_ADDR4 : STUB_BAD_ADDR6);
+    sendto(stub_udp_fd, reply, len, 0, (struct sockaddr *)&from, from_len);
+
+    len = build_stub_reply(reply, id, 0, STUB_HOST, qtype, is_a ? STUB_BAD_ADDR4 : STUB_BAD_ADDR6);
+    sendto(stub_other_fd, reply, len, 0, (struct sockaddr *)&from, from_len);
+
+    switch ( stub_case ) {
+
+    case STUB_CASE_UDP:
+        len = build_stub_reply(reply, id, 0, STUB_HOST, qtype, is_a ? STUB_UDP_ADDR4 : STUB_UDP_ADDR6);
+        sendto(stub_udp_fd, reply, len, 0, (struct sockaddr *)&from, from_len);
+        break;
+
+    case STUB_CASE_TRUNCATED:
+        len = build_stub_reply(reply, id, DNS_FLAG_TC, STUB_HOST, qtype, is_a ? STUB_BAD_ADDR4 : STUB_BAD_ADDR6);
+        sendto(stub_udp_fd, reply, len, 0, (struct sockaddr *)&from, from_len);
+        break;
+
+    default:
+        break;
+
+    }
+
+}
+
+
+static void stub_handle_tcp(void){
+
+    unsigned char query[514];
+    unsigned char reply[514];
+
+    uint16_t query_len;
+    uint16_t id;
+    uint16_t qtype;
+
+    int fd;
+    int len;
+
+    fd = accept(stub_tcp_fd, NULL, NULL);
+
+    if ( -1 == fd ) {
+        return;
+    }
+
+    if ( 0 != recv_full(fd, query, 2) ) {
+        goto finish;
+    }
+
+    query_len = (query[0] << 8) | query[1];
+
+    if ( query_len < DNS_HEAD_SIZE || query_len > 512 || 0 != recv_full(fd, query, query_len) ) {
+        goto finish;
+    }
+
+    id    = (query[0] << 8) | query[1];
+    qtype = (query[query_len-4] << 8) | query[query_len-3];
+
+    len = build_stub_reply(reply + 2, id, 0, STUB_HOST, qtype, DNS_TYPE_A == qtype ? STUB_TCP_ADDR4 : STUB_TCP_ADDR6);
+
+    reply[0] = len >> 8;
+    reply[1] = len & 0xff;
+
+    send(fd, reply, len + 2, 0);
+
+finish:
+
+    close(fd);
+
+}
+
+
+static void* thread_stub_func(void *data){
+
+    fd_set readfds;
+
+    int max_fd = stub_udp_fd > stub_tcp_fd ? stub_udp_fd : stub_tcp_fd;
+
+    for ( ;; ) {
+
+        FD_ZERO(&readfds);
+        FD_SET(stub_udp_fd, &readfds);
+        FD_SET(stub_tcp_fd, &readfds);
+
+        if ( select(max_fd + 1, &readfds, NULL, NULL, NULL) <= 0 ) {
+            continue;
+        }
+
+        if ( FD_ISSET(stub_udp_fd, &readfds) ) {
+            stub_handle_udp();
+        }
+
+        if ( FD_ISSET(stub_tcp_fd, &readfds) ) {
+            stub_handle_tcp();
+        }
+
+    }
+
+    return NULL;
+
+}
+
+
+static void start_stub(void){
+
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(struct sockaddr_in);
+
+    pthread_t thread_stub;
+
+    int on = 1;
+
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    stub_udp_fd   = socket(AF_INET, SOCK_DGRAM, 0);
+    stub_other_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    stub_tcp_fd   = socket(AF_INET, SOCK_STREAM, 0);
+
+    //udp 使用系统分配的端口，tcp 监听同一个端口
+    if ( 0 != bind(stub_udp_fd, (struct sockaddr *)&addr, addr_len) || 0 != getsockname(stub_udp_fd, (struct sockaddr *)&addr, &addr_len) ) {
+        perror("bind udp");
+        exit(1);
+    }
+
+    stub_port = ntohs(addr.sin_port);
+
+    setsockopt(stub_tcp_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    if ( 0 != bind(stub_tcp_fd, (struct sockaddr *)&addr, addr_len) || 0 != listen(stub_tcp_fd, 8) ) {
+        perror("bind tcp");
+        exit(1);
+    }
+
+    addr.sin_port = 0;
+
+    if ( 0 != bind(stub_other_fd, (struct sockaddr *)&addr, addr_len) ) {
+        perror("bind other");
+        exit(1);
+    }
+
+    pthread_create(&thread_stub, NULL, thread_stub_func, NULL);
+    pthread_detach(thread_stub);
+
+}
+
+
+static int has_address(gnb_resolv_host_t *resolv_host, int af, const char *addr_string){
+
+    unsigned char addr[16];
+
+    int i;
+
+    inet_pton(af, addr_string, addr);
+
+    for ( i=0; i<resolv_host->num; i++ ) {
+
+        if ( af != resolv_host->address[i].type ) {
+            continue;
+        }
+
+        if ( AF_INET == af && 0 == memcmp(&resolv_host->address[i].m_address4, addr, 4) ) {
+            return 1;
+        }
+
+        if ( AF_INET6 == af && 0 == memcmp(&resolv_host->address[i].m_address6, addr, 16) ) {
+            return 1;
+        }
+
+    }
+
+    return 0;
+
+}
+
+
+static int run_case(int test_case, const char *name, const char *expect_addr4, const char *expect_addr6){
+
+    struct sockaddr_storage nameserver;
+    struct sockaddr_in *nameserver_in = (struct sockaddr_in *)&nameserver;
+
+    gnb_resolv_cache_t resolv_cache_entry;
+
+    gnb_resolv_host_t resolv_host;
+
+    int pass;
+
+    memset(&nameserver, 0, sizeof(struct sockaddr_storage));
+    nameserver_in->sin_family      = AF_INET;
+    nameserver_in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    nameserver_in->sin_port        = htons(stub_port);
+
+    memset(&resolv_cache_entry, 0, sizeof(gnb_resolv_cache_t));
+    snprintf(resolv_cache_entry.host_string, NAME_MAX+1, "%s", STUB_HOST);
+
+    memset(&resolv_host, 0, sizeof(gnb_resolv_host_t));
+    resolv_host.cache       = &resolv_cache_entry;
+    resolv_host.query_id[0] = STUB_QUERY_ID_A;
+    resolv_host.query_id[1] = STUB_QUERY_ID_AAAA;
+    resolv_host.min_ttl_sec = GNB_RESOLV_MAX_TTL_SEC;
+
+    stub_case = test_case;
+
+    do_resolv_host(&nameserver, 1, &resolv_host, 1);
+
+    if ( NULL == expect_addr4 ) {
+        pass = 0 == resolv_host.num && 0 == resolv_host.answered;
+    } else {
+        pass = 2 == resolv_host.num && has_address(&resolv_host, AF_INET, expect_addr4) && has_address(&resolv_host, AF_INET6, expect_addr6) && 300 == resolv_host.min_ttl_sec;
+    }
+
+    printf("%-10s num[%d] answered[%d] ttl[%u] %s\n", name, resolv_host.num, resolv_host.answered, resolv_host.min_ttl_sec, pass ? "PASS" : "FAIL");
+
+    return pass;
+
+}
+
+
+int main(int argc, char *argv[]){
+
+    int pass = 1;
+
+    start_stub();
+
+    pass &= run_case(STUB_CASE_MISMATCH,  "mismatch",  NULL, NULL);
+    pass &= run_case(STUB_CASE_UDP,       "udp",       STUB_UDP_ADDR4, STUB_UDP_ADDR6);
+    pass &= run_case(STUB_CASE_TRUNCATED, "truncated", STUB_TCP_ADDR4, STUB_TCP_ADDR6);
+
+    return pass ? 0 : 1;
+
+}
@@ -0,0 +1,301 @@
+/*
+   Copyright (C) gnbdev
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+测量 route.conf 的加载时间 (src/gnb_route_conf.c)
+
+  cc -O2 -I./src -o gnb_route_conf_bench tools/gnb_route_conf_bench.c src/gnb_route_conf.c src/gnb_mmap.c src/gnb_time.c libs/hash/murmurhash.c
+  ./gnb_route_conf_bench --lines=100000 --runs=10
+
+在一个临时目录中生成 route.conf, 分别统计:
+fscanf: 以前 gnb_conf_file.c 的方式，先读一遍统计节点数再用 fscanf/sscanf 解析一遍
+source: gnb_route_conf_load 没有 route.conf.cache 时 mmap 单次解析并写 cache
+cache:  gnb_route_conf_load 从 route.conf.cache 直接加载
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "gnb_route_conf.h"
+#include "gnb_time.h"
+
+#define BENCH_MAX_RUNS  1024
+
+
+static void make_route_conf(const char *route_file, int line_num){
+
+    FILE *file;
+
+    uint32_t uuid32;
+
+    int i;
+
+    file = fopen(route_file, "w");
+
+    if ( NULL == file ) {
+        perror("fopen");
+        exit(1);
+    }
+
+    //每 10 行中有一行 relay 和一行 relay mode
+    for ( i=0; i<line_num; i++ ) {
+
+        uuid32 = 1000 + i/10*8 + i%10;
+
+        if ( 8 == i%10 ) {
+            fprintf(file, "%u|%u,%u\n", uuid32 - 8, uuid32 - 7, uuid32 - 6);
+            continue;
+        }
+
+        if ( 9 == i%10 ) {
+            fprintf(file, "%u|auto,static\n", uuid32 - 9);
+            continue;
+        }
+
+        fprintf(file, "%u|10.%u.%u.%u|255.0.0.0\n", uuid32, (uuid32 >> 16) & 0xff, (uuid32 >> 8) & 0xff, uuid32 & 0xff);
+
+    }
+
+    fclose(file);
+
+}
+
+
+//与以前的 gnb_get_node_num_from_file 和 load_route_config 相同的读法，返回解析的行数
+static int fscanf_load(const char *route_file){
+
+    FILE *file;
+
+    char line_buffer[1024];
+    char field1[256];
+    char field2[256];
+
+    uint32_t uuid32;
+
+    int node_num = 0;
+    int num;
+
+    file = fopen(route_file, "r");
+
+    while ( NULL != file && EOF != fscanf(file, "%1023s\n", line_buffer) ) {
+
+        if ( 3 == sscanf(line_buffer, "%u|%255[^|]|%255s", &uuid32, field1, field2) ) {
+            node_num++;
+        }
+
+    }
+
+    if ( NULL == file ) {
+        return 0;
+    }
+
+    rewind(file);
+
+    num = 0;
+
+    while ( EOF != fscanf(file, "%1023s\n", line_buffer) ) {
+
+        if ( '#' == line_buffer[0] ) {
+            continue;
+        }
+
+        if ( sscanf(line_buffer, "%u|%255[^|]|%255s", &uuid32, field1, field2) >= 2 ) {
+            num++;
+        }
+
+    }
+
+    fclose(file);
+
+    return node_num > 0 ? num : 0;
+
+}
+
+
+static int cmp_uint64(const void *a, const void *b){
+
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+
+}
+
+
+static void show_result(const char *name, uint64_t *usec_array, int runs, size_t num){
+
+    qsort(usec_array, runs, sizeof(uint64_t), cmp_uint64);
+
+    printf("%-7s %10zu %12.3f %12.3f %12.3f\n", name, num,
+           usec_array[0] / 1000.0, usec_array[runs/2] / 1000.0, usec_array[runs-1] / 1000.0);
+
+}
+
+
+static void show_useage(char *argv0){
+
+    printf("Usage: %s [OPTION]\n", argv0);
+    printf("      --lines         lines in the generated route.conf, default 100000\n");
+    printf("      --runs          runs per case, default 10\n");
+    printf("      --dir           directory for route.conf and route.conf.cache, default a new directory in /tmp\n");
+    printf("      --help\n");
+
+}
+
+
+int main(int argc, char *argv[]){
+
+    char conf_dir[PATH_MAX] = "";
+    char route_file[PATH_MAX+NAME_MAX];
+    char cache_file[PATH_MAX+NAME_MAX];
+
+    uint64_t usec_array[BENCH_MAX_RUNS];
+
+    uint64_t start_usec;
+
+    gnb_route_conf_t *route_conf;
+
+    size_t num = 0;
+
+    int line_num = 100000;
+    int runs = 10;
+    int remove_dir = 0;
+    int i;
+
+    static struct option long_options[] = {
+        { "lines", required_argument, 0, 'l' },
+        { "runs",  required_argument, 0, 'r' },
+        { "dir",   required_argument, 0, 'd' },
+        { "help",  no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    int opt;
+
+    while ( -1 != (opt = getopt_long(argc, argv, "l:r:d:h", long_options, NULL)) ) {
+
+        switch (opt) {
+
+        case 'l':
+            line_num = atoi(optarg);
+            break;
+
+        case 'r':
+            runs = atoi(optarg);
+            break;
+
+        case 'd':
+            snprintf(conf_dir, sizeof(conf_dir), "%s", optarg);
+            break;
+
+        default:
+            show_useage(argv[0]);
+            return 0;
+
+        }
+
+    }
+
+    if ( runs < 1 ) {
+        runs = 1;
+    }
+
+    if ( runs > BENCH_MAX_RUNS ) {
+        runs = BENCH_MAX_RUNS;
+    }
+
+    if ( '\0' == conf_dir[0] ) {
+
+        snprintf(conf_dir, sizeof(conf_dir), "/tmp/gnb_route_conf_bench.XXXXXX");
+
+        if ( NULL == mkdtemp(conf_dir) ) {
+            perror("mkdtemp");
+            return 1;
+        }
+
+        remove_dir = 1;
+
+    }
+
+    snprintf(route_file, sizeof(route_file), "%s/route.conf", conf_dir);
+    snprintf(cache_file, sizeof(cache_file), "%s/route.conf.cache", conf_dir);
+
+    make_route_conf(route_file, line_num);
+
+    printf("route.conf lines[%d] runs[%d] dir[%s]\n", line_num, runs, conf_dir);
+    printf("%-7s %10s %12s %12s %12s\n", "CASE", "RECORDS", "MIN(ms)", "P50(ms)", "MAX(ms)");
+
+    for ( i=0; i<runs; i++ ) {
+        start_usec = gnb_timestamp_usec();
+        num = fscanf_load(route_file);
+        usec_array[i] = gnb_timestamp_usec() - start_usec;
+    }
+
+    show_result("fscanf", usec_array, runs, num);
+
+    for ( i=0; i<runs; i++ ) {
+
+        unlink(cache_file);
+
+        route_conf = gnb_route_conf_load(conf_dir);
+
+        if ( NULL == route_conf || route_conf->from_cache ) {
+            fprintf(stderr, "load route.conf failed\n");
+            return 1;
+        }
+
+        usec_array[i] = route_conf->load_usec;
+        num = route_conf->num;
+
+        gnb_route_conf_release(route_conf);
+
+    }
+
+    show_result("source", usec_array, runs, num);
+
+    for ( i=0; i<runs; i++ ) {
+
+        route_conf = gnb_route_conf_load(conf_dir);
+
+        if ( NULL == route_conf || !route_conf->from_cache ) {
+            fprintf(stderr, "load route.conf.cache failed\n");
+            return 1;
+        }
+
+        usec_array[i] = route_conf->load_usec;
+        num = route_conf->num;
+
+        gnb_route_conf_release(route_conf);
+
+    }
+
+    show_result("cache", usec_array, runs, num);
+
+    if ( remove_dir ) {
+        unlink(cache_file);
+        unlink(route_file);
+        rmdir(conf_dir);
+    }
+
+    return 0;
+
+}